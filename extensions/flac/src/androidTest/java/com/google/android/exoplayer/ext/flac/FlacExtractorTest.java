@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.google.android.exoplayer.ext.flac;
+
+import com.google.android.exoplayer.C;
+import com.google.android.exoplayer.MediaFormat;
+import com.google.android.exoplayer.drm.DrmInitData;
+import com.google.android.exoplayer.extractor.DefaultExtractorInput;
+import com.google.android.exoplayer.extractor.Extractor;
+import com.google.android.exoplayer.extractor.ExtractorInput;
+import com.google.android.exoplayer.extractor.ExtractorOutput;
+import com.google.android.exoplayer.extractor.PositionHolder;
+import com.google.android.exoplayer.extractor.SeekMap;
+import com.google.android.exoplayer.extractor.TrackOutput;
+import com.google.android.exoplayer.upstream.DataSpec;
+import com.google.android.exoplayer.upstream.FileDataSource;
+import com.google.android.exoplayer.util.ParsableByteArray;
+
+import android.net.Uri;
+import android.test.InstrumentationTestCase;
+
+import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.io.FileInputStream;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+
+/**
+ * Tests for {@link FlacExtractor} reading from a memory mapped file.
+ */
+public class FlacExtractorTest extends InstrumentationTestCase {
+
+  private File file;
+
+  @Override
+  protected void setUp() throws Exception {
+    super.setUp();
+    file = FlacTestUtil.copyAssetToCache(getInstrumentation(), FlacTestUtil.BEAR_FLAC_ASSET);
+  }
+
+  @Override
+  protected void tearDown() throws Exception {
+    file.delete();
+    super.tearDown();
+  }
+
+  public void testPreparedExtractorOutputsPrefetchedFrameFirst() throws Exception {
+    FlacJni decoder = FlacTestUtil.createMappedDecoder(file, C.ENCODING_PCM_16BIT);
+    byte[] expected;
+    try {
+      expected = FlacTestUtil.decodeToEnd(decoder);
+    } finally {
+      decoder.release();
+    }
+
+    FlacExtractor extractor;
+    FileInputStream inputStream = new FileInputStream(file);
+    try {
+      extractor = new FlacExtractor(C.ENCODING_PCM_16BIT, inputStream.getFD(), 0,
+          C.LENGTH_UNBOUNDED);
+      extractor.prepare();
+    } finally {
+      inputStream.close();
+    }
+    FileDataSource dataSource = new FileDataSource();
+    try {
+      assertTrue(extractor.hasPendingFrame());
+      FakeExtractorOutput output = new FakeExtractorOutput();
+      extractor.init(output);
+      // As ExtractingLoadable does, seek the extractor before the first read, even though the
+      // first load starts at the beginning of the stream.
+      extractor.seek();
+      assertTrue(extractor.hasPendingFrame());
+
+      long length = dataSource.open(new DataSpec(Uri.fromFile(file)));
+      ExtractorInput input = new DefaultExtractorInput(dataSource, 0, length);
+      PositionHolder positionHolder = new PositionHolder();
+      assertEquals(Extractor.RESULT_CONTINUE, extractor.read(input, positionHolder));
+      // The first sample starts with the prefetched frame, at the start of the stream.
+      assertFalse(extractor.hasPendingFrame());
+      assertEquals(0, (long) output.trackOutput.sampleTimesUs.get(0));
+      while (extractor.read(input, positionHolder) == Extractor.RESULT_CONTINUE) {
+        // Do nothing.
+      }
+
+      // Had the decoder resynced from the start of the file, the output would not match.
+      assertTrue(Arrays.equals(expected, output.trackOutput.data.toByteArray()));
+    } finally {
+      dataSource.close();
+      extractor.release();
+    }
+  }
+
+  private static final class FakeExtractorOutput implements ExtractorOutput {
+
+    public final FakeTrackOutput trackOutput = new FakeTrackOutput();
+
+    @Override
+    public TrackOutput track(int trackId) {
+      return trackOutput;
+    }
+
+    @Override
+    public void endTracks() {
+      // Do nothing.
+    }
+
+    @Override
+    public void seekMap(SeekMap seekMap) {
+      // Do nothing.
+    }
+
+    @Override
+    public void drmInitData(DrmInitData drmInitData) {
+      // Do nothing.
+    }
+
+  }
+
+  private static final class FakeTrackOutput implements TrackOutput {
+
+    public final ByteArrayOutputStream data = new ByteArrayOutputStream();
+    public final List<Long> sampleTimesUs = new ArrayList<>();
+
+    @Override
+    public void format(MediaFormat format) {
+      // Do nothing.
+    }
+
+    @Override
+    public int sampleData(ExtractorInput input, int length, boolean allowEndOfInput) {
+      throw new UnsupportedOperationException();
+    }
+
+    @Override
+    public void sampleData(ParsableByteArray buffer, int length) {
+      byte[] sampleData = new byte[length];
+      buffer.readBytes(sampleData, 0, length);
+      data.write(sampleData, 0, length);
+    }
+
+    @Override
+    public void sampleMetadata(long timeUs, int flags, int size, int offset,
+        byte[] encryptionKey) {
+      sampleTimesUs.add(timeUs);
+    }
+
+  }
+
+}
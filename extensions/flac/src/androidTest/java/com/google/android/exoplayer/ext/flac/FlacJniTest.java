@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.google.android.exoplayer.ext.flac;
+
+import com.google.android.exoplayer.C;
+
+import android.test.InstrumentationTestCase;
+
+import java.io.File;
+import java.nio.ByteBuffer;
+import java.util.Arrays;
+
+/**
+ * Tests for {@link FlacJni}.
+ */
+public class FlacJniTest extends InstrumentationTestCase {
+
+  /**
+   * bear.flac holds 16-bit stereo samples at 48000 Hz, in frames of 4608 samples.
+   */
+  private static final int SAMPLE_RATE = 48000;
+  private static final int BYTES_PER_FRAME = 4;
+
+  private File file;
+
+  @Override
+  protected void setUp() throws Exception {
+    super.setUp();
+    file = FlacTestUtil.copyAssetToCache(getInstrumentation(), FlacTestUtil.BEAR_FLAC_ASSET);
+  }
+
+  @Override
+  protected void tearDown() throws Exception {
+    file.delete();
+    super.tearDown();
+  }
+
+  public void testSeekStartsAtTargetSample() throws Exception {
+    FlacJni decoder = FlacTestUtil.createMappedDecoder(file, C.ENCODING_PCM_16BIT);
+    byte[] expected;
+    try {
+      expected = FlacTestUtil.decodeToEnd(decoder);
+    } finally {
+      decoder.release();
+    }
+
+    decoder = FlacTestUtil.createMappedDecoder(file, C.ENCODING_PCM_16BIT);
+    try {
+      ByteBuffer buffer = ByteBuffer.allocate(decoder.getMaxOutputFrameSize());
+      // Seeks forwards and backwards, to targets inside frames and to the first sample.
+      long[] seekTimesUs = {1000000, 250000, 2500000, 0};
+      for (long timeUs : seekTimesUs) {
+        assertTrue(decoder.seek(timeUs));
+        int offset = (int) (timeUs * SAMPLE_RATE / C.MICROS_PER_SECOND) * BYTES_PER_FRAME;
+        // The frame containing the target is returned from the target sample, and is followed by
+        // the next frame.
+        for (int i = 0; i < 2; i++) {
+          int size = decoder.decodeSample(buffer);
+          assertTrue(size > 0);
+          if (i == 0) {
+            assertEquals(timeUs, decoder.getLastSampleTimestamp());
+          }
+          assertTrue(Arrays.equals(Arrays.copyOfRange(expected, offset, offset + size),
+              Arrays.copyOf(buffer.array(), size)));
+          offset += size;
+        }
+      }
+    } finally {
+      decoder.release();
+    }
+  }
+
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.google.android.exoplayer.ext.flac;
+
+import com.google.android.exoplayer.C;
+import com.google.android.exoplayer.util.Util;
+
+import android.app.Instrumentation;
+import android.content.Context;
+
+import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+
+/**
+ * Utility methods for tests of the native FLAC decoders.
+ */
+/* package */ final class FlacTestUtil {
+
+  /**
+   * A raw FLAC stream holding the frames of bear-flac.mka, whose STREAMINFO declares its total
+   * number of samples.
+   */
+  public static final String BEAR_FLAC_ASSET = "bear.flac";
+
+  private FlacTestUtil() {}
+
+  /**
+   * Copies an asset into a file in the cache directory, since an asset that is compressed in the
+   * test APK cannot be opened as a file descriptor.
+   */
+  public static File copyAssetToCache(Instrumentation instrumentation, String fileName)
+      throws IOException {
+    Context context = instrumentation.getContext();
+    byte[] data = Util.toByteArray(context.getResources().getAssets().open(fileName));
+    File file = new File(context.getCacheDir(), fileName);
+    FileOutputStream outputStream = new FileOutputStream(file);
+    try {
+      outputStream.write(data);
+    } finally {
+      outputStream.close();
+    }
+    return file;
+  }
+
+  /**
+   * Returns a decoder for a memory mapping of {@code file}, whose metadata has been decoded.
+   */
+  public static FlacJni createMappedDecoder(File file, int outputEncoding)
+      throws IOException, FlacDecoderException {
+    FlacJni decoder = new FlacJni();
+    FileInputStream inputStream = new FileInputStream(file);
+    try {
+      if (!decoder.setData(inputStream.getFD(), 0, C.LENGTH_UNBOUNDED)) {
+        decoder.release();
+        throw new IOException("Failed to map " + file);
+      }
+    } finally {
+      inputStream.close();
+    }
+    if (decoder.decodeMetadata(outputEncoding) == null) {
+      decoder.release();
+      throw new IOException("Metadata decoding failed");
+    }
+    return decoder;
+  }
+
+  /**
+   * Decodes the remaining frames of {@code decoder} one at a time, and returns their samples.
+   */
+  public static byte[] decodeToEnd(FlacJni decoder) {
+    ByteBuffer buffer = ByteBuffer.allocate(decoder.getMaxOutputFrameSize());
+    ByteArrayOutputStream output = new ByteArrayOutputStream();
+    int size;
+    while ((size = decoder.decodeSample(buffer)) > 0) {
+      output.write(buffer.array(), 0, size);
+    }
+    return output.toByteArray();
+  }
+
+}
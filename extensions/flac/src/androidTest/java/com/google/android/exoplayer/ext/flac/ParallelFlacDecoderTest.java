@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.google.android.exoplayer.ext.flac;
+
+import com.google.android.exoplayer.C;
+import com.google.android.exoplayer.util.FlacStreamInfo;
+
+import android.test.InstrumentationTestCase;
+
+import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.util.Arrays;
+
+/**
+ * Tests for {@link ParallelFlacDecoder}.
+ */
+public class ParallelFlacDecoderTest extends InstrumentationTestCase {
+
+  /**
+   * The size of the buffer passed to each read, which is not a multiple of the size of a frame or
+   * of a range, so that reads span the boundaries between ranges.
+   */
+  private static final int READ_SIZE = 10000;
+
+  private File file;
+
+  @Override
+  protected void setUp() throws Exception {
+    super.setUp();
+    file = FlacTestUtil.copyAssetToCache(getInstrumentation(), FlacTestUtil.BEAR_FLAC_ASSET);
+  }
+
+  @Override
+  protected void tearDown() throws Exception {
+    file.delete();
+    super.tearDown();
+  }
+
+  public void testSingleThreadMatchesSequentialDecode() throws Exception {
+    assertMatchesSequentialDecode(1, C.ENCODING_PCM_16BIT);
+  }
+
+  public void testMultipleThreadsMatchSequentialDecode() throws Exception {
+    assertMatchesSequentialDecode(2, C.ENCODING_PCM_16BIT);
+    assertMatchesSequentialDecode(4, C.ENCODING_PCM_24BIT);
+  }
+
+  private void assertMatchesSequentialDecode(int threadCount, int outputEncoding)
+      throws IOException, FlacDecoderException {
+    FlacJni sequentialDecoder = FlacTestUtil.createMappedDecoder(file, outputEncoding);
+    byte[] expected;
+    int bytesPerSample;
+    try {
+      expected = FlacTestUtil.decodeToEnd(sequentialDecoder);
+      bytesPerSample = sequentialDecoder.getOutputBytesPerSample();
+    } finally {
+      sequentialDecoder.release();
+    }
+
+    FileInputStream inputStream = new FileInputStream(file);
+    ParallelFlacDecoder decoder;
+    try {
+      decoder = new ParallelFlacDecoder(inputStream.getFD(), 0, C.LENGTH_UNBOUNDED, threadCount,
+          outputEncoding);
+    } finally {
+      inputStream.close();
+    }
+    byte[] actual;
+    FlacStreamInfo streamInfo;
+    try {
+      streamInfo = decoder.getStreamInfo();
+      ByteBuffer buffer = ByteBuffer.allocate(READ_SIZE);
+      ByteArrayOutputStream output = new ByteArrayOutputStream();
+      int size;
+      while ((size = decoder.read(buffer)) != C.RESULT_END_OF_INPUT) {
+        output.write(buffer.array(), 0, size);
+      }
+      actual = output.toByteArray();
+    } finally {
+      decoder.release();
+    }
+
+    assertEquals(streamInfo.totalSamples * streamInfo.channels * bytesPerSample, expected.length);
+    assertEquals(expected.length, actual.length);
+    assertTrue(Arrays.equals(expected, actual));
+  }
+
+}
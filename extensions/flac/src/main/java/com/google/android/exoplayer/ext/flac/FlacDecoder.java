@@ -15,9 +15,11 @@
  */
 package com.google.android.exoplayer.ext.flac;
 
+import com.google.android.exoplayer.C;
 import com.google.android.exoplayer.SampleHolder;
 import com.google.android.exoplayer.util.FlacStreamInfo;
 import com.google.android.exoplayer.util.extensions.InputBuffer;
+import com.google.android.exoplayer.util.extensions.NativeDecoderCounters;
 import com.google.android.exoplayer.util.extensions.SimpleDecoder;
 
 import java.nio.ByteBuffer;
@@ -30,23 +32,53 @@ import java.util.List;
     SimpleDecoder<InputBuffer, FlacOutputBuffer, FlacDecoderException> {
 
   private final int maxOutputBufferSize;
+  private final int outputSampleRate;
+  private final int outputBytesPerFrame;
   private final FlacJni decoder;
+
+  private long nextTimeUs;
+  private boolean drainPending;
+
   /**
    * Creates a Flac decoder.
    *
    * @param numInputBuffers The number of input buffers.
    * @param numOutputBuffers The number of output buffers.
    * @param initializationData Codec-specific initialization data.
-   * @throws FlacDecoderException Thrown if an exception occurs when initializing the decoder.
+   * @param memoryBudget The maximum native memory that the decoder may use in bytes, or 0 if there
+   *     is no limit.
+   * @throws FlacDecoderException Thrown if an exception occurs when initializing the decoder, or if
+   *     decoding the stream would exceed the memory budget.
+   */
+  public FlacDecoder(int numInputBuffers, int numOutputBuffers, List<byte[]> initializationData,
+      long memoryBudget) throws FlacDecoderException {
+    this(numInputBuffers, numOutputBuffers, initializationData, memoryBudget, 0, 0);
+  }
+
+  /**
+   * Creates a Flac decoder that converts the decoded samples natively.
+   *
+   * @param numInputBuffers The number of input buffers.
+   * @param numOutputBuffers The number of output buffers.
+   * @param initializationData Codec-specific initialization data.
+   * @param memoryBudget The maximum native memory that the decoder may use in bytes, or 0 if there
+   *     is no limit.
+   * @param outputSampleRate The sample rate to which decoded samples are resampled, or 0 to keep
+   *     the rate of the stream.
+   * @param outputChannelCount The number of channels to which decoded samples are mixed, or 0 to
+   *     keep those of the stream.
+   * @throws FlacDecoderException Thrown if an exception occurs when initializing the decoder, if
+   *     decoding the stream would exceed the memory budget, or if the conversion is not supported.
    */
-  public FlacDecoder(int numInputBuffers, int numOutputBuffers, List<byte[]> initializationData)
+  public FlacDecoder(int numInputBuffers, int numOutputBuffers, List<byte[]> initializationData,
+      long memoryBudget, int outputSampleRate, int outputChannelCount)
       throws FlacDecoderException {
     super(new InputBuffer[numInputBuffers], new FlacOutputBuffer[numOutputBuffers]);
     if (initializationData.size() != 1) {
       throw new FlacDecoderException("Wrong number of initialization data");
     }
 
-    decoder = new FlacJni();
+    decoder = new FlacJni(memoryBudget);
 
     ByteBuffer metadata = ByteBuffer.wrap(initializationData.get(0));
     decoder.setData(metadata);
@@ -55,8 +87,16 @@ import java.util.List;
       throw new FlacDecoderException("Metadata decoding failed");
     }
 
+    if ((outputSampleRate != 0 || outputChannelCount != 0)
+        && !decoder.setOutputFormat(outputSampleRate, outputChannelCount)) {
+      throw new FlacDecoderException("Unsupported output format");
+    }
+
     setInitialInputBufferSize(streamInfo.maxFrameSize);
-    maxOutputBufferSize = streamInfo.maxDecodedFrameSize();
+    maxOutputBufferSize = decoder.getMaxOutputFrameSize();
+    this.outputSampleRate = outputSampleRate != 0 ? outputSampleRate : streamInfo.sampleRate;
+    outputBytesPerFrame = (outputChannelCount != 0 ? outputChannelCount : streamInfo.channels)
+        * decoder.getOutputBytesPerSample();
   }
 
   @Override
@@ -79,6 +119,7 @@ import java.util.List;
       boolean reset) {
     if (reset) {
       decoder.flush();
+      drainPending = false;
     }
     SampleHolder sampleHolder = inputBuffer.sampleHolder;
     outputBuffer.timestampUs = sampleHolder.timeUs;
@@ -92,9 +133,46 @@ import java.util.List;
     }
     outputBuffer.data.position(0);
     outputBuffer.data.limit(result);
+    nextTimeUs = sampleHolder.timeUs
+        + (result / outputBytesPerFrame) * C.MICROS_PER_SECOND / outputSampleRate;
     return null;
   }
 
+  @Override
+  protected void onEndOfStream() {
+    // When resampling, the converter holds the output for the end of the last frame.
+    drainPending = decoder.getDrainSize() > 0;
+  }
+
+  @Override
+  protected boolean hasPendingOutput() {
+    return drainPending;
+  }
+
+  @Override
+  protected FlacDecoderException decodePendingOutput(FlacOutputBuffer outputBuffer) {
+    drainPending = false;
+    outputBuffer.timestampUs = nextTimeUs;
+    outputBuffer.init(decoder.getDrainSize());
+    int result = decoder.drain(outputBuffer.data);
+    if (result < 0) {
+      return new FlacDecoderException("Draining the converter failed");
+    }
+    outputBuffer.data.position(0);
+    outputBuffer.data.limit(result);
+    return null;
+  }
+
+  /**
+   * Adds the work done by the native decoder since the previous call to {@code counters}. Must not
+   * be called concurrently with itself, or after {@link #release()}.
+   *
+   * @param counters The counters to update.
+   */
+  public void updateCounters(NativeDecoderCounters counters) {
+    decoder.updateCounters(counters);
+  }
+
   @Override
   public void release() {
     super.release();
@@ -27,6 +27,7 @@ import com.google.android.exoplayer.util.FlacStreamInfo;
 import com.google.android.exoplayer.util.MimeTypes;
 import com.google.android.exoplayer.util.ParsableByteArray;
 
+import java.io.FileDescriptor;
 import java.io.IOException;
 import java.nio.ByteBuffer;
 import java.util.Arrays;
@@ -41,26 +42,115 @@ public final class FlacExtractor implements Extractor {
    */
   private static final byte[] FLAC_SIGNATURE = {'f', 'L', 'a', 'C', 0, 0, 0, 0x22};
 
+  /**
+   * The duration of audio decoded into each sample. Frames are decoded in batches so that a single
+   * call into the native decoder produces several frames.
+   */
+  private static final long SAMPLE_DURATION_US = 100000;
+
+  private final int outputEncoding;
+  private final FileDescriptor fileDescriptor;
+  private final long fileOffset;
+  private final long fileLength;
+
   private ExtractorOutput output;
   private TrackOutput trackOutput;
 
   private FlacJni decoder;
+  private boolean fileMapped;
+  private boolean seekPending;
+  private volatile long seekTimeUs;
+  private FlacStreamInfo preparedStreamInfo;
 
   private boolean metadataParsed;
 
   private ParsableByteArray outputBuffer;
   private ByteBuffer outputByteBuffer;
 
+  public FlacExtractor() {
+    this(C.ENCODING_PCM_16BIT);
+  }
+
+  /**
+   * @param outputEncoding The encoding of the extracted samples. One of
+   *     {@link C#ENCODING_PCM_16BIT}, {@link C#ENCODING_PCM_24BIT}, {@link C#ENCODING_PCM_32BIT}
+   *     and {@link C#ENCODING_PCM_FLOAT}. Samples are decoded directly into this encoding, so
+   *     streams with more than 16 bits per sample are not truncated when a wider encoding is used.
+   *     {@link com.google.android.exoplayer.audio.AudioTrack} does not support
+   *     {@link C#ENCODING_PCM_FLOAT}, so float samples must be consumed by a custom renderer.
+   */
+  public FlacExtractor(int outputEncoding) {
+    this(outputEncoding, null, 0, C.LENGTH_UNBOUNDED);
+  }
+
+  /**
+   * Creates an extractor that decodes from a memory mapping of a local file, rather than from the
+   * {@link ExtractorInput}, so that the native decoder makes no calls into Java to read the data.
+   * The input must read the same data as the mapped part of the file, so that its positions can
+   * be used to seek within the mapping, but is otherwise not read. Seeks within the mapping start
+   * decoding at the exact sample of the seek position. If the file cannot be mapped, data is read
+   * from the input instead.
+   *
+   * @param outputEncoding The encoding of the extracted samples. See
+   *     {@link #FlacExtractor(int)}.
+   * @param fileDescriptor The descriptor of the file being played, for example from
+   *     {@link android.content.res.AssetFileDescriptor#getFileDescriptor()}. It must remain open
+   *     until the extractor is initialized or prepared.
+   * @param fileOffset The offset of the FLAC stream in the file.
+   * @param fileLength The length of the FLAC stream, or {@link C#LENGTH_UNBOUNDED} if it extends
+   *     to the end of the file.
+   */
+  public FlacExtractor(int outputEncoding, FileDescriptor fileDescriptor, long fileOffset,
+      long fileLength) {
+    this.outputEncoding = outputEncoding;
+    this.fileDescriptor = fileDescriptor;
+    this.fileOffset = fileOffset;
+    this.fileLength = fileLength;
+    seekTimeUs = C.UNKNOWN_TIME_US;
+  }
+
+  /**
+   * Prepares the decoder ahead of playback, so that a following track can start without a gap.
+   * The file is mapped, its metadata is decoded and its first frame is decoded, so that none of
+   * this work remains to be done when the extractor starts reading. This method may block, and so
+   * should be called on a background thread while the previous track is playing.
+   * <p>
+   * Only supported for an extractor created with a file descriptor. Must be called before the
+   * extractor is passed to a sample source. If the extractor is then not used, it must be released
+   * by calling {@link #release()}.
+   *
+   * @throws IOException If the file could not be mapped, or its metadata could not be decoded.
+   */
+  public void prepare() throws IOException {
+    if (fileDescriptor == null) {
+      throw new IllegalStateException("Only an extractor for a file can be prepared");
+    }
+    if (preparedStreamInfo != null) {
+      return;
+    }
+    if (decoder == null) {
+      decoder = createDecoder();
+    }
+    if (!fileMapped) {
+      throw new IOException("Failed to map the file");
+    }
+    FlacStreamInfo streamInfo = decoder.decodeMetadata(outputEncoding);
+    if (streamInfo == null) {
+      throw new IOException("Metadata decoding failed");
+    }
+    // An empty stream has no first frame, which is reported when it is read.
+    decoder.prefetchFrame();
+    preparedStreamInfo = streamInfo;
+  }
+
   @Override
   public void init(ExtractorOutput output) {
     this.output = output;
     this.trackOutput = output.track(0);
     output.endTracks();
 
-    try {
-      decoder = new FlacJni();
-    } catch (FlacDecoderException e) {
-      throw new RuntimeException(e);
+    if (decoder == null) {
+      decoder = createDecoder();
     }
   }
 
@@ -74,53 +164,80 @@ public final class FlacExtractor implements Extractor {
   @Override
   public int read(final ExtractorInput input, PositionHolder seekPosition)
       throws IOException, InterruptedException {
-    decoder.setData(input);
+    if (!fileMapped) {
+      decoder.setData(input);
+    } else if (seekPending) {
+      // The input has been reopened at the seek position, but is not read.
+      decoder.setMappedDataPosition(input.getPosition());
+      long timeUs = seekTimeUs;
+      seekTimeUs = C.UNKNOWN_TIME_US;
+      // Seek natively to the exact sample, so that the first batch starts at the seek time rather
+      // than at the frame found at the input position. If the seek fails, decoding continues from
+      // the input position instead.
+      if (metadataParsed && timeUs != C.UNKNOWN_TIME_US && !decoder.seek(timeUs)) {
+        decoder.flush();
+        decoder.setMappedDataPosition(input.getPosition());
+      }
+    }
+    seekPending = false;
 
     if (!metadataParsed) {
-      FlacStreamInfo streamInfo = decoder.decodeMetadata();
+      FlacStreamInfo streamInfo = preparedStreamInfo != null ? preparedStreamInfo
+          : decoder.decodeMetadata(outputEncoding);
       if (streamInfo == null) {
         throw new IOException("Metadata decoding failed");
       }
       metadataParsed = true;
 
       output.seekMap(new SeekMap() {
-        final boolean isSeekable = decoder.getSeekPosition(0) != -1;
-
         @Override
         public boolean isSeekable() {
-          return isSeekable;
+          return true;
         }
 
         @Override
         public long getPosition(long timeUs) {
-          return isSeekable ? decoder.getSeekPosition(timeUs) : 0;
+          // The input is opened at the returned position ahead of the seek, and for mapped data
+          // the decoder then seeks to the sample at timeUs.
+          seekTimeUs = timeUs;
+          return decoder.getSeekPosition(timeUs);
         }
       });
 
       MediaFormat mediaFormat = MediaFormat.createAudioFormat(null, MimeTypes.AUDIO_RAW,
               streamInfo.bitRate(), MediaFormat.NO_VALUE, streamInfo.durationUs(),
-              streamInfo.channels, streamInfo.sampleRate, null, null, C.ENCODING_PCM_16BIT);
+              streamInfo.channels, streamInfo.sampleRate, null, null, outputEncoding);
       trackOutput.format(mediaFormat);
 
-      outputBuffer = new ParsableByteArray(streamInfo.maxDecodedFrameSize());
+      // Leave room for the frame that takes the batch past SAMPLE_DURATION_US.
+      int batchSamples = (int) (streamInfo.sampleRate * SAMPLE_DURATION_US / C.MICROS_PER_SECOND)
+          + streamInfo.maxBlockSize;
+      int batchSize = batchSamples * streamInfo.channels * decoder.getOutputBytesPerSample();
+      outputBuffer = new ParsableByteArray(batchSize);
       outputByteBuffer = ByteBuffer.wrap(outputBuffer.data);
     }
 
     outputBuffer.reset();
-    int size = decoder.decodeSample(outputByteBuffer);
+    int size = decoder.decodeSamples(outputByteBuffer, SAMPLE_DURATION_US);
     if (size <= 0) {
       return RESULT_END_OF_INPUT;
     }
     trackOutput.sampleData(outputBuffer, size);
 
-    trackOutput.sampleMetadata(decoder.getLastSampleTimestamp(), C.SAMPLE_FLAG_SYNC, size, 0, null);
+    trackOutput.sampleMetadata(decoder.getLastBatchTimestamp(), C.SAMPLE_FLAG_SYNC, size, 0, null);
 
     return decoder.isEndOfData() ? RESULT_END_OF_INPUT : RESULT_CONTINUE;
   }
 
   @Override
   public void seek() {
+    if (preparedStreamInfo != null && !metadataParsed) {
+      // The first load starts at the beginning of the stream, where the prepared decoder already
+      // is, so its prefetched frame is kept rather than being discarded by repositioning.
+      return;
+    }
     decoder.flush();
+    seekPending = true;
   }
 
   @Override
@@ -129,4 +246,25 @@ public final class FlacExtractor implements Extractor {
     decoder = null;
   }
 
+  /**
+   * Returns whether the decoder holds a frame decoded by {@link #prepare()} or by a seek that has
+   * yet to be output.
+   */
+  /* package */ boolean hasPendingFrame() {
+    return decoder != null && decoder.hasPendingFrame();
+  }
+
+  private FlacJni createDecoder() {
+    FlacJni decoder;
+    try {
+      decoder = new FlacJni();
+    } catch (FlacDecoderException e) {
+      throw new RuntimeException(e);
+    }
+    if (fileDescriptor != null) {
+      fileMapped = decoder.setData(fileDescriptor, fileOffset, fileLength);
+    }
+    return decoder;
+  }
+
 }
@@ -18,7 +18,9 @@ package com.google.android.exoplayer.ext.flac;
 import com.google.android.exoplayer.C;
 import com.google.android.exoplayer.extractor.ExtractorInput;
 import com.google.android.exoplayer.util.FlacStreamInfo;
+import com.google.android.exoplayer.util.extensions.NativeDecoderCounters;
 
+import java.io.FileDescriptor;
 import java.io.IOException;
 import java.nio.ByteBuffer;
 
@@ -42,21 +44,43 @@ import java.nio.ByteBuffer;
     IS_AVAILABLE = isAvailable;
   }
 
-  private static final int TEMP_BUFFER_SIZE = 8192; // The same buffer size which libflac has
+  // The same size as the native read-ahead buffer, so that it can be filled by a single read.
+  private static final int TEMP_BUFFER_SIZE = 64 * 1024;
+
+  // Output encodings, which must match FLACParser::OutputEncoding.
+  private static final int OUTPUT_ENCODING_PCM_16BIT = 0;
+  private static final int OUTPUT_ENCODING_PCM_24BIT = 1;
+  private static final int OUTPUT_ENCODING_PCM_32BIT = 2;
+  private static final int OUTPUT_ENCODING_PCM_FLOAT = 3;
 
   private final long nativeDecoderContext;
+  private final long[] statsSnapshot;
+  private final long[] previousStatsSnapshot;
 
   private ByteBuffer byteBufferData;
 
   private ExtractorInput extractorInput;
   private boolean endOfExtractorInput;
+  private boolean fileMapped;
   private byte[] tempBuffer;
+  private int outputBytesPerSample;
 
   public FlacJni() throws FlacDecoderException {
-    nativeDecoderContext = flacInit();
+    this(0);
+  }
+
+  /**
+   * @param memoryBudget The maximum native memory that the decoder may use in bytes, or 0 if there
+   *     is no limit. The budget is enforced by {@link #decodeMetadata(int)}, which fails if the
+   *     buffers needed for the block size and channel count of the stream would exceed it.
+   */
+  public FlacJni(long memoryBudget) throws FlacDecoderException {
+    nativeDecoderContext = flacInit(memoryBudget);
     if (nativeDecoderContext == 0) {
       throw new FlacDecoderException("Failed to initialize decoder");
     }
+    statsSnapshot = new long[NativeDecoderCounters.SNAPSHOT_SIZE];
+    previousStatsSnapshot = new long[NativeDecoderCounters.SNAPSHOT_SIZE];
   }
 
   /**
@@ -82,13 +106,59 @@ import java.nio.ByteBuffer;
     endOfExtractorInput = false;
   }
 
+  /**
+   * Sets data to be parsed by libflac from a memory mapping of part of a local file. The native
+   * decoder then reads the data directly, without calling into Java, and the data cannot be
+   * replaced by the other {@code setData} methods. Must be called before
+   * {@link #decodeMetadata(int)}.
+   * <p>
+   * The file must not be truncated while the decoder is in use.
+   *
+   * @param fileDescriptor The descriptor of the file. It may be closed once this method returns.
+   * @param offset The offset of the data in the file.
+   * @param length The length of the data, or {@link C#LENGTH_UNBOUNDED} if it extends to the end
+   *     of the file.
+   * @return Whether the data was mapped. If not, data must be set using another method.
+   */
+  public boolean setData(FileDescriptor fileDescriptor, long offset, long length) {
+    if (!flacSetFileDescriptor(nativeDecoderContext, fileDescriptor, offset, length)) {
+      return false;
+    }
+    this.byteBufferData = null;
+    this.extractorInput = null;
+    this.tempBuffer = null;
+    fileMapped = true;
+    return true;
+  }
+
+  /**
+   * Sets the offset within the mapped data from which decoding continues after a call to
+   * {@link #flush()}, for data set by {@link #setData(FileDescriptor, long, long)}.
+   *
+   * @param position The offset within the mapped data, which is usually the position returned by
+   *     {@link #getSeekPosition(long)}.
+   */
+  public void setMappedDataPosition(long position) {
+    flacSetMappedPosition(nativeDecoderContext, position);
+  }
+
+  /**
+   * Returns whether all of the data has been read from the source, and none of it remains buffered
+   * by the native decoder.
+   */
   public boolean isEndOfData() {
-    if (byteBufferData != null) {
-      return byteBufferData.remaining() == 0;
+    boolean endOfSource;
+    if (fileMapped) {
+      // The native decoder reports the mapped data that it has yet to read as buffered.
+      endOfSource = true;
+    } else if (byteBufferData != null) {
+      endOfSource = byteBufferData.remaining() == 0;
     } else if (extractorInput != null) {
-      return endOfExtractorInput;
+      endOfSource = endOfExtractorInput;
+    } else {
+      endOfSource = true;
     }
-    return true;
+    return endOfSource && flacGetBufferedSize(nativeDecoderContext) == 0;
   }
 
   /**
@@ -97,13 +167,15 @@ import java.nio.ByteBuffer;
    * This method blocks until at least one byte of data can be read, the end of the input is
    * detected or an exception is thrown.
    * <p>
-   * This method is called from the native code.
+   * This method is called from the native code, which reuses the same {@code target} across calls.
    *
-   * @param target A target {@link ByteBuffer} into which data should be written.
+   * @param target A target {@link ByteBuffer} into which data should be written. Data is written
+   *     from the start of the buffer, regardless of its position.
    * @return Returns the number of bytes read, or -1 on failure. It's not an error if this returns
    * zero; it just means all the data read from the source.
    */
   public int read(ByteBuffer target) throws IOException, InterruptedException {
+    target.clear();
     int byteCount = target.remaining();
     if (byteBufferData != null) {
       byteCount = Math.min(byteCount, byteBufferData.remaining());
@@ -130,8 +202,122 @@ import java.nio.ByteBuffer;
     return byteCount;
   }
 
+  /**
+   * Skips forwards or backwards in the data source.
+   * <p>
+   * This method is called from the native code when libflac seeks.
+   *
+   * @param bytes The number of bytes to skip, which is negative to skip backwards.
+   * @return Whether the skip succeeded. An {@link ExtractorInput} can only skip forwards.
+   */
+  public boolean skip(long bytes) throws IOException, InterruptedException {
+    if (byteBufferData != null) {
+      long position = byteBufferData.position() + bytes;
+      if (position < 0 || position > byteBufferData.limit()) {
+        return false;
+      }
+      byteBufferData.position((int) position);
+      return true;
+    } else if (extractorInput != null) {
+      if (bytes < 0 || bytes > Integer.MAX_VALUE) {
+        return false;
+      }
+      return extractorInput.skipFully((int) bytes, true);
+    }
+    return false;
+  }
+
+  /**
+   * Returns the number of bytes remaining in the data source, or -1 if it is unknown.
+   * <p>
+   * This method is called from the native code.
+   */
+  public long getRemainingLength() {
+    if (byteBufferData != null) {
+      return byteBufferData.remaining();
+    } else if (extractorInput != null) {
+      long length = extractorInput.getLength();
+      return length == C.LENGTH_UNBOUNDED ? -1 : length - extractorInput.getPosition();
+    }
+    return -1;
+  }
+
   public FlacStreamInfo decodeMetadata() {
-    return flacDecodeMetadata(nativeDecoderContext);
+    return decodeMetadata(C.ENCODING_PCM_16BIT);
+  }
+
+  /**
+   * Decodes the stream metadata, and configures the encoding of subsequently decoded samples.
+   *
+   * @param outputEncoding The encoding of decoded samples. One of {@link C#ENCODING_PCM_16BIT},
+   *     {@link C#ENCODING_PCM_24BIT} (packed into three bytes per sample),
+   *     {@link C#ENCODING_PCM_32BIT} and {@link C#ENCODING_PCM_FLOAT}. Samples are little endian,
+   *     and are scaled to use the full range of the encoding.
+   * @return The stream info, or null if the metadata could not be decoded.
+   */
+  public FlacStreamInfo decodeMetadata(int outputEncoding) {
+    int nativeOutputEncoding = getNativeOutputEncoding(outputEncoding);
+    switch (nativeOutputEncoding) {
+      case OUTPUT_ENCODING_PCM_16BIT:
+        outputBytesPerSample = 2;
+        break;
+      case OUTPUT_ENCODING_PCM_24BIT:
+        outputBytesPerSample = 3;
+        break;
+      default:
+        outputBytesPerSample = 4;
+        break;
+    }
+    return flacDecodeMetadata(nativeDecoderContext, nativeOutputEncoding);
+  }
+
+  /**
+   * Returns the value of {@code FLACParser::OutputEncoding} for an encoding accepted by
+   * {@link #decodeMetadata(int)}.
+   */
+  /* package */ static int getNativeOutputEncoding(int outputEncoding) {
+    switch (outputEncoding) {
+      case C.ENCODING_PCM_16BIT:
+        return OUTPUT_ENCODING_PCM_16BIT;
+      case C.ENCODING_PCM_24BIT:
+        return OUTPUT_ENCODING_PCM_24BIT;
+      case C.ENCODING_PCM_32BIT:
+        return OUTPUT_ENCODING_PCM_32BIT;
+      case C.ENCODING_PCM_FLOAT:
+        return OUTPUT_ENCODING_PCM_FLOAT;
+      default:
+        throw new IllegalArgumentException("Unsupported output encoding: " + outputEncoding);
+    }
+  }
+
+  /**
+   * Returns the size in bytes of each decoded sample, for the output encoding passed to
+   * {@link #decodeMetadata(int)}.
+   */
+  public int getOutputBytesPerSample() {
+    return outputBytesPerSample;
+  }
+
+  /**
+   * Configures the decoder to resample and mix the decoded samples natively, in the output encoding
+   * passed to {@link #decodeMetadata(int)}. Must be called after the metadata has been decoded.
+   * Streams with more than two channels can be mixed down to stereo or mono, and stereo can be
+   * converted to or from mono.
+   *
+   * @param sampleRate The sample rate of the output, or 0 to keep the rate of the stream.
+   * @param channelCount The number of channels in the output, or 0 to keep those of the stream.
+   * @return Whether the conversion is supported, and is within the memory budget of the decoder.
+   */
+  public boolean setOutputFormat(int sampleRate, int channelCount) {
+    return flacSetOutputFormat(nativeDecoderContext, sampleRate, channelCount);
+  }
+
+  /**
+   * Returns the maximum size in bytes of the samples into which a single frame is decoded, in the
+   * output encoding and format.
+   */
+  public int getMaxOutputFrameSize() {
+    return flacGetMaxOutputFrameSize(nativeDecoderContext);
   }
 
   public int decodeSample(ByteBuffer output) {
@@ -140,6 +326,82 @@ import java.nio.ByteBuffer;
         : flacDecodeToArray(nativeDecoderContext, output.array());
   }
 
+  /**
+   * Returns the size in bytes of the output that the native converter holds for the end of the
+   * last decoded frame, which {@link #drain(ByteBuffer)} writes. Always 0 if no output format was
+   * set by {@link #setOutputFormat(int, int)}, or if the stream is not resampled.
+   */
+  public int getDrainSize() {
+    return flacGetDrainSize(nativeDecoderContext);
+  }
+
+  /**
+   * Writes the output that the native converter holds for the end of the last decoded frame, at
+   * the end of the stream, so that the output covers all of the decoded samples. The output then
+   * continues as after a {@link #flush()}.
+   *
+   * @param output The buffer into which the samples should be written, which must have room for
+   *     {@link #getDrainSize()} bytes.
+   * @return The number of bytes written, or a negative value if {@code output} is too small.
+   */
+  public int drain(ByteBuffer output) {
+    return output.isDirect()
+        ? flacDrainToBuffer(nativeDecoderContext, output)
+        : flacDrainToArray(nativeDecoderContext, output.array());
+  }
+
+  /**
+   * Decodes consecutive frames into {@code output} in a single call.
+   * <p>
+   * Decoding stops once {@code output} could not hold another frame of the maximum block size, or
+   * once the decoded audio lasts at least {@code maxDurationUs}. At the end of the stream, the
+   * output that the native converter holds for the end of the last frame is written after it, as
+   * by {@link #drain(ByteBuffer)}.
+   *
+   * @param output The buffer into which decoded samples should be written.
+   * @param maxDurationUs The duration of audio after which decoding should stop, in microseconds.
+   * @return The number of bytes written, or a negative value if no frame could be decoded.
+   */
+  public int decodeSamples(ByteBuffer output, long maxDurationUs) {
+    return output.isDirect()
+        ? flacDecodeFramesToBuffer(nativeDecoderContext, output, maxDurationUs)
+        : flacDecodeFramesToArray(nativeDecoderContext, output.array(), maxDurationUs);
+  }
+
+  /**
+   * Decodes the next frame ahead of the next call to {@link #decodeSample} or
+   * {@link #decodeSamples}, which then returns it without decoding it. Prefetching the first frame
+   * of a stream before it is played removes the decode from the start of playback.
+   *
+   * @return Whether a frame was decoded. False at the end of the stream or if decoding failed.
+   */
+  public boolean prefetchFrame() {
+    return flacPrefetchFrame(nativeDecoderContext);
+  }
+
+  /**
+   * Returns whether a frame decoded by {@link #prefetchFrame()} or by a seek has yet to be returned
+   * by a decode call.
+   */
+  public boolean hasPendingFrame() {
+    return flacHasPendingFrame(nativeDecoderContext);
+  }
+
+  /**
+   * Returns the number of frames decoded by the last call to {@link #decodeSamples}.
+   */
+  public int getLastBatchFrameCount() {
+    return flacGetLastBatchFrameCount(nativeDecoderContext);
+  }
+
+  /**
+   * Returns the timestamp of the first frame decoded by the last call to {@link #decodeSamples},
+   * in microseconds.
+   */
+  public long getLastBatchTimestamp() {
+    return flacGetLastBatchTimestamp(nativeDecoderContext);
+  }
+
   public long getLastSampleTimestamp() {
     return flacGetLastTimestamp(nativeDecoderContext);
   }
@@ -147,19 +409,57 @@ import java.nio.ByteBuffer;
   /**
    * Maps a seek position in microseconds to a corresponding position (byte offset) in the flac
    * stream.
+   * <p>
+   * The position is taken from the stream's seek table and from the frames decoded so far. If the
+   * stream doesn't have a seek table and the seek position is beyond the decoded frames, the
+   * position is estimated, and decoding resumes at the next frame after it.
    *
    * @param timeUs A seek position in microseconds.
-   * @return The corresponding position (byte offset) in the flac stream or -1 if the stream doesn't
-   * have a seek table.
+   * @return The corresponding position (byte offset) in the flac stream.
    */
   public long getSeekPosition(long timeUs) {
     return flacGetSeekPosition(nativeDecoderContext, timeUs);
   }
 
+  /**
+   * Seeks to the sample at {@code timeUs}. On success, the next call to {@link #decodeSample} or
+   * {@link #decodeSamples} returns samples starting exactly at the target sample.
+   * <p>
+   * libflac may need to read anywhere in the stream to find the target, so this requires a data
+   * source that can skip to the requested positions. For an {@link ExtractorInput}, that means
+   * seeking forwards only.
+   *
+   * @param timeUs The seek position in microseconds.
+   * @return Whether the seek succeeded.
+   */
+  public boolean seek(long timeUs) {
+    return flacSeek(nativeDecoderContext, timeUs);
+  }
+
   public void flush() {
     flacFlush(nativeDecoderContext);
   }
 
+  /**
+   * Adds the work done by the native decoder since the previous call to {@code counters}. Must not
+   * be called concurrently with itself, or after {@link #release()}.
+   *
+   * @param counters The counters to update.
+   */
+  public void updateCounters(NativeDecoderCounters counters) {
+    flacGetStats(nativeDecoderContext, statsSnapshot);
+    counters.accumulate(statsSnapshot, previousStatsSnapshot);
+    counters.memoryUsageBytes = getMemoryUsage();
+  }
+
+  /**
+   * Returns an estimate of the native memory held by the decoder, in bytes, including the buffers
+   * allocated by libFLAC once the metadata has been decoded. Memory mapped data is not included.
+   */
+  public long getMemoryUsage() {
+    return flacGetMemoryUsage(nativeDecoderContext);
+  }
+
   public void release() {
     flacRelease(nativeDecoderContext);
   }
@@ -174,20 +474,56 @@ import java.nio.ByteBuffer;
     return read;
   }
 
-  private native long flacInit();
+  private native long flacInit(long memoryBudget);
+
+  private native boolean flacSetFileDescriptor(long context, FileDescriptor fileDescriptor,
+      long offset, long length);
+
+  private native FlacStreamInfo flacDecodeMetadata(long context, int outputEncoding);
 
-  private native FlacStreamInfo flacDecodeMetadata(long context);
+  private native boolean flacSetOutputFormat(long context, int sampleRate, int channelCount);
+
+  private native int flacGetMaxOutputFrameSize(long context);
 
   private native int flacDecodeToBuffer(long context, ByteBuffer outputBuffer);
 
   private native int flacDecodeToArray(long context, byte[] outputArray);
 
+  private native int flacDecodeFramesToBuffer(long context, ByteBuffer outputBuffer,
+      long maxDurationUs);
+
+  private native int flacDecodeFramesToArray(long context, byte[] outputArray,
+      long maxDurationUs);
+
+  private native boolean flacPrefetchFrame(long context);
+
+  private native int flacGetDrainSize(long context);
+
+  private native int flacDrainToBuffer(long context, ByteBuffer outputBuffer);
+
+  private native int flacDrainToArray(long context, byte[] outputArray);
+
+  private native boolean flacHasPendingFrame(long context);
+
+  private native int flacGetLastBatchFrameCount(long context);
+
+  private native long flacGetLastBatchTimestamp(long context);
+
   private native long flacGetLastTimestamp(long context);
 
   private native long flacGetSeekPosition(long context, long timeUs);
 
+  private native boolean flacSeek(long context, long timeUs);
+
+  private native int flacGetBufferedSize(long context);
+
+  private native void flacSetMappedPosition(long context, long position);
+
   private native void flacFlush(long context);
 
+  private native long flacGetMemoryUsage(long context);
+  private native void flacGetStats(long context, long[] stats);
+
   private native void flacRelease(long context);
 
 }
@@ -29,6 +29,7 @@ import com.google.android.exoplayer.audio.AudioTrack;
 import com.google.android.exoplayer.util.MimeTypes;
 import com.google.android.exoplayer.util.extensions.Buffer;
 import com.google.android.exoplayer.util.extensions.InputBuffer;
+import com.google.android.exoplayer.util.extensions.NativeDecoderCounters;
 
 import android.os.Handler;
 
@@ -78,9 +79,16 @@ public final class LibflacAudioTrackRenderer extends SampleSourceTrackRenderer
   private static final int NUM_BUFFERS = 16;
 
   public final CodecCounters codecCounters = new CodecCounters();
+  /**
+   * Timings and counts of the work done by the native decoder, updated on the playback thread.
+   */
+  public final NativeDecoderCounters nativeDecoderCounters = new NativeDecoderCounters();
 
   private final Handler eventHandler;
   private final EventListener eventListener;
+  private final long memoryBudget;
+  private final boolean downmixToStereo;
+  private final int outputSampleRate;
   private final MediaFormatHolder formatHolder;
 
   private MediaFormat format;
@@ -112,9 +120,47 @@ public final class LibflacAudioTrackRenderer extends SampleSourceTrackRenderer
    */
   public LibflacAudioTrackRenderer(SampleSource source, Handler eventHandler,
       EventListener eventListener) {
+    this(source, eventHandler, eventListener, 0);
+  }
+
+  /**
+   * @param source The upstream source from which the renderer obtains samples.
+   * @param eventHandler A handler to use when delivering events to {@code eventListener}. May be
+   *     null if delivery of events is not required.
+   * @param eventListener A listener of events. May be null if delivery of events is not required.
+   * @param memoryBudget The maximum native memory that each decoder may use in bytes, or 0 if there
+   *     is no limit. Playback of a stream that would need more fails with a decoder error. The
+   *     memory in use is reported by {@link NativeDecoderCounters#memoryUsageBytes}.
+   */
+  public LibflacAudioTrackRenderer(SampleSource source, Handler eventHandler,
+      EventListener eventListener, long memoryBudget) {
+    this(source, eventHandler, eventListener, memoryBudget, false, 0);
+  }
+
+  /**
+   * @param source The upstream source from which the renderer obtains samples.
+   * @param eventHandler A handler to use when delivering events to {@code eventListener}. May be
+   *     null if delivery of events is not required.
+   * @param eventListener A listener of events. May be null if delivery of events is not required.
+   * @param memoryBudget The maximum native memory that each decoder may use in bytes, or 0 if there
+   *     is no limit. Playback of a stream that would need more fails with a decoder error. The
+   *     memory in use is reported by {@link NativeDecoderCounters#memoryUsageBytes}.
+   * @param downmixToStereo Whether streams with more than two channels should be downmixed to
+   *     stereo by the decoder, rather than being passed to the audio track as is.
+   * @param outputSampleRate The sample rate to which the decoder resamples its output, or 0 to pass
+   *     audio to the audio track at the rate of the stream. Passing the native sample rate of the
+   *     device, from {@link android.media.AudioManager#PROPERTY_OUTPUT_SAMPLE_RATE}, avoids
+   *     resampling by the platform.
+   */
+  public LibflacAudioTrackRenderer(SampleSource source, Handler eventHandler,
+      EventListener eventListener, long memoryBudget, boolean downmixToStereo,
+      int outputSampleRate) {
     super(source);
     this.eventHandler = eventHandler;
     this.eventListener = eventListener;
+    this.memoryBudget = memoryBudget;
+    this.downmixToStereo = downmixToStereo;
+    this.outputSampleRate = outputSampleRate;
     this.audioSessionId = AudioTrack.SESSION_ID_NOT_SET;
     this.audioTrack = new AudioTrack();
     formatHolder = new MediaFormatHolder();
@@ -160,7 +206,8 @@ public final class LibflacAudioTrackRenderer extends SampleSourceTrackRenderer
         throw new ExoPlaybackException("Missing initialization data");
       }
       try {
-        decoder = new FlacDecoder(NUM_BUFFERS, NUM_BUFFERS, initializationData);
+        decoder = new FlacDecoder(NUM_BUFFERS, NUM_BUFFERS, initializationData, memoryBudget,
+            outputSampleRate, getOutputChannelCount());
       } catch (FlacDecoderException e) {
         notifyDecoderError(e);
         throw new ExoPlaybackException(e);
@@ -183,6 +230,8 @@ public final class LibflacAudioTrackRenderer extends SampleSourceTrackRenderer
       notifyDecoderError(e);
       throw new ExoPlaybackException(e);
     }
+    decoder.updateCounters(nativeDecoderCounters);
+    nativeDecoderCounters.ensureUpdated();
     codecCounters.ensureUpdated();
   }
 
@@ -333,6 +382,9 @@ public final class LibflacAudioTrackRenderer extends SampleSourceTrackRenderer
     audioSessionId = AudioTrack.SESSION_ID_NOT_SET;
     try {
       if (decoder != null) {
+        decoder.updateCounters(nativeDecoderCounters);
+        nativeDecoderCounters.memoryUsageBytes = 0;
+        nativeDecoderCounters.ensureUpdated();
         decoder.release();
         decoder = null;
         codecCounters.codecReleaseCount++;
@@ -347,13 +399,17 @@ public final class LibflacAudioTrackRenderer extends SampleSourceTrackRenderer
     int result = readSource(positionUs, formatHolder, null);
     if (result == SampleSource.FORMAT_READ) {
       format = formatHolder.format;
-      audioTrack.configure(MimeTypes.AUDIO_RAW, format.channelCount, format.sampleRate,
-          C.ENCODING_PCM_16BIT);
+      audioTrack.configure(MimeTypes.AUDIO_RAW, getOutputChannelCount(),
+          outputSampleRate != 0 ? outputSampleRate : format.sampleRate, C.ENCODING_PCM_16BIT);
       return true;
     }
     return false;
   }
 
+  private int getOutputChannelCount() {
+    return downmixToStereo && format.channelCount > 2 ? 2 : format.channelCount;
+  }
+
   @Override
   public void handleMessage(int messageType, Object message) throws ExoPlaybackException {
     if (messageType == MSG_SET_VOLUME) {
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.google.android.exoplayer.ext.flac;
+
+import com.google.android.exoplayer.C;
+import com.google.android.exoplayer.util.FlacStreamInfo;
+
+import java.io.FileDescriptor;
+import java.nio.ByteBuffer;
+
+/**
+ * Decodes a local FLAC file on several threads, faster than real time, for offline processing such
+ * as transcoding or waveform generation rather than playback.
+ * <p>
+ * The stream is split into ranges of samples, each of which is decoded by a native worker thread
+ * that seeks to the start of the range. Decoded samples are returned by {@link #read(ByteBuffer)}
+ * in stream order, and only a bounded number of ranges are decoded ahead of the reads. The stream
+ * must declare its total number of samples in its metadata.
+ * <p>
+ * Methods of this class must be called from a single thread.
+ */
+public final class ParallelFlacDecoder {
+
+  private final long nativeDecoder;
+  private final FlacStreamInfo streamInfo;
+
+  private boolean released;
+
+  /**
+   * @param fileDescriptor The descriptor of the file. It may be closed once the constructor
+   *     returns, but the file must not be truncated until the decoder is released.
+   * @param offset The offset of the FLAC stream in the file.
+   * @param length The length of the FLAC stream, or {@link C#LENGTH_UNBOUNDED} if it extends to
+   *     the end of the file.
+   * @param threadCount The number of threads to decode on, or 0 to use a thread for each CPU.
+   * @param outputEncoding The encoding of decoded samples. See {@link FlacJni#decodeMetadata(int)}.
+   * @throws FlacDecoderException If the file cannot be decoded in parallel.
+   */
+  public ParallelFlacDecoder(FileDescriptor fileDescriptor, long offset, long length,
+      int threadCount, int outputEncoding) throws FlacDecoderException {
+    if (!FlacJni.IS_AVAILABLE) {
+      throw new FlacDecoderException("Failed to load decoder native library.");
+    }
+    nativeDecoder = flacParallelInit(fileDescriptor, offset, length, threadCount,
+        FlacJni.getNativeOutputEncoding(outputEncoding));
+    if (nativeDecoder == 0) {
+      throw new FlacDecoderException("Failed to initialize parallel decoder");
+    }
+    streamInfo = flacParallelGetStreamInfo(nativeDecoder);
+  }
+
+  /**
+   * Returns the stream info decoded from the metadata of the stream.
+   */
+  public FlacStreamInfo getStreamInfo() {
+    return streamInfo;
+  }
+
+  /**
+   * Reads decoded samples into {@code output}, starting at its beginning and continuing from the
+   * previous call. Blocks until the samples have been decoded.
+   *
+   * @param output The buffer into which samples are written.
+   * @return The number of bytes written, or {@link C#RESULT_END_OF_INPUT} if all of the samples
+   *     have been read.
+   * @throws FlacDecoderException If decoding failed.
+   */
+  public int read(ByteBuffer output) throws FlacDecoderException {
+    if (released) {
+      throw new IllegalStateException();
+    }
+    int size = output.isDirect()
+        ? flacParallelReadToBuffer(nativeDecoder, output)
+        : flacParallelReadToArray(nativeDecoder, output.array());
+    if (size < 0) {
+      throw new FlacDecoderException("Decoding failed");
+    }
+    return size == 0 ? C.RESULT_END_OF_INPUT : size;
+  }
+
+  /**
+   * Stops the worker threads and releases the decoder.
+   */
+  public void release() {
+    if (!released) {
+      released = true;
+      flacParallelRelease(nativeDecoder);
+    }
+  }
+
+  private static native long flacParallelInit(FileDescriptor fileDescriptor, long offset,
+      long length, int threadCount, int outputEncoding);
+  private static native FlacStreamInfo flacParallelGetStreamInfo(long decoder);
+  private static native int flacParallelReadToBuffer(long decoder, ByteBuffer outputBuffer);
+  private static native int flacParallelReadToArray(long decoder, byte[] outputArray);
+  private static native void flacParallelRelease(long decoder);
+
+}
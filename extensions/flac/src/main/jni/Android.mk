@@ -22,17 +22,87 @@ include $(WORKING_DIR)/flac_sources.mk
 
 LOCAL_PATH := $(WORKING_DIR)
 LOCAL_MODULE := libflacJNI
-LOCAL_ARM_MODE := arm
 LOCAL_CPP_EXTENSION := .cc
 
 LOCAL_C_INCLUDES := \
     $(LOCAL_PATH)/flac/include \
     $(LOCAL_PATH)/flac/src/libFLAC/include
 LOCAL_SRC_FILES := $(FLAC_SOURCES)
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+  LOCAL_SRC_FILES += flac_copy_neon.cc.neon
+else ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+  LOCAL_SRC_FILES += flac_copy_neon.cc
+else ifneq ($(filter x86 x86_64,$(TARGET_ARCH_ABI)),)
+  LOCAL_SRC_FILES += flac_copy_sse2.cc
+endif
 
-LOCAL_CFLAGS += '-DVERSION="1.3.1"' -DFLAC__NO_MD5 -DFLAC__INTEGER_ONLY_LIBRARY -DFLAC__NO_ASM
+LOCAL_CFLAGS += '-DVERSION="1.3.1"' -DFLAC__NO_MD5
 LOCAL_CFLAGS += -D_REENTRANT -DPIC -DU_COMMON_IMPLEMENTATION -fPIC
 LOCAL_CFLAGS += -O3 -funroll-loops -finline-functions
 
-LOCAL_LDLIBS := -llog -lz -lm
+# libFLAC's optimized LPC restore routines are SSE2/SSE4.1 intrinsics, which it
+# selects at runtime after checking the CPU with cpuid. They are only compiled
+# when libFLAC is not integer-only. There are no equivalents for other
+# architectures, where the plain C routines are auto-vectorized by the
+# compiler instead (using NEON on arm64-v8a).
+ifeq ($(TARGET_ARCH_ABI),x86)
+  LOCAL_CFLAGS += -DFLAC__CPU_IA32 -DFLAC__HAS_X86INTRIN=1 -DFLAC__SSE_OS=1
+  LOCAL_CFLAGS += -DHAVE_CPUID_H=1
+else ifeq ($(TARGET_ARCH_ABI),x86_64)
+  LOCAL_CFLAGS += -DFLAC__CPU_X86_64 -DFLAC__HAS_X86INTRIN=1 -DFLAC__SSE_OS=1
+  LOCAL_CFLAGS += -DHAVE_CPUID_H=1
+else
+  LOCAL_CFLAGS += -DFLAC__INTEGER_ONLY_LIBRARY -DFLAC__NO_ASM
+endif
+
+ifneq ($(filter armeabi armeabi-v7a,$(TARGET_ARCH_ABI)),)
+  LOCAL_ARM_MODE := arm
+endif
+
+LOCAL_LDLIBS := -llog -lz -lm -ldl
+LOCAL_STATIC_LIBRARIES := cpufeatures
+
+# The benchmark reuses the decoder's sources and flags.
+FLAC_BENCHMARK_SRC_FILES := \
+    $(filter-out flac_jni.cc,$(LOCAL_SRC_FILES)) flac_benchmark.cc
+FLAC_BENCHMARK_C_INCLUDES := $(LOCAL_C_INCLUDES)
+FLAC_BENCHMARK_CFLAGS := $(LOCAL_CFLAGS)
 include $(BUILD_SHARED_LIBRARY)
+
+# build flac_benchmark, a standalone executable that decodes files through
+# FLACParser, when BUILD_BENCHMARK=true is passed to ndk-build.
+ifeq ($(BUILD_BENCHMARK),true)
+  include $(CLEAR_VARS)
+  LOCAL_PATH := $(WORKING_DIR)
+  LOCAL_MODULE := flac_benchmark
+  LOCAL_CPP_EXTENSION := .cc
+  LOCAL_C_INCLUDES := $(FLAC_BENCHMARK_C_INCLUDES)
+  LOCAL_SRC_FILES := $(FLAC_BENCHMARK_SRC_FILES)
+  LOCAL_CFLAGS := $(FLAC_BENCHMARK_CFLAGS) -fPIE
+  LOCAL_LDFLAGS := -fPIE -pie
+  ifneq ($(filter armeabi armeabi-v7a,$(TARGET_ARCH_ABI)),)
+    LOCAL_ARM_MODE := arm
+  endif
+  LOCAL_LDLIBS := -llog -lz -lm
+  LOCAL_STATIC_LIBRARIES := cpufeatures
+  include $(BUILD_EXECUTABLE)
+endif
+
+# build pcm_converter_test, a standalone executable that tests PcmConverter,
+# when BUILD_TESTS=true is passed to ndk-build.
+ifeq ($(BUILD_TESTS),true)
+  include $(CLEAR_VARS)
+  LOCAL_PATH := $(WORKING_DIR)
+  LOCAL_MODULE := pcm_converter_test
+  LOCAL_CPP_EXTENSION := .cc
+  LOCAL_SRC_FILES := pcm_converter.cc pcm_converter_test.cc
+  LOCAL_CFLAGS := -O2 -fPIE
+  LOCAL_LDFLAGS := -fPIE -pie
+  ifneq ($(filter armeabi armeabi-v7a,$(TARGET_ARCH_ABI)),)
+    LOCAL_ARM_MODE := arm
+  endif
+  LOCAL_LDLIBS := -lm
+  include $(BUILD_EXECUTABLE)
+endif
+
+$(call import-module,android/cpufeatures)
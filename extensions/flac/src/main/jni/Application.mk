@@ -15,6 +15,12 @@
 #
 
 APP_OPTIM := release
-APP_STL := gnustl_static
+APP_STL := c++_static
 APP_CPPFLAGS := -frtti
+# The 64-bit ABIs are built against android-21, the first platform with 64-bit
+# support, regardless of this setting.
 APP_PLATFORM := android-9
+APP_ABI := armeabi-v7a arm64-v8a x86 x86_64
+NDK_TOOLCHAIN_VERSION := clang
+APP_CFLAGS := -O3 -flto
+APP_LDFLAGS := -flto
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/buffered_data_source.h"
+
+#include <android/log.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#define LOG_TAG "BufferedDataSource"
+#define ALOGE(...) \
+  ((void)__android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__))
+
+BufferedDataSource::BufferedDataSource(DataSource *source, size_t capacity)
+    : mSource(source),
+      mData(static_cast<uint8_t *>(malloc(capacity))),
+      mCapacity(capacity),
+      mStart(0),
+      mEnd(0),
+      mPosition(0) {
+  if (mData == NULL) {
+    // Reads are forwarded directly to the underlying source.
+    ALOGE("Failed to allocate %zu byte read-ahead buffer", capacity);
+    mCapacity = 0;
+  }
+}
+
+BufferedDataSource::~BufferedDataSource() { free(mData); }
+
+ssize_t BufferedDataSource::readAt(off64_t offset, void *const data,
+                                   size_t size) {
+  if (offset != mPosition) {
+    reset();
+    mPosition = offset;
+  }
+  if (mStart == mEnd) {
+    if (size >= mCapacity) {
+      // Buffering would only add a copy.
+      ssize_t result = mSource->readAt(mPosition, data, size);
+      if (result > 0) {
+        mPosition += result;
+      }
+      return result;
+    }
+    ssize_t result = mSource->readAt(mPosition, mData, mCapacity);
+    if (result <= 0) {
+      return result;
+    }
+    mStart = 0;
+    mEnd = result;
+  }
+  size_t count = mEnd - mStart;
+  if (count > size) {
+    count = size;
+  }
+  memcpy(data, mData + mStart, count);
+  mStart += count;
+  mPosition += count;
+  return count;
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Standalone benchmark of the native FLAC decode path, decoding each file
+// given on the command line through FLACParser as flacDecodeToBuffer does.
+// Built by passing BUILD_BENCHMARK=true to ndk-build. See README.md.
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "include/buffered_data_source.h"
+#include "include/flac_parser.h"
+#include "include/mmap_data_source.h"
+
+#if defined(__aarch64__)
+#define ABI "arm64-v8a"
+#elif defined(__arm__)
+#define ABI "armeabi-v7a"
+#elif defined(__x86_64__)
+#define ABI "x86_64"
+#elif defined(__i386__)
+#define ABI "x86"
+#else
+#define ABI "unknown"
+#endif
+
+// The size of the read-ahead buffer, matching flac_jni.cc.
+static const size_t kReadAheadSize = 64 * 1024;
+
+class FileDataSource : public DataSource {
+ public:
+  explicit FileDataSource(int fd) : fd(fd) {}
+
+  ssize_t readAt(off64_t offset, void *const data, size_t size) {
+    return pread64(fd, data, size, offset);
+  }
+
+  off64_t getLength() {
+    struct stat64 fileStat;
+    return fstat64(fd, &fileStat) == 0 ? fileStat.st_size : -1;
+  }
+
+ private:
+  const int fd;
+};
+
+static int64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static long getPeakRssKb() {
+  struct rusage usage;
+  return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+}
+
+// Prints the given percentiles of latenciesNs, which is sorted in place.
+static void printLatencies(std::vector<int64_t> *latenciesNs) {
+  if (latenciesNs->empty()) {
+    return;
+  }
+  std::sort(latenciesNs->begin(), latenciesNs->end());
+  static const int kPercentiles[] = {50, 90, 99, 100};
+  printf("  frame latency (us):");
+  for (size_t i = 0; i < sizeof(kPercentiles) / sizeof(kPercentiles[0]); i++) {
+    size_t index = (latenciesNs->size() - 1) * kPercentiles[i] / 100;
+    printf(" p%d=%.1f", kPercentiles[i], (*latenciesNs)[index] / 1000.0);
+  }
+  printf("\n");
+}
+
+static bool benchmarkFile(const char *path, int iterations,
+                          FLACParser::OutputEncoding outputEncoding,
+                          bool mapFile) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+  FileDataSource fileSource(fd);
+  std::vector<int64_t> latenciesNs;
+  std::vector<uint8_t> output;
+  int64_t decodeTimeNs = 0;
+  int64_t copyTimeNs = 0;
+  int64_t sampleCount = 0;
+  int64_t inputSize = 0;
+  unsigned sampleRate = 0;
+  bool success = true;
+  for (int i = 0; i < iterations && success; i++) {
+    // A mapped file is read as flacSetFileDescriptor does, without the
+    // read-ahead buffer.
+    BufferedDataSource bufferedSource(&fileSource, kReadAheadSize);
+    MmapDataSource mappedSource;
+    if (mapFile && !mappedSource.init(fd, 0, -1)) {
+      fprintf(stderr, "Failed to map %s\n", path);
+      success = false;
+      break;
+    }
+    FLACParser parser(mapFile ? static_cast<DataSource *>(&mappedSource)
+                              : &bufferedSource);
+    if (!parser.init(outputEncoding)) {
+      fprintf(stderr, "Failed to initialize the parser for %s\n", path);
+      success = false;
+      break;
+    }
+    sampleRate = parser.getSampleRate();
+    output.resize(parser.getMaxBlockSize() * parser.getChannels() *
+                  parser.getOutputBytesPerSample());
+    size_t frameSize = parser.getChannels() * parser.getOutputBytesPerSample();
+    while (true) {
+      int64_t startNs = nowNs();
+      size_t size = parser.readBuffer(&output[0], output.size());
+      int64_t elapsedNs = nowNs() - startNs;
+      if (size == static_cast<size_t>(-1)) {
+        break;
+      }
+      latenciesNs.push_back(elapsedNs);
+      decodeTimeNs += elapsedNs;
+      sampleCount += size / frameSize;
+    }
+    copyTimeNs += parser.getCopyTimeNs();
+    inputSize += fileSource.getLength();
+  }
+  close(fd);
+  if (!success || decodeTimeNs == 0) {
+    return false;
+  }
+
+  double decodeSeconds = decodeTimeNs / 1e9;
+  printf("%s [%s]\n", path, ABI);
+  printf("  %zu frames, %.2f s of audio in %.3f s: %.1fx realtime, %.2f MB/s\n",
+         latenciesNs.size(), static_cast<double>(sampleCount) / sampleRate,
+         decodeSeconds, sampleCount / (sampleRate * decodeSeconds),
+         inputSize / (decodeSeconds * 1024 * 1024));
+  printf("  copy: %.3f s (%.1f%% of decode)\n", copyTimeNs / 1e9,
+         100.0 * copyTimeNs / decodeTimeNs);
+  printLatencies(&latenciesNs);
+  return true;
+}
+
+static void printUsage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-n iterations] [-e output_encoding] [-m] file.flac...\n"
+          "  output_encoding: 0 = 16-bit, 1 = 24-bit, 2 = 32-bit, 3 = float\n"
+          "  -m: read the file through a memory mapping\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  int iterations = 1;
+  FLACParser::OutputEncoding outputEncoding =
+      FLACParser::kOutputEncodingPcm16Bit;
+  bool mapFile = false;
+  int option;
+  while ((option = getopt(argc, argv, "n:e:m")) != -1) {
+    switch (option) {
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 'e':
+        outputEncoding = static_cast<FLACParser::OutputEncoding>(atoi(optarg));
+        break;
+      case 'm':
+        mapFile = true;
+        break;
+      default:
+        printUsage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind == argc || iterations <= 0) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  int failures = 0;
+  for (int i = optind; i < argc; i++) {
+    if (!benchmarkFile(argv[i], iterations, outputEncoding, mapFile)) {
+      failures++;
+    }
+  }
+  printf("peak RSS: %ld KB\n", getPeakRssKb());
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/flac_copy_simd.h"
+
+#include <arm_neon.h>
+
+#include <cstdlib>
+
+// Conversion of a single sample, matching the scalar copy functions.
+template <unsigned kBitsPerSample>
+static inline int16_t narrowSample(int sample);
+
+template <>
+inline int16_t narrowSample<8>(int sample) {
+  return sample << 8;
+}
+
+template <>
+inline int16_t narrowSample<16>(int sample) {
+  return sample;
+}
+
+template <>
+inline int16_t narrowSample<24>(int sample) {
+  return sample >> 8;
+}
+
+// Conversion of four samples. The results are bit-exact with narrowSample.
+template <unsigned kBitsPerSample>
+static inline int16x4_t narrow(const int *src);
+
+template <>
+inline int16x4_t narrow<8>(const int *src) {
+  return vshl_n_s16(vmovn_s32(vld1q_s32(src)), 8);
+}
+
+template <>
+inline int16x4_t narrow<16>(const int *src) {
+  return vmovn_s32(vld1q_s32(src));
+}
+
+template <>
+inline int16x4_t narrow<24>(const int *src) {
+  return vshrn_n_s32(vld1q_s32(src), 8);
+}
+
+// Interleaves four samples of two channels. Each 32-bit lane of the result
+// holds one sample of the first channel followed by one of the second, so
+// that multichannel layouts can be written with 32-bit structure stores.
+template <unsigned kBitsPerSample>
+static inline int32x4_t narrowPair(const int *first, const int *second) {
+  const int16x4x2_t zipped =
+      vzip_s16(narrow<kBitsPerSample>(first), narrow<kBitsPerSample>(second));
+  return vreinterpretq_s32_s16(vcombine_s16(zipped.val[0], zipped.val[1]));
+}
+
+template <unsigned kBitsPerSample>
+static void copyMonoNeon(void *output, const int *const *src,
+                         unsigned nSamples, unsigned /* nChannels */) {
+  int16_t *dst = static_cast<int16_t *>(output);
+  const int *const mono = src[0];
+  unsigned i = 0;
+  for (; i + 8 <= nSamples; i += 8) {
+    vst1q_s16(dst, vcombine_s16(narrow<kBitsPerSample>(mono + i),
+                                narrow<kBitsPerSample>(mono + i + 4)));
+    dst += 8;
+  }
+  for (; i < nSamples; ++i) {
+    *dst++ = narrowSample<kBitsPerSample>(mono[i]);
+  }
+}
+
+template <unsigned kBitsPerSample>
+static void copyStereoNeon(void *output, const int *const *src,
+                           unsigned nSamples, unsigned /* nChannels */) {
+  int16_t *dst = static_cast<int16_t *>(output);
+  const int *const left = src[0];
+  const int *const right = src[1];
+  unsigned i = 0;
+  for (; i + 8 <= nSamples; i += 8) {
+    int16x8x2_t out;
+    out.val[0] = vcombine_s16(narrow<kBitsPerSample>(left + i),
+                              narrow<kBitsPerSample>(left + i + 4));
+    out.val[1] = vcombine_s16(narrow<kBitsPerSample>(right + i),
+                              narrow<kBitsPerSample>(right + i + 4));
+    vst2q_s16(dst, out);
+    dst += 16;
+  }
+  for (; i < nSamples; ++i) {
+    *dst++ = narrowSample<kBitsPerSample>(left[i]);
+    *dst++ = narrowSample<kBitsPerSample>(right[i]);
+  }
+}
+
+// Handles 3, 4, 6 and 8 channels, four samples at a time.
+template <unsigned kBitsPerSample>
+static void copyMultiChNeon(void *output, const int *const *src,
+                            unsigned nSamples, unsigned nChannels) {
+  int16_t *dst = static_cast<int16_t *>(output);
+  unsigned i = 0;
+  switch (nChannels) {
+    case 3:
+      for (; i + 4 <= nSamples; i += 4) {
+        int16x4x3_t out;
+        out.val[0] = narrow<kBitsPerSample>(src[0] + i);
+        out.val[1] = narrow<kBitsPerSample>(src[1] + i);
+        out.val[2] = narrow<kBitsPerSample>(src[2] + i);
+        vst3_s16(dst, out);
+        dst += 12;
+      }
+      break;
+    case 4:
+      for (; i + 4 <= nSamples; i += 4) {
+        int32x4x2_t out;
+        out.val[0] = narrowPair<kBitsPerSample>(src[0] + i, src[1] + i);
+        out.val[1] = narrowPair<kBitsPerSample>(src[2] + i, src[3] + i);
+        vst2q_s32(reinterpret_cast<int32_t *>(dst), out);
+        dst += 16;
+      }
+      break;
+    case 6:
+      for (; i + 4 <= nSamples; i += 4) {
+        int32x4x3_t out;
+        out.val[0] = narrowPair<kBitsPerSample>(src[0] + i, src[1] + i);
+        out.val[1] = narrowPair<kBitsPerSample>(src[2] + i, src[3] + i);
+        out.val[2] = narrowPair<kBitsPerSample>(src[4] + i, src[5] + i);
+        vst3q_s32(reinterpret_cast<int32_t *>(dst), out);
+        dst += 24;
+      }
+      break;
+    case 8:
+      for (; i + 4 <= nSamples; i += 4) {
+        int32x4x4_t out;
+        out.val[0] = narrowPair<kBitsPerSample>(src[0] + i, src[1] + i);
+        out.val[1] = narrowPair<kBitsPerSample>(src[2] + i, src[3] + i);
+        out.val[2] = narrowPair<kBitsPerSample>(src[4] + i, src[5] + i);
+        out.val[3] = narrowPair<kBitsPerSample>(src[6] + i, src[7] + i);
+        vst4q_s32(reinterpret_cast<int32_t *>(dst), out);
+        dst += 32;
+      }
+      break;
+    default:
+      break;
+  }
+  for (; i < nSamples; ++i) {
+    for (unsigned c = 0; c < nChannels; ++c) {
+      *dst++ = narrowSample<kBitsPerSample>(src[c][i]);
+    }
+  }
+}
+
+template <unsigned kBitsPerSample>
+static FlacCopyFunction getCopyFunction(unsigned channels) {
+  switch (channels) {
+    case 1:
+      return copyMonoNeon<kBitsPerSample>;
+    case 2:
+      return copyStereoNeon<kBitsPerSample>;
+    case 3:
+    case 4:
+    case 6:
+    case 8:
+      return copyMultiChNeon<kBitsPerSample>;
+    default:
+      return NULL;
+  }
+}
+
+FlacCopyFunction getNeonCopyFunction(unsigned channels,
+                                     unsigned bitsPerSample) {
+  switch (bitsPerSample) {
+    case 8:
+      return getCopyFunction<8>(channels);
+    case 16:
+      return getCopyFunction<16>(channels);
+    case 24:
+      return getCopyFunction<24>(channels);
+    default:
+      return NULL;
+  }
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/flac_copy_simd.h"
+
+#include <emmintrin.h>
+
+#include <cstdlib>
+#include <cstring>
+
+// Conversion of a single sample, matching the scalar copy functions.
+template <unsigned kBitsPerSample>
+static inline int16_t narrowSample(int sample);
+
+template <>
+inline int16_t narrowSample<8>(int sample) {
+  return sample << 8;
+}
+
+template <>
+inline int16_t narrowSample<16>(int sample) {
+  return sample;
+}
+
+template <>
+inline int16_t narrowSample<24>(int sample) {
+  return sample >> 8;
+}
+
+// Conversion of eight samples. FLAC guarantees that decoded samples fit in
+// bitsPerSample bits, so the saturating pack never saturates and the results
+// are bit-exact with narrowSample.
+template <unsigned kBitsPerSample>
+static inline __m128i narrow(const int *src);
+
+template <>
+inline __m128i narrow<8>(const int *src) {
+  const __m128i packed = _mm_packs_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4)));
+  return _mm_slli_epi16(packed, 8);
+}
+
+template <>
+inline __m128i narrow<16>(const int *src) {
+  return _mm_packs_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4)));
+}
+
+template <>
+inline __m128i narrow<24>(const int *src) {
+  return _mm_packs_epi32(
+      _mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)),
+                     8),
+      _mm_srai_epi32(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4)), 8));
+}
+
+// Interleaves four samples of two channels. Each 32-bit lane of the result
+// holds one sample of the first channel followed by one of the second.
+template <unsigned kBitsPerSample>
+static inline __m128i narrowPair(const int *first, const int *second) {
+  __m128i firstSamples;
+  __m128i secondSamples;
+  if (kBitsPerSample == 24) {
+    firstSamples = _mm_srai_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(first)), 8);
+    secondSamples = _mm_srai_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(second)), 8);
+  } else {
+    firstSamples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+    secondSamples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(second));
+  }
+  __m128i pair = _mm_unpacklo_epi16(_mm_packs_epi32(firstSamples, firstSamples),
+                                    _mm_packs_epi32(secondSamples,
+                                                    secondSamples));
+  if (kBitsPerSample == 8) {
+    pair = _mm_slli_epi16(pair, 8);
+  }
+  return pair;
+}
+
+template <unsigned kBitsPerSample>
+static void copyMonoSse2(void *output, const int *const *src,
+                         unsigned nSamples, unsigned /* nChannels */) {
+  int16_t *dst = static_cast<int16_t *>(output);
+  const int *const mono = src[0];
+  unsigned i = 0;
+  for (; i + 8 <= nSamples; i += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                     narrow<kBitsPerSample>(mono + i));
+    dst += 8;
+  }
+  for (; i < nSamples; ++i) {
+    *dst++ = narrowSample<kBitsPerSample>(mono[i]);
+  }
+}
+
+template <unsigned kBitsPerSample>
+static void copyStereoSse2(void *output, const int *const *src,
+                           unsigned nSamples, unsigned /* nChannels */) {
+  int16_t *dst = static_cast<int16_t *>(output);
+  const int *const left = src[0];
+  const int *const right = src[1];
+  unsigned i = 0;
+  for (; i + 8 <= nSamples; i += 8) {
+    const __m128i leftSamples = narrow<kBitsPerSample>(left + i);
+    const __m128i rightSamples = narrow<kBitsPerSample>(right + i);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                     _mm_unpacklo_epi16(leftSamples, rightSamples));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8),
+                     _mm_unpackhi_epi16(leftSamples, rightSamples));
+    dst += 16;
+  }
+  for (; i < nSamples; ++i) {
+    *dst++ = narrowSample<kBitsPerSample>(left[i]);
+    *dst++ = narrowSample<kBitsPerSample>(right[i]);
+  }
+}
+
+// Handles 4, 6 and 8 channels, four samples at a time. The channel pairs form
+// the rows of a 4x4 matrix of 32-bit lanes, which is transposed so that each
+// row holds all channels of a single sample.
+template <unsigned kBitsPerSample>
+static void copyMultiChSse2(void *output, const int *const *src,
+                            unsigned nSamples, unsigned nChannels) {
+  int16_t *dst = static_cast<int16_t *>(output);
+  unsigned i = 0;
+  if (nChannels == 4) {
+    for (; i + 4 <= nSamples; i += 4) {
+      const __m128i p01 = narrowPair<kBitsPerSample>(src[0] + i, src[1] + i);
+      const __m128i p23 = narrowPair<kBitsPerSample>(src[2] + i, src[3] + i);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                       _mm_unpacklo_epi32(p01, p23));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8),
+                       _mm_unpackhi_epi32(p01, p23));
+      dst += 16;
+    }
+  } else if (nChannels == 6 || nChannels == 8) {
+    for (; i + 4 <= nSamples; i += 4) {
+      const __m128i p01 = narrowPair<kBitsPerSample>(src[0] + i, src[1] + i);
+      const __m128i p23 = narrowPair<kBitsPerSample>(src[2] + i, src[3] + i);
+      const __m128i p45 = narrowPair<kBitsPerSample>(src[4] + i, src[5] + i);
+      const __m128i p67 = nChannels == 8
+          ? narrowPair<kBitsPerSample>(src[6] + i, src[7] + i)
+          : _mm_setzero_si128();
+      const __m128i t0 = _mm_unpacklo_epi32(p01, p23);
+      const __m128i t1 = _mm_unpacklo_epi32(p45, p67);
+      const __m128i t2 = _mm_unpackhi_epi32(p01, p23);
+      const __m128i t3 = _mm_unpackhi_epi32(p45, p67);
+      __m128i rows[4];
+      rows[0] = _mm_unpacklo_epi64(t0, t1);
+      rows[1] = _mm_unpackhi_epi64(t0, t1);
+      rows[2] = _mm_unpacklo_epi64(t2, t3);
+      rows[3] = _mm_unpackhi_epi64(t2, t3);
+      if (nChannels == 8) {
+        for (int j = 0; j < 4; ++j) {
+          _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), rows[j]);
+          dst += 8;
+        }
+      } else {
+        for (int j = 0; j < 4; ++j) {
+          _mm_storel_epi64(reinterpret_cast<__m128i *>(dst), rows[j]);
+          const int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(rows[j], 8));
+          memcpy(dst + 4, &last, sizeof(last));
+          dst += 6;
+        }
+      }
+    }
+  }
+  for (; i < nSamples; ++i) {
+    for (unsigned c = 0; c < nChannels; ++c) {
+      *dst++ = narrowSample<kBitsPerSample>(src[c][i]);
+    }
+  }
+}
+
+template <unsigned kBitsPerSample>
+static FlacCopyFunction getCopyFunction(unsigned channels) {
+  switch (channels) {
+    case 1:
+      return copyMonoSse2<kBitsPerSample>;
+    case 2:
+      return copyStereoSse2<kBitsPerSample>;
+    case 4:
+    case 6:
+    case 8:
+      return copyMultiChSse2<kBitsPerSample>;
+    default:
+      return NULL;
+  }
+}
+
+FlacCopyFunction getSse2CopyFunction(unsigned channels,
+                                     unsigned bitsPerSample) {
+  switch (bitsPerSample) {
+    case 8:
+      return getCopyFunction<8>(channels);
+    case 16:
+      return getCopyFunction<16>(channels);
+    case 24:
+      return getCopyFunction<24>(channels);
+    default:
+      return NULL;
+  }
+}
@@ -17,10 +17,16 @@
 #include <jni.h>
 
 #include <android/log.h>
+#include <cpu-features.h>
 
+#include <atomic>
 #include <cstdlib>
 
+#include "include/buffered_data_source.h"
+#include "include/decoder_stats.h"
 #include "include/flac_parser.h"
+#include "include/mmap_data_source.h"
+#include "include/parallel_flac_decoder.h"
 
 #define LOG_TAG "FlacJniJNI"
 #define ALOGE(...) \
@@ -38,66 +44,325 @@
       Java_com_google_android_exoplayer_ext_flac_FlacJni_##NAME( \
           JNIEnv *env, jobject thiz, ##__VA_ARGS__)
 
+#define PARALLEL_FUNC(RETURN_TYPE, NAME, ...)                              \
+  extern "C" {                                                             \
+  JNIEXPORT RETURN_TYPE                                                    \
+      Java_com_google_android_exoplayer_ext_flac_ParallelFlacDecoder_##NAME( \
+          JNIEnv *env, jobject thiz, ##__VA_ARGS__);                       \
+  }                                                                        \
+  JNIEXPORT RETURN_TYPE                                                    \
+      Java_com_google_android_exoplayer_ext_flac_ParallelFlacDecoder_##NAME( \
+          JNIEnv *env, jobject thiz, ##__VA_ARGS__)
+
+// JNI references cached in JNI_OnLoad.
+static jmethodID readMethod;
+static jmethodID skipMethod;
+static jmethodID getRemainingLengthMethod;
+static jclass flacStreamInfoClass;
+static jmethodID flacStreamInfoConstructor;
+static jfieldID fileDescriptorDescriptorField;
+
+jint JNI_OnLoad(JavaVM *vm, void *reserved) {
+  JNIEnv *env;
+  if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) != JNI_OK) {
+    return -1;
+  }
+  initTrace();
+  jclass flacJniClass =
+      env->FindClass("com/google/android/exoplayer/ext/flac/FlacJni");
+  if (flacJniClass == NULL) {
+    return -1;
+  }
+  readMethod =
+      env->GetMethodID(flacJniClass, "read", "(Ljava/nio/ByteBuffer;)I");
+  skipMethod = env->GetMethodID(flacJniClass, "skip", "(J)Z");
+  getRemainingLengthMethod =
+      env->GetMethodID(flacJniClass, "getRemainingLength", "()J");
+  env->DeleteLocalRef(flacJniClass);
+
+  jclass cls =
+      env->FindClass("com/google/android/exoplayer/util/FlacStreamInfo");
+  if (cls == NULL) {
+    return -1;
+  }
+  flacStreamInfoClass = reinterpret_cast<jclass>(env->NewGlobalRef(cls));
+  flacStreamInfoConstructor = env->GetMethodID(cls, "<init>", "(IIIIIIIJ)V");
+  env->DeleteLocalRef(cls);
+
+  cls = env->FindClass("java/io/FileDescriptor");
+  if (cls == NULL) {
+    return -1;
+  }
+  fileDescriptorDescriptorField = env->GetFieldID(cls, "descriptor", "I");
+  env->DeleteLocalRef(cls);
+  if (readMethod == NULL || skipMethod == NULL ||
+      getRemainingLengthMethod == NULL || flacStreamInfoConstructor == NULL ||
+      fileDescriptorDescriptorField == NULL) {
+    return -1;
+  }
+  return JNI_VERSION_1_6;
+}
+
+// Indices of the running totals kept for each decoder, which must match the
+// indices in NativeDecoderCounters.
+enum Stat {
+  kStatDecodeCount = 0,
+  kStatDecodeTimeNs = 1,
+  kStatConvertCount = 2,
+  kStatConvertTimeNs = 3,
+  kStatReadCount = 4,
+  kStatReadTimeNs = 5,
+  kStatReadBytes = 6,
+  kStatUpcallCount = 7,
+  kStatUpcallTimeNs = 8,
+  kStatErrorCount = 9,
+};
+
 class JavaDataSource : public DataSource {
  public:
+  explicit JavaDataSource(Stats *stats)
+      : stats(stats),
+        env(NULL),
+        flacJni(NULL),
+        position(0),
+        byteBuffer(NULL),
+        byteBufferData(NULL),
+        byteBufferSize(0) {}
+
   void setFlacJni(JNIEnv *env, jobject flacJni) {
     this->env = env;
     this->flacJni = flacJni;
-    if (mid == NULL) {
-      jclass cls = env->GetObjectClass(flacJni);
-      mid = env->GetMethodID(cls, "read", "(Ljava/nio/ByteBuffer;)I");
-      env->DeleteLocalRef(cls);
-    }
   }
 
+  // Sets the offset corresponding to the current position of the Java source,
+  // for example after it has been repositioned by the application.
+  void setPosition(off64_t position) { this->position = position; }
+
   ssize_t readAt(off64_t offset, void *const data, size_t size) {
-    jobject byteBuffer = env->NewDirectByteBuffer(data, size);
-    int result = env->CallIntMethod(flacJni, mid, byteBuffer);
+    // The Java source is only told how far to skip, since its own positions
+    // need not match the offsets used here.
+    if (offset != position) {
+      const int64_t skipStartNs = nowNs();
+      jboolean skipped =
+          env->CallBooleanMethod(flacJni, skipMethod, offset - position);
+      stats->addCall(kStatUpcallCount, kStatUpcallTimeNs, skipStartNs);
+      if (env->ExceptionOccurred() || !skipped) {
+        return -1;
+      }
+      position = offset;
+    }
+    // Reads nearly always target the same memory, so the direct ByteBuffer
+    // wrapping it is kept and only recreated when the target changes.
+    if (byteBuffer == NULL || data != byteBufferData ||
+        size != byteBufferSize) {
+      releaseByteBuffer(env);
+      jobject localByteBuffer = env->NewDirectByteBuffer(data, size);
+      if (localByteBuffer == NULL) {
+        return -1;
+      }
+      byteBuffer = env->NewGlobalRef(localByteBuffer);
+      env->DeleteLocalRef(localByteBuffer);
+      byteBufferData = data;
+      byteBufferSize = size;
+    }
+    const int64_t readStartNs = nowNs();
+    int result = env->CallIntMethod(flacJni, readMethod, byteBuffer);
+    stats->addCall(kStatReadCount, kStatReadTimeNs, readStartNs);
     if (env->ExceptionOccurred()) {
       result = -1;
     }
-    env->DeleteLocalRef(byteBuffer);
+    if (result > 0) {
+      position += result;
+      stats->add(kStatReadBytes, result);
+    }
     return result;
   }
 
+  off64_t getLength() {
+    const int64_t startNs = nowNs();
+    jlong remaining = env->CallLongMethod(flacJni, getRemainingLengthMethod);
+    stats->addCall(kStatUpcallCount, kStatUpcallTimeNs, startNs);
+    if (env->ExceptionOccurred() || remaining < 0) {
+      return -1;
+    }
+    return position + remaining;
+  }
+
+  void releaseByteBuffer(JNIEnv *env) {
+    if (byteBuffer != NULL) {
+      env->DeleteGlobalRef(byteBuffer);
+      byteBuffer = NULL;
+    }
+  }
+
  private:
+  Stats *const stats;
   JNIEnv *env;
   jobject flacJni;
-  jmethodID mid;
+  off64_t position;
+  jobject byteBuffer;
+  void *byteBufferData;
+  size_t byteBufferSize;
 };
 
+// The size of the read-ahead buffer between libFLAC and the Java data source.
+static const size_t kReadAheadSize = 64 * 1024;
+
 struct Context {
   JavaDataSource *source;
+  BufferedDataSource *bufferedSource;
+  // Replaces the Java source, once a local file has been mapped.
+  MmapDataSource *mappedSource;
   FLACParser *parser;
+  // The maximum size of getMemoryUsage once the metadata has been decoded, or
+  // 0 if there is no limit.
+  int64_t memoryBudget;
+  // The most recent value of getMemoryUsage, which is updated by the decode
+  // calls so that it can be read from another thread.
+  std::atomic<int64_t> memoryUsage;
+  Stats stats;
 };
 
-FUNC(jlong, flacInit) {
+// Returns the native memory held by the decoder. A mapping is backed by the
+// file, and so only the data source that reads from it is counted.
+static size_t getMemoryUsage(const Context *context) {
+  size_t size = sizeof(Context) + sizeof(JavaDataSource) +
+                sizeof(BufferedDataSource) + kReadAheadSize +
+                context->parser->getMemoryUsage();
+  if (context->mappedSource != NULL) {
+    size += sizeof(MmapDataSource);
+  }
+  return size;
+}
+
+// Decodes the next frame into output, or consecutive frames if batch is true,
+// and records the stats of the call. Returns the value returned by the parser.
+static size_t decodeFrames(Context *context, void *output, size_t outputSize,
+                           bool batch, int64_t maxDurationUs) {
+  ScopedTrace trace("flacDecode");
+  Stats *const stats = &context->stats;
+  FLACParser *const parser = context->parser;
+  // Reads, upcalls and the copy into the output buffer are counted separately
+  // from the time spent decoding.
+  const int64_t startNs = nowNs();
+  const int64_t startOtherTimeNs =
+      stats->get(kStatReadTimeNs) + stats->get(kStatUpcallTimeNs);
+  const int64_t startCopyTimeNs = parser->getCopyTimeNs();
+  const size_t size = batch
+      ? parser->readBuffers(output, outputSize, maxDurationUs)
+      : parser->readBuffer(output, outputSize);
+  const int64_t copyTimeNs = parser->getCopyTimeNs() - startCopyTimeNs;
+  const int64_t otherTimeNs = stats->get(kStatReadTimeNs) +
+                              stats->get(kStatUpcallTimeNs) - startOtherTimeNs;
+  if (size == static_cast<size_t>(-1)) {
+    if (!parser->isEndOfStream()) {
+      stats->add(kStatErrorCount, 1);
+    }
+    return size;
+  }
+  const int frameCount = batch ? parser->getLastBatchFrameCount() : 1;
+  stats->add(kStatDecodeCount, frameCount);
+  stats->add(kStatDecodeTimeNs, nowNs() - startNs - otherTimeNs - copyTimeNs);
+  stats->add(kStatConvertCount, frameCount);
+  stats->add(kStatConvertTimeNs, copyTimeNs);
+  // the frame index grows as frames are decoded
+  context->memoryUsage.store(getMemoryUsage(context),
+                             std::memory_order_relaxed);
+  return size;
+}
+
+FUNC(jlong, flacInit, jlong memoryBudget) {
   Context *context = new Context;
-  context->source = new JavaDataSource();
-  context->parser = new FLACParser(context->source);
+  context->memoryBudget = memoryBudget;
+  context->memoryUsage.store(0, std::memory_order_relaxed);
+  context->source = new JavaDataSource(&context->stats);
+  context->bufferedSource =
+      new BufferedDataSource(context->source, kReadAheadSize);
+  context->mappedSource = NULL;
+  context->parser = new FLACParser(context->bufferedSource);
   return reinterpret_cast<intptr_t>(context);
 }
 
-FUNC(jobject, flacDecodeMetadata, jlong jContext) {
+// Maps part of a local file and decodes from the mapping rather than from the
+// Java source. libFLAC reads into its own buffer, so reads are served straight
+// from the mapping rather than through the read-ahead buffer. Must be called
+// before flacDecodeMetadata.
+FUNC(jboolean, flacSetFileDescriptor, jlong jContext, jobject jFileDescriptor,
+     jlong offset, jlong length) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  if (context->mappedSource != NULL) {
+    return false;
+  }
+  int fd = env->GetIntField(jFileDescriptor, fileDescriptorDescriptorField);
+  MmapDataSource *mappedSource = new MmapDataSource();
+  if (!mappedSource->init(fd, offset, length)) {
+    delete mappedSource;
+    return false;
+  }
+  delete context->parser;
+  context->mappedSource = mappedSource;
+  context->parser = new FLACParser(mappedSource);
+  return true;
+}
+
+static jobject createStreamInfo(
+    JNIEnv *env, const FLAC__StreamMetadata_StreamInfo &streamInfo) {
+  return env->NewObject(flacStreamInfoClass, flacStreamInfoConstructor,
+                        streamInfo.min_blocksize, streamInfo.max_blocksize,
+                        streamInfo.min_framesize, streamInfo.max_framesize,
+                        streamInfo.sample_rate, streamInfo.channels,
+                        streamInfo.bits_per_sample, streamInfo.total_samples);
+}
+
+FUNC(jobject, flacDecodeMetadata, jlong jContext, jint outputEncoding) {
   Context *context = reinterpret_cast<Context *>(jContext);
   context->source->setFlacJni(env, thiz);
-  if (!context->parser->init()) {
+  if (!context->parser->init(
+          static_cast<FLACParser::OutputEncoding>(outputEncoding))) {
+    context->stats.add(kStatErrorCount, 1);
     return NULL;
   }
+  // libFLAC's buffers grow with the block size and the number of channels,
+  // which are only known once the metadata has been decoded
+  const size_t memoryUsage = getMemoryUsage(context);
+  if (context->memoryBudget > 0 &&
+      memoryUsage > static_cast<uint64_t>(context->memoryBudget)) {
+    ALOGE("Decoder needs %zu bytes, exceeding its budget of %lld bytes",
+          memoryUsage, static_cast<long long>(context->memoryBudget));
+    context->stats.add(kStatErrorCount, 1);
+    return NULL;
+  }
+  context->memoryUsage.store(memoryUsage, std::memory_order_relaxed);
 
-  const FLAC__StreamMetadata_StreamInfo &streamInfo =
-      context->parser->getStreamInfo();
+  return createStreamInfo(env, context->parser->getStreamInfo());
+}
 
-  jclass cls = env->FindClass(
-      "com/google/android/exoplayer/util/"
-      "FlacStreamInfo");
-  jmethodID constructor = env->GetMethodID(cls, "<init>", "(IIIIIIIJ)V");
+// Converts the decoded samples to sampleRate and channelCount, either of which
+// may be 0 to keep that of the stream. Must be called after
+// flacDecodeMetadata. Returns false if the conversion is not supported, or if
+// it would exceed the memory budget.
+FUNC(jboolean, flacSetOutputFormat, jlong jContext, jint sampleRate,
+     jint channelCount) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  if (!context->parser->setOutputFormat(sampleRate, channelCount)) {
+    context->stats.add(kStatErrorCount, 1);
+    return false;
+  }
+  const size_t memoryUsage = getMemoryUsage(context);
+  if (context->memoryBudget > 0 &&
+      memoryUsage > static_cast<uint64_t>(context->memoryBudget)) {
+    ALOGE("Decoder needs %zu bytes, exceeding its budget of %lld bytes",
+          memoryUsage, static_cast<long long>(context->memoryBudget));
+    context->stats.add(kStatErrorCount, 1);
+    return false;
+  }
+  context->memoryUsage.store(memoryUsage, std::memory_order_relaxed);
+  return true;
+}
 
-  return env->NewObject(cls, constructor, streamInfo.min_blocksize,
-                        streamInfo.max_blocksize, streamInfo.min_framesize,
-                        streamInfo.max_framesize, streamInfo.sample_rate,
-                        streamInfo.channels, streamInfo.bits_per_sample,
-                        streamInfo.total_samples);
+FUNC(jint, flacGetMaxOutputFrameSize, jlong jContext) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  return context->parser->getMaxOutputFrameSize();
 }
 
 FUNC(jint, flacDecodeToBuffer, jlong jContext, jobject jOutputBuffer) {
@@ -105,7 +370,7 @@ FUNC(jint, flacDecodeToBuffer, jlong jContext, jobject jOutputBuffer) {
   context->source->setFlacJni(env, thiz);
   void *outputBuffer = env->GetDirectBufferAddress(jOutputBuffer);
   jint outputSize = env->GetDirectBufferCapacity(jOutputBuffer);
-  return context->parser->readBuffer(outputBuffer, outputSize);
+  return decodeFrames(context, outputBuffer, outputSize, false, 0);
 }
 
 FUNC(jint, flacDecodeToArray, jlong jContext, jbyteArray jOutputArray) {
@@ -113,11 +378,93 @@ FUNC(jint, flacDecodeToArray, jlong jContext, jbyteArray jOutputArray) {
   context->source->setFlacJni(env, thiz);
   jbyte *outputBuffer = env->GetByteArrayElements(jOutputArray, NULL);
   jint outputSize = env->GetArrayLength(jOutputArray);
-  int count = context->parser->readBuffer(outputBuffer, outputSize);
+  int count = decodeFrames(context, outputBuffer, outputSize, false, 0);
+  env->ReleaseByteArrayElements(jOutputArray, outputBuffer, 0);
+  return count;
+}
+
+// Writes the output held by the converter at the end of the stream, and
+// returns its size.
+FUNC(jint, flacDrainToBuffer, jlong jContext, jobject jOutputBuffer) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  void *outputBuffer = env->GetDirectBufferAddress(jOutputBuffer);
+  jint outputSize = env->GetDirectBufferCapacity(jOutputBuffer);
+  return context->parser->drain(outputBuffer, outputSize);
+}
+
+FUNC(jint, flacDrainToArray, jlong jContext, jbyteArray jOutputArray) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  jbyte *outputBuffer = env->GetByteArrayElements(jOutputArray, NULL);
+  jint outputSize = env->GetArrayLength(jOutputArray);
+  int size = context->parser->drain(outputBuffer, outputSize);
+  env->ReleaseByteArrayElements(jOutputArray, outputBuffer, 0);
+  return size;
+}
+
+FUNC(jint, flacGetDrainSize, jlong jContext) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  return context->parser->getDrainSize();
+}
+
+FUNC(jint, flacDecodeFramesToBuffer, jlong jContext, jobject jOutputBuffer,
+     jlong maxDurationUs) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  context->source->setFlacJni(env, thiz);
+  void *outputBuffer = env->GetDirectBufferAddress(jOutputBuffer);
+  jint outputSize = env->GetDirectBufferCapacity(jOutputBuffer);
+  return decodeFrames(context, outputBuffer, outputSize, true, maxDurationUs);
+}
+
+FUNC(jint, flacDecodeFramesToArray, jlong jContext, jbyteArray jOutputArray,
+     jlong maxDurationUs) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  context->source->setFlacJni(env, thiz);
+  jbyte *outputBuffer = env->GetByteArrayElements(jOutputArray, NULL);
+  jint outputSize = env->GetArrayLength(jOutputArray);
+  int count =
+      decodeFrames(context, outputBuffer, outputSize, true, maxDurationUs);
   env->ReleaseByteArrayElements(jOutputArray, outputBuffer, 0);
   return count;
 }
 
+// Decodes the next frame ahead of the next decode call, for example while the
+// previous track is still playing, so that the first call returns it at the
+// cost of a copy. The frame is counted when it is returned.
+FUNC(jboolean, flacPrefetchFrame, jlong jContext) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  context->source->setFlacJni(env, thiz);
+  ScopedTrace trace("flacPrefetch");
+  Stats *const stats = &context->stats;
+  const int64_t startNs = nowNs();
+  const int64_t startOtherTimeNs =
+      stats->get(kStatReadTimeNs) + stats->get(kStatUpcallTimeNs);
+  if (!context->parser->prefetchFrame()) {
+    if (!context->parser->isEndOfStream()) {
+      stats->add(kStatErrorCount, 1);
+    }
+    return false;
+  }
+  const int64_t otherTimeNs = stats->get(kStatReadTimeNs) +
+                              stats->get(kStatUpcallTimeNs) - startOtherTimeNs;
+  stats->add(kStatDecodeTimeNs, nowNs() - startNs - otherTimeNs);
+  return true;
+}
+
+FUNC(jboolean, flacHasPendingFrame, jlong jContext) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  return context->parser->hasPendingFrame();
+}
+
+FUNC(jint, flacGetLastBatchFrameCount, jlong jContext) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  return context->parser->getLastBatchFrameCount();
+}
+
+FUNC(jlong, flacGetLastBatchTimestamp, jlong jContext) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  return context->parser->getLastBatchTimestamp();
+}
+
 FUNC(jlong, flacGetLastTimestamp, jlong jContext) {
   Context *context = reinterpret_cast<Context *>(jContext);
   return context->parser->getLastTimestamp();
@@ -128,14 +475,131 @@ FUNC(jlong, flacGetSeekPosition, jlong jContext, jlong timeUs) {
   return context->parser->getSeekPosition(timeUs);
 }
 
+FUNC(jboolean, flacSeek, jlong jContext, jlong timeUs) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  context->source->setFlacJni(env, thiz);
+  if (!context->parser->seekAbsolute(timeUs)) {
+    context->stats.add(kStatErrorCount, 1);
+    return false;
+  }
+  return true;
+}
+
+FUNC(jint, flacGetBufferedSize, jlong jContext) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  if (context->mappedSource != NULL) {
+    // All of the mapped data is available without reading from Java.
+    return context->mappedSource->getRemainingSize() +
+           context->parser->getDrainSize();
+  }
+  // The output held by the converter for the end of the stream is buffered
+  // too, until it is drained.
+  return context->bufferedSource->getBufferedSize() +
+         context->parser->getDrainSize();
+}
+
+FUNC(void, flacSetMappedPosition, jlong jContext, jlong position) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  // The mapped source reads at the offsets requested by the parser, so
+  // decoding continues from the mapped data at position.
+  context->parser->setStreamPosition(position);
+}
+
 FUNC(void, flacFlush, jlong jContext) {
   Context *context = reinterpret_cast<Context *>(jContext);
   context->parser->flush();
+  if (context->mappedSource != NULL) {
+    // The mapped source is repositioned by flacSetMappedPosition.
+    return;
+  }
+  // Discard any read-ahead data, and continue reading from wherever the Java
+  // source is now positioned.
+  context->bufferedSource->reset();
+  context->source->setPosition(context->bufferedSource->getPosition());
+}
+
+// Writes the running totals of the decoder into jStats, in the order of the
+// indices in NativeDecoderCounters.
+FUNC(void, flacGetStats, jlong jContext, jlongArray jStats) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  jlong stats[kStatCount];
+  for (int i = 0; i < kStatCount; i++) {
+    stats[i] = context->stats.get(i);
+  }
+  env->SetLongArrayRegion(jStats, 0, kStatCount, stats);
+}
+
+FUNC(jlong, flacGetMemoryUsage, jlong jContext) {
+  Context *context = reinterpret_cast<Context *>(jContext);
+  return context->memoryUsage.load(std::memory_order_relaxed);
 }
 
 FUNC(void, flacRelease, jlong jContext) {
   Context *context = reinterpret_cast<Context *>(jContext);
   delete context->parser;
+  delete context->mappedSource;
+  delete context->bufferedSource;
+  context->source->releaseByteBuffer(env);
   delete context->source;
   delete context;
 }
+
+// Creates a decoder that decodes part of a local file on threadCount threads,
+// each reading from its own mapping of the file. Uses a thread for each CPU if
+// threadCount is not positive. Returns 0 if the file cannot be decoded in
+// parallel.
+PARALLEL_FUNC(jlong, flacParallelInit, jobject jFileDescriptor, jlong offset,
+              jlong length, jint threadCount, jint outputEncoding) {
+  if (threadCount <= 0) {
+    threadCount = android_getCpuCount();
+  }
+  int fd = env->GetIntField(jFileDescriptor, fileDescriptorDescriptorField);
+  std::vector<DataSource *> sources;
+  for (int i = 0; i < threadCount; i++) {
+    MmapDataSource *source = new MmapDataSource();
+    if (!source->init(fd, offset, length)) {
+      delete source;
+      break;
+    }
+    sources.push_back(source);
+  }
+  if (sources.empty()) {
+    return 0;
+  }
+  ParallelFlacDecoder *decoder = new ParallelFlacDecoder(sources);
+  if (!decoder->init(static_cast<FLACParser::OutputEncoding>(outputEncoding))) {
+    delete decoder;
+    return 0;
+  }
+  return reinterpret_cast<intptr_t>(decoder);
+}
+
+PARALLEL_FUNC(jobject, flacParallelGetStreamInfo, jlong jDecoder) {
+  ParallelFlacDecoder *decoder =
+      reinterpret_cast<ParallelFlacDecoder *>(jDecoder);
+  return createStreamInfo(env, decoder->getStreamInfo());
+}
+
+PARALLEL_FUNC(jint, flacParallelReadToBuffer, jlong jDecoder,
+              jobject jOutputBuffer) {
+  ParallelFlacDecoder *decoder =
+      reinterpret_cast<ParallelFlacDecoder *>(jDecoder);
+  void *outputBuffer = env->GetDirectBufferAddress(jOutputBuffer);
+  jint outputSize = env->GetDirectBufferCapacity(jOutputBuffer);
+  return decoder->read(outputBuffer, outputSize);
+}
+
+PARALLEL_FUNC(jint, flacParallelReadToArray, jlong jDecoder,
+              jbyteArray jOutputArray) {
+  ParallelFlacDecoder *decoder =
+      reinterpret_cast<ParallelFlacDecoder *>(jDecoder);
+  jbyte *outputBuffer = env->GetByteArrayElements(jOutputArray, NULL);
+  jint outputSize = env->GetArrayLength(jOutputArray);
+  int count = decoder->read(outputBuffer, outputSize);
+  env->ReleaseByteArrayElements(jOutputArray, outputBuffer, 0);
+  return count;
+}
+
+PARALLEL_FUNC(void, flacParallelRelease, jlong jDecoder) {
+  delete reinterpret_cast<ParallelFlacDecoder *>(jDecoder);
+}
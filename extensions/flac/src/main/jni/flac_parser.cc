@@ -19,9 +19,14 @@
 #include <jni.h>
 
 #include <android/log.h>
+#include <cpu-features.h>
 
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "include/flac_copy_simd.h"
 
 #define LOG_TAG "FLACParser"
 #define ALOGE(...) \
@@ -135,7 +140,12 @@ FLAC__StreamDecoderTellStatus FLACParser::tellCallback(
 
 FLAC__StreamDecoderLengthStatus FLACParser::lengthCallback(
     FLAC__uint64 *stream_length) {
-  return FLAC__STREAM_DECODER_LENGTH_STATUS_UNSUPPORTED;
+  off64_t length = mDataSource->getLength();
+  if (length < 0) {
+    return FLAC__STREAM_DECODER_LENGTH_STATUS_UNSUPPORTED;
+  }
+  *stream_length = length;
+  return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
 }
 
 FLAC__bool FLACParser::eofCallback() { return mEOF; }
@@ -144,9 +154,13 @@ FLAC__StreamDecoderWriteStatus FLACParser::writeCallback(
     const FLAC__Frame *frame, const FLAC__int32 *const buffer[]) {
   if (mWriteRequested) {
     mWriteRequested = false;
-    // FLAC parser doesn't free or realloc buffer until next frame or finish
+    // FLAC parser doesn't free or realloc the samples until next frame or
+    // finish, but the array of channel pointers may not outlive this call
     mWriteHeader = frame->header;
-    mWriteBuffer = buffer;
+    for (unsigned c = 0; c < frame->header.channels; ++c) {
+      mWriteChannels[c] = buffer[c];
+    }
+    mWriteBuffer = mWriteChannels;
     mWriteCompleted = true;
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
   } else {
@@ -180,25 +194,28 @@ void FLACParser::errorCallback(FLAC__StreamDecoderErrorStatus status) {
 }
 
 // Copy samples from FLAC native 32-bit non-interleaved to 16-bit interleaved.
-// These are candidates for optimization if needed.
+// Vectorized versions of these are in flac_copy_neon.cc and flac_copy_sse2.cc.
 
-static void copyMono8(int16_t *dst, const int *const *src, unsigned nSamples,
+static void copyMono8(void *output, const int *const *src, unsigned nSamples,
                       unsigned /* nChannels */) {
+  int16_t *dst = static_cast<int16_t *>(output);
   for (unsigned i = 0; i < nSamples; ++i) {
     *dst++ = src[0][i] << 8;
   }
 }
 
-static void copyStereo8(int16_t *dst, const int *const *src, unsigned nSamples,
+static void copyStereo8(void *output, const int *const *src, unsigned nSamples,
                         unsigned /* nChannels */) {
+  int16_t *dst = static_cast<int16_t *>(output);
   for (unsigned i = 0; i < nSamples; ++i) {
     *dst++ = src[0][i] << 8;
     *dst++ = src[1][i] << 8;
   }
 }
 
-static void copyMultiCh8(int16_t *dst, const int *const *src, unsigned nSamples,
+static void copyMultiCh8(void *output, const int *const *src, unsigned nSamples,
                          unsigned nChannels) {
+  int16_t *dst = static_cast<int16_t *>(output);
   for (unsigned i = 0; i < nSamples; ++i) {
     for (unsigned c = 0; c < nChannels; ++c) {
       *dst++ = src[c][i] << 8;
@@ -206,23 +223,26 @@ static void copyMultiCh8(int16_t *dst, const int *const *src, unsigned nSamples,
   }
 }
 
-static void copyMono16(int16_t *dst, const int *const *src, unsigned nSamples,
+static void copyMono16(void *output, const int *const *src, unsigned nSamples,
                        unsigned /* nChannels */) {
+  int16_t *dst = static_cast<int16_t *>(output);
   for (unsigned i = 0; i < nSamples; ++i) {
     *dst++ = src[0][i];
   }
 }
 
-static void copyStereo16(int16_t *dst, const int *const *src, unsigned nSamples,
+static void copyStereo16(void *output, const int *const *src, unsigned nSamples,
                          unsigned /* nChannels */) {
+  int16_t *dst = static_cast<int16_t *>(output);
   for (unsigned i = 0; i < nSamples; ++i) {
     *dst++ = src[0][i];
     *dst++ = src[1][i];
   }
 }
 
-static void copyMultiCh16(int16_t *dst, const int *const *src,
+static void copyMultiCh16(void *output, const int *const *src,
                           unsigned nSamples, unsigned nChannels) {
+  int16_t *dst = static_cast<int16_t *>(output);
   for (unsigned i = 0; i < nSamples; ++i) {
     for (unsigned c = 0; c < nChannels; ++c) {
       *dst++ = src[c][i];
@@ -232,23 +252,26 @@ static void copyMultiCh16(int16_t *dst, const int *const *src,
 
 // 24-bit versions should do dithering or noise-shaping, here or in AudioFlinger
 
-static void copyMono24(int16_t *dst, const int *const *src, unsigned nSamples,
+static void copyMono24(void *output, const int *const *src, unsigned nSamples,
                        unsigned /* nChannels */) {
+  int16_t *dst = static_cast<int16_t *>(output);
   for (unsigned i = 0; i < nSamples; ++i) {
     *dst++ = src[0][i] >> 8;
   }
 }
 
-static void copyStereo24(int16_t *dst, const int *const *src, unsigned nSamples,
+static void copyStereo24(void *output, const int *const *src, unsigned nSamples,
                          unsigned /* nChannels */) {
+  int16_t *dst = static_cast<int16_t *>(output);
   for (unsigned i = 0; i < nSamples; ++i) {
     *dst++ = src[0][i] >> 8;
     *dst++ = src[1][i] >> 8;
   }
 }
 
-static void copyMultiCh24(int16_t *dst, const int *const *src,
+static void copyMultiCh24(void *output, const int *const *src,
                           unsigned nSamples, unsigned nChannels) {
+  int16_t *dst = static_cast<int16_t *>(output);
   for (unsigned i = 0; i < nSamples; ++i) {
     for (unsigned c = 0; c < nChannels; ++c) {
       *dst++ = src[c][i] >> 8;
@@ -256,29 +279,101 @@ static void copyMultiCh24(int16_t *dst, const int *const *src,
   }
 }
 
-static void copyTrespass(int16_t * /* dst */, const int *const * /* src */,
+// Copy samples from FLAC native 32-bit non-interleaved to wider interleaved
+// encodings. The samples are scaled to use the full range of the output.
+
+template <unsigned kBitsPerSample>
+static void copyToPcm24(void *output, const int *const *src, unsigned nSamples,
+                        unsigned nChannels) {
+  uint8_t *dst = static_cast<uint8_t *>(output);
+  for (unsigned i = 0; i < nSamples; ++i) {
+    for (unsigned c = 0; c < nChannels; ++c) {
+      const int sample = src[c][i] << (24 - kBitsPerSample);
+      *dst++ = sample;
+      *dst++ = sample >> 8;
+      *dst++ = sample >> 16;
+    }
+  }
+}
+
+template <unsigned kBitsPerSample>
+static void copyToPcm32(void *output, const int *const *src, unsigned nSamples,
+                        unsigned nChannels) {
+  int32_t *dst = static_cast<int32_t *>(output);
+  for (unsigned i = 0; i < nSamples; ++i) {
+    for (unsigned c = 0; c < nChannels; ++c) {
+      *dst++ = src[c][i] << (32 - kBitsPerSample);
+    }
+  }
+}
+
+template <unsigned kBitsPerSample>
+static void copyToPcmFloat(void *output, const int *const *src,
+                           unsigned nSamples, unsigned nChannels) {
+  static const float kScale = 1.0f / (1 << (kBitsPerSample - 1));
+  float *dst = static_cast<float *>(output);
+  for (unsigned i = 0; i < nSamples; ++i) {
+    for (unsigned c = 0; c < nChannels; ++c) {
+      *dst++ = src[c][i] * kScale;
+    }
+  }
+}
+
+static void copyTrespass(void * /* output */, const int *const * /* src */,
                          unsigned /* nSamples */, unsigned /* nChannels */) {
   TRESPASS();
 }
 
+// Downmix coefficients (left, right) for each input channel, for the channel
+// order of FLAC, which is that of WAVE. The LFE channel is dropped. Rows are
+// normalized in setOutputFormat so that the output cannot clip.
+static const float kDownmixCoefficients[9][8][2] = {
+    {}, {}, {},
+    // L, R, C
+    {{1, 0}, {0, 1}, {0.7071f, 0.7071f}},
+    // FL, FR, BL, BR
+    {{1, 0}, {0, 1}, {0.7071f, 0}, {0, 0.7071f}},
+    // FL, FR, FC, BL, BR
+    {{1, 0}, {0, 1}, {0.7071f, 0.7071f}, {0.7071f, 0}, {0, 0.7071f}},
+    // FL, FR, FC, LFE, BL, BR
+    {{1, 0}, {0, 1}, {0.7071f, 0.7071f}, {0, 0}, {0.7071f, 0}, {0, 0.7071f}},
+    // FL, FR, FC, LFE, BC, SL, SR
+    {{1, 0}, {0, 1}, {0.7071f, 0.7071f}, {0, 0}, {0.5f, 0.5f}, {0.7071f, 0},
+     {0, 0.7071f}},
+    // FL, FR, FC, LFE, BL, BR, SL, SR
+    {{1, 0}, {0, 1}, {0.7071f, 0.7071f}, {0, 0}, {0.7071f, 0}, {0, 0.7071f},
+     {0.7071f, 0}, {0, 0.7071f}},
+};
+
 // FLACParser
 
 FLACParser::FLACParser(DataSource *source)
     : mDataSource(source),
       mCopy(copyTrespass),
+      mOutputEncoding(kOutputEncodingPcm16Bit),
+      mOutputBytesPerSample(sizeof(int16_t)),
+      mConverter(NULL),
       mDecoder(NULL),
       mSeekTable(NULL),
       firstFrameOffset(0LL),
+      mStreamLength(-1),
       mCurrentPos(0LL),
       mEOF(false),
       mStreamInfoValid(false),
       mWriteRequested(false),
       mWriteCompleted(false),
       mWriteBuffer(NULL),
+      mBatchFrameCount(0),
+      mBatchTimestamp(0),
+      mBatchErrorPending(false),
+      mCopyTimeNs(0),
+      mIndexing(true),
+      mSeekFramePending(false),
       mErrorStatus((FLAC__StreamDecoderErrorStatus)-1) {
   ALOGV("FLACParser::FLACParser");
   memset(&mStreamInfo, 0, sizeof(mStreamInfo));
   memset(&mWriteHeader, 0, sizeof(mWriteHeader));
+  memset(mWriteChannels, 0, sizeof(mWriteChannels));
 }
 
 FLACParser::~FLACParser() {
@@ -287,9 +382,10 @@ FLACParser::~FLACParser() {
     FLAC__stream_decoder_delete(mDecoder);
     mDecoder = NULL;
   }
+  delete mConverter;
 }
 
-bool FLACParser::init() {
+bool FLACParser::init(OutputEncoding outputEncoding) {
   // setup libFLAC parser
   mDecoder = FLAC__stream_decoder_new();
   if (mDecoder == NULL) {
@@ -323,6 +419,11 @@ bool FLACParser::init() {
   }
   // store first frame offset
   FLAC__stream_decoder_get_decode_position(mDecoder, &firstFrameOffset);
+  IndexPoint firstFrame = {0, firstFrameOffset};
+  mIndex.push_back(firstFrame);
+  // cached, since getSeekPosition may be called on a thread from which the
+  // data source cannot be read
+  mStreamLength = mDataSource->getLength();
 
   if (mStreamInfoValid) {
     // check channel count
@@ -340,29 +441,62 @@ bool FLACParser::init() {
         ALOGE("unsupported bits per sample %u", getBitsPerSample());
         return false;
     }
-    // check sample rate
-    switch (getSampleRate()) {
-      case 8000:
-      case 11025:
-      case 12000:
-      case 16000:
-      case 22050:
-      case 24000:
-      case 32000:
-      case 44100:
-      case 48000:
-      case 88200:
-      case 96000:
+    // check sample rate, which may be any rate that STREAMINFO can hold since
+    // the output can be resampled by setOutputFormat
+    if (getSampleRate() == 0) {
+      ALOGE("unsupported sample rate %u", getSampleRate());
+      return false;
+    }
+    // check output encoding
+    switch (outputEncoding) {
+      case kOutputEncodingPcm16Bit:
+        mOutputBytesPerSample = sizeof(int16_t);
+        break;
+      case kOutputEncodingPcm24Bit:
+        mOutputBytesPerSample = 3;
+        break;
+      case kOutputEncodingPcm32Bit:
+        mOutputBytesPerSample = sizeof(int32_t);
+        break;
+      case kOutputEncodingPcmFloat:
+        mOutputBytesPerSample = sizeof(float);
         break;
       default:
-        ALOGE("unsupported sample rate %u", getSampleRate());
+        ALOGE("unsupported output encoding %d", outputEncoding);
         return false;
     }
+    mOutputEncoding = outputEncoding;
+    if (mOutputEncoding != kOutputEncodingPcm16Bit) {
+      static const struct {
+        OutputEncoding mOutputEncoding;
+        unsigned mBitsPerSample;
+        void (*mCopy)(void *dst, const int *const *src, unsigned nSamples,
+                      unsigned nChannels);
+      } table[] = {
+          {kOutputEncodingPcm24Bit, 8, copyToPcm24<8>},
+          {kOutputEncodingPcm24Bit, 16, copyToPcm24<16>},
+          {kOutputEncodingPcm24Bit, 24, copyToPcm24<24>},
+          {kOutputEncodingPcm32Bit, 8, copyToPcm32<8>},
+          {kOutputEncodingPcm32Bit, 16, copyToPcm32<16>},
+          {kOutputEncodingPcm32Bit, 24, copyToPcm32<24>},
+          {kOutputEncodingPcmFloat, 8, copyToPcmFloat<8>},
+          {kOutputEncodingPcmFloat, 16, copyToPcmFloat<16>},
+          {kOutputEncodingPcmFloat, 24, copyToPcmFloat<24>},
+      };
+      for (unsigned i = 0; i < sizeof(table) / sizeof(table[0]); ++i) {
+        if (table[i].mOutputEncoding == mOutputEncoding &&
+            table[i].mBitsPerSample == getBitsPerSample()) {
+          mCopy = table[i].mCopy;
+          break;
+        }
+      }
+      return true;
+    }
     // configure the appropriate copy function, defaulting to trespass
     static const struct {
       unsigned mChannels;
       unsigned mBitsPerSample;
-      void (*mCopy)(int16_t *dst, const int *const *src, unsigned nSamples,
+      void (*mCopy)(void *dst, const int *const *src, unsigned nSamples,
                     unsigned nChannels);
     } table[] = {
         {1, 8, copyMono8},   {2, 8, copyStereo8},   {8, 8, copyMultiCh8},
@@ -376,6 +510,24 @@ bool FLACParser::init() {
         break;
       }
     }
+    // prefer a vectorized copy function if the CPU supports one
+    FlacCopyFunction simdCopy = NULL;
+#if defined(__ARM_ARCH_7A__)
+    if (android_getCpuFamily() == ANDROID_CPU_FAMILY_ARM &&
+        (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON) != 0) {
+      simdCopy = getNeonCopyFunction(getChannels(), getBitsPerSample());
+    }
+#elif defined(__aarch64__)
+    simdCopy = getNeonCopyFunction(getChannels(), getBitsPerSample());
+#elif defined(__i386__) || defined(__x86_64__)
+    if (android_getCpuFamily() == ANDROID_CPU_FAMILY_X86 ||
+        android_getCpuFamily() == ANDROID_CPU_FAMILY_X86_64) {
+      simdCopy = getSse2CopyFunction(getChannels(), getBitsPerSample());
+    }
+#endif
+    if (simdCopy != NULL) {
+      mCopy = simdCopy;
+    }
   } else {
     ALOGE("missing STREAMINFO");
     return false;
@@ -383,14 +535,83 @@ bool FLACParser::init() {
   return true;
 }
 
+bool FLACParser::setOutputFormat(unsigned sampleRate, unsigned channels) {
+  if (sampleRate == 0) {
+    sampleRate = getSampleRate();
+  }
+  if (channels == 0) {
+    channels = getChannels();
+  }
+  delete mConverter;
+  mConverter = NULL;
+  if (sampleRate == getSampleRate() && channels == getChannels()) {
+    return true;
+  }
+
+  float mix[2 * 8];
+  const float *mixMatrix = NULL;
+  if ((channels == 1 || channels == 2) && getChannels() > 2) {
+    const float(*coefficients)[2] = kDownmixCoefficients[getChannels()];
+    float leftSum = 0;
+    float rightSum = 0;
+    for (unsigned c = 0; c < getChannels(); c++) {
+      leftSum += coefficients[c][0];
+      rightSum += coefficients[c][1];
+    }
+    for (unsigned c = 0; c < getChannels(); c++) {
+      mix[c] = coefficients[c][0] / leftSum;
+      mix[getChannels() + c] = coefficients[c][1] / rightSum;
+      if (channels == 1) {
+        mix[c] = (mix[c] + mix[getChannels() + c]) / 2;
+      }
+    }
+    mixMatrix = mix;
+  }
+  // the output encodings have the values of the converter's sample formats
+  PcmConverter *converter = new PcmConverter();
+  if (!converter->init(getSampleRate(), getChannels(), sampleRate, channels,
+                       mixMatrix,
+                       static_cast<PcmConverter::SampleFormat>(
+                           mOutputEncoding))) {
+    ALOGE("unsupported output format %u Hz, %u channels", sampleRate,
+          channels);
+    delete converter;
+    return false;
+  }
+  mConverter = converter;
+  return true;
+}
+
+size_t FLACParser::getMaxOutputFrameSize() const {
+  if (mConverter != NULL) {
+    return mConverter->getMaxOutputFrameCount(getMaxBlockSize()) *
+           mConverter->getOutputBytesPerFrame();
+  }
+  return getMaxBlockSize() * getChannels() * mOutputBytesPerSample;
+}
+
 size_t FLACParser::readBuffer(void *output, size_t output_size) {
-  mWriteRequested = true;
-  mWriteCompleted = false;
+  // the frame starts at the current decode position, which is recorded in the
+  // index once the frame is known to be valid
+  FLAC__uint64 frameOffset = 0;
+  bool indexFrame = false;
+
+  if (mSeekFramePending) {
+    // the frame was written by libFLAC during seekAbsolute or prefetchFrame
+    mSeekFramePending = false;
+  } else {
+    indexFrame = mIndexing &&
+                 FLAC__stream_decoder_get_decode_position(mDecoder,
+                                                          &frameOffset);
 
-  if (!FLAC__stream_decoder_process_single(mDecoder)) {
-    ALOGE("FLACParser::readBuffer process_single failed. Status: %s",
+    mWriteRequested = true;
+    mWriteCompleted = false;
+
+    if (!FLAC__stream_decoder_process_single(mDecoder)) {
+      ALOGE("FLACParser::readBuffer process_single failed. Status: %s",
             FLAC__stream_decoder_get_resolved_state_string(mDecoder));
-    return -1;
+      return -1;
+    }
   }
   if (!mWriteCompleted) {
     if (FLAC__stream_decoder_get_state(mDecoder) !=
@@ -419,7 +640,11 @@ size_t FLACParser::readBuffer(void *output, size_t output_size) {
     return -1;
   }
 
-  size_t bufferSize = blocksize * getChannels() * sizeof(int16_t);
+  size_t bufferSize =
+      mConverter != NULL
+          ? mConverter->getOutputFrameCount(blocksize) *
+                mConverter->getOutputBytesPerFrame()
+          : blocksize * getChannels() * mOutputBytesPerSample;
   if (bufferSize > output_size) {
     ALOGE(
         "FLACParser::readBuffer not enough space in output buffer "
@@ -429,30 +654,232 @@ size_t FLACParser::readBuffer(void *output, size_t output_size) {
   }
 
   // copy PCM from FLAC write buffer to our media buffer, with interleaving.
-  (*mCopy)(reinterpret_cast<int16_t *>(output), mWriteBuffer, blocksize,
-           getChannels());
+  struct timespec copyStart;
+  struct timespec copyEnd;
+  clock_gettime(CLOCK_MONOTONIC, &copyStart);
+  if (mConverter != NULL) {
+    mConverter->convert(mWriteBuffer, getBitsPerSample(), blocksize, output);
+  } else {
+    (*mCopy)(output, mWriteBuffer, blocksize, getChannels());
+  }
+  clock_gettime(CLOCK_MONOTONIC, &copyEnd);
+  mCopyTimeNs += (copyEnd.tv_sec - copyStart.tv_sec) * 1000000000LL +
+                 (copyEnd.tv_nsec - copyStart.tv_nsec);
 
   // fill in buffer metadata
   CHECK(mWriteHeader.number_type == FLAC__FRAME_NUMBER_TYPE_SAMPLE_NUMBER);
 
+  FLAC__uint64 sampleNumber = mWriteHeader.number.sample_number;
+  if (indexFrame &&
+      sampleNumber >= mIndex.back().sampleNumber +
+                          kIndexIntervalSeconds * getSampleRate()) {
+    IndexPoint point = {sampleNumber, frameOffset};
+    mIndex.push_back(point);
+  }
+
   return bufferSize;
 }
 
-int64_t FLACParser::getSeekPosition(int64_t timeUs) {
-  if (!mSeekTable) {
+size_t FLACParser::readBuffers(void *output, size_t output_size,
+                               int64_t maxDurationUs) {
+  const size_t maxFrameSize = getMaxOutputFrameSize();
+  uint8_t *const dst = reinterpret_cast<uint8_t *>(output);
+  size_t totalSize = 0;
+  FLAC__uint64 totalSamples = 0;
+  mBatchFrameCount = 0;
+  if (mBatchErrorPending) {
+    mBatchErrorPending = false;
     return -1;
   }
+  while (output_size - totalSize >= maxFrameSize) {
+    size_t size = readBuffer(dst + totalSize, output_size - totalSize);
+    if (size == static_cast<size_t>(-1)) {
+      // Return what has been decoded so far. libFLAC may already have moved
+      // past a bad frame, so an error other than the end of the stream is
+      // kept and returned by the next call.
+      mBatchErrorPending = mBatchFrameCount > 0 && !isEndOfStream();
+      if (isEndOfStream() && getDrainSize() > 0) {
+        // if the end of the last frame does not fit, the next call writes it
+        size = drain(dst + totalSize, output_size - totalSize);
+        if (size != static_cast<size_t>(-1)) {
+          if (mBatchFrameCount == 0) {
+            mBatchTimestamp = (1000000LL * (mWriteHeader.number.sample_number +
+                                            mWriteHeader.blocksize)) /
+                              getSampleRate();
+          }
+          totalSize += size;
+        }
+      }
+      break;
+    }
+    if (mBatchFrameCount == 0) {
+      mBatchTimestamp = getLastTimestamp();
+    }
+    mBatchFrameCount++;
+    totalSize += size;
+    totalSamples += mWriteHeader.blocksize;
+    if ((1000000LL * totalSamples) / getSampleRate() >=
+        static_cast<FLAC__uint64>(maxDurationUs)) {
+      break;
+    }
+  }
+  return mBatchFrameCount == 0 && totalSize == 0 ? -1 : totalSize;
+}
+
+size_t FLACParser::drain(void *output, size_t output_size) {
+  const size_t size = getDrainSize();
+  if (size > output_size) {
+    ALOGE("FLACParser::drain not enough space in output buffer %zu < %zu",
+          output_size, size);
+    return -1;
+  }
+  if (size > 0) {
+    mConverter->drain(output);
+  }
+  return size;
+}
+
+bool FLACParser::prefetchFrame() {
+  if (mSeekFramePending) {
+    return true;
+  }
+  mWriteRequested = true;
+  mWriteCompleted = false;
+  if (!FLAC__stream_decoder_process_single(mDecoder)) {
+    ALOGE("FLACParser::prefetchFrame process_single failed. Status: %s",
+          FLAC__stream_decoder_get_resolved_state_string(mDecoder));
+    mWriteRequested = false;
+    return false;
+  }
+  mWriteRequested = false;
+  // like a seek frame, the prefetched frame is not indexed, which is fine
+  // because it is either the first frame or follows a seek
+  mSeekFramePending = mWriteCompleted;
+  return mWriteCompleted;
+}
+
+bool FLACParser::seekAbsolute(int64_t timeUs) {
+  FLAC__uint64 sample =
+      timeUs <= 0 ? 0 : (timeUs * getSampleRate()) / 1000000LL;
+  return seekToSample(sample);
+}
+
+bool FLACParser::seekToSample(FLAC__uint64 sample) {
+  if (getTotalSamples() > 0 && sample >= getTotalSamples()) {
+    sample = getTotalSamples() - 1;
+  }
 
-  int64_t sample = (timeUs * getSampleRate()) / 1000000LL;
-  if (sample >= getTotalSamples()) {
-      sample = getTotalSamples();
+  // libFLAC writes the frame containing the target sample, trimmed so that it
+  // starts at the target sample, before the seek returns
+  mSeekFramePending = false;
+  mBatchErrorPending = false;
+  if (mConverter != NULL) {
+    mConverter->reset();
   }
+  mWriteRequested = true;
+  mWriteCompleted = false;
+  if (!FLAC__stream_decoder_seek_absolute(mDecoder, sample)) {
+    ALOGE("FLACParser::seekToSample seek_absolute failed. Status: %s",
+          FLAC__stream_decoder_get_resolved_state_string(mDecoder));
+    mWriteRequested = false;
+    if (FLAC__stream_decoder_get_state(mDecoder) ==
+        FLAC__STREAM_DECODER_SEEK_ERROR) {
+      FLAC__stream_decoder_flush(mDecoder);
+    }
+    return false;
+  }
+  mWriteRequested = false;
+  mSeekFramePending = mWriteCompleted;
+  return true;
+}
+
+size_t FLACParser::getMemoryUsage() const {
+  // libFLAC's fixed state, which is dominated by the 8KB buffer of its bit
+  // reader
+  static const size_t kDecoderStateSize = 16 * 1024;
+  size_t size = sizeof(*this) + mIndex.capacity() * sizeof(IndexPoint);
+  if (mDecoder != NULL) {
+    size += kDecoderStateSize;
+  }
+  if (mStreamInfoValid) {
+    // the decoded samples and residuals of each channel, and its rice
+    // parameters, of which there are at most two per sample
+    size += getChannels() * (getMaxBlockSize() + 4) * 4 * sizeof(FLAC__int32);
+  }
+  if (mConverter != NULL) {
+    size += mConverter->getMemoryUsage();
+  }
+  return size;
+}
 
-  FLAC__StreamMetadata_SeekPoint* points = mSeekTable->points;
-  for (unsigned i = mSeekTable->num_points - 1; i >= 0; i--) {
-    if (points[i].sample_number <= sample) {
-      return firstFrameOffset + points[i].stream_offset;
+int64_t FLACParser::getSeekPosition(int64_t timeUs) {
+  FLAC__uint64 sample =
+      timeUs <= 0 ? 0 : (timeUs * getSampleRate()) / 1000000LL;
+  if (getTotalSamples() > 0 && sample >= getTotalSamples()) {
+    sample = getTotalSamples();
+  }
+
+  // the closest known frame at or before the target sample
+  FLAC__uint64 bestSample = 0;
+  FLAC__uint64 bestOffset = firstFrameOffset;
+
+  if (mSeekTable != NULL) {
+    // seek points are sorted by sample number, with any placeholder points
+    // (which have the largest possible sample number) at the end
+    const FLAC__StreamMetadata_SeekPoint *points = mSeekTable->points;
+    unsigned low = 0;
+    unsigned high = mSeekTable->num_points;
+    while (low < high) {
+      unsigned mid = low + (high - low) / 2;
+      if (points[mid].sample_number <= sample) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    if (low > 0) {
+      bestSample = points[low - 1].sample_number;
+      bestOffset = firstFrameOffset + points[low - 1].stream_offset;
+    }
+  }
+
+  size_t low = 0;
+  size_t high = mIndex.size();
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (mIndex[mid].sampleNumber <= sample) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low > 0 && mIndex[low - 1].sampleNumber >= bestSample) {
+    bestSample = mIndex[low - 1].sampleNumber;
+    bestOffset = mIndex[low - 1].streamOffset;
+  }
+
+  // without a SEEKTABLE, estimate positions beyond the decoded frames by
+  // interpolating between the last indexed frame and the end of the stream,
+  // or failing that from the average size of the decoded frames
+  const IndexPoint &last = mIndex.back();
+  if (mSeekTable == NULL && low == mIndex.size() &&
+      sample > last.sampleNumber) {
+    double bytesPerSample = -1;
+    if (getTotalSamples() > last.sampleNumber &&
+        mStreamLength > static_cast<off64_t>(last.streamOffset)) {
+      bytesPerSample =
+          static_cast<double>(mStreamLength - last.streamOffset) /
+          (getTotalSamples() - last.sampleNumber);
+    } else if (last.sampleNumber > 0) {
+      bytesPerSample =
+          static_cast<double>(last.streamOffset - firstFrameOffset) /
+          last.sampleNumber;
+    }
+    if (bytesPerSample >= 0) {
+      FLAC__uint64 extraBytes = static_cast<FLAC__uint64>(
+          (sample - last.sampleNumber) * bytesPerSample);
+      bestOffset = last.streamOffset + extraBytes;
     }
   }
-  return firstFrameOffset;
+  return bestOffset;
 }
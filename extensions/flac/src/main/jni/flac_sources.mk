@@ -15,8 +15,12 @@
 #
 
 FLAC_SOURCES = \
+  buffered_data_source.cc                        \
   flac_jni.cc                                    \
   flac_parser.cc                                 \
+  mmap_data_source.cc                            \
+  parallel_flac_decoder.cc                       \
+  pcm_converter.cc                               \
   flac/src/libFLAC/bitmath.c                     \
   flac/src/libFLAC/bitreader.c                   \
   flac/src/libFLAC/bitwriter.c                   \
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_BUFFERED_DATA_SOURCE_H_
+#define INCLUDE_BUFFERED_DATA_SOURCE_H_
+
+#include <stdint.h>
+
+#include "include/data_source.h"
+
+// A DataSource that reads ahead from another DataSource in large chunks, so
+// that the many small reads made by libFLAC are served from memory rather than
+// each reaching the underlying source.
+//
+// A read at an offset other than the one following the previous read (i.e.
+// after a seek) discards the buffered data and is forwarded to the underlying
+// source at the requested offset.
+class BufferedDataSource : public DataSource {
+ public:
+  BufferedDataSource(DataSource *source, size_t capacity);
+  ~BufferedDataSource();
+
+  ssize_t readAt(off64_t offset, void *const data, size_t size);
+
+  off64_t getLength() { return mSource->getLength(); }
+
+  // Discards the buffered data, for example because the underlying source is
+  // now positioned elsewhere in the stream.
+  void reset() {
+    mStart = 0;
+    mEnd = 0;
+  }
+
+  // Returns the number of bytes that have been read from the underlying
+  // source, but not yet returned by readAt.
+  size_t getBufferedSize() const { return mEnd - mStart; }
+
+  // Returns the offset of the next byte that will be returned by readAt, if
+  // it is called without seeking.
+  off64_t getPosition() const { return mPosition; }
+
+ private:
+  DataSource *mSource;
+  uint8_t *mData;
+  size_t mCapacity;
+
+  // the buffered data is mData[mStart, mEnd)
+  size_t mStart;
+  size_t mEnd;
+
+  // offset in the stream of mData[mStart]
+  off64_t mPosition;
+
+  // no copy constructor or assignment
+  BufferedDataSource(const BufferedDataSource &);
+  BufferedDataSource &operator=(const BufferedDataSource &);
+};
+
+#endif  // INCLUDE_BUFFERED_DATA_SOURCE_H_
@@ -22,10 +22,15 @@
 
 class DataSource {
  public:
+  virtual ~DataSource() {}
+
   // Returns the number of bytes read, or -1 on failure. It's not an error if
   // this returns zero; it just means the given offset is equal to, or
   // beyond, the end of the source.
   virtual ssize_t readAt(off64_t offset, void* const data, size_t size) = 0;
+
+  // Returns the length of the source in bytes, or -1 if it is unknown.
+  virtual off64_t getLength() { return -1; }
 };
 
 #endif  // INCLUDE_DATA_SOURCE_H_
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_DECODER_STATS_H_
+#define INCLUDE_DECODER_STATS_H_
+
+#include <dlfcn.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <ctime>
+
+// Tracing and running totals shared by the JNI code of the FLAC, Opus and VP9
+// extensions. Each extension includes this header from the single source file
+// that implements its JNI functions, and defines its own indices into Stats.
+
+// ATrace functions, which are only available from API level 23 and so are
+// looked up by initTrace. NULL if they are not available.
+static bool (*atraceIsEnabled)();
+static void (*atraceBeginSection)(const char *sectionName);
+static void (*atraceEndSection)();
+
+// Looks up the ATrace functions. Called from JNI_OnLoad.
+static inline void initTrace() {
+  void *const library = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+  if (library == NULL) {
+    return;
+  }
+  atraceIsEnabled =
+      reinterpret_cast<bool (*)()>(dlsym(library, "ATrace_isEnabled"));
+  atraceBeginSection = reinterpret_cast<void (*)(const char *)>(
+      dlsym(library, "ATrace_beginSection"));
+  atraceEndSection =
+      reinterpret_cast<void (*)()>(dlsym(library, "ATrace_endSection"));
+  if (atraceIsEnabled == NULL || atraceBeginSection == NULL ||
+      atraceEndSection == NULL) {
+    atraceIsEnabled = NULL;
+  }
+}
+
+// Emits a trace section for its lifetime, if tracing is enabled.
+class ScopedTrace {
+ public:
+  explicit ScopedTrace(const char *name)
+      : enabled(atraceIsEnabled != NULL && atraceIsEnabled()) {
+    if (enabled) {
+      atraceBeginSection(name);
+    }
+  }
+  ~ScopedTrace() {
+    if (enabled) {
+      atraceEndSection();
+    }
+  }
+
+ private:
+  const bool enabled;
+};
+
+static inline int64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// The number of running totals kept for each decoder, which must match
+// NativeDecoderCounters.SNAPSHOT_SIZE.
+static const int kStatCount = 10;
+
+// Running totals, written on the decode thread and read on any thread by the
+// getStats function of each extension. Indexed by the Stat enum of the
+// extension, whose values must match the indices in NativeDecoderCounters.
+struct Stats {
+  std::atomic<int64_t> values[kStatCount];
+
+  Stats() {
+    for (int i = 0; i < kStatCount; i++) {
+      values[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  int64_t get(int index) const {
+    return values[index].load(std::memory_order_relaxed);
+  }
+
+  void add(int stat, int64_t value) {
+    values[stat].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  // Adds a call and the time elapsed since startNs to a count and a time.
+  void addCall(int countStat, int timeStat, int64_t startNs) {
+    add(countStat, 1);
+    add(timeStat, nowNs() - startNs);
+  }
+};
+
+#endif  // INCLUDE_DECODER_STATS_H_
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_FLAC_COPY_SIMD_H_
+#define INCLUDE_FLAC_COPY_SIMD_H_
+
+#include <stdint.h>
+
+// Vectorized versions of the FLACParser copy functions, which convert FLAC
+// native 32-bit non-interleaved samples to 16-bit interleaved samples.
+
+typedef void (*FlacCopyFunction)(void *dst, const int *const *src,
+                                 unsigned nSamples, unsigned nChannels);
+
+// Each of these returns the copy function for the given channel count and bit
+// depth, or NULL if there is no vectorized implementation for that layout.
+// The caller is responsible for checking that the CPU supports the
+// instruction set.
+#if defined(__ARM_ARCH_7A__) || defined(__aarch64__)
+FlacCopyFunction getNeonCopyFunction(unsigned channels,
+                                     unsigned bitsPerSample);
+#endif
+#if defined(__i386__) || defined(__x86_64__)
+FlacCopyFunction getSse2CopyFunction(unsigned channels,
+                                     unsigned bitsPerSample);
+#endif
+
+#endif  // INCLUDE_FLAC_COPY_SIMD_H_
@@ -19,19 +19,38 @@
 
 #include <stdint.h>
 
+#include <vector>
+
 // libFLAC parser
 #include "FLAC/stream_decoder.h"
 
 #include "include/data_source.h"
+#include "include/pcm_converter.h"
 
 typedef int status_t;
 
 class FLACParser {
  public:
+  // encodings of the samples written by readBuffer
+  enum OutputEncoding {
+    kOutputEncodingPcm16Bit = 0,
+    // little-endian, packed into three bytes per sample
+    kOutputEncodingPcm24Bit = 1,
+    kOutputEncodingPcm32Bit = 2,
+    // normalized to [-1, 1)
+    kOutputEncodingPcmFloat = 3,
+  };
+
   FLACParser(DataSource *source);
   ~FLACParser();
 
-  bool init();
+  bool init(OutputEncoding outputEncoding = kOutputEncodingPcm16Bit);
+
+  // Converts the samples written by readBuffer and readBuffers to sampleRate
+  // and channels, in the output encoding, rather than writing them as they
+  // are decoded. Either may be 0 to keep that of the stream. Must be called
+  // after init. Returns false if the conversion is not supported.
+  bool setOutputFormat(unsigned sampleRate, unsigned channels);
 
   // stream properties
   unsigned getMaxBlockSize() const { return mStreamInfo.max_blocksize; }
@@ -39,6 +58,19 @@ class FLACParser {
   unsigned getChannels() const { return mStreamInfo.channels; }
   unsigned getBitsPerSample() const { return mStreamInfo.bits_per_sample; }
   FLAC__uint64 getTotalSamples() const { return mStreamInfo.total_samples; }
+  OutputEncoding getOutputEncoding() const { return mOutputEncoding; }
+  unsigned getOutputBytesPerSample() const { return mOutputBytesPerSample; }
+  unsigned getOutputSampleRate() const {
+    return mConverter != NULL ? mConverter->getOutputSampleRate()
+                              : getSampleRate();
+  }
+  unsigned getOutputChannels() const {
+    return mConverter != NULL ? mConverter->getOutputChannels()
+                              : getChannels();
+  }
+
+  // the maximum size of the samples written by readBuffer for one frame
+  size_t getMaxOutputFrameSize() const;
 
   const FLAC__StreamMetadata_StreamInfo& getStreamInfo() const {
     return mStreamInfo;
@@ -50,19 +82,105 @@ class FLACParser {
 
   size_t readBuffer(void *output, size_t output_size);
 
+  // Decodes consecutive frames into output, stopping once it could not hold
+  // another frame of the maximum block size or once the decoded audio lasts
+  // at least maxDurationUs. Returns the total size of the decoded frames, or
+  // -1 if no frame could be decoded. If a frame fails to decode after others
+  // in the batch, the next call returns -1. At the end of the stream, the
+  // output still held by the converter is added after the last frame.
+  size_t readBuffers(void *output, size_t output_size, int64_t maxDurationUs);
+
+  // the size of the output that the converter holds for the end of the last
+  // decoded frame, which drain writes
+  size_t getDrainSize() const {
+    return mConverter != NULL ? mConverter->getDrainFrameCount() *
+                                    mConverter->getOutputBytesPerFrame()
+                              : 0;
+  }
+
+  // Writes the output held by the converter at the end of the stream, and
+  // returns its size, or -1 if it does not fit in output_size bytes.
+  size_t drain(void *output, size_t output_size);
+
+  // Decodes the next frame ahead of the next call to readBuffer or
+  // readBuffers, which then returns it without decoding. Returns false if no
+  // frame could be decoded, for example at the end of the stream.
+  bool prefetchFrame();
+
+  // whether a frame decoded by prefetchFrame or by a seek is waiting to be
+  // returned by the next call to readBuffer or readBuffers
+  bool hasPendingFrame() const { return mSeekFramePending; }
+
+  // properties of the frames decoded by the most recent call to readBuffers
+  unsigned getLastBatchFrameCount() const { return mBatchFrameCount; }
+  int64_t getLastBatchTimestamp() const { return mBatchTimestamp; }
+
+  // whether the last call to readBuffer or readBuffers failed because the end
+  // of the stream was reached
+  bool isEndOfStream() const {
+    return mDecoder != NULL && FLAC__stream_decoder_get_state(mDecoder) ==
+                                   FLAC__STREAM_DECODER_END_OF_STREAM;
+  }
+
+  // Returns an estimate of the memory held by the parser and libFLAC, which
+  // allocates buffers for each channel that grow with the block size. Only
+  // includes those buffers once the metadata has been decoded.
+  size_t getMemoryUsage() const;
+
+  // total time spent interleaving decoded samples into output buffers
+  int64_t getCopyTimeNs() const { return mCopyTimeNs; }
+
+  // Returns the byte offset of a frame at or before timeUs, from the SEEKTABLE
+  // and from the positions of the frames decoded so far. Beyond the decoded
+  // frames of a stream without a SEEKTABLE, the offset is interpolated from
+  // the total number of samples and the length of the stream if both are
+  // known, and from the average frame size otherwise, and the decoder resyncs
+  // at the next frame.
   int64_t getSeekPosition(int64_t timeUs);
 
+  // Seeks to the sample at timeUs, using the SEEKTABLE if there is one and a
+  // binary search of the stream otherwise. The data source must support
+  // reading at the offsets requested by libFLAC. On success, the next call to
+  // readBuffer returns a frame that starts exactly at the target sample.
+  bool seekAbsolute(int64_t timeUs);
+
+  // As seekAbsolute, but seeks to a sample number rather than a time.
+  bool seekToSample(FLAC__uint64 sample);
+
   void flush() {
     if (mDecoder != NULL) {
       FLAC__stream_decoder_flush(mDecoder);
     }
+    mSeekFramePending = false;
+    mBatchErrorPending = false;
+    if (mConverter != NULL) {
+      mConverter->reset();
+    }
+    // The data source can be repositioned without the decoder knowing, so the
+    // decode position no longer necessarily matches the stream offset.
+    mIndexing = false;
+  }
+
+  // Declares the stream offset of the next byte that the data source returns
+  // after a flush, for a data source that reads at the offsets requested by
+  // libFLAC. The decode position matches the stream offset again, so decoded
+  // frames are indexed once more.
+  void setStreamPosition(off64_t position) {
+    mCurrentPos = position;
+    mEOF = false;
+    mIndexing = true;
   }
 
  private:
   DataSource *mDataSource;
 
-  void (*mCopy)(int16_t *dst, const int *const *src, unsigned nSamples,
-                unsigned nChannels);
+  void (*mCopy)(void *dst, const int *const *src, unsigned nSamples,
+               unsigned nChannels);
+  OutputEncoding mOutputEncoding;
+  unsigned mOutputBytesPerSample;
+
+  // replaces mCopy once an output format is set, or NULL
+  PcmConverter *mConverter;
 
   // handle to underlying libFLAC parser
   FLAC__StreamDecoder *mDecoder;
@@ -77,12 +195,40 @@ class FLACParser {
 
   const FLAC__StreamMetadata_SeekTable *mSeekTable;
   uint64_t firstFrameOffset;
+  // the length of the stream when the metadata was decoded, or -1 if unknown
+  off64_t mStreamLength;
 
   // cached when a decoded PCM block is "written" by libFLAC parser
   bool mWriteRequested;
   bool mWriteCompleted;
   FLAC__FrameHeader mWriteHeader;
   const FLAC__int32 *const *mWriteBuffer;
+  // the channel pointers passed to writeCallback, which libFLAC may pass in an
+  // array on its own stack, for example for the frame trimmed by a seek
+  const FLAC__int32 *mWriteChannels[FLAC__MAX_CHANNELS];
+
+  // cached when a batch of frames is decoded by readBuffers
+  unsigned mBatchFrameCount;
+  int64_t mBatchTimestamp;
+  // whether a frame failed to decode after others in the same batch, which
+  // is then returned as a failure by the next call to readBuffers
+  bool mBatchErrorPending;
+
+  int64_t mCopyTimeNs;
+
+  // sparse index of the frames decoded since the start of the stream, at
+  // intervals of at least kIndexIntervalSeconds
+  struct IndexPoint {
+    FLAC__uint64 sampleNumber;
+    FLAC__uint64 streamOffset;
+  };
+  static const unsigned kIndexIntervalSeconds = 1;
+  std::vector<IndexPoint> mIndex;
+  bool mIndexing;
+
+  // whether the frame written by libFLAC during seekAbsolute or prefetchFrame
+  // has yet to be returned by readBuffer
+  bool mSeekFramePending;
 
   // most recent error reported by libFLAC parser
   FLAC__StreamDecoderErrorStatus mErrorStatus;
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_MMAP_DATA_SOURCE_H_
+#define INCLUDE_MMAP_DATA_SOURCE_H_
+
+#include <stdint.h>
+
+#include "include/data_source.h"
+
+// A DataSource that serves reads from a read-only memory mapping of part of a
+// local file, so that each read is a copy out of the page cache with no system
+// call or JNI upcall. The offsets passed to readAt are offsets in the mapped
+// range.
+//
+// The file must not be truncated while it is mapped, since reading a page
+// beyond the end of the file raises SIGBUS.
+class MmapDataSource : public DataSource {
+ public:
+  MmapDataSource();
+  ~MmapDataSource();
+
+  // Maps the length bytes of fd starting at offset, or the rest of the file if
+  // length is negative. fd may be closed once this returns. Returns false if
+  // the range cannot be mapped.
+  bool init(int fd, off64_t offset, off64_t length);
+
+  ssize_t readAt(off64_t offset, void *const data, size_t size);
+
+  off64_t getLength() { return mLength; }
+
+  // Returns the number of mapped bytes that follow the previous read.
+  size_t getRemainingSize() const {
+    return mPosition < mLength ? mLength - mPosition : 0;
+  }
+
+ private:
+  // the mapping, which starts at a page boundary
+  void *mMapping;
+  size_t mMappingSize;
+
+  // the mapped range, which is mData[0, mLength)
+  const uint8_t *mData;
+  off64_t mLength;
+
+  // offset passed to readAt following the previous read
+  off64_t mPosition;
+
+  // no copy constructor or assignment
+  MmapDataSource(const MmapDataSource &);
+  MmapDataSource &operator=(const MmapDataSource &);
+};
+
+#endif  // INCLUDE_MMAP_DATA_SOURCE_H_
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PARALLEL_FLAC_DECODER_H_
+#define INCLUDE_PARALLEL_FLAC_DECODER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "include/data_source.h"
+#include "include/flac_parser.h"
+
+// Decodes a FLAC stream on several threads, for faster than real time
+// processing. The stream is split into ranges of samples, which worker threads
+// decode independently, each with its own FLACParser seeking to the start of
+// its range. The decoded ranges are returned by read in stream order.
+//
+// Only a bounded window of ranges ahead of the one being read is decoded, so
+// memory use does not grow with the length of the stream. The total number of
+// samples must be known, and the data sources must support reading at any
+// offset.
+class ParallelFlacDecoder {
+ public:
+  // Takes ownership of sources, which must all read the same stream. One
+  // worker thread is used for each source.
+  explicit ParallelFlacDecoder(const std::vector<DataSource *> &sources);
+  ~ParallelFlacDecoder();
+
+  // Decodes the stream metadata and starts the worker threads. Returns false
+  // if the stream cannot be decoded in parallel.
+  bool init(FLACParser::OutputEncoding outputEncoding);
+
+  const FLAC__StreamMetadata_StreamInfo &getStreamInfo() const {
+    return mWorkers[0].parser->getStreamInfo();
+  }
+
+  // Copies up to size bytes of decoded samples into output, continuing from
+  // the previous call and blocking until they have been decoded. Returns the
+  // number of bytes copied, 0 at the end of the stream, or -1 if decoding
+  // failed.
+  ssize_t read(void *output, size_t size);
+
+ private:
+  struct Worker {
+    ParallelFlacDecoder *decoder;
+    DataSource *source;
+    FLACParser *parser;
+    pthread_t thread;
+    bool started;
+  };
+
+  // a range of samples, which is held in the slot for its index modulo the
+  // window size while it is decoded and read
+  struct Chunk {
+    enum State { kFree, kDecoding, kDecoded, kFailed };
+    State state;
+    std::vector<uint8_t> data;
+  };
+
+  // the duration of each range of samples
+  static const unsigned kChunkDurationSeconds = 2;
+  // the number of ranges that can be decoded ahead of reads, per worker
+  static const unsigned kChunksPerWorker = 2;
+
+  std::vector<Worker> mWorkers;
+  std::vector<Chunk> mChunks;
+
+  FLAC__uint64 mTotalSamples;
+  FLAC__uint64 mChunkSamples;
+  FLAC__uint64 mChunkCount;
+  size_t mFrameSize;
+
+  // guards the fields below and the states of the chunks
+  pthread_mutex_t mMutex;
+  pthread_cond_t mChunkDecodedCondition;
+  pthread_cond_t mChunkFreedCondition;
+  // index of the next range to be decoded
+  FLAC__uint64 mNextChunk;
+  // index of the range being read, and the offset within it
+  FLAC__uint64 mReadChunk;
+  size_t mReadOffset;
+  bool mStopping;
+
+  static void *workerThread(void *worker);
+  void runWorker(FLACParser *parser);
+  bool decodeChunk(FLACParser *parser, FLAC__uint64 index,
+                   std::vector<uint8_t> *data, std::vector<uint8_t> *scratch);
+
+  // no copy constructor or assignment
+  ParallelFlacDecoder(const ParallelFlacDecoder &);
+  ParallelFlacDecoder &operator=(const ParallelFlacDecoder &);
+};
+
+#endif  // INCLUDE_PARALLEL_FLAC_DECODER_H_
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PCM_CONVERTER_H_
+#define INCLUDE_PCM_CONVERTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Converts decoded samples to another channel layout and sample rate in a
+// single pass, so that audio reaches the platform at the rate of the output
+// device and is not resampled again by the mixer. Used by both the FLAC and
+// Opus extensions.
+//
+// Channels are mixed by a matrix as the input is appended to a short history,
+// which is then resampled by a windowed sinc filter whose coefficients are
+// interpolated from a table of phases, so that any pair of rates is supported.
+// Output samples keep the timing of the input: the first output sample is at
+// the time of the first input sample. The output lags the input by up to half
+// the length of the filter, which is held until more input arrives or until
+// drain is called at the end of the stream.
+class PcmConverter {
+ public:
+  // formats of the samples written by convert, which are always interleaved
+  enum SampleFormat {
+    kSampleFormatPcm16Bit = 0,
+    // little-endian, packed into three bytes per sample
+    kSampleFormatPcm24Bit = 1,
+    kSampleFormatPcm32Bit = 2,
+    // normalized to [-1, 1)
+    kSampleFormatPcmFloat = 3,
+  };
+
+  PcmConverter();
+
+  // Configures the conversion. mixMatrix holds a row of inputChannels
+  // coefficients for each output channel, or is NULL for the default mapping,
+  // which is only defined if the channel counts match or if mono is converted
+  // to or from stereo. Returns false if the conversion is not supported.
+  bool init(unsigned inputSampleRate, unsigned inputChannels,
+            unsigned outputSampleRate, unsigned outputChannels,
+            const float *mixMatrix, SampleFormat outputFormat);
+
+  unsigned getOutputSampleRate() const { return mOutputSampleRate; }
+  unsigned getOutputChannels() const { return mOutputChannels; }
+  unsigned getOutputBytesPerFrame() const { return mOutputBytesPerFrame; }
+
+  // Returns the number of frames that the next call to convert writes for
+  // inputFrames frames of input.
+  size_t getOutputFrameCount(size_t inputFrames) const;
+
+  // Returns the maximum number of frames that any call to convert writes for
+  // inputFrames frames of input.
+  size_t getMaxOutputFrameCount(size_t inputFrames) const;
+
+  // Each of these converts frameCount frames of input into output, which must
+  // have room for getOutputFrameCount(frameCount) frames, and returns the
+  // number of frames written. Integer input is scaled by its bit depth, so
+  // that full scale input is full scale output.
+  size_t convert(const int16_t *input, size_t frameCount, void *output);
+  size_t convert(const float *input, size_t frameCount, void *output);
+  // for non-interleaved input, such as the samples written by libFLAC
+  size_t convert(const int32_t *const *input, unsigned bitsPerSample,
+                 size_t frameCount, void *output);
+
+  // Returns the number of frames that drain writes.
+  size_t getDrainFrameCount() const;
+
+  // Writes the output still held for the end of the input into output, which
+  // must have room for getDrainFrameCount() frames, as if the input were
+  // followed by silence, and then resets the converter. Called at the end of
+  // the stream, so that the output covers all of the input. Returns the number
+  // of frames written.
+  size_t drain(void *output);
+
+  // Discards the held input, for example after a seek.
+  void reset();
+
+  // Returns the memory held by the converter, which is fixed at init.
+  size_t getMemoryUsage() const;
+
+ private:
+  unsigned mInputSampleRate;
+  unsigned mInputChannels;
+  unsigned mOutputSampleRate;
+  unsigned mOutputChannels;
+  SampleFormat mOutputFormat;
+  unsigned mOutputBytesPerFrame;
+  bool mResampling;
+
+  // mOutputChannels rows of mInputChannels coefficients
+  std::vector<float> mMix;
+
+  // kPhaseCount + 1 rows of mTaps filter coefficients, so that coefficients
+  // can be interpolated between adjacent rows
+  unsigned mHalfTaps;
+  unsigned mTaps;
+  std::vector<float> mFilter;
+  // the interpolated coefficients for the current output sample
+  std::vector<float> mCoefficients;
+
+  // mixed input for each output channel, mHistoryCapacity frames apart
+  std::vector<float> mHistory;
+  size_t mHistoryCapacity;
+  size_t mHistoryFrames;
+  // the position of the next output sample, as the index of the preceding
+  // sample in mHistory and the remaining fraction of an input sample, in
+  // units of 1 / mOutputSampleRate
+  size_t mIndex;
+  uint64_t mRemainder;
+
+  // one interleaved output frame, before it is stored in mOutputFormat
+  std::vector<float> mFrame;
+
+  // Mixes frameCount frames of input into the history, which must have room
+  // for them.
+  template <typename T>
+  void mixInterleaved(const T *input, size_t frameCount, float scale);
+  void mixPlanar(const int32_t *const *input, size_t offset,
+                 size_t frameCount, float scale);
+
+  // Writes the output for as much of the history as possible, and discards
+  // the history that is no longer needed. When resampling, no more than
+  // maxFrames frames are written. Returns the number of frames written.
+  size_t writeOutput(uint8_t *output, size_t maxFrames);
+
+  void storeFrame(uint8_t *output) const;
+
+  // no copy constructor or assignment
+  PcmConverter(const PcmConverter &);
+  PcmConverter &operator=(const PcmConverter &);
+};
+
+#endif  // INCLUDE_PCM_CONVERTER_H_
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/mmap_data_source.h"
+
+#include <android/log.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#define LOG_TAG "MmapDataSource"
+#define ALOGE(...) \
+  ((void)__android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__))
+
+MmapDataSource::MmapDataSource()
+    : mMapping(MAP_FAILED),
+      mMappingSize(0),
+      mData(NULL),
+      mLength(0),
+      mPosition(0) {}
+
+MmapDataSource::~MmapDataSource() {
+  if (mMapping != MAP_FAILED) {
+    munmap(mMapping, mMappingSize);
+  }
+}
+
+bool MmapDataSource::init(int fd, off64_t offset, off64_t length) {
+  if (mMapping != MAP_FAILED || offset < 0) {
+    return false;
+  }
+  if (length < 0) {
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size < offset) {
+      ALOGE("Failed to get the length of fd %d: %s", fd, strerror(errno));
+      return false;
+    }
+    length = fileStat.st_size - offset;
+  }
+  if (length == 0) {
+    return false;
+  }
+  // mmap offsets must be a multiple of the page size.
+  const off64_t pageSize = sysconf(_SC_PAGESIZE);
+  const off64_t mappingOffset = offset - offset % pageSize;
+  const off64_t mappingSize = length + (offset - mappingOffset);
+  // The 32-bit ABIs are built against a platform without mmap64, and could
+  // not map a range that does not fit in their address space anyway.
+  if (static_cast<off_t>(mappingOffset) != mappingOffset ||
+      static_cast<off64_t>(static_cast<size_t>(mappingSize)) != mappingSize) {
+    ALOGE("Range of %lld bytes at %lld is too large to map",
+          static_cast<long long>(length), static_cast<long long>(offset));
+    return false;
+  }
+  void *mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd,
+                       static_cast<off_t>(mappingOffset));
+  if (mapping == MAP_FAILED) {
+    ALOGE("Failed to map fd %d: %s", fd, strerror(errno));
+    return false;
+  }
+  // libFLAC reads the stream in order, except when seeking.
+  madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+  mMapping = mapping;
+  mMappingSize = mappingSize;
+  mData = static_cast<const uint8_t *>(mapping) + (offset - mappingOffset);
+  mLength = length;
+  return true;
+}
+
+ssize_t MmapDataSource::readAt(off64_t offset, void *const data,
+                               size_t size) {
+  if (mData == NULL || offset < 0) {
+    return -1;
+  }
+  mPosition = offset;
+  if (offset >= mLength) {
+    return 0;
+  }
+  size_t count = mLength - offset;
+  if (count > size) {
+    count = size;
+  }
+  memcpy(data, mData + offset, count);
+  mPosition += count;
+  return count;
+}
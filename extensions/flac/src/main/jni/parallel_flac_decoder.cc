@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/parallel_flac_decoder.h"
+
+#include <android/log.h>
+
+#include <cstring>
+
+#define LOG_TAG "ParallelFlacDecoder"
+#define ALOGE(...) \
+  ((void)__android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__))
+
+ParallelFlacDecoder::ParallelFlacDecoder(
+    const std::vector<DataSource *> &sources)
+    : mWorkers(sources.size()),
+      mTotalSamples(0),
+      mChunkSamples(0),
+      mChunkCount(0),
+      mFrameSize(0),
+      mNextChunk(0),
+      mReadChunk(0),
+      mReadOffset(0),
+      mStopping(false) {
+  for (size_t i = 0; i < sources.size(); ++i) {
+    Worker *worker = &mWorkers[i];
+    worker->decoder = this;
+    worker->source = sources[i];
+    worker->parser = new FLACParser(sources[i]);
+    worker->started = false;
+  }
+  pthread_mutex_init(&mMutex, NULL);
+  pthread_cond_init(&mChunkDecodedCondition, NULL);
+  pthread_cond_init(&mChunkFreedCondition, NULL);
+}
+
+ParallelFlacDecoder::~ParallelFlacDecoder() {
+  pthread_mutex_lock(&mMutex);
+  mStopping = true;
+  pthread_cond_broadcast(&mChunkFreedCondition);
+  pthread_mutex_unlock(&mMutex);
+  for (size_t i = 0; i < mWorkers.size(); ++i) {
+    if (mWorkers[i].started) {
+      pthread_join(mWorkers[i].thread, NULL);
+    }
+    delete mWorkers[i].parser;
+    delete mWorkers[i].source;
+  }
+  pthread_cond_destroy(&mChunkFreedCondition);
+  pthread_cond_destroy(&mChunkDecodedCondition);
+  pthread_mutex_destroy(&mMutex);
+}
+
+bool ParallelFlacDecoder::init(FLACParser::OutputEncoding outputEncoding) {
+  if (mWorkers.empty()) {
+    return false;
+  }
+  for (size_t i = 0; i < mWorkers.size(); ++i) {
+    if (!mWorkers[i].parser->init(outputEncoding)) {
+      return false;
+    }
+  }
+  const FLACParser *parser = mWorkers[0].parser;
+  mTotalSamples = parser->getTotalSamples();
+  if (mTotalSamples == 0) {
+    ALOGE("total number of samples is unknown");
+    return false;
+  }
+  mFrameSize = parser->getChannels() * parser->getOutputBytesPerSample();
+  mChunkSamples =
+      static_cast<FLAC__uint64>(kChunkDurationSeconds) *
+      parser->getSampleRate();
+  mChunkCount = (mTotalSamples + mChunkSamples - 1) / mChunkSamples;
+  mChunks.resize(mWorkers.size() * kChunksPerWorker);
+  for (size_t i = 0; i < mChunks.size(); ++i) {
+    mChunks[i].state = Chunk::kFree;
+  }
+
+  size_t startedCount = 0;
+  for (size_t i = 0; i < mWorkers.size(); ++i) {
+    Worker *worker = &mWorkers[i];
+    worker->started = pthread_create(&worker->thread, NULL, workerThread,
+                                     worker) == 0;
+    if (worker->started) {
+      ++startedCount;
+    }
+  }
+  // the ranges are shared between the workers that did start
+  return startedCount > 0;
+}
+
+ssize_t ParallelFlacDecoder::read(void *output, size_t size) {
+  pthread_mutex_lock(&mMutex);
+  if (mReadChunk == mChunkCount) {
+    pthread_mutex_unlock(&mMutex);
+    return 0;
+  }
+  Chunk *chunk = &mChunks[mReadChunk % mChunks.size()];
+  while (chunk->state == Chunk::kFree || chunk->state == Chunk::kDecoding) {
+    pthread_cond_wait(&mChunkDecodedCondition, &mMutex);
+  }
+  Chunk::State state = chunk->state;
+  pthread_mutex_unlock(&mMutex);
+  if (state == Chunk::kFailed) {
+    return -1;
+  }
+
+  // workers do not touch a decoded chunk until it has been freed
+  size_t count = chunk->data.size() - mReadOffset;
+  if (count > size) {
+    count = size;
+  }
+  memcpy(output, &chunk->data[mReadOffset], count);
+  mReadOffset += count;
+  if (mReadOffset == chunk->data.size()) {
+    pthread_mutex_lock(&mMutex);
+    chunk->state = Chunk::kFree;
+    ++mReadChunk;
+    mReadOffset = 0;
+    pthread_cond_broadcast(&mChunkFreedCondition);
+    pthread_mutex_unlock(&mMutex);
+  }
+  return count;
+}
+
+void *ParallelFlacDecoder::workerThread(void *worker) {
+  Worker *const self = reinterpret_cast<Worker *>(worker);
+  self->decoder->runWorker(self->parser);
+  return NULL;
+}
+
+void ParallelFlacDecoder::runWorker(FLACParser *parser) {
+  // holds the last frame of a range, which is usually only partly inside it
+  std::vector<uint8_t> scratch(parser->getMaxBlockSize() * mFrameSize);
+  pthread_mutex_lock(&mMutex);
+  while (true) {
+    while (!mStopping && mNextChunk < mChunkCount &&
+           mNextChunk - mReadChunk >= mChunks.size()) {
+      pthread_cond_wait(&mChunkFreedCondition, &mMutex);
+    }
+    if (mStopping || mNextChunk == mChunkCount) {
+      break;
+    }
+    FLAC__uint64 index = mNextChunk++;
+    Chunk *chunk = &mChunks[index % mChunks.size()];
+    chunk->state = Chunk::kDecoding;
+    pthread_mutex_unlock(&mMutex);
+    bool decoded = decodeChunk(parser, index, &chunk->data, &scratch);
+    pthread_mutex_lock(&mMutex);
+    chunk->state = decoded ? Chunk::kDecoded : Chunk::kFailed;
+    pthread_cond_broadcast(&mChunkDecodedCondition);
+  }
+  pthread_mutex_unlock(&mMutex);
+}
+
+bool ParallelFlacDecoder::decodeChunk(FLACParser *parser, FLAC__uint64 index,
+                                      std::vector<uint8_t> *data,
+                                      std::vector<uint8_t> *scratch) {
+  FLAC__uint64 startSample = index * mChunkSamples;
+  FLAC__uint64 endSample = startSample + mChunkSamples;
+  if (endSample > mTotalSamples) {
+    endSample = mTotalSamples;
+  }
+  data->resize((endSample - startSample) * mFrameSize);
+  // the frame written by the seek starts exactly at startSample, and the
+  // following frames are contiguous
+  if (!parser->seekToSample(startSample)) {
+    return false;
+  }
+  size_t offset = 0;
+  while (offset < data->size()) {
+    size_t remaining = data->size() - offset;
+    // frames that fit are decoded straight into the range
+    bool direct = remaining >= scratch->size();
+    uint8_t *dst = direct ? &(*data)[offset] : &(*scratch)[0];
+    size_t size = parser->readBuffer(dst, direct ? remaining : scratch->size());
+    if (size == static_cast<size_t>(-1) || size == 0) {
+      ALOGE("failed to decode samples %llu to %llu",
+            static_cast<unsigned long long>(startSample),
+            static_cast<unsigned long long>(endSample));
+      return false;
+    }
+    if (!direct) {
+      if (size > remaining) {
+        size = remaining;
+      }
+      memcpy(&(*data)[offset], dst, size);
+    }
+    offset += size;
+  }
+  return true;
+}
@@ -0,0 +1,460 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/pcm_converter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// the most channels on either side of the conversion
+static const unsigned kMaxChannels = 8;
+
+// The number of input frames that are mixed into the history before it is
+// resampled. Longer input is converted in several steps.
+static const size_t kChunkFrames = 1024;
+
+// The resolution of the filter table. Coefficients between two phases are
+// linearly interpolated, so the table stays small for any pair of rates.
+static const unsigned kPhaseCount = 128;
+
+// Half the number of filter taps when upsampling. Downsampling lowers the
+// cutoff, and so widens the filter by the same ratio, up to kMaxHalfTaps.
+static const unsigned kMinHalfTaps = 16;
+static const unsigned kMaxHalfTaps = 64;
+
+// The passband, as a fraction of the lower of the two Nyquist frequencies,
+// which leaves room for the transition band below the point of aliasing.
+static const double kCutoff = 0.92;
+
+// The shape of the Kaiser window, which trades the width of the transition
+// band for stopband attenuation of around 80dB.
+static const double kKaiserBeta = 8.0;
+
+static const double kPi = 3.14159265358979323846;
+
+// passed to writeOutput when all of the output that is ready can be written
+static const size_t kNoFrameLimit = static_cast<size_t>(-1);
+
+// The filter loops use the generic vector extensions of GCC and Clang, which
+// compile to NEON or SSE where the ABI has them and to scalar code otherwise.
+typedef float float4 __attribute__((vector_size(16)));
+
+static inline float4 load4(const float *p) {
+  float4 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void store4(float *p, float4 v) { memcpy(p, &v, sizeof(v)); }
+
+// Returns the dot product of a and b, whose length is a multiple of 4.
+static inline float dotProduct(const float *a, const float *b, unsigned n) {
+  float4 sum = {0, 0, 0, 0};
+  for (unsigned i = 0; i < n; i += 4) {
+    sum += load4(a + i) * load4(b + i);
+  }
+  return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+// the zeroth order modified Bessel function of the first kind
+static double besselI0(double x) {
+  double sum = 1;
+  double term = 1;
+  const double halfX = x / 2;
+  for (int k = 1; k < 64 && term > sum * 1e-12; k++) {
+    term *= (halfX / k) * (halfX / k);
+    sum += term;
+  }
+  return sum;
+}
+
+static inline int32_t clampToInt(double sample, int32_t min, int32_t max) {
+  if (sample >= max) {
+    return max;
+  } else if (sample <= min) {
+    return min;
+  }
+  return static_cast<int32_t>(lrint(sample));
+}
+
+PcmConverter::PcmConverter()
+    : mInputSampleRate(0),
+      mInputChannels(0),
+      mOutputSampleRate(0),
+      mOutputChannels(0),
+      mOutputFormat(kSampleFormatPcm16Bit),
+      mOutputBytesPerFrame(0),
+      mResampling(false),
+      mHalfTaps(0),
+      mTaps(0),
+      mHistoryCapacity(0),
+      mHistoryFrames(0),
+      mIndex(0),
+      mRemainder(0) {}
+
+bool PcmConverter::init(unsigned inputSampleRate, unsigned inputChannels,
+                        unsigned outputSampleRate, unsigned outputChannels,
+                        const float *mixMatrix, SampleFormat outputFormat) {
+  if (inputSampleRate == 0 || outputSampleRate == 0 || inputChannels == 0 ||
+      inputChannels > kMaxChannels || outputChannels == 0 ||
+      outputChannels > kMaxChannels) {
+    return false;
+  }
+  unsigned bytesPerSample;
+  switch (outputFormat) {
+    case kSampleFormatPcm16Bit:
+      bytesPerSample = sizeof(int16_t);
+      break;
+    case kSampleFormatPcm24Bit:
+      bytesPerSample = 3;
+      break;
+    case kSampleFormatPcm32Bit:
+      bytesPerSample = sizeof(int32_t);
+      break;
+    case kSampleFormatPcmFloat:
+      bytesPerSample = sizeof(float);
+      break;
+    default:
+      return false;
+  }
+
+  mMix.assign(outputChannels * inputChannels, 0.0f);
+  if (mixMatrix != NULL) {
+    mMix.assign(mixMatrix, mixMatrix + outputChannels * inputChannels);
+  } else if (inputChannels == outputChannels) {
+    for (unsigned c = 0; c < outputChannels; c++) {
+      mMix[c * inputChannels + c] = 1.0f;
+    }
+  } else if (inputChannels == 1 && outputChannels == 2) {
+    mMix[0] = 1.0f;
+    mMix[1] = 1.0f;
+  } else if (inputChannels == 2 && outputChannels == 1) {
+    mMix[0] = 0.5f;
+    mMix[1] = 0.5f;
+  } else {
+    return false;
+  }
+
+  mInputSampleRate = inputSampleRate;
+  mInputChannels = inputChannels;
+  mOutputSampleRate = outputSampleRate;
+  mOutputChannels = outputChannels;
+  mOutputFormat = outputFormat;
+  mOutputBytesPerFrame = outputChannels * bytesPerSample;
+  mResampling = inputSampleRate != outputSampleRate;
+
+  mHalfTaps = 0;
+  mTaps = 0;
+  mFilter.clear();
+  mCoefficients.clear();
+  if (mResampling) {
+    const double ratio =
+        static_cast<double>(outputSampleRate) / inputSampleRate;
+    // an even number, so that the number of taps is a multiple of 4
+    mHalfTaps = kMinHalfTaps;
+    if (ratio < 1) {
+      mHalfTaps = std::min(
+          kMaxHalfTaps,
+          (static_cast<unsigned>(ceil(kMinHalfTaps / ratio)) + 1) & ~1u);
+    }
+    mTaps = 2 * mHalfTaps;
+    const double cutoff = kCutoff * std::min(1.0, ratio);
+    const double windowScale = 1 / besselI0(kKaiserBeta);
+    mFilter.resize((kPhaseCount + 1) * mTaps);
+    for (unsigned p = 0; p <= kPhaseCount; p++) {
+      // tap k is applied to the input sample at this distance from the output
+      // sample, which follows the sample at tap mHalfTaps - 1 by p phases
+      float *row = &mFilter[p * mTaps];
+      double sum = 0;
+      for (unsigned k = 0; k < mTaps; k++) {
+        const double distance = static_cast<double>(k + 1) - mHalfTaps -
+                                static_cast<double>(p) / kPhaseCount;
+        const double x = distance / mHalfTaps;
+        double value = 0;
+        if (x > -1 && x < 1) {
+          const double window =
+              besselI0(kKaiserBeta * sqrt(1 - x * x)) * windowScale;
+          const double phase = kPi * cutoff * distance;
+          const double sinc = phase == 0 ? 1 : sin(phase) / phase;
+          value = cutoff * sinc * window;
+        }
+        row[k] = value;
+        sum += value;
+      }
+      // unity gain at DC for every phase, so that the phase is not audible
+      for (unsigned k = 0; k < mTaps; k++) {
+        row[k] /= sum;
+      }
+    }
+    mCoefficients.resize(mTaps);
+  }
+
+  mHistoryCapacity = mTaps + kChunkFrames;
+  mHistory.assign(outputChannels * mHistoryCapacity, 0.0f);
+  mFrame.resize(outputChannels);
+  reset();
+  return true;
+}
+
+size_t PcmConverter::getOutputFrameCount(size_t inputFrames) const {
+  if (!mResampling) {
+    return inputFrames;
+  }
+  // output samples are written up to the last whose filter is covered by the
+  // history, including the new input
+  const size_t available = mHistoryFrames + inputFrames;
+  if (available <= mIndex + mHalfTaps) {
+    return 0;
+  }
+  const uint64_t remaining = available - mIndex - mHalfTaps;
+  return (remaining * mOutputSampleRate - mRemainder + mInputSampleRate - 1) /
+         mInputSampleRate;
+}
+
+size_t PcmConverter::getMaxOutputFrameCount(size_t inputFrames) const {
+  if (!mResampling) {
+    return inputFrames;
+  }
+  // The history holds at most mHalfTaps frames beyond the next output sample,
+  // which never covers its filter, so no more than the new input is consumed.
+  return (static_cast<uint64_t>(inputFrames) * mOutputSampleRate +
+          mInputSampleRate - 1) /
+         mInputSampleRate;
+}
+
+size_t PcmConverter::convert(const int16_t *input, size_t frameCount,
+                             void *output) {
+  uint8_t *dst = reinterpret_cast<uint8_t *>(output);
+  size_t written = 0;
+  while (frameCount > 0) {
+    const size_t frames =
+        std::min(frameCount, mHistoryCapacity - mHistoryFrames);
+    mixInterleaved(input, frames, 1.0f / 32768);
+    input += frames * mInputChannels;
+    frameCount -= frames;
+    written += writeOutput(dst + written * mOutputBytesPerFrame, kNoFrameLimit);
+  }
+  return written;
+}
+
+size_t PcmConverter::convert(const float *input, size_t frameCount,
+                             void *output) {
+  uint8_t *dst = reinterpret_cast<uint8_t *>(output);
+  size_t written = 0;
+  while (frameCount > 0) {
+    const size_t frames =
+        std::min(frameCount, mHistoryCapacity - mHistoryFrames);
+    mixInterleaved(input, frames, 1.0f);
+    input += frames * mInputChannels;
+    frameCount -= frames;
+    written += writeOutput(dst + written * mOutputBytesPerFrame, kNoFrameLimit);
+  }
+  return written;
+}
+
+size_t PcmConverter::convert(const int32_t *const *input,
+                             unsigned bitsPerSample, size_t frameCount,
+                             void *output) {
+  uint8_t *dst = reinterpret_cast<uint8_t *>(output);
+  const float scale = 1.0f / (1 << (bitsPerSample - 1));
+  size_t offset = 0;
+  size_t written = 0;
+  while (offset < frameCount) {
+    const size_t frames =
+        std::min(frameCount - offset, mHistoryCapacity - mHistoryFrames);
+    mixPlanar(input, offset, frames, scale);
+    offset += frames;
+    written += writeOutput(dst + written * mOutputBytesPerFrame, kNoFrameLimit);
+  }
+  return written;
+}
+
+size_t PcmConverter::getDrainFrameCount() const {
+  if (!mResampling || mHistoryFrames <= mIndex) {
+    return 0;
+  }
+  // the output samples that are before the end of the input, whose filters
+  // are not yet covered by the history
+  const uint64_t remaining = mHistoryFrames - mIndex;
+  return (remaining * mOutputSampleRate - mRemainder + mInputSampleRate - 1) /
+         mInputSampleRate;
+}
+
+size_t PcmConverter::drain(void *output) {
+  const size_t frameCount = getDrainFrameCount();
+  size_t written = 0;
+  if (frameCount > 0) {
+    // Silence after the input covers the filters of the remaining output
+    // samples. It fits in the history, which holds less than one filter length
+    // between calls.
+    for (unsigned c = 0; c < mOutputChannels; c++) {
+      std::fill_n(&mHistory[c * mHistoryCapacity + mHistoryFrames], mHalfTaps,
+                  0.0f);
+    }
+    mHistoryFrames += mHalfTaps;
+    written = writeOutput(reinterpret_cast<uint8_t *>(output), frameCount);
+  }
+  reset();
+  return written;
+}
+
+void PcmConverter::reset() {
+  // The history starts with silence before the first input sample, so that
+  // the first output sample is at the time of the first input sample.
+  mHistoryFrames = mResampling ? mHalfTaps - 1 : 0;
+  for (unsigned c = 0; c < mOutputChannels; c++) {
+    std::fill_n(&mHistory[c * mHistoryCapacity], mHistoryFrames, 0.0f);
+  }
+  mIndex = mHistoryFrames;
+  mRemainder = 0;
+}
+
+size_t PcmConverter::getMemoryUsage() const {
+  return sizeof(*this) +
+         (mMix.capacity() + mFilter.capacity() + mCoefficients.capacity() +
+          mHistory.capacity() + mFrame.capacity()) *
+             sizeof(float);
+}
+
+template <typename T>
+void PcmConverter::mixInterleaved(const T *input, size_t frameCount,
+                                  float scale) {
+  for (unsigned c = 0; c < mOutputChannels; c++) {
+    float *dst = &mHistory[c * mHistoryCapacity + mHistoryFrames];
+    const float *mix = &mMix[c * mInputChannels];
+    const T *src = input;
+    for (size_t i = 0; i < frameCount; i++) {
+      float sum = 0;
+      for (unsigned j = 0; j < mInputChannels; j++) {
+        sum += mix[j] * src[j];
+      }
+      dst[i] = sum * scale;
+      src += mInputChannels;
+    }
+  }
+  mHistoryFrames += frameCount;
+}
+
+void PcmConverter::mixPlanar(const int32_t *const *input, size_t offset,
+                             size_t frameCount, float scale) {
+  for (unsigned c = 0; c < mOutputChannels; c++) {
+    float *dst = &mHistory[c * mHistoryCapacity + mHistoryFrames];
+    const float *mix = &mMix[c * mInputChannels];
+    // each channel is accumulated in turn, in loops that vectorize
+    const int32_t *src = input[0] + offset;
+    float coefficient = mix[0] * scale;
+    for (size_t i = 0; i < frameCount; i++) {
+      dst[i] = coefficient * src[i];
+    }
+    for (unsigned j = 1; j < mInputChannels; j++) {
+      src = input[j] + offset;
+      coefficient = mix[j] * scale;
+      if (coefficient == 0) {
+        continue;
+      }
+      for (size_t i = 0; i < frameCount; i++) {
+        dst[i] += coefficient * src[i];
+      }
+    }
+  }
+  mHistoryFrames += frameCount;
+}
+
+size_t PcmConverter::writeOutput(uint8_t *output, size_t maxFrames) {
+  if (!mResampling) {
+    for (size_t i = 0; i < mHistoryFrames; i++) {
+      for (unsigned c = 0; c < mOutputChannels; c++) {
+        mFrame[c] = mHistory[c * mHistoryCapacity + i];
+      }
+      storeFrame(output + i * mOutputBytesPerFrame);
+    }
+    const size_t written = mHistoryFrames;
+    mHistoryFrames = 0;
+    return written;
+  }
+
+  float *const coefficients = &mCoefficients[0];
+  size_t written = 0;
+  while (mIndex + mHalfTaps < mHistoryFrames && written < maxFrames) {
+    // interpolate the coefficients between the two nearest phases
+    const uint64_t position = mRemainder * kPhaseCount;
+    const unsigned phase = position / mOutputSampleRate;
+    const float fraction =
+        static_cast<float>(position % mOutputSampleRate) / mOutputSampleRate;
+    const float4 fraction4 = {fraction, fraction, fraction, fraction};
+    const float *row = &mFilter[phase * mTaps];
+    const float *nextRow = row + mTaps;
+    for (unsigned k = 0; k < mTaps; k += 4) {
+      const float4 value = load4(row + k);
+      store4(coefficients + k,
+             value + (load4(nextRow + k) - value) * fraction4);
+    }
+    const size_t start = mIndex + 1 - mHalfTaps;
+    for (unsigned c = 0; c < mOutputChannels; c++) {
+      mFrame[c] = dotProduct(coefficients,
+                             &mHistory[c * mHistoryCapacity + start], mTaps);
+    }
+    storeFrame(output + written * mOutputBytesPerFrame);
+    written++;
+    mRemainder += mInputSampleRate;
+    mIndex += mRemainder / mOutputSampleRate;
+    mRemainder %= mOutputSampleRate;
+  }
+
+  // keep the input still needed by the filter of the next output sample
+  const size_t start = std::min(mIndex + 1 - mHalfTaps, mHistoryFrames);
+  if (start > 0) {
+    for (unsigned c = 0; c < mOutputChannels; c++) {
+      float *history = &mHistory[c * mHistoryCapacity];
+      memmove(history, history + start,
+              (mHistoryFrames - start) * sizeof(float));
+    }
+    mHistoryFrames -= start;
+    mIndex -= start;
+  }
+  return written;
+}
+
+void PcmConverter::storeFrame(uint8_t *output) const {
+  switch (mOutputFormat) {
+    case kSampleFormatPcm16Bit:
+      for (unsigned c = 0; c < mOutputChannels; c++) {
+        const int16_t sample = clampToInt(mFrame[c] * 32768.0, -32768, 32767);
+        memcpy(output + c * sizeof(sample), &sample, sizeof(sample));
+      }
+      break;
+    case kSampleFormatPcm24Bit:
+      for (unsigned c = 0; c < mOutputChannels; c++) {
+        const int32_t sample =
+            clampToInt(mFrame[c] * 8388608.0, -8388608, 8388607);
+        output[3 * c] = sample;
+        output[3 * c + 1] = sample >> 8;
+        output[3 * c + 2] = sample >> 16;
+      }
+      break;
+    case kSampleFormatPcm32Bit:
+      for (unsigned c = 0; c < mOutputChannels; c++) {
+        const int32_t sample = clampToInt(mFrame[c] * 2147483648.0,
+                                          -2147483647 - 1, 2147483647);
+        memcpy(output + c * sizeof(sample), &sample, sizeof(sample));
+      }
+      break;
+    case kSampleFormatPcmFloat:
+      memcpy(output, &mFrame[0], mOutputChannels * sizeof(float));
+      break;
+  }
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Standalone tests of PcmConverter, which has no dependencies on Android and so
+// can also be built and run on the host:
+//   g++ -O2 -I. pcm_converter.cc pcm_converter_test.cc -o pcm_converter_test
+// Built by passing BUILD_TESTS=true to ndk-build. See README.md.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "include/pcm_converter.h"
+
+static const double kPi = 3.14159265358979323846;
+
+static int failureCount = 0;
+
+#define EXPECT(condition, ...)                       \
+  do {                                               \
+    if (!(condition)) {                              \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__);                  \
+      fprintf(stderr, "\n");                         \
+      failureCount++;                                \
+    }                                                \
+  } while (0)
+
+// Converts frameCount frames of silence in chunks of varying sizes, and checks
+// that each call writes the number of frames reported by getOutputFrameCount,
+// and that the drained output completes the frames covering the input.
+static void testOutputFrameCounts(unsigned inputSampleRate,
+                                  unsigned outputSampleRate) {
+  const unsigned channels = 2;
+  const size_t chunkSizes[] = {1, 17, 480, 4608, 1, 960, 3, 2000};
+  const size_t chunkCount = sizeof(chunkSizes) / sizeof(chunkSizes[0]);
+  PcmConverter converter;
+  EXPECT(converter.init(inputSampleRate, channels, outputSampleRate, channels,
+                        NULL, PcmConverter::kSampleFormatPcm16Bit),
+         "init failed for %u -> %u", inputSampleRate, outputSampleRate);
+  std::vector<int16_t> input(4608 * channels, 0);
+  std::vector<uint8_t> output;
+  // The counts are checked across a reset, as after a seek.
+  for (int pass = 0; pass < 2; pass++) {
+    uint64_t inputFrames = 0;
+    uint64_t outputFrames = 0;
+    for (int repeat = 0; repeat < 4; repeat++) {
+      for (size_t i = 0; i < chunkCount; i++) {
+        const size_t frames = chunkSizes[i];
+        const size_t expected = converter.getOutputFrameCount(frames);
+        EXPECT(expected <= converter.getMaxOutputFrameCount(frames),
+               "%u -> %u: %zu frames exceed the maximum for %zu",
+               inputSampleRate, outputSampleRate, expected, frames);
+        output.resize(converter.getMaxOutputFrameCount(frames) *
+                      converter.getOutputBytesPerFrame());
+        const size_t written = converter.convert(&input[0], frames,
+                                                 output.empty() ? NULL
+                                                                : &output[0]);
+        EXPECT(written == expected,
+               "%u -> %u: wrote %zu frames for %zu, expected %zu",
+               inputSampleRate, outputSampleRate, written, frames, expected);
+        inputFrames += frames;
+        outputFrames += written;
+      }
+    }
+    const size_t drainFrames = converter.getDrainFrameCount();
+    output.resize((drainFrames + 1) * converter.getOutputBytesPerFrame());
+    const size_t drained = converter.drain(&output[0]);
+    EXPECT(drained == drainFrames, "%u -> %u: drained %zu frames, expected %zu",
+           inputSampleRate, outputSampleRate, drained, drainFrames);
+    outputFrames += drained;
+    // one output frame for each output sample time before the end of the
+    // input
+    const uint64_t expectedTotal =
+        (inputFrames * outputSampleRate + inputSampleRate - 1) /
+        inputSampleRate;
+    EXPECT(outputFrames == expectedTotal,
+           "%u -> %u: wrote %llu frames in total for %llu, expected %llu",
+           inputSampleRate, outputSampleRate,
+           static_cast<unsigned long long>(outputFrames),
+           static_cast<unsigned long long>(inputFrames),
+           static_cast<unsigned long long>(expectedTotal));
+    EXPECT(converter.getDrainFrameCount() == 0,
+           "%u -> %u: output held after draining", inputSampleRate,
+           outputSampleRate);
+    if (pass == 0) {
+      converter.reset();
+    }
+  }
+}
+
+// Resamples a sine wave, and checks that the output is the same sine wave at
+// the output rate, in time with the input.
+static void testSineWave(unsigned inputSampleRate, unsigned outputSampleRate,
+                         double frequency) {
+  const size_t inputFrames = inputSampleRate;
+  const double amplitude = 0.5;
+  std::vector<float> input(inputFrames);
+  for (size_t i = 0; i < inputFrames; i++) {
+    input[i] = amplitude * sin(2 * kPi * frequency * i / inputSampleRate);
+  }
+  PcmConverter converter;
+  EXPECT(converter.init(inputSampleRate, 1, outputSampleRate, 1, NULL,
+                        PcmConverter::kSampleFormatPcmFloat),
+         "init failed for %u -> %u", inputSampleRate, outputSampleRate);
+  std::vector<float> output(converter.getMaxOutputFrameCount(inputFrames) +
+                            converter.getDrainFrameCount() + 64);
+  size_t outputFrames = 0;
+  const size_t chunkFrames = 960;
+  for (size_t offset = 0; offset < inputFrames; offset += chunkFrames) {
+    const size_t frames = std::min(chunkFrames, inputFrames - offset);
+    outputFrames += converter.convert(&input[offset], frames,
+                                      &output[outputFrames]);
+  }
+  outputFrames += converter.drain(&output[outputFrames]);
+  const size_t expectedFrames =
+      (static_cast<uint64_t>(inputFrames) * outputSampleRate +
+       inputSampleRate - 1) /
+      inputSampleRate;
+  EXPECT(outputFrames == expectedFrames,
+         "%u -> %u: %zu frames of sine wave, expected %zu", inputSampleRate,
+         outputSampleRate, outputFrames, expectedFrames);
+
+  // Away from the edges, where the filter covers the silence before and after
+  // the input, the output matches the sine wave at the output rate.
+  const size_t margin = 128;
+  double maxError = 0;
+  double sumSquares = 0;
+  for (size_t i = margin; i + margin < outputFrames; i++) {
+    const double expected =
+        amplitude * sin(2 * kPi * frequency * i / outputSampleRate);
+    const double error = fabs(output[i] - expected);
+    maxError = std::max(maxError, error);
+    sumSquares += output[i] * output[i];
+  }
+  const double rms = sqrt(sumSquares / (outputFrames - 2 * margin));
+  EXPECT(maxError < 1e-3, "%u -> %u: %.0f Hz sine wave differs by %g",
+         inputSampleRate, outputSampleRate, frequency, maxError);
+  EXPECT(fabs(rms - amplitude / sqrt(2.0)) < 1e-3,
+         "%u -> %u: %.0f Hz sine wave has RMS %g", inputSampleRate,
+         outputSampleRate, frequency, rms);
+}
+
+int main() {
+  const unsigned rates[][2] = {
+      {48000, 44100}, {44100, 48000}, {8000, 48000},
+      {96000, 44100}, {48000, 48000}, {22050, 16000},
+  };
+  for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+    testOutputFrameCounts(rates[i][0], rates[i][1]);
+  }
+  testSineWave(48000, 44100, 1000);
+  testSineWave(48000, 44100, 10000);
+  testSineWave(44100, 48000, 1000);
+  if (failureCount > 0) {
+    fprintf(stderr, "%d failures\n", failureCount);
+    return 1;
+  }
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.google.android.exoplayer.ext.opus;
+
+import com.google.android.exoplayer.C;
+
+import junit.framework.TestCase;
+
+import java.nio.ByteBuffer;
+
+/**
+ * Unit tests for the packet parsing, packet loss concealment and output sizing logic in
+ * {@link OpusDecoder}.
+ */
+public class OpusDecoderTest extends TestCase {
+
+  private static final long START_TIME_US = 1000000;
+
+  public void testNoLostSamplesWithoutPreviousPacket() {
+    assertEquals(0, OpusDecoder.getLostSamples(C.UNKNOWN_TIME_US, START_TIME_US));
+  }
+
+  public void testNoLostSamplesWithoutGap() {
+    assertEquals(0, OpusDecoder.getLostSamples(START_TIME_US, START_TIME_US));
+    // A packet that overlaps the previous one does not need concealment either.
+    assertEquals(0, OpusDecoder.getLostSamples(START_TIME_US, START_TIME_US - 20000));
+  }
+
+  public void testLostSamplesForMissingPacket() {
+    assertEquals(960, OpusDecoder.getLostSamples(START_TIME_US, START_TIME_US + 20000));
+  }
+
+  public void testLostSamplesRoundedDownToGranularity() {
+    // 2.6ms is 124.8 samples, which is concealed as a single 2.5ms frame.
+    assertEquals(120, OpusDecoder.getLostSamples(START_TIME_US, START_TIME_US + 2600));
+    // A gap shorter than 2.5ms is not concealed.
+    assertEquals(0, OpusDecoder.getLostSamples(START_TIME_US, START_TIME_US + 2000));
+  }
+
+  public void testNoLostSamplesForLongGap() {
+    assertEquals(48000, OpusDecoder.getLostSamples(START_TIME_US, START_TIME_US + 1000000));
+    assertEquals(0, OpusDecoder.getLostSamples(START_TIME_US, START_TIME_US + 1100000));
+  }
+
+  public void testFecSamplesLimitedByPacket() {
+    // A single lost 20ms packet is recovered from the next packet's FEC data.
+    assertEquals(960, OpusDecoder.getFecSamples(960, 960));
+    // Only the samples immediately before a packet can be recovered. The rest are concealed.
+    assertEquals(960, OpusDecoder.getFecSamples(2880, 960));
+    assertEquals(0, OpusDecoder.getFecSamples(0, 960));
+  }
+
+  public void testFecSamplesRoundedDownToGranularity() {
+    assertEquals(120, OpusDecoder.getFecSamples(960, 200));
+  }
+
+  public void testOutputSamplesAtDecoderRate() {
+    assertEquals(960, OpusDecoder.getOutputSamples(960, 48000));
+    assertEquals(0, OpusDecoder.getOutputSamples(0, 48000));
+  }
+
+  public void testOutputSamplesRoundedUpWhenResampling() {
+    assertEquals(882, OpusDecoder.getOutputSamples(960, 44100));
+    // 120 samples is 110.25 samples at 44100Hz.
+    assertEquals(111, OpusDecoder.getOutputSamples(120, 44100));
+  }
+
+  public void testRequiredOutputSamples() {
+    assertEquals(960, OpusDecoder.getRequiredOutputSamples(0, 0, 960, 48000));
+    assertEquals(2880, OpusDecoder.getRequiredOutputSamples(960, 960, 960, 48000));
+    // Each part is rounded up separately, since each is written by a separate native call.
+    assertEquals(111 + 111 + 882, OpusDecoder.getRequiredOutputSamples(120, 120, 960, 44100));
+  }
+
+  public void testPacketSamplesSingleFrame() {
+    // SILK 20ms.
+    assertEquals(960, OpusDecoder.getPacketSamples(packet(0x08)));
+    // Hybrid 20ms.
+    assertEquals(960, OpusDecoder.getPacketSamples(packet(0x68)));
+    // CELT 2.5ms and 20ms.
+    assertEquals(120, OpusDecoder.getPacketSamples(packet(0x80)));
+    assertEquals(960, OpusDecoder.getPacketSamples(packet(0xF8)));
+  }
+
+  public void testPacketSamplesMultipleFrames() {
+    // Two SILK 60ms frames of equal and different sizes.
+    assertEquals(5760, OpusDecoder.getPacketSamples(packet(0x19)));
+    assertEquals(5760, OpusDecoder.getPacketSamples(packet(0x1A)));
+    // Three CELT 20ms frames, with the frame count in the second byte.
+    assertEquals(2880, OpusDecoder.getPacketSamples(packet(0xFB, 0x03)));
+  }
+
+  public void testPacketSamplesMalformed() {
+    assertEquals(-1, OpusDecoder.getPacketSamples(packet()));
+    // A code 3 packet without a frame count, and one with no frames.
+    assertEquals(-1, OpusDecoder.getPacketSamples(packet(0xFB)));
+    assertEquals(-1, OpusDecoder.getPacketSamples(packet(0xFB, 0x00)));
+    // Three SILK 60ms frames exceed the maximum packet duration of 120ms.
+    assertEquals(-1, OpusDecoder.getPacketSamples(packet(0x1B, 0x03)));
+  }
+
+  public void testPacketSamplesReadsFromPosition() {
+    ByteBuffer buffer = ByteBuffer.wrap(new byte[] {(byte) 0xF8, (byte) 0x80, 0});
+    buffer.position(1);
+    assertEquals(120, OpusDecoder.getPacketSamples(buffer));
+    assertEquals(1, buffer.position());
+  }
+
+  private static ByteBuffer packet(int... bytes) {
+    ByteBuffer packet = ByteBuffer.allocate(bytes.length);
+    for (int value : bytes) {
+      packet.put((byte) value);
+    }
+    packet.flip();
+    return packet;
+  }
+
+}
@@ -29,6 +29,7 @@ import com.google.android.exoplayer.audio.AudioTrack;
 import com.google.android.exoplayer.util.MimeTypes;
 import com.google.android.exoplayer.util.extensions.Buffer;
 import com.google.android.exoplayer.util.extensions.InputBuffer;
+import com.google.android.exoplayer.util.extensions.NativeDecoderCounters;
 
 import android.os.Handler;
 
@@ -74,14 +75,33 @@ public final class LibopusAudioTrackRenderer extends SampleSourceTrackRenderer
    * should be a {@link Float} with 0 being silence and 1 being unity gain.
    */
   public static final int MSG_SET_VOLUME = 1;
+  /**
+   * The type of a message that can be passed to an instance of this class via
+   * {@link ExoPlayer#sendMessage} or {@link ExoPlayer#blockingSendMessage}. The message object
+   * should be a {@link Boolean} indicating whether gaps between packets should be concealed by the
+   * decoder. See {@link OpusDecoder#setPacketLossConcealmentEnabled(boolean)}.
+   */
+  public static final int MSG_SET_PACKET_LOSS_CONCEALMENT = 2;
+
+  /**
+   * The maximum capacity that can be passed to {@link #setDecoderPoolCapacity(int)}.
+   */
+  public static final int MAX_DECODER_POOL_CAPACITY = OpusDecoder.MAX_DECODER_POOL_CAPACITY;
 
   private static final int NUM_BUFFERS = 16;
   private static final int INITIAL_INPUT_BUFFER_SIZE = 960 * 6;
 
   public final CodecCounters codecCounters = new CodecCounters();
+  /**
+   * Timings and counts of the work done by the native decoder, updated on the playback thread.
+   */
+  public final NativeDecoderCounters nativeDecoderCounters = new NativeDecoderCounters();
 
   private final Handler eventHandler;
   private final EventListener eventListener;
+  private final boolean downmixToStereo;
+  private final long memoryBudget;
+  private final int outputSampleRate;
   private final AudioTrack audioTrack;
   private final MediaFormatHolder formatHolder;
 
@@ -97,6 +117,7 @@ public final class LibopusAudioTrackRenderer extends SampleSourceTrackRenderer
   private boolean sourceIsReady;
 
   private int audioSessionId;
+  private boolean packetLossConcealmentEnabled;
 
   /**
    * @param source The upstream source from which the renderer obtains samples.
@@ -113,9 +134,63 @@ public final class LibopusAudioTrackRenderer extends SampleSourceTrackRenderer
    */
   public LibopusAudioTrackRenderer(SampleSource source, Handler eventHandler,
       EventListener eventListener) {
+    this(source, eventHandler, eventListener, false);
+  }
+
+  /**
+   * @param source The upstream source from which the renderer obtains samples.
+   * @param eventHandler A handler to use when delivering events to {@code eventListener}. May be
+   *     null if delivery of events is not required.
+   * @param eventListener A listener of events. May be null if delivery of events is not required.
+   * @param downmixToStereo Whether streams with more than two channels should be downmixed to
+   *     stereo by the decoder, rather than being passed to the audio track as is.
+   */
+  public LibopusAudioTrackRenderer(SampleSource source, Handler eventHandler,
+      EventListener eventListener, boolean downmixToStereo) {
+    this(source, eventHandler, eventListener, downmixToStereo, 0);
+  }
+
+  /**
+   * @param source The upstream source from which the renderer obtains samples.
+   * @param eventHandler A handler to use when delivering events to {@code eventListener}. May be
+   *     null if delivery of events is not required.
+   * @param eventListener A listener of events. May be null if delivery of events is not required.
+   * @param downmixToStereo Whether streams with more than two channels should be downmixed to
+   *     stereo by the decoder, rather than being passed to the audio track as is.
+   * @param memoryBudget The maximum native memory that each decoder may use in bytes, or 0 if there
+   *     is no limit. Playback of a stream that would need more fails with a decoder error. The
+   *     memory in use is reported by {@link NativeDecoderCounters#memoryUsageBytes}.
+   */
+  public LibopusAudioTrackRenderer(SampleSource source, Handler eventHandler,
+      EventListener eventListener, boolean downmixToStereo, long memoryBudget) {
+    this(source, eventHandler, eventListener, downmixToStereo, memoryBudget, 0);
+  }
+
+  /**
+   * @param source The upstream source from which the renderer obtains samples.
+   * @param eventHandler A handler to use when delivering events to {@code eventListener}. May be
+   *     null if delivery of events is not required.
+   * @param eventListener A listener of events. May be null if delivery of events is not required.
+   * @param downmixToStereo Whether streams with more than two channels should be downmixed to
+   *     stereo by the decoder, rather than being passed to the audio track as is.
+   * @param memoryBudget The maximum native memory that each decoder may use in bytes, or 0 if there
+   *     is no limit. Playback of a stream that would need more fails with a decoder error. The
+   *     memory in use is reported by {@link NativeDecoderCounters#memoryUsageBytes}.
+   * @param outputSampleRate The sample rate to which the decoder resamples its output, or 0 to pass
+   *     audio to the audio track at the 48000 Hz at which Opus is decoded. Passing the native
+   *     sample rate of the device, from
+   *     {@link android.media.AudioManager#PROPERTY_OUTPUT_SAMPLE_RATE}, avoids resampling by the
+   *     platform.
+   */
+  public LibopusAudioTrackRenderer(SampleSource source, Handler eventHandler,
+      EventListener eventListener, boolean downmixToStereo, long memoryBudget,
+      int outputSampleRate) {
     super(source);
     this.eventHandler = eventHandler;
     this.eventListener = eventListener;
+    this.downmixToStereo = downmixToStereo;
+    this.memoryBudget = memoryBudget;
+    this.outputSampleRate = outputSampleRate;
     this.audioSessionId = AudioTrack.SESSION_ID_NOT_SET;
     audioTrack = new AudioTrack();
     formatHolder = new MediaFormatHolder();
@@ -135,6 +210,21 @@ public final class LibopusAudioTrackRenderer extends SampleSourceTrackRenderer
     return isLibopusAvailable() ? OpusDecoder.getLibopusVersion() : null;
   }
 
+  /**
+   * Sets the number of released decoders that are kept warm for reuse by renderers playing streams
+   * with the same channel layout. Reusing a decoder avoids allocating and initializing libopus
+   * state when renderers are replaced in quick succession, for example when switching between
+   * content and ads. The pool is empty by default. Lowering the capacity destroys the excess
+   * decoders. Does nothing if libopus is not available.
+   *
+   * @param capacity The capacity of the pool, from zero to {@link #MAX_DECODER_POOL_CAPACITY}.
+   */
+  public static void setDecoderPoolCapacity(int capacity) {
+    if (isLibopusAvailable()) {
+      OpusDecoder.setDecoderPoolCapacity(capacity);
+    }
+  }
+
   @Override
   protected MediaClock getMediaClock() {
     return this;
@@ -172,7 +262,9 @@ public final class LibopusAudioTrackRenderer extends SampleSourceTrackRenderer
       }
       try {
         decoder = new OpusDecoder(NUM_BUFFERS, NUM_BUFFERS, INITIAL_INPUT_BUFFER_SIZE,
-            initializationData);
+            initializationData, C.ENCODING_PCM_16BIT, downmixToStereo, memoryBudget,
+            outputSampleRate);
+        decoder.setPacketLossConcealmentEnabled(packetLossConcealmentEnabled);
       } catch (OpusDecoderException e) {
         notifyDecoderError(e);
         throw new ExoPlaybackException(e);
@@ -195,6 +287,8 @@ public final class LibopusAudioTrackRenderer extends SampleSourceTrackRenderer
       notifyDecoderError(e);
       throw new ExoPlaybackException(e);
     }
+    decoder.updateCounters(nativeDecoderCounters);
+    nativeDecoderCounters.ensureUpdated();
     codecCounters.ensureUpdated();
   }
 
@@ -345,6 +439,9 @@ public final class LibopusAudioTrackRenderer extends SampleSourceTrackRenderer
     audioSessionId = AudioTrack.SESSION_ID_NOT_SET;
     try {
       if (decoder != null) {
+        decoder.updateCounters(nativeDecoderCounters);
+        nativeDecoderCounters.memoryUsageBytes = 0;
+        nativeDecoderCounters.ensureUpdated();
         decoder.release();
         decoder = null;
         codecCounters.codecReleaseCount++;
@@ -359,8 +456,9 @@ public final class LibopusAudioTrackRenderer extends SampleSourceTrackRenderer
     int result = readSource(positionUs, formatHolder, null);
     if (result == SampleSource.FORMAT_READ) {
       format = formatHolder.format;
-      audioTrack.configure(MimeTypes.AUDIO_RAW, format.channelCount, format.sampleRate,
-          C.ENCODING_PCM_16BIT);
+      int channelCount = downmixToStereo && format.channelCount > 2 ? 2 : format.channelCount;
+      audioTrack.configure(MimeTypes.AUDIO_RAW, channelCount,
+          outputSampleRate != 0 ? outputSampleRate : format.sampleRate, C.ENCODING_PCM_16BIT);
       return true;
     }
     return false;
@@ -370,6 +468,11 @@ public final class LibopusAudioTrackRenderer extends SampleSourceTrackRenderer
   public void handleMessage(int messageType, Object message) throws ExoPlaybackException {
     if (messageType == MSG_SET_VOLUME) {
       audioTrack.setVolume((Float) message);
+    } else if (messageType == MSG_SET_PACKET_LOSS_CONCEALMENT) {
+      packetLossConcealmentEnabled = (Boolean) message;
+      if (decoder != null) {
+        decoder.setPacketLossConcealmentEnabled(packetLossConcealmentEnabled);
+      }
     } else {
       super.handleMessage(messageType, message);
     }
@@ -15,9 +15,11 @@
  */
 package com.google.android.exoplayer.ext.opus;
 
+import com.google.android.exoplayer.C;
 import com.google.android.exoplayer.SampleHolder;
 import com.google.android.exoplayer.util.extensions.Buffer;
 import com.google.android.exoplayer.util.extensions.InputBuffer;
+import com.google.android.exoplayer.util.extensions.NativeDecoderCounters;
 import com.google.android.exoplayer.util.extensions.SimpleDecoder;
 
 import java.nio.ByteBuffer;
@@ -51,6 +53,22 @@ import java.util.List;
    */
   public static native String getLibopusVersion();
 
+  /**
+   * The maximum capacity of the native decoder pool.
+   */
+  public static final int MAX_DECODER_POOL_CAPACITY = 4;
+
+  /**
+   * Sets the number of released decoders that are kept initialized by the native code, for reuse
+   * by later decoders created with the same channel layout. Decoders beyond the new capacity are
+   * destroyed.
+   *
+   * @param capacity The capacity of the pool, from zero to {@link #MAX_DECODER_POOL_CAPACITY}.
+   */
+  public static void setDecoderPoolCapacity(int capacity) {
+    opusSetDecoderPoolCapacity(capacity);
+  }
+
   private static final int DEFAULT_SEEK_PRE_ROLL_SAMPLES = 3840;
 
   /**
@@ -58,12 +76,47 @@ import java.util.List;
    */
   private static final int SAMPLE_RATE = 48000;
 
+  /**
+   * The granularity of concealed audio, since libopus can only conceal multiples of 2.5ms.
+   */
+  private static final int CONCEALMENT_GRANULARITY_SAMPLES = 120;
+
+  /**
+   * The maximum duration of a gap that will be concealed. Larger gaps are assumed to be
+   * discontinuities rather than lost packets.
+   */
+  private static final int MAX_CONCEALED_SAMPLES = SAMPLE_RATE;
+
+  /**
+   * The maximum number of queued packets that are decoded into one output buffer by a single call
+   * into the native decoder.
+   */
+  private static final int MAX_BATCH_PACKETS = 8;
+
+  /**
+   * The maximum duration of an Opus packet, which is 120ms.
+   */
+  private static final int MAX_PACKET_SAMPLES = 5760;
+
   private final int channelCount;
+  private final int outputChannelCount;
+  private final int outputSampleRate;
+  private final int outputBytesPerSample;
   private final int headerSkipSamples;
   private final int headerSeekPreRollSamples;
   private final long nativeDecoderContext;
+  private final long[] statsSnapshot;
+  private final long[] previousStatsSnapshot;
+
+  private final int[] batchOffsets;
+  private final int[] batchSizes;
+  private final int[] batchSampleCounts;
 
   private int skipSamples;
+  private long nextTimeUs;
+  private boolean drainPending;
+  private volatile boolean packetLossConcealmentEnabled;
+  private ByteBuffer batchInputBuffer;
 
   /**
    * Creates an Opus decoder.
@@ -78,6 +131,80 @@ import java.util.List;
    */
   public OpusDecoder(int numInputBuffers, int numOutputBuffers, int initialInputBufferSize,
       List<byte[]> initializationData) throws OpusDecoderException {
+    this(numInputBuffers, numOutputBuffers, initialInputBufferSize, initializationData,
+        C.ENCODING_PCM_16BIT, false);
+  }
+
+  /**
+   * Creates an Opus decoder.
+   *
+   * @param numInputBuffers The number of input buffers.
+   * @param numOutputBuffers The number of output buffers.
+   * @param initialInputBufferSize The initial size of each input buffer.
+   * @param initializationData Codec-specific initialization data. The first element must contain an
+   *     opus header. Optionally, the list may contain two additional buffers, which must contain
+   *     the encoder delay and seek pre roll values in nanoseconds, encoded as longs.
+   * @param outputEncoding The encoding of the output, which must be {@link C#ENCODING_PCM_16BIT}
+   *     or {@link C#ENCODING_PCM_FLOAT}.
+   * @param downmixToStereo Whether streams with more than two channels should be downmixed to
+   *     stereo by the decoder.
+   * @throws OpusDecoderException Thrown if an exception occurs when initializing the decoder.
+   */
+  public OpusDecoder(int numInputBuffers, int numOutputBuffers, int initialInputBufferSize,
+      List<byte[]> initializationData, int outputEncoding, boolean downmixToStereo)
+      throws OpusDecoderException {
+    this(numInputBuffers, numOutputBuffers, initialInputBufferSize, initializationData,
+        outputEncoding, downmixToStereo, 0);
+  }
+
+  /**
+   * Creates an Opus decoder.
+   *
+   * @param numInputBuffers The number of input buffers.
+   * @param numOutputBuffers The number of output buffers.
+   * @param initialInputBufferSize The initial size of each input buffer.
+   * @param initializationData Codec-specific initialization data. The first element must contain an
+   *     opus header. Optionally, the list may contain two additional buffers, which must contain
+   *     the encoder delay and seek pre roll values in nanoseconds, encoded as longs.
+   * @param outputEncoding The encoding of the output, which must be {@link C#ENCODING_PCM_16BIT}
+   *     or {@link C#ENCODING_PCM_FLOAT}.
+   * @param downmixToStereo Whether streams with more than two channels should be downmixed to
+   *     stereo by the decoder.
+   * @param memoryBudget The maximum native memory that the decoder may use in bytes, or 0 if there
+   *     is no limit. The native memory of an Opus decoder is allocated in full when it is created.
+   * @throws OpusDecoderException Thrown if an exception occurs when initializing the decoder, or if
+   *     the decoder would exceed the memory budget.
+   */
+  public OpusDecoder(int numInputBuffers, int numOutputBuffers, int initialInputBufferSize,
+      List<byte[]> initializationData, int outputEncoding, boolean downmixToStereo,
+      long memoryBudget) throws OpusDecoderException {
+    this(numInputBuffers, numOutputBuffers, initialInputBufferSize, initializationData,
+        outputEncoding, downmixToStereo, memoryBudget, 0);
+  }
+
+  /**
+   * Creates an Opus decoder.
+   *
+   * @param numInputBuffers The number of input buffers.
+   * @param numOutputBuffers The number of output buffers.
+   * @param initialInputBufferSize The initial size of each input buffer.
+   * @param initializationData Codec-specific initialization data. The first element must contain an
+   *     opus header. Optionally, the list may contain two additional buffers, which must contain
+   *     the encoder delay and seek pre roll values in nanoseconds, encoded as longs.
+   * @param outputEncoding The encoding of the output, which must be {@link C#ENCODING_PCM_16BIT}
+   *     or {@link C#ENCODING_PCM_FLOAT}.
+   * @param downmixToStereo Whether streams with more than two channels should be downmixed to
+   *     stereo by the decoder.
+   * @param memoryBudget The maximum native memory that the decoder may use in bytes, or 0 if there
+   *     is no limit. The native memory of an Opus decoder is allocated in full when it is created.
+   * @param outputSampleRate The sample rate to which the decoder resamples its output, in the same
+   *     pass as any downmixing, or 0 to output at the 48000 Hz at which Opus is decoded.
+   * @throws OpusDecoderException Thrown if an exception occurs when initializing the decoder, or if
+   *     the decoder would exceed the memory budget.
+   */
+  public OpusDecoder(int numInputBuffers, int numOutputBuffers, int initialInputBufferSize,
+      List<byte[]> initializationData, int outputEncoding, boolean downmixToStereo,
+      long memoryBudget, int outputSampleRate) throws OpusDecoderException {
     super(new InputBuffer[numInputBuffers], new OpusOutputBuffer[numOutputBuffers]);
     byte[] headerBytes = initializationData.get(0);
     if (headerBytes.length < 19) {
@@ -87,6 +214,19 @@ import java.util.List;
     if (channelCount > 8) {
       throw new OpusDecoderException("Invalid channel count: " + channelCount);
     }
+    boolean floatOutput;
+    if (outputEncoding == C.ENCODING_PCM_16BIT) {
+      floatOutput = false;
+      outputBytesPerSample = 2;
+    } else if (outputEncoding == C.ENCODING_PCM_FLOAT) {
+      floatOutput = true;
+      outputBytesPerSample = 4;
+    } else {
+      throw new OpusDecoderException("Unsupported output encoding: " + outputEncoding);
+    }
+    downmixToStereo &= channelCount > 2;
+    outputChannelCount = downmixToStereo ? 2 : channelCount;
+    this.outputSampleRate = outputSampleRate != 0 ? outputSampleRate : SAMPLE_RATE;
     int preskip = readLittleEndian16(headerBytes, 10);
     int gain = readLittleEndian16(headerBytes, 16);
 
@@ -127,13 +267,67 @@ import java.util.List;
       headerSeekPreRollSamples = DEFAULT_SEEK_PRE_ROLL_SAMPLES;
     }
     nativeDecoderContext = opusInit(SAMPLE_RATE, channelCount, numStreams, numCoupled, gain,
-        streamMap);
+        streamMap, floatOutput, downmixToStereo, memoryBudget, outputSampleRate);
     if (nativeDecoderContext == 0) {
       throw new OpusDecoderException("Failed to initialize decoder");
     }
+    statsSnapshot = new long[NativeDecoderCounters.SNAPSHOT_SIZE];
+    previousStatsSnapshot = new long[NativeDecoderCounters.SNAPSHOT_SIZE];
+    batchOffsets = new int[MAX_BATCH_PACKETS];
+    batchSizes = new int[MAX_BATCH_PACKETS];
+    batchSampleCounts = new int[MAX_BATCH_PACKETS];
     setInitialInputBufferSize(initialInputBufferSize);
   }
 
+  /**
+   * Sets whether gaps between the timestamps of consecutive packets should be treated as lost
+   * packets and concealed. Concealed audio is prepended to the output of the packet that follows
+   * the gap, recovering as much as possible from that packet's forward error correction data and
+   * using packet loss concealment for the remainder.
+   * <p>
+   * While concealment is disabled, packets that are already queued are decoded in batches, with a
+   * single call into the native decoder for each output buffer. Each packet is decoded on its own
+   * while concealment is enabled, since a gap before any packet must be concealed first.
+   *
+   * @param enabled Whether packet loss concealment is enabled.
+   */
+  public void setPacketLossConcealmentEnabled(boolean enabled) {
+    packetLossConcealmentEnabled = enabled;
+  }
+
+  /**
+   * Adds the work done by the native decoder since the previous call to {@code counters}. Must not
+   * be called concurrently with itself, or after {@link #release()}.
+   *
+   * @param counters The counters to update.
+   */
+  public void updateCounters(NativeDecoderCounters counters) {
+    opusGetStats(nativeDecoderContext, statsSnapshot);
+    counters.accumulate(statsSnapshot, previousStatsSnapshot);
+    counters.memoryUsageBytes = getMemoryUsage();
+  }
+
+  /**
+   * Returns the native memory held by the decoder, in bytes.
+   */
+  public long getMemoryUsage() {
+    return opusGetMemoryUsage(nativeDecoderContext);
+  }
+
+  /**
+   * Returns the number of channels in the decoded output.
+   */
+  public int getOutputChannelCount() {
+    return outputChannelCount;
+  }
+
+  /**
+   * Returns the sample rate of the decoded output.
+   */
+  public int getOutputSampleRate() {
+    return outputSampleRate;
+  }
+
   @Override
   public InputBuffer createInputBuffer() {
     return new InputBuffer();
@@ -153,41 +347,163 @@ import java.util.List;
   public OpusDecoderException decode(InputBuffer inputBuffer, OpusOutputBuffer outputBuffer,
       boolean reset) {
     if (reset) {
-      opusReset(nativeDecoderContext);
-      // When seeking to 0, skip number of samples as specified in opus header. When seeking to
-      // any other time, skip number of samples as specified by seek preroll.
-      skipSamples =
-          (inputBuffer.sampleHolder.timeUs == 0) ? headerSkipSamples : headerSeekPreRollSamples;
+      resetDecoder(inputBuffer.sampleHolder.timeUs);
     }
     SampleHolder sampleHolder = inputBuffer.sampleHolder;
-    outputBuffer.timestampUs = sampleHolder.timeUs;
     sampleHolder.data.position(sampleHolder.data.position() - sampleHolder.size);
     int requiredOutputBufferSize =
-        opusGetRequiredOutputBufferSize(sampleHolder.data, sampleHolder.size, SAMPLE_RATE);
+        opusGetRequiredOutputBufferSize(nativeDecoderContext, sampleHolder.data, sampleHolder.size);
     if (requiredOutputBufferSize < 0) {
       return new OpusDecoderException("Error when computing required output buffer size.");
     }
-    outputBuffer.init(requiredOutputBufferSize);
-    int result = opusDecode(nativeDecoderContext, sampleHolder.data, sampleHolder.size,
-        outputBuffer.data, outputBuffer.data.capacity());
+    int bytesPerSample = outputChannelCount * outputBytesPerSample;
+    int packetSamples = requiredOutputBufferSize / bytesPerSample;
+    int lostSamples = packetLossConcealmentEnabled
+        ? getLostSamples(nextTimeUs, sampleHolder.timeUs) : 0;
+    int fecSamples = getFecSamples(lostSamples, packetSamples);
+    int plcSamples = lostSamples - fecSamples;
+    outputBuffer.timestampUs = lostSamples > 0 ? nextTimeUs : sampleHolder.timeUs;
+    outputBuffer.init(getRequiredOutputSamples(plcSamples, fecSamples, packetSamples,
+        outputSampleRate) * bytesPerSample);
+    int result = 0;
+    ByteBuffer packetOutput = outputBuffer.data;
+    if (lostSamples > 0) {
+      if (plcSamples > 0) {
+        result = opusDecodeLost(nativeDecoderContext, plcSamples, outputBuffer.data,
+            outputBuffer.data.capacity());
+        if (result < 0) {
+          return new OpusDecoderException("Concealment error: " + opusGetErrorMessage(result));
+        }
+      }
+      if (fecSamples > 0) {
+        outputBuffer.data.position(result);
+        ByteBuffer fecOutput = outputBuffer.data.slice();
+        int fecResult = opusDecodeFec(nativeDecoderContext, sampleHolder.data, sampleHolder.size,
+            fecSamples, fecOutput, fecOutput.capacity());
+        if (fecResult < 0) {
+          return new OpusDecoderException("FEC decode error: " + opusGetErrorMessage(fecResult));
+        }
+        result += fecResult;
+      }
+      outputBuffer.data.position(result);
+      packetOutput = outputBuffer.data.slice();
+    }
+    int packetResult = opusDecode(nativeDecoderContext, sampleHolder.data, sampleHolder.size,
+        packetOutput, packetOutput.capacity());
+    if (packetResult < 0) {
+      return new OpusDecoderException("Decode error: " + opusGetErrorMessage(packetResult));
+    }
+    result += packetResult;
+    nextTimeUs = sampleHolder.timeUs + (packetResult / bytesPerSample) * C.MICROS_PER_SECOND
+        / outputSampleRate;
+    setOutputSize(outputBuffer, result);
+    return null;
+  }
+
+  @Override
+  protected void onEndOfStream() {
+    // When resampling, the converter holds the output for the end of the last packet.
+    drainPending = opusGetDrainSize(nativeDecoderContext) > 0;
+  }
+
+  @Override
+  protected boolean hasPendingOutput() {
+    return drainPending;
+  }
+
+  @Override
+  protected OpusDecoderException decodePendingOutput(OpusOutputBuffer outputBuffer) {
+    drainPending = false;
+    outputBuffer.timestampUs = nextTimeUs;
+    outputBuffer.init(opusGetDrainSize(nativeDecoderContext));
+    int result = opusDrain(nativeDecoderContext, outputBuffer.data,
+        outputBuffer.data.capacity());
+    if (result < 0) {
+      return new OpusDecoderException("Drain error: " + opusGetErrorMessage(result));
+    }
+    setOutputSize(outputBuffer, result);
+    return null;
+  }
+
+  @Override
+  protected int getMaxInputBuffersPerDecode() {
+    return packetLossConcealmentEnabled ? 1 : MAX_BATCH_PACKETS;
+  }
+
+  @Override
+  protected OpusDecoderException decode(List<InputBuffer> inputBuffers,
+      OpusOutputBuffer outputBuffer, boolean reset) {
+    if (reset) {
+      resetDecoder(inputBuffers.get(0).sampleHolder.timeUs);
+    }
+    int packetCount = inputBuffers.size();
+    int totalInputSize = 0;
+    for (int i = 0; i < packetCount; i++) {
+      totalInputSize += inputBuffers.get(i).sampleHolder.size;
+    }
+    if (batchInputBuffer == null || batchInputBuffer.capacity() < totalInputSize) {
+      batchInputBuffer = ByteBuffer.allocateDirect(totalInputSize);
+    }
+    // The packets are copied into one buffer, so that the native decoder looks up a single address,
+    // and the output is sized from the durations in their TOC bytes.
+    batchInputBuffer.clear();
+    int outputSamples = 0;
+    for (int i = 0; i < packetCount; i++) {
+      SampleHolder sampleHolder = inputBuffers.get(i).sampleHolder;
+      ByteBuffer packet = sampleHolder.data.duplicate();
+      packet.limit(packet.position());
+      packet.position(packet.position() - sampleHolder.size);
+      int packetSamples = getPacketSamples(packet);
+      if (packetSamples < 0) {
+        return new OpusDecoderException("Invalid packet in batch");
+      }
+      outputSamples += getOutputSamples(packetSamples);
+      batchOffsets[i] = batchInputBuffer.position();
+      batchSizes[i] = sampleHolder.size;
+      batchInputBuffer.put(packet);
+    }
+    int bytesPerSample = outputChannelCount * outputBytesPerSample;
+    outputBuffer.timestampUs = inputBuffers.get(0).sampleHolder.timeUs;
+    outputBuffer.init(outputSamples * bytesPerSample);
+    int result = opusDecodeBatch(nativeDecoderContext, batchInputBuffer, batchOffsets, batchSizes,
+        packetCount, outputBuffer.data, outputBuffer.data.capacity(), batchSampleCounts);
     if (result < 0) {
       return new OpusDecoderException("Decode error: " + opusGetErrorMessage(result));
     }
+    nextTimeUs = inputBuffers.get(packetCount - 1).sampleHolder.timeUs
+        + batchSampleCounts[packetCount - 1] * C.MICROS_PER_SECOND / outputSampleRate;
+    setOutputSize(outputBuffer, result);
+    return null;
+  }
+
+  private void resetDecoder(long timeUs) {
+    opusReset(nativeDecoderContext);
+    // When seeking to 0, skip number of samples as specified in opus header. When seeking to
+    // any other time, skip number of samples as specified by seek preroll.
+    skipSamples = getOutputSamples((timeUs == 0) ? headerSkipSamples : headerSeekPreRollSamples);
+    nextTimeUs = C.UNKNOWN_TIME_US;
+    drainPending = false;
+  }
+
+  /**
+   * Sets the limit of {@code outputBuffer} to the {@code size} bytes of decoded samples, and skips
+   * any of them that remain to be skipped.
+   */
+  private void setOutputSize(OpusOutputBuffer outputBuffer, int size) {
+    int bytesPerSample = outputChannelCount * outputBytesPerSample;
     outputBuffer.data.position(0);
-    outputBuffer.data.limit(result);
+    outputBuffer.data.limit(size);
     if (skipSamples > 0) {
-      int bytesPerSample = channelCount * 2;
       int skipBytes = skipSamples * bytesPerSample;
-      if (result <= skipBytes) {
-        skipSamples -= result / bytesPerSample;
+      if (size <= skipBytes) {
+        skipSamples -= size / bytesPerSample;
         outputBuffer.setFlag(Buffer.FLAG_DECODE_ONLY);
-        outputBuffer.data.position(result);
+        outputBuffer.data.position(size);
       } else {
         skipSamples = 0;
         outputBuffer.data.position(skipBytes);
       }
     }
-    return null;
   }
 
   @Override
@@ -197,15 +513,123 @@ import java.util.List;
   }
 
   private native long opusInit(int sampleRate, int channelCount, int numStreams, int numCoupled,
-      int gain, byte[] streamMap);
-  private native int opusDecode(long decoder, ByteBuffer inputBuffer, int inputSize,
+      int gain, byte[] streamMap, boolean floatOutput, boolean downmixToStereo,
+      long memoryBudget, int outputSampleRate);
+  private native int opusDecode(long context, ByteBuffer inputBuffer, int inputSize,
       ByteBuffer outputBuffer, int outputSize);
-  private native int opusGetRequiredOutputBufferSize(
-      ByteBuffer inputBuffer, int inputSize, int sampleRate);
-  private native void opusClose(long decoder);
-  private native void opusReset(long decoder);
+  private native int opusDecodeLost(long context, int lostSamples, ByteBuffer outputBuffer,
+      int outputSize);
+  private native int opusDecodeFec(long context, ByteBuffer inputBuffer, int inputSize,
+      int lostSamples, ByteBuffer outputBuffer, int outputSize);
+  private native int opusDecodeBatch(long context, ByteBuffer inputBuffer, int[] inputOffsets,
+      int[] inputSizes, int packetCount, ByteBuffer outputBuffer, int outputSize,
+      int[] sampleCounts);
+  private native int opusGetRequiredOutputBufferSize(long context, ByteBuffer inputBuffer,
+      int inputSize);
+  private native int opusGetDrainSize(long context);
+  private native int opusDrain(long context, ByteBuffer outputBuffer, int outputSize);
+  private native void opusClose(long context);
+  private static native void opusSetDecoderPoolCapacity(int capacity);
+  private native void opusReset(long context);
+  private native void opusGetStats(long context, long[] stats);
+  private native long opusGetMemoryUsage(long context);
   private native String opusGetErrorMessage(int errorCode);
 
+  private int getOutputSamples(int samples) {
+    return getOutputSamples(samples, outputSampleRate);
+  }
+
+  /**
+   * Returns the number of samples that should be concealed before a packet with the specified
+   * timestamp, or 0 if there is no gap before the packet or the gap is too long to conceal.
+   *
+   * @param nextTimeUs The time at which the output of the previous packet ended, or
+   *     {@link C#UNKNOWN_TIME_US} if there is no previous packet.
+   * @param timeUs The timestamp of the packet.
+   */
+  /* package */ static int getLostSamples(long nextTimeUs, long timeUs) {
+    if (nextTimeUs == C.UNKNOWN_TIME_US || timeUs <= nextTimeUs) {
+      return 0;
+    }
+    long lostSamples = (timeUs - nextTimeUs) * SAMPLE_RATE / C.MICROS_PER_SECOND;
+    if (lostSamples > MAX_CONCEALED_SAMPLES) {
+      return 0;
+    }
+    return (int) (lostSamples - lostSamples % CONCEALMENT_GRANULARITY_SAMPLES);
+  }
+
+  /**
+   * Returns how many of {@code lostSamples} can be recovered from the forward error correction
+   * data of a packet of {@code packetSamples} samples. The rest are concealed.
+   */
+  /* package */ static int getFecSamples(int lostSamples, int packetSamples) {
+    return Math.min(lostSamples, packetSamples - packetSamples % CONCEALMENT_GRANULARITY_SAMPLES);
+  }
+
+  /**
+   * Returns the number of samples per channel for which an output buffer must have room, when a
+   * packet is decoded after concealing a gap. Each native call writes at most the number of
+   * samples it decodes at the output rate, rounded up.
+   */
+  /* package */ static int getRequiredOutputSamples(int plcSamples, int fecSamples,
+      int packetSamples, int outputSampleRate) {
+    return getOutputSamples(plcSamples, outputSampleRate)
+        + getOutputSamples(fecSamples, outputSampleRate)
+        + getOutputSamples(packetSamples, outputSampleRate);
+  }
+
+  /**
+   * Returns the maximum number of samples per channel that are output at
+   * {@code outputSampleRate} for the specified number of samples decoded at {@link #SAMPLE_RATE}.
+   */
+  /* package */ static int getOutputSamples(int samples, int outputSampleRate) {
+    return (int) (((long) samples * outputSampleRate + SAMPLE_RATE - 1) / SAMPLE_RATE);
+  }
+
+  /**
+   * Returns the number of samples per channel at {@link #SAMPLE_RATE} in an Opus packet, from its
+   * TOC byte and frame count as described in RFC 6716, or -1 if the packet is malformed. The
+   * position and limit of {@code packet} delimit the packet, and are not changed.
+   */
+  /* package */ static int getPacketSamples(ByteBuffer packet) {
+    int size = packet.remaining();
+    if (size < 1) {
+      return -1;
+    }
+    int toc = packet.get(packet.position()) & 0xFF;
+    int config = toc >> 3;
+    int frameSamples;
+    if (config < 12) {
+      // SILK frames of 10, 20, 40 or 60ms.
+      int sizeIndex = config & 3;
+      frameSamples = sizeIndex == 3 ? 2880 : 480 << sizeIndex;
+    } else if (config < 16) {
+      // Hybrid frames of 10 or 20ms.
+      frameSamples = 480 << (config & 1);
+    } else {
+      // CELT frames of 2.5, 5, 10 or 20ms.
+      frameSamples = 120 << (config & 3);
+    }
+    int frameCount;
+    switch (toc & 3) {
+      case 0:
+        frameCount = 1;
+        break;
+      case 1:
+      case 2:
+        frameCount = 2;
+        break;
+      default:
+        if (size < 2) {
+          return -1;
+        }
+        frameCount = packet.get(packet.position() + 1) & 0x3F;
+        break;
+    }
+    int samples = frameSamples * frameCount;
+    return samples == 0 || samples > MAX_PACKET_SAMPLES ? -1 : samples;
+  }
+
   private static int nsToSamples(long ns) {
     return (int) (ns * SAMPLE_RATE / 1000000000);
   }
@@ -27,7 +27,27 @@ LOCAL_PATH := $(WORKING_DIR)
 LOCAL_MODULE := libopusJNI
 LOCAL_ARM_MODE := arm
 LOCAL_CPP_EXTENSION := .cc
-LOCAL_SRC_FILES := opus_jni.cc
-LOCAL_LDLIBS := -llog -lz -lm
+# The native resampler and the tracing and stats helpers are shared with the
+# FLAC extension.
+FLAC_JNI_PATH := ../../../../flac/src/main/jni
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/$(FLAC_JNI_PATH)
+LOCAL_SRC_FILES := opus_jni.cc $(FLAC_JNI_PATH)/pcm_converter.cc
+LOCAL_LDLIBS := -llog -lz -lm -ldl
 LOCAL_SHARED_LIBRARIES := libopus
 include $(BUILD_SHARED_LIBRARY)
+
+# build opus_benchmark, a standalone executable that decodes Ogg Opus files
+# with libopus, when BUILD_BENCHMARK=true is passed to ndk-build.
+ifeq ($(BUILD_BENCHMARK),true)
+  include $(CLEAR_VARS)
+  LOCAL_PATH := $(WORKING_DIR)
+  LOCAL_MODULE := opus_benchmark
+  LOCAL_ARM_MODE := arm
+  LOCAL_CPP_EXTENSION := .cc
+  LOCAL_SRC_FILES := opus_benchmark.cc
+  LOCAL_CFLAGS := -fPIE
+  LOCAL_LDFLAGS := -fPIE -pie
+  LOCAL_LDLIBS := -lm
+  LOCAL_SHARED_LIBRARIES := libopus
+  include $(BUILD_EXECUTABLE)
+endif
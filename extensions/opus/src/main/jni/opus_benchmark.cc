@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Standalone benchmark of the native Opus decode path, decoding the packets of
+// each Ogg Opus file given on the command line with opus_multistream_decode as
+// opusDecode does. Built by passing BUILD_BENCHMARK=true to ndk-build. See
+// README.md.
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "opus.h"  // NOLINT
+#include "opus_multistream.h"  // NOLINT
+
+#if defined(__aarch64__)
+#define ABI "arm64-v8a"
+#elif defined(__arm__)
+#define ABI "armeabi-v7a"
+#elif defined(__x86_64__)
+#define ABI "x86_64"
+#elif defined(__i386__)
+#define ABI "x86"
+#else
+#define ABI "unknown"
+#endif
+
+// The maximum duration of an Opus packet is 120ms, which is 5760 samples per
+// channel at 48kHz.
+static const int kMaxFrameSize = 5760;
+static const int kSampleRate = 48000;
+
+typedef std::vector<uint8_t> Packet;
+
+// The decoder configuration from an OpusHead header packet.
+struct OpusHeader {
+  int channelCount;
+  int preSkip;
+  int gain;
+  int streamCount;
+  int coupledCount;
+  uint8_t streamMap[255];
+};
+
+static int64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static long getPeakRssKb() {
+  struct rusage usage;
+  return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+}
+
+// Reads the packets of the first logical bitstream of the Ogg file at path.
+// The whole file is read up front so that I/O is not measured.
+static bool readOggPackets(const char* path, std::vector<Packet>* packets) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+  bool haveSerial = false;
+  uint32_t serial = 0;
+  Packet packet;
+  uint8_t header[27];
+  uint8_t segmentTable[255];
+  while (fread(header, 1, sizeof(header), file) == sizeof(header)) {
+    if (memcmp(header, "OggS", 4) != 0) {
+      fprintf(stderr, "Invalid Ogg page in %s\n", path);
+      fclose(file);
+      return false;
+    }
+    const uint32_t pageSerial = header[14] | (header[15] << 8) |
+        (header[16] << 16) | (static_cast<uint32_t>(header[17]) << 24);
+    const int segmentCount = header[26];
+    if (fread(segmentTable, 1, segmentCount, file) !=
+        static_cast<size_t>(segmentCount)) {
+      break;
+    }
+    if (!haveSerial) {
+      serial = pageSerial;
+      haveSerial = true;
+    }
+    for (int i = 0; i < segmentCount; i++) {
+      const size_t offset = packet.size();
+      packet.resize(offset + segmentTable[i]);
+      if (segmentTable[i] > 0 &&
+          fread(&packet[offset], 1, segmentTable[i], file) != segmentTable[i]) {
+        break;
+      }
+      if (pageSerial != serial) {
+        packet.clear();
+      } else if (segmentTable[i] < 255) {
+        // A lacing value below 255 terminates the packet.
+        packets->push_back(packet);
+        packet.clear();
+      }
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+static bool parseOpusHeader(const Packet& packet, OpusHeader* header) {
+  if (packet.size() < 19 || memcmp(&packet[0], "OpusHead", 8) != 0) {
+    return false;
+  }
+  header->channelCount = packet[9];
+  header->preSkip = packet[10] | (packet[11] << 8);
+  header->gain = static_cast<int16_t>(packet[16] | (packet[17] << 8));
+  const int mappingFamily = packet[18];
+  if (mappingFamily == 0) {
+    if (header->channelCount > 2) {
+      return false;
+    }
+    header->streamCount = 1;
+    header->coupledCount = header->channelCount == 2 ? 1 : 0;
+    header->streamMap[0] = 0;
+    header->streamMap[1] = 1;
+    return true;
+  }
+  if (packet.size() < 21u + header->channelCount) {
+    return false;
+  }
+  header->streamCount = packet[19];
+  header->coupledCount = packet[20];
+  memcpy(header->streamMap, &packet[21], header->channelCount);
+  return true;
+}
+
+// Prints the given percentiles of latenciesNs, which is sorted in place.
+static void printLatencies(std::vector<int64_t>* latenciesNs) {
+  if (latenciesNs->empty()) {
+    return;
+  }
+  std::sort(latenciesNs->begin(), latenciesNs->end());
+  static const int kPercentiles[] = {50, 90, 99, 100};
+  printf("  packet latency (us):");
+  for (size_t i = 0; i < sizeof(kPercentiles) / sizeof(kPercentiles[0]); i++) {
+    const size_t index = (latenciesNs->size() - 1) * kPercentiles[i] / 100;
+    printf(" p%d=%.1f", kPercentiles[i], (*latenciesNs)[index] / 1000.0);
+  }
+  printf("\n");
+}
+
+static bool benchmarkFile(const char* path, int iterations, bool floatOutput) {
+  std::vector<Packet> packets;
+  if (!readOggPackets(path, &packets)) {
+    return false;
+  }
+  OpusHeader header;
+  if (packets.size() < 2 || !parseOpusHeader(packets[0], &header)) {
+    fprintf(stderr, "Missing or unsupported OpusHead in %s\n", path);
+    return false;
+  }
+  // The first two packets are the OpusHead and OpusTags headers.
+  const size_t firstAudioPacket = 2;
+  size_t inputSize = 0;
+  for (size_t i = firstAudioPacket; i < packets.size(); i++) {
+    inputSize += packets[i].size();
+  }
+
+  const size_t bytesPerSample = floatOutput ? sizeof(float) : sizeof(int16_t);
+  std::vector<uint8_t> output(kMaxFrameSize * header.channelCount *
+                              bytesPerSample);
+  std::vector<int64_t> latenciesNs;
+  int64_t decodeTimeNs = 0;
+  int64_t sampleCount = 0;
+  for (int i = 0; i < iterations; i++) {
+    int status;
+    OpusMSDecoder* decoder = opus_multistream_decoder_create(
+        kSampleRate, header.channelCount, header.streamCount,
+        header.coupledCount, header.streamMap, &status);
+    if (status != OPUS_OK || decoder == NULL) {
+      fprintf(stderr, "Failed to create decoder for %s: %s\n", path,
+              opus_strerror(status));
+      return false;
+    }
+    opus_multistream_decoder_ctl(decoder, OPUS_SET_GAIN(header.gain));
+    for (size_t j = firstAudioPacket; j < packets.size(); j++) {
+      const Packet& packet = packets[j];
+      const int64_t startNs = nowNs();
+      int result;
+      if (floatOutput) {
+        result = opus_multistream_decode_float(
+            decoder, &packet[0], packet.size(),
+            reinterpret_cast<float*>(&output[0]), kMaxFrameSize, 0);
+      } else {
+        result = opus_multistream_decode(
+            decoder, &packet[0], packet.size(),
+            reinterpret_cast<opus_int16*>(&output[0]), kMaxFrameSize, 0);
+      }
+      const int64_t elapsedNs = nowNs() - startNs;
+      if (result < 0) {
+        fprintf(stderr, "Decode error in %s: %s\n", path,
+                opus_strerror(result));
+        opus_multistream_decoder_destroy(decoder);
+        return false;
+      }
+      latenciesNs.push_back(elapsedNs);
+      decodeTimeNs += elapsedNs;
+      sampleCount += result;
+    }
+    opus_multistream_decoder_destroy(decoder);
+  }
+  if (decodeTimeNs == 0) {
+    return false;
+  }
+
+  // Samples are decoded in place, so there is no separate copy stage.
+  const double decodeSeconds = decodeTimeNs / 1e9;
+  printf("%s [%s]\n", path, ABI);
+  printf("  %zu packets, %.2f s of audio in %.3f s: %.1fx realtime, "
+         "%.2f MB/s\n", latenciesNs.size(),
+         static_cast<double>(sampleCount) / kSampleRate, decodeSeconds,
+         sampleCount / (kSampleRate * decodeSeconds),
+         inputSize * iterations / (decodeSeconds * 1024 * 1024));
+  printLatencies(&latenciesNs);
+  return true;
+}
+
+static void printUsage(const char* name) {
+  fprintf(stderr, "usage: %s [-n iterations] [-f] file.opus...\n"
+          "  -f: decode to float rather than 16-bit samples\n", name);
+}
+
+int main(int argc, char** argv) {
+  int iterations = 1;
+  bool floatOutput = false;
+  int option;
+  while ((option = getopt(argc, argv, "n:f")) != -1) {
+    switch (option) {
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 'f':
+        floatOutput = true;
+        break;
+      default:
+        printUsage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind == argc || iterations <= 0) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  int failures = 0;
+  for (int i = optind; i < argc; i++) {
+    if (!benchmarkFile(argv[i], iterations, floatOutput)) {
+      failures++;
+    }
+  }
+  printf("peak RSS: %ld KB\n", getPeakRssKb());
+  return failures == 0 ? 0 : 1;
+}
@@ -17,9 +17,15 @@
 #include <jni.h>
 
 #include <android/log.h>
+#include <pthread.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
+#include <cstring>
 
+#include "include/decoder_stats.h"
+#include "include/pcm_converter.h"
 #include "opus.h"  // NOLINT
 #include "opus_multistream.h"  // NOLINT
 
@@ -42,64 +48,600 @@ jint JNI_OnLoad(JavaVM* vm, void* reserved) {
   if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
     return -1;
   }
+  initTrace();
   return JNI_VERSION_1_6;
 }
 
-static const int kBytesPerSample = 2;  // opus fixed point uses 16 bit samples.
-static int channelCount;
+// Indices of the running totals kept for each decoder, which must match the
+// indices in NativeDecoderCounters. Opus packets are passed in by Java, so
+// there are no reads or upcalls.
+enum Stat {
+  kStatDecodeCount = 0,
+  kStatDecodeTimeNs = 1,
+  kStatConvertCount = 2,
+  kStatConvertTimeNs = 3,
+  kStatErrorCount = 9,
+};
 
-FUNC(jlong, opusInit, jint sampleRate, jint channelCount, jint numStreams,
-     jint numCoupled, jint gain, jbyteArray jStreamMap) {
-  int status = OPUS_INVALID_STATE;
-  ::channelCount = channelCount;
-  jbyte* streamMapBytes = env->GetByteArrayElements(jStreamMap, 0);
-  uint8_t* streamMap = reinterpret_cast<uint8_t*>(streamMapBytes);
-  OpusMSDecoder* decoder = opus_multistream_decoder_create(
-      sampleRate, channelCount, numStreams, numCoupled, streamMap, &status);
-  env->ReleaseByteArrayElements(jStreamMap, streamMapBytes, 0);
-  if (!decoder || status != OPUS_OK) {
+// The maximum duration of an Opus packet is 120ms, which is 5760 samples per
+// channel at 48kHz.
+static const int kMaxFrameSize = 5760;
+
+// Downmix coefficients (left, right) for each input channel, for the Vorbis
+// channel order used by Opus channel mapping family 1. The LFE channel is
+// dropped. Rows are normalized in opusInit so that the output cannot clip.
+static const float kDownmixCoefficients[9][8][2] = {
+    {}, {}, {},
+    // L, C, R
+    {{1, 0}, {0.7071f, 0.7071f}, {0, 1}},
+    // FL, FR, RL, RR
+    {{1, 0}, {0, 1}, {0.7071f, 0}, {0, 0.7071f}},
+    // FL, C, FR, RL, RR
+    {{1, 0}, {0.7071f, 0.7071f}, {0, 1}, {0.7071f, 0}, {0, 0.7071f}},
+    // FL, C, FR, RL, RR, LFE
+    {{1, 0}, {0.7071f, 0.7071f}, {0, 1}, {0.7071f, 0}, {0, 0.7071f}, {0, 0}},
+    // FL, C, FR, SL, SR, RC, LFE
+    {{1, 0}, {0.7071f, 0.7071f}, {0, 1}, {0.7071f, 0}, {0, 0.7071f},
+     {0.5f, 0.5f}, {0, 0}},
+    // FL, C, FR, SL, SR, RL, RR, LFE
+    {{1, 0}, {0.7071f, 0.7071f}, {0, 1}, {0.7071f, 0}, {0, 0.7071f},
+     {0.7071f, 0}, {0, 0.7071f}, {0, 0}},
+};
+
+// The parameters that an OpusMSDecoder is created with.
+struct DecoderLayout {
+  int sampleRate;
+  int channelCount;
+  int numStreams;
+  int numCoupled;
+  uint8_t streamMap[255];
+
+  bool matches(const DecoderLayout& other) const {
+    return sampleRate == other.sampleRate &&
+        channelCount == other.channelCount &&
+        numStreams == other.numStreams && numCoupled == other.numCoupled &&
+        memcmp(streamMap, other.streamMap, channelCount) == 0;
+  }
+};
+
+// Per-decoder state, so that decoders with different layouts can be used
+// concurrently.
+struct Context {
+  OpusMSDecoder* decoder;
+  DecoderLayout layout;
+  int channelCount;
+  int sampleRate;
+  // Whether samples are output as float rather than 16-bit integers.
+  bool floatOutput;
+  // The number of output channels, which is two when downmixing and
+  // channelCount otherwise.
+  int outputChannelCount;
+  // Normalized kDownmixCoefficients, when downmixing.
+  float downmix[8][2];
+  // Holds samples decoded by libopus before they are downmixed or converted.
+  void* decodeBuffer;
+  // Resamples the decoded samples to the output rate, downmixing them in the
+  // same pass, or NULL if the output is at the rate of the stream.
+  PcmConverter* converter;
+  // The native memory held by the decoder, which is fixed at init.
+  size_t memoryUsage;
+  Stats stats;
+
+  int bytesPerSample() const {
+    return floatOutput ? sizeof(float) : sizeof(int16_t);
+  }
+  int outputBytesPerFrame() const {
+    return bytesPerSample() * outputChannelCount;
+  }
+};
+
+static inline int16_t clampToInt16(float sample) {
+  if (sample >= 32767.0f) {
+    return 32767;
+  } else if (sample <= -32768.0f) {
+    return -32768;
+  }
+  return static_cast<int16_t>(sample + (sample >= 0 ? 0.5f : -0.5f));
+}
+
+static inline float toOutputSample(float sample, float* /* type */) {
+  return sample;
+}
+
+static inline int16_t toOutputSample(float sample, int16_t* /* type */) {
+  return clampToInt16(sample);
+}
+
+template <typename T>
+static void downmixToStereo(const Context* context, const T* input, T* output,
+                            int frameCount) {
+  const int channelCount = context->channelCount;
+  for (int i = 0; i < frameCount; i++) {
+    float left = 0;
+    float right = 0;
+    for (int c = 0; c < channelCount; c++) {
+      left += input[c] * context->downmix[c][0];
+      right += input[c] * context->downmix[c][1];
+    }
+    output[0] = toOutputSample(left, output);
+    output[1] = toOutputSample(right, output);
+    input += channelCount;
+    output += 2;
+  }
+}
+
+// Returns the number of frames written to the output for sampleCount samples
+// per channel decoded by the next call to decodePacket.
+static int getOutputFrameCount(const Context* context, int sampleCount) {
+  return context->converter != NULL
+      ? context->converter->getOutputFrameCount(sampleCount) : sampleCount;
+}
+
+// Decodes a packet into output, which has room for outputFrames frames.
+// frameSize is the number of samples per channel that libopus may decode, which
+// is the exact duration to recover for concealment and FEC. Returns the number
+// of samples decoded per channel, or an Opus error code, and sets
+// outputFrameCount to the number of frames written, which differs only when
+// the output is resampled.
+static int decodePacket(Context* context, const uint8_t* packet,
+                        int packetSize, void* output, int outputFrames,
+                        int frameSize, int decodeFec, int* outputFrameCount) {
+  ScopedTrace trace("opusDecode");
+  PcmConverter* const converter = context->converter;
+  const bool downmix = context->decodeBuffer != NULL && converter == NULL;
+  void* decodeBuffer =
+      context->decodeBuffer != NULL ? context->decodeBuffer : output;
+  if (context->decodeBuffer != NULL && frameSize > kMaxFrameSize) {
+    frameSize = kMaxFrameSize;
+  }
+  if (converter == NULL && frameSize > outputFrames) {
+    frameSize = outputFrames;
+  }
+  const int64_t startNs = nowNs();
+  int sampleCount;
+  if (context->floatOutput) {
+    sampleCount = opus_multistream_decode_float(
+        context->decoder, packet, packetSize,
+        reinterpret_cast<float*>(decodeBuffer), frameSize, decodeFec);
+  } else {
+    sampleCount = opus_multistream_decode(
+        context->decoder, packet, packetSize,
+        reinterpret_cast<int16_t*>(decodeBuffer), frameSize, decodeFec);
+  }
+  if (sampleCount < 0) {
+    context->stats.add(kStatErrorCount, 1);
+    return sampleCount;
+  }
+  context->stats.addCall(kStatDecodeCount, kStatDecodeTimeNs, startNs);
+  *outputFrameCount = sampleCount;
+  if (converter != NULL) {
+    *outputFrameCount = converter->getOutputFrameCount(sampleCount);
+    if (*outputFrameCount > outputFrames) {
+      context->stats.add(kStatErrorCount, 1);
+      return OPUS_BUFFER_TOO_SMALL;
+    }
+    const int64_t convertStartNs = nowNs();
+    if (context->floatOutput) {
+      converter->convert(reinterpret_cast<const float*>(decodeBuffer),
+                         sampleCount, output);
+    } else {
+      converter->convert(reinterpret_cast<const int16_t*>(decodeBuffer),
+                         sampleCount, output);
+    }
+    context->stats.addCall(kStatConvertCount, kStatConvertTimeNs,
+                           convertStartNs);
+  } else if (downmix) {
+    const int64_t downmixStartNs = nowNs();
+    if (context->floatOutput) {
+      downmixToStereo(context, reinterpret_cast<const float*>(decodeBuffer),
+                      reinterpret_cast<float*>(output), sampleCount);
+    } else {
+      downmixToStereo(context, reinterpret_cast<const int16_t*>(decodeBuffer),
+                      reinterpret_cast<int16_t*>(output), sampleCount);
+    }
+    context->stats.addCall(kStatConvertCount, kStatConvertTimeNs,
+                           downmixStartNs);
+  }
+  return sampleCount;
+}
+
+// Decoders kept by opusClose for reuse by opusInit, so that renderers that are
+// replaced in quick succession, for example at ad breaks, do not reallocate
+// them. Empty unless a capacity is set by opusSetDecoderPoolCapacity.
+struct PooledDecoder {
+  DecoderLayout layout;
+  OpusMSDecoder* decoder;
+};
+
+static const int kMaxDecoderPoolCapacity = 4;
+static pthread_mutex_t decoderPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+static PooledDecoder decoderPool[kMaxDecoderPoolCapacity];
+static int decoderPoolSize = 0;
+static int decoderPoolCapacity = 0;
+
+// Takes a pooled decoder with the given layout, or returns NULL if there is
+// none.
+static OpusMSDecoder* takePooledDecoder(const DecoderLayout& layout) {
+  OpusMSDecoder* decoder = NULL;
+  pthread_mutex_lock(&decoderPoolMutex);
+  for (int i = 0; i < decoderPoolSize; i++) {
+    if (decoderPool[i].layout.matches(layout)) {
+      decoder = decoderPool[i].decoder;
+      decoderPool[i] = decoderPool[--decoderPoolSize];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&decoderPoolMutex);
+  return decoder;
+}
+
+// Resets the decoder of a context that is being closed and adds it to the
+// pool. Returns false if the pool is full and the decoder must be destroyed.
+static bool recycleDecoder(Context* context) {
+  if (opus_multistream_decoder_ctl(context->decoder, OPUS_RESET_STATE) !=
+      OPUS_OK) {
+    return false;
+  }
+  pthread_mutex_lock(&decoderPoolMutex);
+  const bool pooled = decoderPoolSize < decoderPoolCapacity;
+  if (pooled) {
+    PooledDecoder* pooledDecoder = &decoderPool[decoderPoolSize++];
+    pooledDecoder->layout = context->layout;
+    pooledDecoder->decoder = context->decoder;
+  }
+  pthread_mutex_unlock(&decoderPoolMutex);
+  return pooled;
+}
+
+// Creates a decoder with a single allocation of the size that libopus reports
+// for the layout, rather than letting libopus allocate it, so that its size is
+// known before it is allocated.
+static OpusMSDecoder* createDecoder(const DecoderLayout& layout,
+                                    size_t decoderSize) {
+  OpusMSDecoder* decoder =
+      reinterpret_cast<OpusMSDecoder*>(malloc(decoderSize));
+  if (!decoder) {
+    LOGE("Failed to allocate Opus Decoder");
+    return NULL;
+  }
+  const int status = opus_multistream_decoder_init(
+      decoder, layout.sampleRate, layout.channelCount, layout.numStreams,
+      layout.numCoupled, layout.streamMap);
+  if (status != OPUS_OK) {
     LOGE("Failed to create Opus Decoder; status=%s", opus_strerror(status));
+    free(decoder);
+    return NULL;
+  }
+  // opus_multistream_decoder_destroy frees the decoder with free().
+  return decoder;
+}
+
+FUNC(jlong, opusInit, jint sampleRate, jint channelCount, jint numStreams,
+     jint numCoupled, jint gain, jbyteArray jStreamMap, jboolean floatOutput,
+     jboolean downmixToStereo, jlong memoryBudget, jint outputSampleRate) {
+  const opus_int32 decoderSize =
+      opus_multistream_decoder_get_size(numStreams, numCoupled);
+  if (decoderSize <= 0) {
+    LOGE("Invalid Opus stream counts; streams=%d coupled=%d", numStreams,
+         numCoupled);
     return 0;
   }
+  const bool downmix = downmixToStereo && channelCount > 2;
+  float normalizedDownmix[8][2];
+  if (downmix) {
+    float leftSum = 0;
+    float rightSum = 0;
+    for (int c = 0; c < channelCount; c++) {
+      leftSum += kDownmixCoefficients[channelCount][c][0];
+      rightSum += kDownmixCoefficients[channelCount][c][1];
+    }
+    for (int c = 0; c < channelCount; c++) {
+      const float* coefficients = kDownmixCoefficients[channelCount][c];
+      normalizedDownmix[c][0] = coefficients[0] / leftSum;
+      normalizedDownmix[c][1] = coefficients[1] / rightSum;
+    }
+  }
+  const int outputChannelCount = downmix ? 2 : channelCount;
+  PcmConverter* converter = NULL;
+  if (outputSampleRate > 0 && outputSampleRate != sampleRate) {
+    // the converter takes a row of coefficients for each output channel
+    float mixMatrix[2 * 8];
+    for (int c = 0; c < channelCount && downmix; c++) {
+      mixMatrix[c] = normalizedDownmix[c][0];
+      mixMatrix[channelCount + c] = normalizedDownmix[c][1];
+    }
+    converter = new PcmConverter();
+    if (!converter->init(sampleRate, channelCount, outputSampleRate,
+                         outputChannelCount, downmix ? mixMatrix : NULL,
+                         floatOutput ? PcmConverter::kSampleFormatPcmFloat
+                                     : PcmConverter::kSampleFormatPcm16Bit)) {
+      LOGE("Unsupported output sample rate %d", outputSampleRate);
+      delete converter;
+      return 0;
+    }
+  }
+  const size_t decodeBufferSize = downmix || converter != NULL
+      ? kMaxFrameSize * channelCount *
+            (floatOutput ? sizeof(float) : sizeof(int16_t))
+      : 0;
+  size_t memoryUsage = sizeof(Context) + decoderSize + decodeBufferSize;
+  if (converter != NULL) {
+    memoryUsage += converter->getMemoryUsage();
+  }
+  if (memoryBudget > 0 && memoryUsage > static_cast<uint64_t>(memoryBudget)) {
+    LOGE("Decoder needs %zu bytes, exceeding its budget of %lld bytes",
+         memoryUsage, static_cast<long long>(memoryBudget));
+    delete converter;
+    return 0;
+  }
+
+  Context* context = new Context;
+  context->memoryUsage = memoryUsage;
+  context->converter = converter;
+  DecoderLayout* layout = &context->layout;
+  layout->sampleRate = sampleRate;
+  layout->channelCount = channelCount;
+  layout->numStreams = numStreams;
+  layout->numCoupled = numCoupled;
+  env->GetByteArrayRegion(jStreamMap, 0, channelCount,
+                          reinterpret_cast<jbyte*>(layout->streamMap));
+  int status = OPUS_INVALID_STATE;
+  OpusMSDecoder* decoder = takePooledDecoder(*layout);
+  if (decoder == NULL) {
+    decoder = createDecoder(*layout, decoderSize);
+    if (decoder == NULL) {
+      delete converter;
+      delete context;
+      return 0;
+    }
+  }
+  // The gain is part of the header rather than the layout, so it is always set.
   status = opus_multistream_decoder_ctl(decoder, OPUS_SET_GAIN(gain));
   if (status != OPUS_OK) {
     LOGE("Failed to set Opus header gain; status=%s", opus_strerror(status));
+    opus_multistream_decoder_destroy(decoder);
+    delete converter;
+    delete context;
     return 0;
   }
-  return reinterpret_cast<intptr_t>(decoder);
+  context->decoder = decoder;
+  context->channelCount = channelCount;
+  context->sampleRate = sampleRate;
+  context->floatOutput = floatOutput;
+  context->outputChannelCount = outputChannelCount;
+  context->decodeBuffer = NULL;
+  if (downmix) {
+    memcpy(context->downmix, normalizedDownmix, sizeof(normalizedDownmix));
+  }
+  if (decodeBufferSize > 0) {
+    context->decodeBuffer = malloc(decodeBufferSize);
+    if (!context->decodeBuffer) {
+      LOGE("Failed to allocate decode buffer");
+      opus_multistream_decoder_destroy(decoder);
+      delete converter;
+      delete context;
+      return 0;
+    }
+  }
+  return reinterpret_cast<intptr_t>(context);
 }
 
-FUNC(jint, opusDecode, jlong jDecoder, jobject jInputBuffer, jint inputSize,
+FUNC(jint, opusDecode, jlong jContext, jobject jInputBuffer, jint inputSize,
      jobject jOutputBuffer, jint outputSize) {
-  OpusMSDecoder* decoder = reinterpret_cast<OpusMSDecoder*>(jDecoder);
+  Context* context = reinterpret_cast<Context*>(jContext);
   const uint8_t* inputBuffer =
       reinterpret_cast<const uint8_t*>(
           env->GetDirectBufferAddress(jInputBuffer));
-  int16_t* outputBuffer = reinterpret_cast<int16_t*>(
+  void* outputBuffer = env->GetDirectBufferAddress(jOutputBuffer);
+  const int bytesPerFrame = context->outputBytesPerFrame();
+  int outputFrameCount;
+  int sampleCount = decodePacket(context, inputBuffer, inputSize, outputBuffer,
+                                 outputSize / bytesPerFrame, kMaxFrameSize, 0,
+                                 &outputFrameCount);
+  return (sampleCount < 0) ? sampleCount : outputFrameCount * bytesPerFrame;
+}
+
+// Returns the size of the packet in jInputBuffer when decoded at the rate of
+// the stream, before any resampling, or an Opus error code.
+FUNC(jint, opusGetRequiredOutputBufferSize, jlong jContext,
+     jobject jInputBuffer, jint inputSize) {
+  Context* context = reinterpret_cast<Context*>(jContext);
+  const uint8_t* inputBuffer = reinterpret_cast<const uint8_t*>(
+      env->GetDirectBufferAddress(jInputBuffer));
+  const int32_t sampleCount = opus_packet_get_nb_samples(
+      inputBuffer, inputSize, context->sampleRate);
+  return (sampleCount < 0)
+      ? sampleCount : sampleCount * context->outputBytesPerFrame();
+}
+
+// Conceals lostSamples samples per channel of missing audio, which must be a
+// multiple of 2.5ms, using packet loss concealment. Returns the number of bytes
+// written to jOutputBuffer, or an Opus error code.
+FUNC(jint, opusDecodeLost, jlong jContext, jint lostSamples,
+     jobject jOutputBuffer, jint outputSize) {
+  Context* context = reinterpret_cast<Context*>(jContext);
+  uint8_t* outputBuffer = reinterpret_cast<uint8_t*>(
       env->GetDirectBufferAddress(jOutputBuffer));
-  int sampleCount = opus_multistream_decode(decoder, inputBuffer, inputSize,
-                                            outputBuffer, outputSize, 0);
-  return (sampleCount < 0) ? sampleCount
-                           : sampleCount * kBytesPerSample * channelCount;
+  const int bytesPerFrame = context->outputBytesPerFrame();
+  if (getOutputFrameCount(context, lostSamples) > outputSize / bytesPerFrame) {
+    return OPUS_BUFFER_TOO_SMALL;
+  }
+  int outputPosition = 0;
+  while (lostSamples > 0) {
+    const int frameSize =
+        (lostSamples < kMaxFrameSize) ? lostSamples : kMaxFrameSize;
+    int outputFrameCount;
+    const int sampleCount = decodePacket(
+        context, NULL, 0, outputBuffer + outputPosition,
+        (outputSize - outputPosition) / bytesPerFrame, frameSize, 0,
+        &outputFrameCount);
+    if (sampleCount <= 0) {
+      return (sampleCount < 0) ? sampleCount : OPUS_INTERNAL_ERROR;
+    }
+    lostSamples -= sampleCount;
+    outputPosition += outputFrameCount * bytesPerFrame;
+  }
+  return outputPosition;
+}
+
+// Recovers lostSamples samples per channel of audio that immediately precede
+// the packet in jInputBuffer, using the forward error correction data it
+// carries. lostSamples must be a multiple of 2.5ms and no longer than the
+// packet. If the packet has no FEC data libopus falls back to packet loss
+// concealment. The packet itself must subsequently be decoded normally.
+// Returns the number of bytes written to jOutputBuffer, or an Opus error code.
+FUNC(jint, opusDecodeFec, jlong jContext, jobject jInputBuffer, jint inputSize,
+     jint lostSamples, jobject jOutputBuffer, jint outputSize) {
+  Context* context = reinterpret_cast<Context*>(jContext);
+  const uint8_t* inputBuffer = reinterpret_cast<const uint8_t*>(
+      env->GetDirectBufferAddress(jInputBuffer));
+  void* outputBuffer = env->GetDirectBufferAddress(jOutputBuffer);
+  const int bytesPerFrame = context->outputBytesPerFrame();
+  const int outputFrames = outputSize / bytesPerFrame;
+  if (getOutputFrameCount(context, lostSamples) > outputFrames) {
+    return OPUS_BUFFER_TOO_SMALL;
+  }
+  int outputFrameCount;
+  int sampleCount = decodePacket(context, inputBuffer, inputSize, outputBuffer,
+                                 outputFrames, lostSamples, 1,
+                                 &outputFrameCount);
+  return (sampleCount < 0) ? sampleCount : outputFrameCount * bytesPerFrame;
 }
 
-FUNC(jint, opusGetRequiredOutputBufferSize, jobject jInputBuffer,
-     jint inputSize, jint sampleRate) {
+// Decodes packetCount packets, packet i occupying inputSizes[i] bytes from
+// inputOffsets[i] in jInputBuffer, into consecutive regions of jOutputBuffer.
+// The number of frames written for each packet, which is the number of samples
+// per channel decoded from it unless the output is resampled, is written to
+// jSampleCounts. Returns the total number of bytes written, or an Opus error
+// code if any packet fails to decode or the output buffer is too small.
+FUNC(jint, opusDecodeBatch, jlong jContext, jobject jInputBuffer,
+     jintArray jInputOffsets, jintArray jInputSizes, jint packetCount,
+     jobject jOutputBuffer, jint outputSize, jintArray jSampleCounts) {
+  Context* context = reinterpret_cast<Context*>(jContext);
   const uint8_t* inputBuffer = reinterpret_cast<const uint8_t*>(
       env->GetDirectBufferAddress(jInputBuffer));
-  const int32_t sampleCount =
-      opus_packet_get_nb_samples(inputBuffer, inputSize, sampleRate);
-  return sampleCount * kBytesPerSample * channelCount;
+  uint8_t* outputBuffer = reinterpret_cast<uint8_t*>(
+      env->GetDirectBufferAddress(jOutputBuffer));
+  jint* inputOffsets = env->GetIntArrayElements(jInputOffsets, 0);
+  jint* inputSizes = env->GetIntArrayElements(jInputSizes, 0);
+  jint* sampleCounts = env->GetIntArrayElements(jSampleCounts, 0);
+  const int bytesPerFrame = context->outputBytesPerFrame();
+  int outputPosition = 0;
+  int result = 0;
+  for (int i = 0; i < packetCount; i++) {
+    const uint8_t* packet = inputBuffer + inputOffsets[i];
+    // Check the packet fits in the remaining output before decoding, since a
+    // short output buffer would otherwise only fail inside libopus.
+    const int requiredSamples = opus_packet_get_nb_samples(
+        packet, inputSizes[i], context->sampleRate);
+    if (requiredSamples < 0) {
+      result = requiredSamples;
+      break;
+    }
+    const int remainingFrames = (outputSize - outputPosition) / bytesPerFrame;
+    if (getOutputFrameCount(context, requiredSamples) > remainingFrames) {
+      result = OPUS_BUFFER_TOO_SMALL;
+      break;
+    }
+    int outputFrameCount;
+    const int sampleCount = decodePacket(context, packet, inputSizes[i],
+                                         outputBuffer + outputPosition,
+                                         remainingFrames, kMaxFrameSize, 0,
+                                         &outputFrameCount);
+    if (sampleCount < 0) {
+      result = sampleCount;
+      break;
+    }
+    sampleCounts[i] = outputFrameCount;
+    outputPosition += outputFrameCount * bytesPerFrame;
+  }
+  env->ReleaseIntArrayElements(jInputOffsets, inputOffsets, JNI_ABORT);
+  env->ReleaseIntArrayElements(jInputSizes, inputSizes, JNI_ABORT);
+  env->ReleaseIntArrayElements(jSampleCounts, sampleCounts, 0);
+  return (result < 0) ? result : outputPosition;
+}
+
+// Returns the size of the output that the converter holds for the end of the
+// last decoded packet, which opusDrain writes.
+FUNC(jint, opusGetDrainSize, jlong jContext) {
+  Context* context = reinterpret_cast<Context*>(jContext);
+  return context->converter != NULL
+      ? context->converter->getDrainFrameCount() *
+            context->outputBytesPerFrame()
+      : 0;
+}
+
+// Writes the output that the converter holds for the end of the stream into
+// jOutputBuffer, and resets the converter. Returns the number of bytes written,
+// or an Opus error code.
+FUNC(jint, opusDrain, jlong jContext, jobject jOutputBuffer, jint outputSize) {
+  Context* context = reinterpret_cast<Context*>(jContext);
+  PcmConverter* const converter = context->converter;
+  if (converter == NULL) {
+    return 0;
+  }
+  const int bytesPerFrame = context->outputBytesPerFrame();
+  if (static_cast<int>(converter->getDrainFrameCount()) >
+      outputSize / bytesPerFrame) {
+    context->stats.add(kStatErrorCount, 1);
+    return OPUS_BUFFER_TOO_SMALL;
+  }
+  void* outputBuffer = env->GetDirectBufferAddress(jOutputBuffer);
+  const int64_t startNs = nowNs();
+  const int frameCount = converter->drain(outputBuffer);
+  context->stats.addCall(kStatConvertCount, kStatConvertTimeNs, startNs);
+  return frameCount * bytesPerFrame;
 }
 
-FUNC(void, opusClose, jlong jDecoder) {
-  OpusMSDecoder* decoder = reinterpret_cast<OpusMSDecoder*>(jDecoder);
-  opus_multistream_decoder_destroy(decoder);
+FUNC(void, opusClose, jlong jContext) {
+  Context* context = reinterpret_cast<Context*>(jContext);
+  if (!recycleDecoder(context)) {
+    opus_multistream_decoder_destroy(context->decoder);
+  }
+  free(context->decodeBuffer);
+  delete context->converter;
+  delete context;
+}
+
+// Sets the number of closed decoders that are kept for reuse, destroying any
+// pooled decoders beyond the new capacity.
+FUNC(void, opusSetDecoderPoolCapacity, jint capacity) {
+  OpusMSDecoder* excess[kMaxDecoderPoolCapacity];
+  int excessCount = 0;
+  pthread_mutex_lock(&decoderPoolMutex);
+  decoderPoolCapacity = std::max(
+      0, std::min(static_cast<int>(capacity), kMaxDecoderPoolCapacity));
+  while (decoderPoolSize > decoderPoolCapacity) {
+    excess[excessCount++] = decoderPool[--decoderPoolSize].decoder;
+  }
+  pthread_mutex_unlock(&decoderPoolMutex);
+  for (int i = 0; i < excessCount; i++) {
+    opus_multistream_decoder_destroy(excess[i]);
+  }
 }
 
-FUNC(void, opusReset, jlong jDecoder) {
-  OpusMSDecoder* decoder = reinterpret_cast<OpusMSDecoder*>(jDecoder);
-  opus_multistream_decoder_ctl(decoder, OPUS_RESET_STATE);
+FUNC(jlong, opusGetMemoryUsage, jlong jContext) {
+  Context* context = reinterpret_cast<Context*>(jContext);
+  return context->memoryUsage;
+}
+
+FUNC(void, opusReset, jlong jContext) {
+  Context* context = reinterpret_cast<Context*>(jContext);
+  opus_multistream_decoder_ctl(context->decoder, OPUS_RESET_STATE);
+  if (context->converter != NULL) {
+    context->converter->reset();
+  }
+}
+
+// Writes the running totals of the decoder into jStats, in the order of the
+// indices in NativeDecoderCounters.
+FUNC(void, opusGetStats, jlong jContext, jlongArray jStats) {
+  Context* context = reinterpret_cast<Context*>(jContext);
+  jlong stats[kStatCount];
+  for (int i = 0; i < kStatCount; i++) {
+    stats[i] = context->stats.get(i);
+  }
+  env->SetLongArrayRegion(jStats, 0, kStatCount, stats);
 }
 
 FUNC(jstring, getLibopusVersion) {
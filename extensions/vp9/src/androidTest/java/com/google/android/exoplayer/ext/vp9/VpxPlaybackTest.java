@@ -37,6 +37,8 @@ public class VpxPlaybackTest extends InstrumentationTestCase {
   private static final String BEAR_ODD_DIMENSIONS_URI = "asset:///bear-vp9-odd-dimensions.webm";
   private static final String INVALID_BITSTREAM_URI = "asset:///invalid-bitstream.webm";
 
+  private static final long NO_SEEK = -1;
+
   public void testBasicPlayback() throws ExoPlaybackException {
     playUri(BEAR_URI);
   }
@@ -55,9 +57,46 @@ public class VpxPlaybackTest extends InstrumentationTestCase {
     }
   }
 
+  public void testPipelinedPlayback() throws ExoPlaybackException {
+    playUri(BEAR_URI, true, NO_SEEK);
+  }
+
+  public void testPipelinedPlaybackWithSeek() throws ExoPlaybackException {
+    // Seeking once playback is ready discards the frames that are being decoded ahead, and
+    // playback then continues to the end of the stream.
+    playUri(BEAR_URI, true, 1500);
+  }
+
+  public void testPipelinedPlaybackWithSeekToStart() throws ExoPlaybackException {
+    playUri(BEAR_URI, true, 0);
+  }
+
+  public void testPipelinedInvalidBitstream() {
+    try {
+      playUri(INVALID_BITSTREAM_URI, true, NO_SEEK);
+      fail();
+    } catch (Exception e) {
+      assertNotNull(e.getCause());
+      assertTrue(e.getCause() instanceof VpxDecoderException);
+    }
+  }
+
   private void playUri(String uri) throws ExoPlaybackException {
+    playUri(uri, false, NO_SEEK);
+  }
+
+  /**
+   * Plays {@code uri} to the end.
+   *
+   * @param uri The URI to play.
+   * @param enablePipelinedMode Whether the renderer decodes in pipelined mode.
+   * @param seekPositionMs A position to seek to once playback first becomes ready, or
+   *     {@link #NO_SEEK}.
+   */
+  private void playUri(String uri, boolean enablePipelinedMode, long seekPositionMs)
+      throws ExoPlaybackException {
     TestPlaybackThread thread = new TestPlaybackThread(Uri.parse(uri),
-        getInstrumentation().getContext());
+        getInstrumentation().getContext(), enablePipelinedMode, seekPositionMs);
     thread.start();
     try {
       thread.join();
@@ -67,6 +106,9 @@ public class VpxPlaybackTest extends InstrumentationTestCase {
     if (thread.playbackException != null) {
       throw thread.playbackException;
     }
+    if (seekPositionMs != NO_SEEK) {
+      assertTrue(thread.seeked);
+    }
   }
 
   private static class TestPlaybackThread extends Thread implements ExoPlayer.Listener {
@@ -76,13 +118,19 @@ public class VpxPlaybackTest extends InstrumentationTestCase {
 
     private final Context context;
     private final Uri uri;
+    private final boolean enablePipelinedMode;
+    private final long seekPositionMs;
 
     private ExoPlayer player;
     private ExoPlaybackException playbackException;
+    private boolean seeked;
 
-    public TestPlaybackThread(Uri uri, Context context) {
+    public TestPlaybackThread(Uri uri, Context context, boolean enablePipelinedMode,
+        long seekPositionMs) {
       this.uri = uri;
       this.context = context;
+      this.enablePipelinedMode = enablePipelinedMode;
+      this.seekPositionMs = seekPositionMs;
     }
 
     @Override
@@ -94,7 +142,8 @@ public class VpxPlaybackTest extends InstrumentationTestCase {
           uri, new DefaultUriDataSource(context, Util.getUserAgent(context, "ExoPlayerExtVP9Test")),
           new DefaultAllocator(BUFFER_SEGMENT_SIZE), BUFFER_SEGMENT_SIZE * BUFFER_SEGMENT_COUNT,
           new WebmExtractor());
-      LibvpxVideoTrackRenderer videoRenderer = new LibvpxVideoTrackRenderer(sampleSource, true);
+      LibvpxVideoTrackRenderer videoRenderer = new LibvpxVideoTrackRenderer(sampleSource, true,
+          null, null, 0, 0, false, false, 0, enablePipelinedMode);
       player.sendMessage(videoRenderer, LibvpxVideoTrackRenderer.MSG_SET_OUTPUT_BUFFER_RENDERER,
           new VpxVideoSurfaceView(context));
       player.prepare(videoRenderer);
@@ -117,6 +166,9 @@ public class VpxPlaybackTest extends InstrumentationTestCase {
       if (playbackState == ExoPlayer.STATE_ENDED
           || (playbackState == ExoPlayer.STATE_IDLE && playbackException != null)) {
         releasePlayerAndQuitLooper();
+      } else if (playbackState == ExoPlayer.STATE_READY && seekPositionMs != NO_SEEK && !seeked) {
+        seeked = true;
+        player.seekTo(seekPositionMs);
       }
     }
 
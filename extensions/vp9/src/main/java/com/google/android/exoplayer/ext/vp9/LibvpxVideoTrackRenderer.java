@@ -15,6 +15,7 @@
  */
 package com.google.android.exoplayer.ext.vp9;
 
+import com.google.android.exoplayer.C;
 import com.google.android.exoplayer.CodecCounters;
 import com.google.android.exoplayer.ExoPlaybackException;
 import com.google.android.exoplayer.ExoPlayer;
@@ -25,9 +26,8 @@ import com.google.android.exoplayer.SampleSourceTrackRenderer;
 import com.google.android.exoplayer.TrackRenderer;
 import com.google.android.exoplayer.util.MimeTypes;
 import com.google.android.exoplayer.util.extensions.Buffer;
+import com.google.android.exoplayer.util.extensions.NativeDecoderCounters;
 
-import android.graphics.Bitmap;
-import android.graphics.Canvas;
 import android.os.Handler;
 import android.os.SystemClock;
 import android.view.Surface;
@@ -104,6 +104,18 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
    * should be the target {@link VpxOutputBufferRenderer}, or null.
    */
   public static final int MSG_SET_OUTPUT_BUFFER_RENDERER = 2;
+  /**
+   * The type of a message that can be passed to an instance of this class via
+   * {@link ExoPlayer#sendMessage} or {@link ExoPlayer#blockingSendMessage}. The message object
+   * should be a {@link Boolean} indicating whether the decoder should skip the loop filter, which
+   * trades quality for decoding speed.
+   */
+  public static final int MSG_SET_SKIP_LOOP_FILTER = 3;
+
+  /**
+   * The maximum capacity that can be passed to {@link #setDecoderPoolCapacity(int)}.
+   */
+  public static final int MAX_DECODER_POOL_CAPACITY = VpxDecoder.MAX_DECODER_POOL_CAPACITY;
 
   /**
    * The number of input buffers and the number of output buffers. The track renderer may limit the
@@ -112,13 +124,26 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
    */
   private static final int NUM_BUFFERS = 16;
   private static final int INITIAL_INPUT_BUFFER_SIZE = 768 * 1024; // Value based on cs/SoftVpx.cpp.
+  /**
+   * How late a frame must be when it is decoded for the decoder to drop it without outputting it.
+   */
+  private static final long LATE_FRAME_THRESHOLD_US = 30000;
 
   public final CodecCounters codecCounters = new CodecCounters();
+  /**
+   * Timings and counts of the work done by the native decoder, updated on the playback thread.
+   */
+  public final NativeDecoderCounters nativeDecoderCounters = new NativeDecoderCounters();
 
   private final boolean scaleToFit;
   private final Handler eventHandler;
   private final EventListener eventListener;
   private final int maxDroppedFrameCountToNotify;
+  private final int threadCount;
+  private final boolean enableFrameParallelMode;
+  private final boolean enableRowMultiThreadMode;
+  private final long memoryBudget;
+  private final boolean enablePipelinedMode;
   private final MediaFormatHolder formatHolder;
 
   private MediaFormat format;
@@ -127,12 +152,12 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
   private VpxOutputBuffer outputBuffer;
   private VpxOutputBuffer nextOutputBuffer;
 
-  private Bitmap bitmap;
   private boolean drawnToSurface;
   private boolean renderedFirstFrame;
   private Surface surface;
   private VpxOutputBufferRenderer outputBufferRenderer;
   private int outputMode;
+  private boolean skipLoopFilter;
 
   private boolean inputStreamEnded;
   private boolean outputStreamEnded;
@@ -142,6 +167,7 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
 
   private int droppedFrameCount;
   private long droppedFrameAccumulationStartTimeMs;
+  private int decoderSkippedLateFrameCount;
 
   /**
    * @param source The upstream source from which the renderer obtains samples.
@@ -164,7 +190,89 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
    */
   public LibvpxVideoTrackRenderer(SampleSource source, boolean scaleToFit,
       Handler eventHandler, EventListener eventListener, int maxDroppedFrameCountToNotify) {
+    this(source, scaleToFit, eventHandler, eventListener, maxDroppedFrameCountToNotify, 0, false,
+        false);
+  }
+
+  /**
+   * @param source The upstream source from which the renderer obtains samples.
+   * @param scaleToFit Boolean that indicates if video frames should be scaled to fit when
+   *     rendering.
+   * @param eventHandler A handler to use when delivering events to {@code eventListener}. May be
+   *     null if delivery of events is not required.
+   * @param eventListener A listener of events. May be null if delivery of events is not required.
+   * @param maxDroppedFrameCountToNotify The maximum number of frames that can be dropped between
+   *     invocations of {@link EventListener#onDroppedFrames(int, long)}.
+   * @param threadCount The number of decoding threads, or 0 to use one per CPU core.
+   * @param enableFrameParallelMode Whether libvpx should decode multiple frames in parallel, if
+   *     supported.
+   * @param enableRowMultiThreadMode Whether libvpx should use row based multithreading, if
+   *     supported.
+   */
+  public LibvpxVideoTrackRenderer(SampleSource source, boolean scaleToFit,
+      Handler eventHandler, EventListener eventListener, int maxDroppedFrameCountToNotify,
+      int threadCount, boolean enableFrameParallelMode, boolean enableRowMultiThreadMode) {
+    this(source, scaleToFit, eventHandler, eventListener, maxDroppedFrameCountToNotify,
+        threadCount, enableFrameParallelMode, enableRowMultiThreadMode, 0);
+  }
+
+  /**
+   * @param source The upstream source from which the renderer obtains samples.
+   * @param scaleToFit Boolean that indicates if video frames should be scaled to fit when
+   *     rendering.
+   * @param eventHandler A handler to use when delivering events to {@code eventListener}. May be
+   *     null if delivery of events is not required.
+   * @param eventListener A listener of events. May be null if delivery of events is not required.
+   * @param maxDroppedFrameCountToNotify The maximum number of frames that can be dropped between
+   *     invocations of {@link EventListener#onDroppedFrames(int, long)}.
+   * @param threadCount The number of decoding threads, or 0 to use one per CPU core.
+   * @param enableFrameParallelMode Whether libvpx should decode multiple frames in parallel, if
+   *     supported.
+   * @param enableRowMultiThreadMode Whether libvpx should use row based multithreading, if
+   *     supported.
+   * @param memoryBudget The maximum size of the frame buffers of each decoder in bytes, or 0 if
+   *     there is no limit. A frame that would need more fails to decode with a decoder error. The
+   *     memory in use is reported by {@link NativeDecoderCounters#memoryUsageBytes}.
+   */
+  public LibvpxVideoTrackRenderer(SampleSource source, boolean scaleToFit,
+      Handler eventHandler, EventListener eventListener, int maxDroppedFrameCountToNotify,
+      int threadCount, boolean enableFrameParallelMode, boolean enableRowMultiThreadMode,
+      long memoryBudget) {
+    this(source, scaleToFit, eventHandler, eventListener, maxDroppedFrameCountToNotify,
+        threadCount, enableFrameParallelMode, enableRowMultiThreadMode, memoryBudget, false);
+  }
+
+  /**
+   * @param source The upstream source from which the renderer obtains samples.
+   * @param scaleToFit Boolean that indicates if video frames should be scaled to fit when
+   *     rendering.
+   * @param eventHandler A handler to use when delivering events to {@code eventListener}. May be
+   *     null if delivery of events is not required.
+   * @param eventListener A listener of events. May be null if delivery of events is not required.
+   * @param maxDroppedFrameCountToNotify The maximum number of frames that can be dropped between
+   *     invocations of {@link EventListener#onDroppedFrames(int, long)}.
+   * @param threadCount The number of decoding threads, or 0 to use one per CPU core.
+   * @param enableFrameParallelMode Whether libvpx should decode multiple frames in parallel, if
+   *     supported.
+   * @param enableRowMultiThreadMode Whether libvpx should use row based multithreading, if
+   *     supported.
+   * @param memoryBudget The maximum size of the frame buffers of each decoder in bytes, or 0 if
+   *     there is no limit. A frame that would need more fails to decode with a decoder error. The
+   *     memory in use is reported by {@link NativeDecoderCounters#memoryUsageBytes}.
+   * @param enablePipelinedMode Whether frames should be decoded on a native worker thread, which
+   *     overlaps decoding with the output of earlier frames and smooths out the time taken for
+   *     each frame. Takes precedence over {@code enableFrameParallelMode}.
+   */
+  public LibvpxVideoTrackRenderer(SampleSource source, boolean scaleToFit,
+      Handler eventHandler, EventListener eventListener, int maxDroppedFrameCountToNotify,
+      int threadCount, boolean enableFrameParallelMode, boolean enableRowMultiThreadMode,
+      long memoryBudget, boolean enablePipelinedMode) {
     super(source);
+    this.enablePipelinedMode = enablePipelinedMode;
+    this.memoryBudget = memoryBudget;
+    this.threadCount = threadCount;
+    this.enableFrameParallelMode = enableFrameParallelMode;
+    this.enableRowMultiThreadMode = enableRowMultiThreadMode;
     this.scaleToFit = scaleToFit;
     this.eventHandler = eventHandler;
     this.eventListener = eventListener;
@@ -189,6 +297,22 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
     return isLibvpxAvailable() ? VpxDecoder.getLibvpxVersion() : null;
   }
 
+  /**
+   * Sets the number of released decoders that are kept warm for reuse by renderers created with the
+   * same threading configuration. Reusing a decoder avoids the cost of initializing libvpx and
+   * starting its threads when renderers are replaced in quick succession, for example when
+   * switching between content and ads. Pooled decoders keep their frame buffers, so the pool is
+   * empty by default. Lowering the capacity destroys the excess decoders. Does nothing if libvpx is
+   * not available.
+   *
+   * @param capacity The capacity of the pool, from zero to {@link #MAX_DECODER_POOL_CAPACITY}.
+   */
+  public static void setDecoderPoolCapacity(int capacity) {
+    if (isLibvpxAvailable()) {
+      VpxDecoder.setDecoderPoolCapacity(capacity);
+    }
+  }
+
   @Override
   protected boolean handlesTrack(MediaFormat mediaFormat) {
     return MimeTypes.VIDEO_VP9.equalsIgnoreCase(mediaFormat.mimeType);
@@ -212,18 +336,24 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
       if (decoder == null) {
         // If we don't have a decoder yet, we need to instantiate one.
         long startElapsedRealtimeMs = SystemClock.elapsedRealtime();
-        decoder = new VpxDecoder(NUM_BUFFERS, NUM_BUFFERS, INITIAL_INPUT_BUFFER_SIZE);
+        decoder = new VpxDecoder(NUM_BUFFERS, NUM_BUFFERS, INITIAL_INPUT_BUFFER_SIZE, threadCount,
+            enableFrameParallelMode, skipLoopFilter, enableRowMultiThreadMode, memoryBudget,
+            enablePipelinedMode);
         decoder.setOutputMode(outputMode);
+        decoderSkippedLateFrameCount = 0;
         decoder.start();
         notifyDecoderInitialized(startElapsedRealtimeMs, SystemClock.elapsedRealtime());
         codecCounters.codecInitCount++;
       }
       while (processOutputBuffer(positionUs)) {}
+      updateLateFrameDeadline(positionUs);
       while (feedInputBuffer(positionUs)) {}
     } catch (VpxDecoderException e) {
       notifyDecoderError(e);
       throw new ExoPlaybackException(e);
     }
+    decoder.updateCounters(nativeDecoderCounters);
+    nativeDecoderCounters.ensureUpdated();
     codecCounters.ensureUpdated();
   }
 
@@ -286,11 +416,33 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
     return false;
   }
 
-  private void renderBuffer() {
+  /**
+   * Lets the decoder drop frames that are already late when they are decoded, while playback is
+   * catching up, and counts the frames it has dropped since the previous call.
+   */
+  private void updateLateFrameDeadline(long positionUs) {
+    // The first frame after a seek is always rendered, so there is no deadline until then.
+    boolean catchingUp = renderedFirstFrame && getState() == TrackRenderer.STATE_STARTED;
+    decoder.setLateFrameDeadlineUs(catchingUp ? positionUs - LATE_FRAME_THRESHOLD_US
+        : C.UNKNOWN_TIME_US);
+    int skippedLateFrameCount = decoder.getSkippedLateFrameCount();
+    int newSkippedLateFrameCount = skippedLateFrameCount - decoderSkippedLateFrameCount;
+    if (newSkippedLateFrameCount > 0) {
+      decoderSkippedLateFrameCount = skippedLateFrameCount;
+      codecCounters.droppedOutputBufferCount += newSkippedLateFrameCount;
+      droppedFrameCount += newSkippedLateFrameCount;
+      if (maxDroppedFrameCountToNotify > 0 && droppedFrameCount >= maxDroppedFrameCountToNotify) {
+        notifyAndResetDroppedFrameCount();
+      }
+    }
+  }
+
+  private void renderBuffer() throws VpxDecoderException {
     codecCounters.renderedOutputBufferCount++;
     notifyIfVideoSizeChanged(outputBuffer.width, outputBuffer.height);
-    if (outputBuffer.mode == VpxDecoder.OUTPUT_MODE_RGB && surface != null) {
-      renderRgbFrame(outputBuffer, scaleToFit);
+    if ((outputBuffer.mode == VpxDecoder.OUTPUT_MODE_YUV
+        || outputBuffer.mode == VpxDecoder.OUTPUT_MODE_ABGR) && surface != null) {
+      decoder.renderToSurface(outputBuffer, surface, scaleToFit);
       if (!drawnToSurface) {
         drawnToSurface = true;
         notifyDrawnToSurface(surface);
@@ -305,21 +457,6 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
     outputBuffer = null;
   }
 
-  private void renderRgbFrame(VpxOutputBuffer outputBuffer, boolean scale) {
-    if (bitmap == null || bitmap.getWidth() != outputBuffer.width
-        || bitmap.getHeight() != outputBuffer.height) {
-      bitmap = Bitmap.createBitmap(outputBuffer.width, outputBuffer.height, Bitmap.Config.RGB_565);
-    }
-    bitmap.copyPixelsFromBuffer(outputBuffer.data);
-    Canvas canvas = surface.lockCanvas(null);
-    if (scale) {
-      canvas.scale(((float) canvas.getWidth()) / outputBuffer.width,
-          ((float) canvas.getHeight()) / outputBuffer.height);
-    }
-    canvas.drawBitmap(bitmap, 0, 0, null);
-    surface.unlockCanvasAndPost(canvas);
-  }
-
   private boolean feedInputBuffer(long positionUs) throws VpxDecoderException {
     if (inputStreamEnded) {
       return false;
@@ -388,6 +525,8 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
     outputStreamEnded = false;
     renderedFirstFrame = false;
     if (decoder != null) {
+      // Frames decoded after the flush must not be compared with the old position.
+      decoder.setLateFrameDeadlineUs(C.UNKNOWN_TIME_US);
       flushDecoder();
     }
   }
@@ -406,10 +545,21 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
   @Override
   protected void onDisabled() throws ExoPlaybackException {
     inputBuffer = null;
-    outputBuffer = null;
+    // Release dequeued output buffers, as they may reference decoder frame buffers.
+    if (outputBuffer != null) {
+      outputBuffer.release();
+      outputBuffer = null;
+    }
+    if (nextOutputBuffer != null) {
+      nextOutputBuffer.release();
+      nextOutputBuffer = null;
+    }
     format = null;
     try {
       if (decoder != null) {
+        decoder.updateCounters(nativeDecoderCounters);
+        nativeDecoderCounters.memoryUsageBytes = 0;
+        nativeDecoderCounters.ensureUpdated();
         decoder.release();
         decoder = null;
         codecCounters.codecReleaseCount++;
@@ -434,6 +584,11 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
       setSurface((Surface) message);
     } else if (messageType == MSG_SET_OUTPUT_BUFFER_RENDERER) {
       setOutputBufferRenderer((VpxOutputBufferRenderer) message);
+    } else if (messageType == MSG_SET_SKIP_LOOP_FILTER) {
+      skipLoopFilter = (Boolean) message;
+      if (decoder != null) {
+        decoder.setSkipLoopFilter(skipLoopFilter);
+      }
     } else {
       super.handleMessage(messageType, message);
     }
@@ -445,7 +600,7 @@ public final class LibvpxVideoTrackRenderer extends SampleSourceTrackRenderer {
     }
     this.surface = surface;
     outputBufferRenderer = null;
-    outputMode = (surface != null) ? VpxDecoder.OUTPUT_MODE_RGB : VpxDecoder.OUTPUT_MODE_UNKNOWN;
+    outputMode = (surface != null) ? VpxDecoder.OUTPUT_MODE_YUV : VpxDecoder.OUTPUT_MODE_UNKNOWN;
     if (decoder != null) {
       decoder.setOutputMode(outputMode);
     }
@@ -15,10 +15,14 @@
  */
 package com.google.android.exoplayer.ext.vp9;
 
+import com.google.android.exoplayer.C;
 import com.google.android.exoplayer.SampleHolder;
 import com.google.android.exoplayer.util.extensions.Buffer;
+import com.google.android.exoplayer.util.extensions.NativeDecoderCounters;
 import com.google.android.exoplayer.util.extensions.SimpleDecoder;
 
+import android.view.Surface;
+
 import java.nio.ByteBuffer;
 
 /**
@@ -30,6 +34,24 @@ import java.nio.ByteBuffer;
   public static final int OUTPUT_MODE_UNKNOWN = -1;
   public static final int OUTPUT_MODE_YUV = 0;
   public static final int OUTPUT_MODE_RGB = 1;
+  /**
+   * 32-bit RGB output in libyuv's ARGB layout, which is B, G, R, A in memory.
+   */
+  public static final int OUTPUT_MODE_ARGB = 2;
+  /**
+   * 32-bit RGB output in libyuv's ABGR layout, which is R, G, B, A in memory. This matches
+   * {@link android.graphics.Bitmap.Config#ARGB_8888} and RGBA_8888 window buffers.
+   */
+  public static final int OUTPUT_MODE_ABGR = 3;
+  /**
+   * Semi-planar YUV output, with a Y plane followed by an interleaved UV plane.
+   */
+  public static final int OUTPUT_MODE_NV12 = 4;
+  /**
+   * Semi-planar YUV output with 16 bits per sample, holding samples in the most significant bits,
+   * with a Y plane followed by an interleaved UV plane. 8-bit streams are converted to 10 bits.
+   */
+  public static final int OUTPUT_MODE_P010 = 5;
 
   /**
    * Whether the underlying libvpx library is available.
@@ -52,9 +74,49 @@ import java.nio.ByteBuffer;
    */
   public static native String getLibvpxVersion();
 
+  /**
+   * The maximum capacity of the native decoder pool.
+   */
+  public static final int MAX_DECODER_POOL_CAPACITY = 4;
+
+  /**
+   * Sets the number of released decoders that are kept initialized by the native code, for reuse
+   * by later decoders created with the same threading configuration. Decoders beyond the new
+   * capacity are destroyed.
+   *
+   * @param capacity The capacity of the pool, from zero to {@link #MAX_DECODER_POOL_CAPACITY}.
+   */
+  public static void setDecoderPoolCapacity(int capacity) {
+    vpxSetDecoderPoolCapacity(capacity);
+  }
+
+  /**
+   * The number of decoded frames whose timestamps are remembered, which must exceed the number of
+   * frames that libvpx can hold back in frame parallel mode.
+   */
+  private static final int FRAME_INFO_SLOTS = 64;
+
+  /**
+   * Values returned by {@link #vpxGetFrame} when there is no frame, and when the frame could not be
+   * output (e.g. if its format is not supported).
+   */
+  private static final int NO_FRAME = -1;
+  private static final int FRAME_ERROR = -2;
+
   private final long vpxDecContext;
+  private final long[] frameTimestampsUs;
+  private final boolean[] frameDecodeOnly;
+  private final long[] statsSnapshot;
+  private final long[] previousStatsSnapshot;
+
+  private int nextFrameIndex;
 
   private volatile int outputMode;
+  private volatile boolean skipLoopFilter;
+  private boolean appliedSkipLoopFilter;
+  private volatile long lateFrameDeadlineUs;
+  // Only incremented on the decode thread.
+  private volatile int skippedLateFrameCount;
 
   /**
    * Creates a VP9 decoder.
@@ -66,8 +128,92 @@ import java.nio.ByteBuffer;
    */
   public VpxDecoder(int numInputBuffers, int numOutputBuffers, int initialInputBufferSize)
       throws VpxDecoderException {
+    this(numInputBuffers, numOutputBuffers, initialInputBufferSize, 0, false, false, false);
+  }
+
+  /**
+   * Creates a VP9 decoder.
+   *
+   * @param numInputBuffers The number of input buffers.
+   * @param numOutputBuffers The number of output buffers.
+   * @param initialInputBufferSize The initial size of each input buffer.
+   * @param threadCount The number of decoding threads, or 0 to use one per CPU core.
+   * @param enableFrameParallelMode Whether libvpx should decode multiple frames in parallel, if
+   *     supported. This increases throughput at the cost of latency.
+   * @param skipLoopFilter Whether the loop filter should be skipped, which reduces the cost of
+   *     decoding at the expense of quality. See also {@link #setSkipLoopFilter(boolean)}.
+   * @param enableRowMultiThreadMode Whether libvpx should use row based multithreading, if
+   *     supported. Has no effect in frame parallel mode.
+   * @throws VpxDecoderException Thrown if an exception occurs when initializing the decoder.
+   */
+  public VpxDecoder(int numInputBuffers, int numOutputBuffers, int initialInputBufferSize,
+      int threadCount, boolean enableFrameParallelMode, boolean skipLoopFilter,
+      boolean enableRowMultiThreadMode) throws VpxDecoderException {
+    this(numInputBuffers, numOutputBuffers, initialInputBufferSize, threadCount,
+        enableFrameParallelMode, skipLoopFilter, enableRowMultiThreadMode, 0);
+  }
+
+  /**
+   * Creates a VP9 decoder.
+   *
+   * @param numInputBuffers The number of input buffers.
+   * @param numOutputBuffers The number of output buffers.
+   * @param initialInputBufferSize The initial size of each input buffer.
+   * @param threadCount The number of decoding threads, or 0 to use one per CPU core.
+   * @param enableFrameParallelMode Whether libvpx should decode multiple frames in parallel, if
+   *     supported. This increases throughput at the cost of latency.
+   * @param skipLoopFilter Whether the loop filter should be skipped, which reduces the cost of
+   *     decoding at the expense of quality. See also {@link #setSkipLoopFilter(boolean)}.
+   * @param enableRowMultiThreadMode Whether libvpx should use row based multithreading, if
+   *     supported. Has no effect in frame parallel mode.
+   * @param memoryBudget The maximum size of the decoder's frame buffers in bytes, or 0 if there is
+   *     no limit. Frame buffers hold most of a decoder's memory, and are allocated as frames are
+   *     decoded, so a frame that would take them beyond the budget fails to decode.
+   * @throws VpxDecoderException Thrown if an exception occurs when initializing the decoder.
+   */
+  public VpxDecoder(int numInputBuffers, int numOutputBuffers, int initialInputBufferSize,
+      int threadCount, boolean enableFrameParallelMode, boolean skipLoopFilter,
+      boolean enableRowMultiThreadMode, long memoryBudget) throws VpxDecoderException {
+    this(numInputBuffers, numOutputBuffers, initialInputBufferSize, threadCount,
+        enableFrameParallelMode, skipLoopFilter, enableRowMultiThreadMode, memoryBudget, false);
+  }
+
+  /**
+   * Creates a VP9 decoder.
+   *
+   * @param numInputBuffers The number of input buffers.
+   * @param numOutputBuffers The number of output buffers.
+   * @param initialInputBufferSize The initial size of each input buffer.
+   * @param threadCount The number of decoding threads, or 0 to use one per CPU core.
+   * @param enableFrameParallelMode Whether libvpx should decode multiple frames in parallel, if
+   *     supported. This increases throughput at the cost of latency.
+   * @param skipLoopFilter Whether the loop filter should be skipped, which reduces the cost of
+   *     decoding at the expense of quality. See also {@link #setSkipLoopFilter(boolean)}.
+   * @param enableRowMultiThreadMode Whether libvpx should use row based multithreading, if
+   *     supported. Has no effect in frame parallel mode.
+   * @param memoryBudget The maximum size of the decoder's frame buffers in bytes, or 0 if there is
+   *     no limit. Frame buffers hold most of a decoder's memory, and are allocated as frames are
+   *     decoded, so a frame that would take them beyond the budget fails to decode.
+   * @param enablePipelinedMode Whether frames should be decoded on a native worker thread, so that
+   *     the decoding of each frame overlaps with the output of the frames before it. Each decoded
+   *     frame is then output by a later call to the decoder than the one that queued it. Frame
+   *     parallel mode, which pipelines decoding within libvpx, is not used in pipelined mode.
+   * @throws VpxDecoderException Thrown if an exception occurs when initializing the decoder.
+   */
+  public VpxDecoder(int numInputBuffers, int numOutputBuffers, int initialInputBufferSize,
+      int threadCount, boolean enableFrameParallelMode, boolean skipLoopFilter,
+      boolean enableRowMultiThreadMode, long memoryBudget, boolean enablePipelinedMode)
+      throws VpxDecoderException {
     super(new VpxInputBuffer[numInputBuffers], new VpxOutputBuffer[numOutputBuffers]);
-    vpxDecContext = vpxInit();
+    this.skipLoopFilter = skipLoopFilter;
+    appliedSkipLoopFilter = skipLoopFilter;
+    lateFrameDeadlineUs = C.UNKNOWN_TIME_US;
+    frameTimestampsUs = new long[FRAME_INFO_SLOTS];
+    frameDecodeOnly = new boolean[FRAME_INFO_SLOTS];
+    statsSnapshot = new long[NativeDecoderCounters.SNAPSHOT_SIZE];
+    previousStatsSnapshot = new long[NativeDecoderCounters.SNAPSHOT_SIZE];
+    vpxDecContext = vpxInit(threadCount, enableFrameParallelMode, skipLoopFilter,
+        enableRowMultiThreadMode, memoryBudget, enablePipelinedMode);
     if (vpxDecContext == 0) {
       throw new VpxDecoderException("Failed to initialize decoder");
     }
@@ -84,6 +230,58 @@ import java.nio.ByteBuffer;
     this.outputMode = outputMode;
   }
 
+  /**
+   * Sets whether the loop filter should be skipped when decoding subsequent frames. Skipping the
+   * loop filter allows decoding to keep up with real time when the CPU is under pressure, at the
+   * expense of quality.
+   *
+   * @param skipLoopFilter Whether the loop filter should be skipped.
+   */
+  public void setSkipLoopFilter(boolean skipLoopFilter) {
+    this.skipLoopFilter = skipLoopFilter;
+  }
+
+  /**
+   * Sets a deadline for subsequently decoded frames. Frames with earlier timestamps are too late to
+   * be rendered, and so are decoded without being output, which skips copying or converting them
+   * into an output buffer. The frames are still decoded, because later frames may reference them.
+   * The deadline should be reset to {@link C#UNKNOWN_TIME_US} before the decoder is flushed.
+   *
+   * @param deadlineUs The deadline in microseconds, or {@link C#UNKNOWN_TIME_US} to output every
+   *     frame that is not decode-only.
+   */
+  public void setLateFrameDeadlineUs(long deadlineUs) {
+    lateFrameDeadlineUs = deadlineUs;
+  }
+
+  /**
+   * Returns the number of frames that have been decoded without being output because they were
+   * later than the deadline set by {@link #setLateFrameDeadlineUs(long)}.
+   */
+  public int getSkippedLateFrameCount() {
+    return skippedLateFrameCount;
+  }
+
+  /**
+   * Adds the work done by the native decoder since the previous call to {@code counters}. Must not
+   * be called concurrently with itself, or after {@link #release()}.
+   *
+   * @param counters The counters to update.
+   */
+  public void updateCounters(NativeDecoderCounters counters) {
+    vpxGetStats(vpxDecContext, statsSnapshot);
+    counters.accumulate(statsSnapshot, previousStatsSnapshot);
+    counters.memoryUsageBytes = getMemoryUsage();
+  }
+
+  /**
+   * Returns the size of the decoder's frame buffers in bytes, which hold most of its native
+   * memory. Allocations made internally by libvpx are not included.
+   */
+  public long getMemoryUsage() {
+    return vpxGetMemoryUsage(vpxDecContext);
+  }
+
   @Override
   protected VpxInputBuffer createInputBuffer() {
     return new VpxInputBuffer();
@@ -96,35 +294,155 @@ import java.nio.ByteBuffer;
 
   @Override
   protected void releaseOutputBuffer(VpxOutputBuffer buffer) {
+    releaseFrameBuffer(buffer);
     super.releaseOutputBuffer(buffer);
   }
 
+  /**
+   * Releases the decoder frame buffer referenced by an output buffer, if any.
+   *
+   * @param buffer The output buffer.
+   */
+  /* package */ void releaseFrameBuffer(VpxOutputBuffer buffer) {
+    if (buffer.frameBufferId != VpxOutputBuffer.NO_FRAME_BUFFER) {
+      vpxReleaseFrame(vpxDecContext, buffer.frameBufferId);
+      buffer.frameBufferId = VpxOutputBuffer.NO_FRAME_BUFFER;
+    }
+  }
+
+  /**
+   * Draws a frame to a {@link Surface} from native code, converting it straight into the window
+   * buffer. Must be called on the thread that releases the decoder.
+   *
+   * @param outputBuffer The buffer to draw, which must have been output in
+   *     {@link #OUTPUT_MODE_YUV} or {@link #OUTPUT_MODE_ABGR}.
+   * @param surface The surface to draw to.
+   * @param scaleToFit Whether the frame should be scaled to fit the surface.
+   * @throws VpxDecoderException If the frame could not be drawn.
+   */
+  /* package */ void renderToSurface(VpxOutputBuffer outputBuffer, Surface surface,
+      boolean scaleToFit) throws VpxDecoderException {
+    int result;
+    if (outputBuffer.mode == OUTPUT_MODE_YUV) {
+      result = vpxRenderFrame(vpxDecContext, surface, outputBuffer.mode,
+          outputBuffer.yuvPlanes[0], outputBuffer.yuvPlanes[1], outputBuffer.yuvPlanes[2],
+          outputBuffer.yuvStrides[0], outputBuffer.yuvStrides[1], outputBuffer.width,
+          outputBuffer.height, outputBuffer.colorspace, outputBuffer.bitDepth, scaleToFit);
+    } else if (outputBuffer.mode == OUTPUT_MODE_ABGR) {
+      result = vpxRenderFrame(vpxDecContext, surface, outputBuffer.mode, outputBuffer.data, null,
+          null, outputBuffer.width * 4, 0, outputBuffer.width, outputBuffer.height,
+          outputBuffer.colorspace, 8, scaleToFit);
+    } else {
+      throw new VpxDecoderException("Unsupported output mode: " + outputBuffer.mode);
+    }
+    if (result != 0) {
+      throw new VpxDecoderException("Failed to render frame to surface");
+    }
+  }
+
   @Override
   protected VpxDecoderException decode(VpxInputBuffer inputBuffer, VpxOutputBuffer outputBuffer,
       boolean reset) {
+    // The native decoder may only be reconfigured on the decode thread.
+    boolean skipLoopFilter = this.skipLoopFilter;
+    if (skipLoopFilter != appliedSkipLoopFilter) {
+      vpxSetSkipLoopFilter(vpxDecContext, skipLoopFilter);
+      appliedSkipLoopFilter = skipLoopFilter;
+    }
+    // Drop any frames held back from before the reset.
+    if (reset && vpxFlush(vpxDecContext, true) != 0) {
+      return new VpxDecoderException("Flush error: " + vpxGetErrorMessage(vpxDecContext));
+    }
     SampleHolder sampleHolder = inputBuffer.sampleHolder;
-    outputBuffer.timestampUs = sampleHolder.timeUs;
+    int frameIndex = nextFrameIndex;
+    nextFrameIndex = (nextFrameIndex + 1) % FRAME_INFO_SLOTS;
+    frameTimestampsUs[frameIndex] = sampleHolder.timeUs;
+    frameDecodeOnly[frameIndex] = inputBuffer.getFlag(Buffer.FLAG_DECODE_ONLY);
     sampleHolder.data.position(sampleHolder.data.position() - sampleHolder.size);
-    if (vpxDecode(vpxDecContext, sampleHolder.data, sampleHolder.size) != 0) {
+    if (vpxDecode(vpxDecContext, sampleHolder.data, sampleHolder.size, frameIndex) != 0) {
       return new VpxDecoderException("Decode error: " + vpxGetErrorMessage(vpxDecContext));
     }
-    outputBuffer.mode = outputMode;
-    if (vpxGetFrame(vpxDecContext, outputBuffer) != 0) {
+    return getFrame(outputBuffer);
+  }
+
+  @Override
+  protected boolean hasPendingOutput() {
+    return vpxHasFrame(vpxDecContext);
+  }
+
+  @Override
+  protected VpxDecoderException decodePendingOutput(VpxOutputBuffer outputBuffer) {
+    return getFrame(outputBuffer);
+  }
+
+  @Override
+  protected void onEndOfStream() {
+    // Make libvpx output the frames it holds back in frame parallel mode.
+    vpxFlush(vpxDecContext, false);
+  }
+
+  /**
+   * Outputs the next frame that is ready into {@code outputBuffer}, or marks it as decode-only if
+   * there is no frame (e.g. if the decoded data was a hidden frame) or if the frame will not be
+   * presented.
+   *
+   * @return A decoder exception if the frame could not be output, or null.
+   */
+  private VpxDecoderException getFrame(VpxOutputBuffer outputBuffer) {
+    int frameIndex = vpxPeekFrame(vpxDecContext);
+    if (frameIndex == NO_FRAME) {
       outputBuffer.setFlag(Buffer.FLAG_DECODE_ONLY);
+      return null;
+    }
+    // The frame may have been decoded from an earlier input buffer than the last one.
+    long timestampUs = frameTimestampsUs[frameIndex];
+    outputBuffer.timestampUs = timestampUs;
+    boolean decodeOnly = frameDecodeOnly[frameIndex];
+    long deadlineUs = lateFrameDeadlineUs;
+    boolean late = !decodeOnly && deadlineUs != C.UNKNOWN_TIME_US && timestampUs < deadlineUs;
+    if (decodeOnly || late) {
+      // The frame will not be presented, so drop it without copying it into the output buffer.
+      vpxSkipFrame(vpxDecContext);
+      if (late) {
+        skippedLateFrameCount++;
+      }
+      outputBuffer.setFlag(Buffer.FLAG_DECODE_ONLY);
+      return null;
+    }
+    outputBuffer.mode = outputMode;
+    if (vpxGetFrame(vpxDecContext, outputBuffer) == FRAME_ERROR) {
+      return new VpxDecoderException("Failed to output frame in mode " + outputMode);
     }
+    outputBuffer.clearFlag(Buffer.FLAG_DECODE_ONLY);
     return null;
   }
 
   @Override
   public void release() {
     super.release();
+    // Frame buffers still referenced by output buffers that have not been released remain valid,
+    // and are freed when the last of them is released.
     vpxClose(vpxDecContext);
   }
 
-  private native long vpxInit();
+  private native long vpxInit(int threadCount, boolean enableFrameParallelMode,
+      boolean skipLoopFilter, boolean enableRowMultiThreadMode, long memoryBudget,
+      boolean enablePipelinedMode);
   private native long vpxClose(long context);
-  private native long vpxDecode(long context, ByteBuffer encoded, int length);
+  private static native void vpxSetDecoderPoolCapacity(int capacity);
+  private native void vpxSetSkipLoopFilter(long context, boolean skipLoopFilter);
+  private native long vpxDecode(long context, ByteBuffer encoded, int length, int frameIndex);
+  private native long vpxFlush(long context, boolean discard);
   private native int vpxGetFrame(long context, VpxOutputBuffer outputBuffer);
+  private native boolean vpxHasFrame(long context);
+  private native int vpxPeekFrame(long context);
+  private native int vpxSkipFrame(long context);
+  private native void vpxReleaseFrame(long context, int frameBufferId);
+  private native int vpxRenderFrame(long context, Surface surface, int outputMode,
+      ByteBuffer plane0, ByteBuffer plane1, ByteBuffer plane2, int stride0, int stride1, int width,
+      int height, int colorspace, int bitDepth, boolean scaleToFit);
+  private native void vpxGetStats(long context, long[] stats);
+  private native long vpxGetMemoryUsage(long context);
   private native String vpxGetErrorMessage(long context);
 
 }
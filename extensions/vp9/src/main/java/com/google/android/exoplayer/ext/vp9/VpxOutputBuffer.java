@@ -27,25 +27,54 @@ public final class VpxOutputBuffer extends OutputBuffer {
   public static final int COLORSPACE_UNKNOWN = 0;
   public static final int COLORSPACE_BT601 = 1;
   public static final int COLORSPACE_BT709 = 2;
+  public static final int COLORSPACE_BT2020 = 3;
+
+  /**
+   * Value of {@link #frameBufferId} when the buffer does not reference a decoder frame buffer.
+   */
+  /* package */ static final int NO_FRAME_BUFFER = -1;
 
   private final VpxDecoder owner;
 
   public int mode;
   /**
-   * RGB buffer for RGB mode.
+   * RGB buffer for RGB, ARGB and ABGR modes, and semi-planar buffer for NV12 and P010 modes.
    */
   public ByteBuffer data;
+  /**
+   * The native address of {@link #data}, maintained by the decoder's native code.
+   */
+  /* package */ long dataAddress;
   public int width;
   public int height;
   /**
-   * YUV planes for YUV mode.
+   * YUV planes for YUV mode, and the Y and interleaved UV planes for NV12 and P010 modes.
    */
   public ByteBuffer[] yuvPlanes;
   public int[] yuvStrides;
   public int colorspace;
+  /**
+   * The bit depth of the samples in {@link #yuvPlanes} in YUV mode. Samples with a bit depth
+   * greater than 8 occupy 16 bits each, in native byte order, and {@link #yuvStrides} are in bytes.
+   */
+  public int bitDepth = 8;
+
+  /**
+   * Identifier of the decoder frame buffer that {@link #yuvPlanes} point into, or
+   * {@link #NO_FRAME_BUFFER} if the planes are backed by {@link #data}.
+   */
+  /* package */ int frameBufferId;
 
   /* package */ VpxOutputBuffer(VpxDecoder owner) {
     this.owner = owner;
+    frameBufferId = NO_FRAME_BUFFER;
+  }
+
+  @Override
+  public void reset() {
+    super.reset();
+    // The decoder may reuse a buffer without it having been released (e.g. after a flush).
+    owner.releaseFrameBuffer(this);
   }
 
   @Override
@@ -55,23 +84,30 @@ public final class VpxOutputBuffer extends OutputBuffer {
 
   /**
    * Resizes the buffer based on the given dimensions. Called via JNI after decoding completes.
+   *
+   * @return Whether {@link #data} was reallocated.
    */
-  /* package */ void initForRgbFrame(int width, int height) {
+  /* package */ boolean initForRgbFrame(int width, int height, int bytesPerPixel) {
     this.width = width;
     this.height = height;
-    int minimumRgbSize = width * height * 2;
+    int minimumRgbSize = width * height * bytesPerPixel;
+    boolean reallocated = false;
     if (data == null || data.capacity() < minimumRgbSize) {
       data = ByteBuffer.allocateDirect(minimumRgbSize);
       yuvPlanes = null;
+      reallocated = true;
     }
     data.position(0);
     data.limit(minimumRgbSize);
+    return reallocated;
   }
 
   /**
    * Resizes the buffer based on the given stride. Called via JNI after decoding completes.
+   *
+   * @return Whether {@link #data} was reallocated.
    */
-  /* package */ void initForYuvFrame(int width, int height, int yStride, int uvStride,
+  /* package */ boolean initForYuvFrame(int width, int height, int yStride, int uvStride,
       int colorspace) {
     this.width = width;
     this.height = height;
@@ -79,8 +115,10 @@ public final class VpxOutputBuffer extends OutputBuffer {
     int yLength = yStride * height;
     int uvLength = uvStride * ((height + 1) / 2);
     int minimumYuvSize = yLength + (uvLength * 2);
+    boolean reallocated = false;
     if (data == null || data.capacity() < minimumYuvSize) {
       data = ByteBuffer.allocateDirect(minimumYuvSize);
+      reallocated = true;
     }
     data.limit(minimumYuvSize);
     if (yuvPlanes == null) {
@@ -102,6 +140,83 @@ public final class VpxOutputBuffer extends OutputBuffer {
     yuvStrides[0] = yStride;
     yuvStrides[1] = uvStride;
     yuvStrides[2] = uvStride;
+    return reallocated;
+  }
+
+  /**
+   * Resizes the buffer for a tightly packed semi-planar frame with the given dimensions, which is
+   * NV12 if {@code bytesPerSample} is 1 and P010 if it is 2. Called via JNI after decoding
+   * completes.
+   *
+   * @return Whether {@link #data} was reallocated.
+   */
+  /* package */ boolean initForSemiPlanarFrame(int width, int height, int bytesPerSample,
+      int colorspace) {
+    this.width = width;
+    this.height = height;
+    this.colorspace = colorspace;
+    int yStride = width * bytesPerSample;
+    int yLength = yStride * height;
+    int uvStride = ((width + 1) / 2) * 2 * bytesPerSample;
+    int uvLength = uvStride * ((height + 1) / 2);
+    int minimumSize = yLength + uvLength;
+    boolean reallocated = false;
+    if (data == null || data.capacity() < minimumSize) {
+      data = ByteBuffer.allocateDirect(minimumSize);
+      reallocated = true;
+    }
+    data.clear();
+    if (yuvPlanes == null) {
+      yuvPlanes = new ByteBuffer[3];
+    }
+    yuvPlanes[0] = slice(data, 0, yLength);
+    yuvPlanes[1] = slice(data, yLength, uvLength);
+    yuvPlanes[2] = null;
+    data.position(0);
+    data.limit(minimumSize);
+    if (yuvStrides == null) {
+      yuvStrides = new int[3];
+    }
+    yuvStrides[0] = yStride;
+    yuvStrides[1] = uvStride;
+    yuvStrides[2] = 0;
+    return reallocated;
+  }
+
+  /**
+   * Points the YUV planes at a frame buffer owned by the decoder, rather than copying the frame.
+   * The buffer holds a reference to the frame buffer until it is released or reused. Called via
+   * JNI after decoding completes.
+   */
+  /* package */ void initForExternalYuvFrame(ByteBuffer frameData, int yOffset, int uOffset,
+      int vOffset, int width, int height, int yStride, int uvStride, int colorspace,
+      int frameBufferId) {
+    this.width = width;
+    this.height = height;
+    this.colorspace = colorspace;
+    this.frameBufferId = frameBufferId;
+    int yLength = yStride * height;
+    int uvLength = uvStride * ((height + 1) / 2);
+    if (yuvPlanes == null) {
+      yuvPlanes = new ByteBuffer[3];
+    }
+    frameData.clear();
+    yuvPlanes[0] = slice(frameData, yOffset, yLength);
+    yuvPlanes[1] = slice(frameData, uOffset, uvLength);
+    yuvPlanes[2] = slice(frameData, vOffset, uvLength);
+    if (yuvStrides == null) {
+      yuvStrides = new int[3];
+    }
+    yuvStrides[0] = yStride;
+    yuvStrides[1] = uvStride;
+    yuvStrides[2] = uvStride;
+  }
+
+  private static ByteBuffer slice(ByteBuffer buffer, int offset, int length) {
+    buffer.position(offset);
+    ByteBuffer slice = buffer.slice();
+    slice.limit(length);
+    return slice;
   }
 
 }
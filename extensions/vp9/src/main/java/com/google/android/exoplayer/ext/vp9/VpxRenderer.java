@@ -44,6 +44,12 @@ import javax.microedition.khronos.opengles.GL10;
     1.793f, -0.533f, 0.0f,
   };
 
+  private static final float[] kColorConversion2020 = {
+    1.164f, 1.164f, 1.164f,
+    0.0f, -0.188f, 2.141f,
+    1.678f, -0.652f, 0.0f,
+  };
+
   private static final String VERTEX_SHADER =
       "varying vec2 interp_tc;\n"
       + "attribute vec4 in_pos;\n"
@@ -60,11 +66,19 @@ import javax.microedition.khronos.opengles.GL10;
       + "uniform sampler2D u_tex;\n"
       + "uniform sampler2D v_tex;\n"
       + "uniform mat3 mColorConversion;\n"
+      // High bit depth samples are uploaded as luminance-alpha textures with the low byte in the
+      // luminance channel and the high byte in the alpha channel, so the scale applied to each
+      // channel depends on the bit depth.
+      + "uniform vec2 mSampleScale;\n"
+      + "float readSample(sampler2D tex) {\n"
+      + "  vec4 texel = texture2D(tex, interp_tc);\n"
+      + "  return dot(vec2(texel.r, texel.a), mSampleScale);\n"
+      + "}\n"
       + "void main() {\n"
       + "  vec3 yuv;"
-      + "  yuv.x = texture2D(y_tex, interp_tc).r - 0.0625;\n"
-      + "  yuv.y = texture2D(u_tex, interp_tc).r - 0.5;\n"
-      + "  yuv.z = texture2D(v_tex, interp_tc).r - 0.5;\n"
+      + "  yuv.x = readSample(y_tex) - 0.0625;\n"
+      + "  yuv.y = readSample(u_tex) - 0.5;\n"
+      + "  yuv.z = readSample(v_tex) - 0.5;\n"
       + "  gl_FragColor = vec4(mColorConversion * yuv, 1.0);"
       + "}\n";
   private static final FloatBuffer TEXTURE_VERTICES = nativeFloatBuffer(
@@ -78,6 +92,7 @@ import javax.microedition.khronos.opengles.GL10;
   private int program;
   private int texLocation;
   private int colorMatrixLocation;
+  private int sampleScaleLocation;
   private FloatBuffer textureCoords;
   private int previousWidth;
   private int previousStride;
@@ -130,6 +145,7 @@ import javax.microedition.khronos.opengles.GL10;
     GLES20.glEnableVertexAttribArray(texLocation);
     checkNoGLES2Error();
     colorMatrixLocation = GLES20.glGetUniformLocation(program, "mColorConversion");
+    sampleScaleLocation = GLES20.glGetUniformLocation(program, "mSampleScale");
     checkNoGLES2Error();
     setupTextures();
     checkNoGLES2Error();
@@ -155,22 +171,38 @@ import javax.microedition.khronos.opengles.GL10;
     }
     VpxOutputBuffer outputBuffer = renderedOutputBuffer;
     // Set color matrix. Assume BT709 if the color space is unknown.
-    float[] colorConversion = outputBuffer.colorspace == VpxOutputBuffer.COLORSPACE_BT601
-        ? kColorConversion601 : kColorConversion709;
+    float[] colorConversion;
+    if (outputBuffer.colorspace == VpxOutputBuffer.COLORSPACE_BT601) {
+      colorConversion = kColorConversion601;
+    } else if (outputBuffer.colorspace == VpxOutputBuffer.COLORSPACE_BT2020) {
+      colorConversion = kColorConversion2020;
+    } else {
+      colorConversion = kColorConversion709;
+    }
     GLES20.glUniformMatrix3fv(colorMatrixLocation, 1, false, colorConversion, 0);
 
+    boolean highBitDepth = outputBuffer.bitDepth > 8;
+    int bytesPerSample = highBitDepth ? 2 : 1;
+    int format = highBitDepth ? GLES20.GL_LUMINANCE_ALPHA : GLES20.GL_LUMINANCE;
+    if (highBitDepth) {
+      float maxValue = (1 << outputBuffer.bitDepth) - 1;
+      GLES20.glUniform2f(sampleScaleLocation, 255 / maxValue, 255 * 256 / maxValue);
+    } else {
+      GLES20.glUniform2f(sampleScaleLocation, 1, 0);
+    }
     for (int i = 0; i < 3; i++) {
       int h = (i == 0) ? outputBuffer.height : (outputBuffer.height + 1) / 2;
       GLES20.glActiveTexture(GLES20.GL_TEXTURE0 + i);
       GLES20.glBindTexture(GLES20.GL_TEXTURE_2D, yuvTextures[i]);
       GLES20.glPixelStorei(GLES20.GL_UNPACK_ALIGNMENT, 1);
-      GLES20.glTexImage2D(GLES20.GL_TEXTURE_2D, 0, GLES20.GL_LUMINANCE,
-          outputBuffer.yuvStrides[i], h, 0, GLES20.GL_LUMINANCE, GLES20.GL_UNSIGNED_BYTE,
+      GLES20.glTexImage2D(GLES20.GL_TEXTURE_2D, 0, format,
+          outputBuffer.yuvStrides[i] / bytesPerSample, h, 0, format, GLES20.GL_UNSIGNED_BYTE,
           outputBuffer.yuvPlanes[i]);
     }
     // Set cropping of stride if either width or stride has changed.
-    if (previousWidth != outputBuffer.width || previousStride != outputBuffer.yuvStrides[0]) {
-      float crop = (float) outputBuffer.width / outputBuffer.yuvStrides[0];
+    int stride = outputBuffer.yuvStrides[0] / bytesPerSample;
+    if (previousWidth != outputBuffer.width || previousStride != stride) {
+      float crop = (float) outputBuffer.width / stride;
       textureCoords = nativeFloatBuffer(
           0.0f, 0.0f,
           0.0f, 1.0f,
@@ -179,7 +211,7 @@ import javax.microedition.khronos.opengles.GL10;
       GLES20.glVertexAttribPointer(
           texLocation, 2, GLES20.GL_FLOAT, false, 0, textureCoords);
       previousWidth = outputBuffer.width;
-      previousStride = outputBuffer.yuvStrides[0];
+      previousStride = stride;
     }
     GLES20.glClear(GLES20.GL_COLOR_BUFFER_BIT);
     GLES20.glDrawArrays(GLES20.GL_TRIANGLE_STRIP, 0, 4);
@@ -33,10 +33,30 @@ LOCAL_PATH := $(WORKING_DIR)
 LOCAL_MODULE := libvpxJNI
 LOCAL_ARM_MODE := arm
 LOCAL_CPP_EXTENSION := .cc
+# The tracing and stats helpers are shared with the FLAC extension.
+FLAC_JNI_PATH := ../../../../flac/src/main/jni
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/$(FLAC_JNI_PATH)
 LOCAL_SRC_FILES := vpx_jni.cc
-LOCAL_LDLIBS := -llog -lz -lm
+LOCAL_LDLIBS := -llog -lz -lm -landroid -ldl
 LOCAL_SHARED_LIBRARIES := libvpx
 LOCAL_STATIC_LIBRARIES := libyuv_static cpufeatures
 include $(BUILD_SHARED_LIBRARY)
 
+# build vpx_benchmark, a standalone executable that decodes IVF files with
+# libvpx, when BUILD_BENCHMARK=true is passed to ndk-build.
+ifeq ($(BUILD_BENCHMARK),true)
+  include $(CLEAR_VARS)
+  LOCAL_PATH := $(WORKING_DIR)
+  LOCAL_MODULE := vpx_benchmark
+  LOCAL_ARM_MODE := arm
+  LOCAL_CPP_EXTENSION := .cc
+  LOCAL_SRC_FILES := vpx_benchmark.cc
+  LOCAL_CFLAGS := -fPIE
+  LOCAL_LDFLAGS := -fPIE -pie
+  LOCAL_LDLIBS := -lm
+  LOCAL_SHARED_LIBRARIES := libvpx
+  LOCAL_STATIC_LIBRARIES := libyuv_static cpufeatures
+  include $(BUILD_EXECUTABLE)
+endif
+
 $(call import-module,android/cpufeatures)
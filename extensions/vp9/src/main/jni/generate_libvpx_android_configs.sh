@@ -32,6 +32,7 @@ shift 1
 common_params="--disable-examples --disable-docs --enable-realtime-only"
 common_params+=" --disable-vp8 --disable-vp9-encoder --disable-webm-io"
 common_params+=" --disable-vp10 --disable-libyuv --disable-runtime-cpu-detect"
+common_params+=" --enable-vp9-highbitdepth"
 
 # configuration parameters for various architectures
 arch[0]="armeabi-v7a"
@@ -45,18 +46,19 @@ config[1]+=" --disable-neon-asm --disable-media"
 arch[2]="mips"
 config[2]="--force-target=mips32-android-gcc --sdk-path=$ndk"
 
+# Runtime CPU detection is disabled, so only the instruction sets guaranteed by
+# each ABI are enabled: up to SSSE3 on x86, up to SSE4.2 on x86_64 and NEON on
+# arm64-v8a.
 arch[3]="x86"
-config[3]="--force-target=x86-android-gcc --sdk-path=$ndk --disable-sse2"
-config[3]+=" --disable-sse3 --disable-ssse3 --disable-sse4_1 --disable-avx"
-config[3]+=" --disable-avx2 --enable-pic"
+config[3]="--force-target=x86-android-gcc --sdk-path=$ndk --disable-sse4_1"
+config[3]+=" --disable-avx --disable-avx2 --enable-pic"
 
 arch[4]="arm64-v8a"
-config[4]="--force-target=armv8-android-gcc --sdk-path=$ndk --disable-neon"
+config[4]="--force-target=armv8-android-gcc --sdk-path=$ndk --enable-neon"
 config[4]+=" --disable-neon-asm"
 
 arch[5]="x86_64"
-config[5]="--force-target=x86_64-android-gcc --sdk-path=$ndk --disable-sse2"
-config[5]+=" --disable-sse3 --disable-ssse3 --disable-sse4_1 --disable-avx"
+config[5]="--force-target=x86_64-android-gcc --sdk-path=$ndk --disable-avx"
 config[5]+=" --disable-avx2 --enable-pic --disable-neon --disable-neon-asm"
 
 arch[6]="mips64"
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Standalone benchmark of the native VP9 decode path, decoding the frames of
+// each IVF file given on the command line with libvpx and then copying or
+// converting them as vpxGetFrame does. Built by passing BUILD_BENCHMARK=true
+// to ndk-build. See README.md.
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "libyuv.h"  // NOLINT
+
+#define VPX_CODEC_DISABLE_COMPAT 1
+#include "vpx/vpx_decoder.h"
+#include "vpx/vp8dx.h"
+
+#if defined(__aarch64__)
+#define ABI "arm64-v8a"
+#elif defined(__arm__)
+#define ABI "armeabi-v7a"
+#elif defined(__x86_64__)
+#define ABI "x86_64"
+#elif defined(__i386__)
+#define ABI "x86"
+#else
+#define ABI "unknown"
+#endif
+
+// Output modes, matching the constants in VpxDecoder.
+static const int kOutputModeYuv = 0;
+static const int kOutputModeRgb = 1;
+static const int kOutputModeArgb = 2;
+
+typedef std::vector<uint8_t> Frame;
+
+static int64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static long getPeakRssKb() {
+  struct rusage usage;
+  return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+}
+
+static uint32_t readLittleEndian32(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) |
+      (static_cast<uint32_t>(data[3]) << 24);
+}
+
+// Reads the frames of the IVF file at path. The whole file is read up front so
+// that I/O is not measured.
+static bool readIvfFrames(const char* path, std::vector<Frame>* frames,
+                          double* frameRate) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+  uint8_t header[32];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      memcmp(header, "DKIF", 4) != 0 || memcmp(&header[8], "VP90", 4) != 0) {
+    fprintf(stderr, "%s is not a VP9 IVF file\n", path);
+    fclose(file);
+    return false;
+  }
+  const uint32_t rate = readLittleEndian32(&header[16]);
+  const uint32_t scale = readLittleEndian32(&header[20]);
+  *frameRate = scale == 0 ? 0 : static_cast<double>(rate) / scale;
+  uint8_t frameHeader[12];
+  while (fread(frameHeader, 1, sizeof(frameHeader), file) ==
+         sizeof(frameHeader)) {
+    const uint32_t size = readLittleEndian32(frameHeader);
+    frames->push_back(Frame(size));
+    if (size == 0 || fread(&frames->back()[0], 1, size, file) != size) {
+      frames->pop_back();
+      break;
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// Copies or converts img into output in the given output mode. Returns false
+// if the image format is not supported.
+static bool outputFrame(const vpx_image_t* const img, int outputMode,
+                        Frame* output) {
+  const bool highBitDepth = (img->fmt & VPX_IMG_FMT_HIGHBITDEPTH) != 0;
+  const int uvHeight = (img->d_h + 1) / 2;
+  if (outputMode == kOutputModeYuv) {
+    // Copy the planes with their strides, as initForYuvFrame is called.
+    const size_t yLength = img->stride[VPX_PLANE_Y] * img->d_h;
+    const size_t uvLength = img->stride[VPX_PLANE_U] * uvHeight;
+    output->resize(yLength + 2 * uvLength);
+    memcpy(&(*output)[0], img->planes[VPX_PLANE_Y], yLength);
+    memcpy(&(*output)[yLength], img->planes[VPX_PLANE_U], uvLength);
+    memcpy(&(*output)[yLength + uvLength], img->planes[VPX_PLANE_V], uvLength);
+    return true;
+  }
+  const int bytesPerPixel = outputMode == kOutputModeRgb ? 2 : 4;
+  output->resize(img->d_w * img->d_h * bytesPerPixel);
+  uint8_t* const dst = &(*output)[0];
+  if (highBitDepth) {
+    if (outputMode != kOutputModeArgb || img->bit_depth != 10) {
+      return false;
+    }
+    libyuv::I010ToARGB(
+        reinterpret_cast<const uint16_t*>(img->planes[VPX_PLANE_Y]),
+        img->stride[VPX_PLANE_Y] / 2,
+        reinterpret_cast<const uint16_t*>(img->planes[VPX_PLANE_U]),
+        img->stride[VPX_PLANE_U] / 2,
+        reinterpret_cast<const uint16_t*>(img->planes[VPX_PLANE_V]),
+        img->stride[VPX_PLANE_V] / 2, dst, img->d_w * 4, img->d_w, img->d_h);
+  } else if (outputMode == kOutputModeRgb) {
+    libyuv::I420ToRGB565(img->planes[VPX_PLANE_Y], img->stride[VPX_PLANE_Y],
+                         img->planes[VPX_PLANE_U], img->stride[VPX_PLANE_U],
+                         img->planes[VPX_PLANE_V], img->stride[VPX_PLANE_V],
+                         dst, img->d_w * 2, img->d_w, img->d_h);
+  } else {
+    libyuv::I420ToARGB(img->planes[VPX_PLANE_Y], img->stride[VPX_PLANE_Y],
+                       img->planes[VPX_PLANE_U], img->stride[VPX_PLANE_U],
+                       img->planes[VPX_PLANE_V], img->stride[VPX_PLANE_V],
+                       dst, img->d_w * 4, img->d_w, img->d_h);
+  }
+  return true;
+}
+
+// Prints the given percentiles of latenciesNs, which is sorted in place.
+static void printLatencies(const char* name,
+                           std::vector<int64_t>* latenciesNs) {
+  if (latenciesNs->empty()) {
+    return;
+  }
+  std::sort(latenciesNs->begin(), latenciesNs->end());
+  static const int kPercentiles[] = {50, 90, 99, 100};
+  printf("  %s latency (us):", name);
+  for (size_t i = 0; i < sizeof(kPercentiles) / sizeof(kPercentiles[0]); i++) {
+    const size_t index = (latenciesNs->size() - 1) * kPercentiles[i] / 100;
+    printf(" p%d=%.1f", kPercentiles[i], (*latenciesNs)[index] / 1000.0);
+  }
+  printf("\n");
+}
+
+static bool benchmarkFile(const char* path, int iterations, int threads,
+                          int outputMode) {
+  std::vector<Frame> frames;
+  double frameRate;
+  if (!readIvfFrames(path, &frames, &frameRate)) {
+    return false;
+  }
+  size_t inputSize = 0;
+  for (size_t i = 0; i < frames.size(); i++) {
+    inputSize += frames[i].size();
+  }
+
+  Frame output;
+  std::vector<int64_t> decodeLatenciesNs;
+  std::vector<int64_t> outputLatenciesNs;
+  int64_t decodeTimeNs = 0;
+  int64_t outputTimeNs = 0;
+  unsigned width = 0;
+  unsigned height = 0;
+  unsigned bitDepth = 8;
+  for (int i = 0; i < iterations; i++) {
+    vpx_codec_ctx_t decoder;
+    vpx_codec_dec_cfg_t cfg = {0, 0, 0};
+    cfg.threads = threads;
+    if (vpx_codec_dec_init(&decoder, &vpx_codec_vp9_dx_algo, &cfg, 0)) {
+      fprintf(stderr, "Failed to initialize decoder for %s: %s\n", path,
+              vpx_codec_error(&decoder));
+      return false;
+    }
+    for (size_t j = 0; j < frames.size(); j++) {
+      const int64_t startNs = nowNs();
+      if (vpx_codec_decode(&decoder, &frames[j][0], frames[j].size(), NULL,
+                           0)) {
+        fprintf(stderr, "Decode error in %s: %s\n", path,
+                vpx_codec_error(&decoder));
+        vpx_codec_destroy(&decoder);
+        return false;
+      }
+      vpx_codec_iter_t iter = NULL;
+      const vpx_image_t* img = vpx_codec_get_frame(&decoder, &iter);
+      const int64_t decodedNs = nowNs();
+      decodeLatenciesNs.push_back(decodedNs - startNs);
+      decodeTimeNs += decodedNs - startNs;
+      if (img == NULL) {
+        // A hidden frame.
+        continue;
+      }
+      width = img->d_w;
+      height = img->d_h;
+      bitDepth = img->bit_depth;
+      if (!outputFrame(img, outputMode, &output)) {
+        fprintf(stderr, "Unsupported output mode for %u-bit frames in %s\n",
+                bitDepth, path);
+        vpx_codec_destroy(&decoder);
+        return false;
+      }
+      const int64_t outputNs = nowNs() - decodedNs;
+      outputLatenciesNs.push_back(outputNs);
+      outputTimeNs += outputNs;
+    }
+    vpx_codec_destroy(&decoder);
+  }
+  if (decodeTimeNs == 0) {
+    return false;
+  }
+
+  const double decodeSeconds = decodeTimeNs / 1e9;
+  const double totalSeconds = (decodeTimeNs + outputTimeNs) / 1e9;
+  const size_t outputFrameCount = outputLatenciesNs.size();
+  printf("%s [%s] %ux%u %u-bit, %d threads\n", path, ABI, width, height,
+         bitDepth, threads);
+  printf("  %zu frames in %.3f s: %.1f fps (%.1f fps with output)",
+         decodeLatenciesNs.size(), decodeSeconds,
+         decodeLatenciesNs.size() / decodeSeconds,
+         outputFrameCount / totalSeconds);
+  if (frameRate > 0) {
+    printf(", %.1fx realtime", outputFrameCount / (frameRate * totalSeconds));
+  }
+  printf(", %.2f MB/s\n",
+         inputSize * iterations / (decodeSeconds * 1024 * 1024));
+  printf("  copy/convert: %.3f s (%.1f%% of total)\n", outputTimeNs / 1e9,
+         100.0 * outputTimeNs / (decodeTimeNs + outputTimeNs));
+  printLatencies("decode", &decodeLatenciesNs);
+  printLatencies("copy/convert", &outputLatenciesNs);
+  return true;
+}
+
+static void printUsage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-n iterations] [-t threads] [-m output_mode] "
+          "file.ivf...\n"
+          "  output_mode: 0 = YUV copy, 1 = RGB565, 2 = ARGB\n", name);
+}
+
+int main(int argc, char** argv) {
+  int iterations = 1;
+  int threads = 1;
+  int outputMode = kOutputModeYuv;
+  int option;
+  while ((option = getopt(argc, argv, "n:t:m:")) != -1) {
+    switch (option) {
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 't':
+        threads = atoi(optarg);
+        break;
+      case 'm':
+        outputMode = atoi(optarg);
+        break;
+      default:
+        printUsage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind == argc || iterations <= 0 || threads <= 0 ||
+      outputMode < kOutputModeYuv || outputMode > kOutputModeArgb) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  int failures = 0;
+  for (int i = optind; i < argc; i++) {
+    if (!benchmarkFile(argv[i], iterations, threads, outputMode)) {
+      failures++;
+    }
+  }
+  printf("peak RSS: %ld KB\n", getPeakRssKb());
+  return failures == 0 ? 0 : 1;
+}
@@ -18,16 +18,24 @@
 #include <jni.h>
 
 #include <android/log.h>
+#include <android/native_window.h>
+#include <android/native_window_jni.h>
+#include <pthread.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cstdarg>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <new>
 
+#include "include/decoder_stats.h"
 #include "libyuv.h"  // NOLINT
 
 #define VPX_CODEC_DISABLE_COMPAT 1
 #include "vpx/vpx_decoder.h"
+#include "vpx/vpx_frame_buffer.h"
 #include "vpx/vp8dx.h"
 
 #define LOG_TAG "LIBVPX_DEC"
@@ -44,133 +52,1597 @@
     Java_com_google_android_exoplayer_ext_vp9_VpxDecoder_ ## NAME \
       (JNIEnv* env, jobject thiz, ##__VA_ARGS__)\
 
-// JNI references for VpxOutputBuffer class.
+// Indices of the running totals kept for each decoder, which must match the
+// indices in NativeDecoderCounters. The totals are written on the decode thread
+// and the rendering thread for vpxRenderFrame.
+enum Stat {
+  kStatDecodeCount = 0,
+  kStatDecodeTimeNs = 1,
+  kStatConvertCount = 2,
+  kStatConvertTimeNs = 3,
+  kStatReadCount = 4,
+  kStatReadTimeNs = 5,
+  kStatReadBytes = 6,
+  kStatUpcallCount = 7,
+  kStatUpcallTimeNs = 8,
+  kStatErrorCount = 9,
+};
+
+// JNI references for VpxOutputBuffer class, cached in JNI_OnLoad.
 static jmethodID initForRgbFrame;
 static jmethodID initForYuvFrame;
+static jmethodID initForExternalYuvFrame;
+static jmethodID initForSemiPlanarFrame;
 static jfieldID dataField;
+static jfieldID dataAddressField;
 static jfieldID outputModeField;
+static jfieldID bitDepthField;
 
 jint JNI_OnLoad(JavaVM* vm, void* reserved) {
   JNIEnv* env;
   if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
     return -1;
   }
-  return JNI_VERSION_1_6;
-}
-
-FUNC(jlong, vpxInit) {
-  vpx_codec_ctx_t* context = new vpx_codec_ctx_t();
-  vpx_codec_dec_cfg_t cfg = {0};
-  cfg.threads = android_getCpuCount();
-  if (vpx_codec_dec_init(context, &vpx_codec_vp9_dx_algo, &cfg, 0)) {
-    LOGE("ERROR: Fail to initialize libvpx decoder.");
-    return 0;
-  }
-
-  // Populate JNI References.
+  initTrace();
   const jclass outputBufferClass = env->FindClass(
       "com/google/android/exoplayer/ext/vp9/VpxOutputBuffer");
+  if (outputBufferClass == NULL) {
+    return -1;
+  }
   initForYuvFrame = env->GetMethodID(outputBufferClass, "initForYuvFrame",
-                                     "(IIIII)V");
+                                     "(IIIII)Z");
+  initForExternalYuvFrame = env->GetMethodID(
+      outputBufferClass, "initForExternalYuvFrame",
+      "(Ljava/nio/ByteBuffer;IIIIIIIII)V");
   initForRgbFrame = env->GetMethodID(outputBufferClass, "initForRgbFrame",
-                                     "(II)V");
+                                     "(III)Z");
+  initForSemiPlanarFrame = env->GetMethodID(
+      outputBufferClass, "initForSemiPlanarFrame", "(IIII)Z");
   dataField = env->GetFieldID(outputBufferClass, "data",
                               "Ljava/nio/ByteBuffer;");
+  dataAddressField = env->GetFieldID(outputBufferClass, "dataAddress", "J");
   outputModeField = env->GetFieldID(outputBufferClass, "mode", "I");
+  bitDepthField = env->GetFieldID(outputBufferClass, "bitDepth", "I");
+  env->DeleteLocalRef(outputBufferClass);
+  if (initForYuvFrame == NULL || initForExternalYuvFrame == NULL ||
+      initForRgbFrame == NULL || initForSemiPlanarFrame == NULL ||
+      dataField == NULL || dataAddressField == NULL ||
+      outputModeField == NULL || bitDepthField == NULL) {
+    return -1;
+  }
+  return JNI_VERSION_1_6;
+}
+
+// Returns the address of an output buffer's data, given whether the call to
+// one of its init methods reallocated the data. The address is kept in the
+// buffer so that it is only looked up when the data changes.
+static uint8_t* getOutputData(JNIEnv* env, jobject jOutputBuffer,
+                              jboolean reallocated) {
+  if (!reallocated) {
+    return reinterpret_cast<uint8_t*>(static_cast<intptr_t>(
+        env->GetLongField(jOutputBuffer, dataAddressField)));
+  }
+  const jobject dataObject = env->GetObjectField(jOutputBuffer, dataField);
+  uint8_t* const data =
+      reinterpret_cast<uint8_t*>(env->GetDirectBufferAddress(dataObject));
+  env->DeleteLocalRef(dataObject);
+  env->SetLongField(jOutputBuffer, dataAddressField,
+                    static_cast<jlong>(reinterpret_cast<intptr_t>(data)));
+  return data;
+}
+
+// The number of compressed frames that can be queued for the worker thread in
+// pipelined mode, and the number of decoded frames that it can queue for
+// output. Both must be powers of two. The output queue is drained before the
+// decoder thread queues the next compressed frame, and in serial mode each
+// compressed frame produces at most one decoded frame, so a larger output
+// queue means that the worker never waits for output space while the decoder
+// thread waits for input space.
+static const unsigned kPipelineInputCapacity = 4;
+static const unsigned kPipelineOutputCapacity = 8;
+
+// A fixed capacity queue with a single producer thread and a single consumer
+// thread, which synchronize through the head and tail indices alone. The
+// capacity must be a power of two, so that the indices can wrap around.
+template <typename T, unsigned kCapacity>
+class SpscQueue {
+ public:
+  SpscQueue() : slots(), head(0), tail(0) {}
+
+  bool empty() const { return head.load() == tail.load(); }
+  bool full() const { return tail.load() - head.load() == kCapacity; }
+
+  // The slot that the producer fills before calling push.
+  T* back() {
+    return &slots[tail.load(std::memory_order_relaxed) % kCapacity];
+  }
+  void push() { tail.fetch_add(1); }
+
+  // The oldest slot, which the consumer reads before calling pop.
+  T* front() {
+    return &slots[head.load(std::memory_order_relaxed) % kCapacity];
+  }
+  void pop() { head.fetch_add(1); }
+
+  // Every slot, whether or not it is queued, for freeing what slots own.
+  T* slot(unsigned index) { return &slots[index]; }
+
+ private:
+  T slots[kCapacity];
+  std::atomic<unsigned> head;
+  std::atomic<unsigned> tail;
+};
+
+// Puts a thread to sleep until a condition changed by another thread holds.
+// The other thread only takes the mutex to wake a thread that is asleep, so a
+// thread that is not waiting never blocks the other. Changes to the condition
+// and the count of waiters are sequentially consistent, so a change is either
+// seen by the waiting thread before it sleeps or followed by a wake up.
+class Waiter {
+ public:
+  Waiter() : waiters(0) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+  }
+
+  ~Waiter() {
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+  }
+
+  template <typename Condition>
+  void wait_until(Condition condition) {
+    if (condition()) {
+      return;
+    }
+    pthread_mutex_lock(&mutex);
+    waiters.fetch_add(1);
+    while (!condition()) {
+      pthread_cond_wait(&cond, &mutex);
+    }
+    waiters.fetch_sub(1);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  void notify() {
+    if (waiters.load() > 0) {
+      pthread_mutex_lock(&mutex);
+      pthread_cond_broadcast(&cond);
+      pthread_mutex_unlock(&mutex);
+    }
+  }
+
+ private:
+  std::atomic<int> waiters;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+
+// A decoder-owned frame buffer, handed to libvpx through the external frame
+// buffer API so that decoded planes can be given to Java without copying.
+struct JniFrameBuffer {
+  int id;
+  // References held by libvpx plus references held by VpxOutputBuffers.
+  int ref_count;
+  vpx_codec_frame_buffer_t vpx_fb;
+  // Direct ByteBuffer wrapping vpx_fb.data, created lazily on a thread that
+  // has a JNIEnv. Stale once vpx_fb.data has been reallocated.
+  jobject byte_buffer;
+  bool byte_buffer_stale;
+};
+
+// Pool of JniFrameBuffers shared between libvpx and the Java output buffers.
+// libvpx acquires and releases buffers on the decoder thread, whereas output
+// buffers may be released on any thread, so all access is guarded by a mutex.
+// The pool outlives vpxClose if output buffers still reference frames, and is
+// deleted by whichever of vpxClose and vpxReleaseFrame drops the last use.
+class JniBufferManager {
+  // libvpx may hold up to VP9_MAXIMUM_REF_BUFFERS + VPX_MAXIMUM_WORK_BUFFERS
+  // buffers at once, and the output queue of a pipelined decoder up to
+  // kPipelineOutputCapacity. The remainder can be referenced by output
+  // buffers.
+  static const int kMaxFrames = VP9_MAXIMUM_REF_BUFFERS +
+      VPX_MAXIMUM_WORK_BUFFERS + kPipelineOutputCapacity + 16;
+
+  JniFrameBuffer* all_buffers[kMaxFrames];
+  int all_buffer_count;
+
+  JniFrameBuffer* free_buffers[kMaxFrames];
+  int free_buffer_count;
+
+  int java_ref_count;
+  bool closed;
+
+  // The total size of the frame buffers, and the size that allocations may
+  // not take it beyond, or 0 if there is no limit.
+  size_t allocated_size;
+  size_t budget;
+
+  pthread_mutex_t mutex;
+
+ public:
+  JniBufferManager()
+      : all_buffer_count(0),
+        free_buffer_count(0),
+        java_ref_count(0),
+        closed(false),
+        allocated_size(0),
+        budget(0) {
+    pthread_mutex_init(&mutex, NULL);
+  }
+
+  // Limits the size of the frame buffers allocated from now on. Buffers that
+  // are already allocated are kept.
+  void set_budget(size_t new_budget) {
+    pthread_mutex_lock(&mutex);
+    budget = new_budget;
+    pthread_mutex_unlock(&mutex);
+  }
+
+  size_t get_allocated_size() {
+    pthread_mutex_lock(&mutex);
+    const size_t result = allocated_size;
+    pthread_mutex_unlock(&mutex);
+    return result;
+  }
+
+  void destroy(JNIEnv* env) {
+    while (all_buffer_count--) {
+      JniFrameBuffer* buffer = all_buffers[all_buffer_count];
+      if (buffer->byte_buffer != NULL) {
+        env->DeleteGlobalRef(buffer->byte_buffer);
+      }
+      free(buffer->vpx_fb.data);
+      delete buffer;
+    }
+    pthread_mutex_destroy(&mutex);
+    delete this;
+  }
+
+  int get_buffer(size_t min_size, vpx_codec_frame_buffer_t* fb) {
+    pthread_mutex_lock(&mutex);
+    JniFrameBuffer* out_buffer;
+    // The next free buffer is reused as is if it is large enough, and is
+    // otherwise reallocated, which releases its current size.
+    const size_t free_size = free_buffer_count
+        ? free_buffers[free_buffer_count - 1]->vpx_fb.size : 0;
+    if (budget && free_size < min_size &&
+        allocated_size - free_size + min_size > budget) {
+      pthread_mutex_unlock(&mutex);
+      LOGE("JniBufferManager get_buffer: %zu bytes would exceed the budget "
+           "of %zu bytes.", min_size, budget);
+      return -1;
+    }
+    if (free_buffer_count) {
+      out_buffer = free_buffers[--free_buffer_count];
+      if (out_buffer->vpx_fb.size < min_size) {
+        allocated_size -= out_buffer->vpx_fb.size;
+        free(out_buffer->vpx_fb.data);
+        out_buffer->vpx_fb.data = reinterpret_cast<uint8_t*>(malloc(min_size));
+        out_buffer->vpx_fb.size = min_size;
+        allocated_size += min_size;
+        out_buffer->byte_buffer_stale = true;
+        if (out_buffer->vpx_fb.data) {
+          memset(out_buffer->vpx_fb.data, 0, min_size);
+        }
+      }
+    } else if (all_buffer_count < kMaxFrames) {
+      out_buffer = new JniFrameBuffer();
+      out_buffer->id = all_buffer_count;
+      all_buffers[all_buffer_count++] = out_buffer;
+      out_buffer->vpx_fb.data =
+          reinterpret_cast<uint8_t*>(calloc(min_size, 1));
+      out_buffer->vpx_fb.size = min_size;
+      allocated_size += min_size;
+      out_buffer->vpx_fb.priv = out_buffer;
+      out_buffer->byte_buffer = NULL;
+      out_buffer->byte_buffer_stale = true;
+    } else {
+      pthread_mutex_unlock(&mutex);
+      LOGE("JniBufferManager get_buffer: all %d frame buffers in use.",
+           kMaxFrames);
+      return -1;
+    }
+    if (!out_buffer->vpx_fb.data) {
+      // Keep the entry so that ids stay stable, and retry the allocation
+      // next time it is handed out.
+      allocated_size -= out_buffer->vpx_fb.size;
+      out_buffer->vpx_fb.size = 0;
+      free_buffers[free_buffer_count++] = out_buffer;
+      pthread_mutex_unlock(&mutex);
+      LOGE("JniBufferManager get_buffer OOM.");
+      return -1;
+    }
+    out_buffer->ref_count = 1;
+    *fb = out_buffer->vpx_fb;
+    pthread_mutex_unlock(&mutex);
+    return 0;
+  }
+
+  // Returns the buffer backing img, taking a reference that is dropped by
+  // release, or NULL if img does not come from this pool.
+  JniFrameBuffer* add_ref(const vpx_image_t* img) {
+    JniFrameBuffer* buffer = reinterpret_cast<JniFrameBuffer*>(img->fb_priv);
+    if (buffer == NULL) {
+      return NULL;
+    }
+    pthread_mutex_lock(&mutex);
+    buffer->ref_count++;
+    pthread_mutex_unlock(&mutex);
+    return buffer;
+  }
+
+  // Returns the buffer backing img, taking a reference on behalf of Java, or
+  // NULL if img does not come from this pool.
+  JniFrameBuffer* add_java_ref(const vpx_image_t* img) {
+    JniFrameBuffer* buffer = reinterpret_cast<JniFrameBuffer*>(img->fb_priv);
+    if (buffer == NULL) {
+      return NULL;
+    }
+    pthread_mutex_lock(&mutex);
+    buffer->ref_count++;
+    java_ref_count++;
+    pthread_mutex_unlock(&mutex);
+    return buffer;
+  }
+
+  // Returns a direct ByteBuffer wrapping the buffer's data. Must only be
+  // called while a reference to the buffer is held.
+  jobject get_byte_buffer(JNIEnv* env, JniFrameBuffer* buffer) {
+    if (buffer->byte_buffer_stale) {
+      if (buffer->byte_buffer != NULL) {
+        env->DeleteGlobalRef(buffer->byte_buffer);
+      }
+      jobject localRef =
+          env->NewDirectByteBuffer(buffer->vpx_fb.data, buffer->vpx_fb.size);
+      buffer->byte_buffer = env->NewGlobalRef(localRef);
+      env->DeleteLocalRef(localRef);
+      buffer->byte_buffer_stale = false;
+    }
+    return buffer->byte_buffer;
+  }
+
+  void release(JniFrameBuffer* buffer) {
+    pthread_mutex_lock(&mutex);
+    release_locked(buffer);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  // Drops a reference taken by add_java_ref. Returns true if the pool is no
+  // longer used and should be destroyed by the caller.
+  bool release_java_ref(int id) {
+    pthread_mutex_lock(&mutex);
+    if (id < 0 || id >= all_buffer_count) {
+      pthread_mutex_unlock(&mutex);
+      LOGE("JniBufferManager release_java_ref: invalid id %d.", id);
+      return false;
+    }
+    release_locked(all_buffers[id]);
+    java_ref_count--;
+    const bool unused = closed && java_ref_count == 0;
+    pthread_mutex_unlock(&mutex);
+    return unused;
+  }
+
+  // Returns whether any frame is referenced by an output buffer. Once the
+  // decoder is closed no new references can be taken, so a false result is
+  // final.
+  bool has_java_refs() {
+    pthread_mutex_lock(&mutex);
+    const bool result = java_ref_count > 0;
+    pthread_mutex_unlock(&mutex);
+    return result;
+  }
+
+  // Marks the pool as no longer used by libvpx. Returns true if the pool
+  // should be destroyed by the caller.
+  bool close() {
+    pthread_mutex_lock(&mutex);
+    closed = true;
+    const bool unused = java_ref_count == 0;
+    pthread_mutex_unlock(&mutex);
+    return unused;
+  }
+
+ private:
+  void release_locked(JniFrameBuffer* buffer) {
+    if (buffer->ref_count == 0) {
+      LOGE("JniBufferManager release: buffer %d not in use.", buffer->id);
+      return;
+    }
+    if (--buffer->ref_count == 0) {
+      free_buffers[free_buffer_count++] = buffer;
+    }
+  }
+};
+
+// State for rendering frames to a Surface. Only accessed on the thread that
+// renders frames and closes the decoder.
+struct NativeWindowCtx {
+  // Global reference to the Surface that native_window was acquired from.
+  jobject surface;
+  ANativeWindow* native_window;
+  // Requested buffer geometry, where zero means the size of the window.
+  int width;
+  int height;
+  // I420 frame scaled to the size of the window buffer, when it differs from
+  // the size of the frame.
+  uint8_t* scaled_frame;
+  size_t scaled_frame_size;
+};
+
+// The configuration that a libvpx decoder is initialized with, which must match
+// for a pooled decoder to be reused.
+struct DecoderConfig {
+  int threads;
+  vpx_codec_flags_t flags;
+  bool row_mt;
+
+  bool matches(const DecoderConfig& other) const {
+    return threads == other.threads && flags == other.flags &&
+        row_mt == other.row_mt;
+  }
+};
+
+class DecodePipeline;
+
+struct JniCtx {
+  vpx_codec_ctx_t* decoder;
+  JniBufferManager* buffer_manager;
+  DecoderConfig config;
+  NativeWindowCtx window;
+  // Decodes on a worker thread in pipelined mode, or NULL.
+  DecodePipeline* pipeline;
+  // Iterator over the frames that are ready after the last decode, and the
+  // next of those frames, or NULL if there are no more. In pipelined mode the
+  // next frame is instead the head of the pipeline's output queue, once it
+  // has been peeked.
+  vpx_codec_iter_t iter;
+  const vpx_image_t* next_frame;
+  // Scratch buffer for converting frames between bit depths, only accessed on
+  // the decode thread.
+  uint8_t* convert_buffer;
+  size_t convert_buffer_size;
+  Stats stats;
+};
+
+static void releaseNativeWindow(JNIEnv* env, NativeWindowCtx* window) {
+  if (window->native_window != NULL) {
+    ANativeWindow_release(window->native_window);
+    window->native_window = NULL;
+  }
+  if (window->surface != NULL) {
+    env->DeleteGlobalRef(window->surface);
+    window->surface = NULL;
+  }
+  free(window->scaled_frame);
+  window->scaled_frame = NULL;
+  window->scaled_frame_size = 0;
+}
+
+static int vpx_get_frame_buffer(void* priv, size_t min_size,
+                                vpx_codec_frame_buffer_t* fb) {
+  JniBufferManager* const buffer_manager =
+      reinterpret_cast<JniBufferManager*>(priv);
+  return buffer_manager->get_buffer(min_size, fb);
+}
+
+static int vpx_release_frame_buffer(void* priv, vpx_codec_frame_buffer_t* fb) {
+  JniBufferManager* const buffer_manager =
+      reinterpret_cast<JniBufferManager*>(priv);
+  if (fb->priv != NULL) {
+    buffer_manager->release(reinterpret_cast<JniFrameBuffer*>(fb->priv));
+  }
+  return 0;
+}
+
+static void setSkipLoopFilter(vpx_codec_ctx_t* decoder, bool skipLoopFilter) {
+#ifdef VPX_CTRL_VP9_SET_SKIP_LOOP_FILTER
+  if (vpx_codec_control(decoder, VP9_SET_SKIP_LOOP_FILTER,
+                        skipLoopFilter ? 1 : 0)) {
+    LOGE("ERROR: Fail to set skip loop filter: %s",
+         vpx_codec_error_detail(decoder));
+  }
+#else
+  if (skipLoopFilter) {
+    LOGE("ERROR: Skipping the loop filter is not supported by this libvpx.");
+  }
+#endif
+}
+
+// Decodes on a native worker thread in pipelined mode, so that the decoder
+// thread only queues compressed frames and polls for decoded ones, and the
+// decoding of each frame overlaps with the output of the frames before it. The
+// decoder thread produces the input queue and consumes the output queue, and
+// the worker thread is the other end of each. Only the worker thread uses the
+// decoder, except while the pipeline is idle after discard.
+class DecodePipeline {
+ public:
+  DecodePipeline(JniCtx* context, bool skip_loop_filter)
+      : context(context),
+        skip_loop_filter(skip_loop_filter),
+        applied_skip_loop_filter(skip_loop_filter),
+        stopping(false),
+        discarding(false),
+        end_of_stream_pending(false),
+        decode_failed(false),
+        started(false) {}
+
+  bool start() {
+    started = pthread_create(&thread, NULL, run_worker, this) == 0;
+    return started;
+  }
+
+  // Stops the worker thread, and drops the decoded frames that have not been
+  // output.
+  ~DecodePipeline() {
+    if (started) {
+      stopping.store(true);
+      waiter.notify();
+      pthread_join(thread, NULL);
+    }
+    while (!output_queue.empty()) {
+      pop_output();
+    }
+    for (unsigned i = 0; i < kPipelineInputCapacity; i++) {
+      free(input_queue.slot(i)->data);
+    }
+  }
+
+  // Copies a compressed frame into the input queue, waiting for space if it is
+  // full. Returns false if the copy could not be allocated, or if an earlier
+  // frame failed to decode.
+  bool queue_input(const uint8_t* data, size_t size, int frame_index) {
+    if (!wait_for_input_space()) {
+      return false;
+    }
+    InputFrame* const input = input_queue.back();
+    if (input->capacity < size) {
+      uint8_t* const new_data =
+          reinterpret_cast<uint8_t*>(realloc(input->data, size));
+      if (new_data == NULL) {
+        LOGE("ERROR: Fail to allocate a %zu byte pipeline input.", size);
+        return false;
+      }
+      input->data = new_data;
+      input->capacity = size;
+    }
+    memcpy(input->data, data, size);
+    input->size = size;
+    input->frame_index = frame_index;
+    input->end_of_stream = false;
+    input_queue.push();
+    waiter.notify();
+    return true;
+  }
+
+  // Queues a flush of the decoder, after which the frames that it holds back
+  // are output. Returns false if an earlier frame failed to decode.
+  bool queue_end_of_stream() {
+    if (!wait_for_input_space()) {
+      return false;
+    }
+    InputFrame* const input = input_queue.back();
+    input->size = 0;
+    input->end_of_stream = true;
+    end_of_stream_pending.store(true);
+    input_queue.push();
+    waiter.notify();
+    return true;
+  }
+
+  // Drops the queued compressed and decoded frames, and waits for the worker
+  // thread to become idle, so that the decoder can then be reset on the
+  // calling thread.
+  void discard() {
+    discarding.store(true);
+    waiter.notify();
+    waiter.wait_until([this] { return input_queue.empty(); });
+    while (!output_queue.empty()) {
+      pop_output();
+    }
+    end_of_stream_pending.store(false);
+    discarding.store(false);
+  }
+
+  // Returns whether a decoded frame is queued, or will be once a queued end
+  // of stream has been processed.
+  bool has_output() const {
+    return !output_queue.empty() || end_of_stream_pending.load();
+  }
+
+  // Returns the oldest decoded frame, or NULL if there is none. Only waits if
+  // the end of stream has been queued, until the worker thread either outputs
+  // a frame or finishes flushing the decoder.
+  const vpx_image_t* peek_output() {
+    if (output_queue.empty() && end_of_stream_pending.load()) {
+      waiter.wait_until([this] {
+        return !output_queue.empty() || !end_of_stream_pending.load();
+      });
+    }
+    return output_queue.empty() ? NULL : &output_queue.front()->img;
+  }
+
+  // Removes the oldest decoded frame, dropping the pipeline's reference to its
+  // frame buffer.
+  void pop_output() {
+    OutputFrame* const output = output_queue.front();
+    if (output->buffer != NULL) {
+      context->buffer_manager->release(output->buffer);
+    }
+    output_queue.pop();
+    waiter.notify();
+  }
+
+  void set_skip_loop_filter(bool skip) { skip_loop_filter.store(skip); }
+
+  bool failed() const { return decode_failed.load(); }
+
+ private:
+  struct InputFrame {
+    uint8_t* data;
+    size_t capacity;
+    size_t size;
+    int frame_index;
+    bool end_of_stream;
+  };
+
+  // A copy of a decoded image, which remains valid while the pipeline holds a
+  // reference to its frame buffer.
+  struct OutputFrame {
+    vpx_image_t img;
+    JniFrameBuffer* buffer;
+  };
+
+  JniCtx* const context;
+  SpscQueue<InputFrame, kPipelineInputCapacity> input_queue;
+  SpscQueue<OutputFrame, kPipelineOutputCapacity> output_queue;
+  Waiter waiter;
+  pthread_t thread;
+
+  std::atomic<bool> skip_loop_filter;
+  // Only accessed on the worker thread.
+  bool applied_skip_loop_filter;
+  std::atomic<bool> stopping;
+  std::atomic<bool> discarding;
+  std::atomic<bool> end_of_stream_pending;
+  std::atomic<bool> decode_failed;
+  bool started;
+
+  bool wait_for_input_space() {
+    waiter.wait_until([this] { return failed() || !input_queue.full(); });
+    return !failed();
+  }
+
+  static void* run_worker(void* pipeline) {
+    reinterpret_cast<DecodePipeline*>(pipeline)->run();
+    return NULL;
+  }
+
+  void run() {
+    while (true) {
+      waiter.wait_until(
+          [this] { return stopping.load() || !input_queue.empty(); });
+      if (stopping.load()) {
+        return;
+      }
+      InputFrame* const input = input_queue.front();
+      if (!failed() && !discarding.load()) {
+        if (input->end_of_stream) {
+          flush_decoder();
+        } else {
+          decode(input);
+        }
+      }
+      if (input->end_of_stream) {
+        end_of_stream_pending.store(false);
+      }
+      input_queue.pop();
+      waiter.notify();
+    }
+  }
+
+  void decode(const InputFrame* input) {
+    ScopedTrace trace("vpxDecode");
+    const bool skip = skip_loop_filter.load();
+    if (skip != applied_skip_loop_filter) {
+      setSkipLoopFilter(context->decoder, skip);
+      applied_skip_loop_filter = skip;
+    }
+    const int64_t startNs = nowNs();
+    const vpx_codec_err_t status = vpx_codec_decode(
+        context->decoder, input->data, input->size,
+        reinterpret_cast<void*>(static_cast<intptr_t>(input->frame_index)),
+        0);
+    if (status != VPX_CODEC_OK) {
+      fail("vpx_codec_decode() failed", status);
+      return;
+    }
+    context->stats.addCall(kStatDecodeCount, kStatDecodeTimeNs, startNs);
+    queue_frames();
+  }
+
+  void flush_decoder() {
+    const vpx_codec_err_t status =
+        vpx_codec_decode(context->decoder, NULL, 0, NULL, 0);
+    if (status != VPX_CODEC_OK) {
+      fail("vpx_codec_decode() flush failed", status);
+      return;
+    }
+    queue_frames();
+  }
+
+  void fail(const char* message, vpx_codec_err_t status) {
+    context->stats.add(kStatErrorCount, 1);
+    LOGE("ERROR: %s, status= %d", message, status);
+    // The decoder is no longer used, so its error can be read by vpxDecode.
+    decode_failed.store(true);
+    waiter.notify();
+  }
+
+  // Moves the frames that are ready after a decode into the output queue.
+  // Frames returned by libvpx are only valid until the next decode, so the
+  // queue keeps a copy of each image and a reference to its frame buffer.
+  void queue_frames() {
+    vpx_codec_iter_t iter = NULL;
+    const vpx_image_t* img;
+    while ((img = vpx_codec_get_frame(context->decoder, &iter)) != NULL) {
+      waiter.wait_until([this] {
+        return stopping.load() || discarding.load() || !output_queue.full();
+      });
+      if (stopping.load() || discarding.load()) {
+        continue;
+      }
+      OutputFrame* const output = output_queue.back();
+      output->img = *img;
+      output->buffer = context->buffer_manager->add_ref(img);
+      output_queue.push();
+      waiter.notify();
+    }
+  }
+
+  // no copy constructor or assignment
+  DecodePipeline(const DecodePipeline&);
+  DecodePipeline& operator=(const DecodePipeline&);
+};
+
+// Starts decoding on a worker thread, or leaves the decoder synchronous if
+// the thread cannot be created.
+static void startPipeline(JniCtx* context, bool skipLoopFilter) {
+  DecodePipeline* const pipeline = new DecodePipeline(context, skipLoopFilter);
+  if (!pipeline->start()) {
+    LOGE("ERROR: Fail to start the decode thread; decoding synchronously.");
+    delete pipeline;
+    return;
+  }
+  context->pipeline = pipeline;
+}
+
+// Initialized decoders kept by vpxClose for reuse by vpxInit, together with the
+// frame buffer pools that their frame buffer functions are bound to. Reusing a
+// decoder avoids reallocating it and restarting its threads when decoders are
+// replaced in quick succession, for example at ad breaks. Empty unless a
+// capacity is set by vpxSetDecoderPoolCapacity.
+struct PooledDecoder {
+  DecoderConfig config;
+  vpx_codec_ctx_t* decoder;
+  JniBufferManager* buffer_manager;
+};
+
+static const int kMaxDecoderPoolCapacity = 4;
+static pthread_mutex_t decoder_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PooledDecoder decoder_pool[kMaxDecoderPoolCapacity];
+static int decoder_pool_size = 0;
+static int decoder_pool_capacity = 0;
+
+static void destroyDecoder(JNIEnv* env, vpx_codec_ctx_t* decoder,
+                           JniBufferManager* buffer_manager) {
+  // Destroying the decoder releases all of the buffers that libvpx holds.
+  vpx_codec_destroy(decoder);
+  delete decoder;
+  buffer_manager->destroy(env);
+}
+
+// Takes a pooled decoder with the given configuration, if there is one.
+static bool takePooledDecoder(const DecoderConfig& config,
+                              PooledDecoder* pooledDecoder) {
+  pthread_mutex_lock(&decoder_pool_mutex);
+  bool found = false;
+  for (int i = 0; i < decoder_pool_size; i++) {
+    if (decoder_pool[i].config.matches(config)) {
+      *pooledDecoder = decoder_pool[i];
+      decoder_pool[i] = decoder_pool[--decoder_pool_size];
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&decoder_pool_mutex);
+  return found;
+}
+
+// Resets the decoder of a context that is being closed and adds it to the
+// pool. Returns false if the decoder cannot be pooled and must be destroyed.
+static bool recycleDecoder(JniCtx* const context) {
+  pthread_mutex_lock(&decoder_pool_mutex);
+  const bool hasCapacity = decoder_pool_size < decoder_pool_capacity;
+  pthread_mutex_unlock(&decoder_pool_mutex);
+  // Output buffers that still reference frames release them through the old
+  // context, so its frame buffer pool cannot be reused.
+  if (!hasCapacity || context->buffer_manager->has_java_refs()) {
+    return false;
+  }
+  // Flush the decoder and drop the frames that it outputs, as a reset does.
+  if (vpx_codec_decode(context->decoder, NULL, 0, NULL, 0) != VPX_CODEC_OK) {
+    return false;
+  }
+  vpx_codec_iter_t iter = NULL;
+  while (vpx_codec_get_frame(context->decoder, &iter) != NULL) {}
+
+  pthread_mutex_lock(&decoder_pool_mutex);
+  const bool pooled = decoder_pool_size < decoder_pool_capacity;
+  if (pooled) {
+    PooledDecoder* const pooledDecoder = &decoder_pool[decoder_pool_size++];
+    pooledDecoder->config = context->config;
+    pooledDecoder->decoder = context->decoder;
+    pooledDecoder->buffer_manager = context->buffer_manager;
+  }
+  pthread_mutex_unlock(&decoder_pool_mutex);
+  return pooled;
+}
+
+FUNC(jlong, vpxInit, jint threads, jboolean enableFrameParallelMode,
+     jboolean skipLoopFilter, jboolean enableRowMultiThreadMode,
+     jlong memoryBudget, jboolean enablePipelinedMode) {
+  DecoderConfig config;
+  config.threads = threads > 0 ? threads : android_getCpuCount();
+  config.flags = 0;
+  // In frame parallel mode libvpx already pipelines decoding internally, and
+  // may output several frames for one compressed frame, so it is not used in
+  // pipelined mode.
+  if (enableFrameParallelMode && !enablePipelinedMode) {
+    if (vpx_codec_get_caps(&vpx_codec_vp9_dx_algo) &
+        VPX_CODEC_CAP_FRAME_THREADING) {
+      config.flags |= VPX_CODEC_USE_FRAME_THREADING;
+    } else {
+      LOGE("ERROR: Frame parallel mode is not supported by this libvpx.");
+    }
+  }
+  // Row based multithreading only applies when frames are decoded serially.
+  config.row_mt = enableRowMultiThreadMode &&
+      !(config.flags & VPX_CODEC_USE_FRAME_THREADING);
+
+  JniCtx* context = new JniCtx();
+  context->config = config;
+  PooledDecoder pooledDecoder;
+  if (takePooledDecoder(config, &pooledDecoder)) {
+    context->decoder = pooledDecoder.decoder;
+    context->buffer_manager = pooledDecoder.buffer_manager;
+    context->buffer_manager->set_budget(std::max<jlong>(memoryBudget, 0));
+    setSkipLoopFilter(context->decoder, skipLoopFilter);
+    if (enablePipelinedMode) {
+      startPipeline(context, skipLoopFilter);
+    }
+    return reinterpret_cast<intptr_t>(context);
+  }
+
+  context->decoder = new vpx_codec_ctx_t();
+  vpx_codec_dec_cfg_t cfg = {0};
+  cfg.threads = config.threads;
+  if (vpx_codec_dec_init(context->decoder, &vpx_codec_vp9_dx_algo, &cfg,
+                         config.flags)) {
+    LOGE("ERROR: Fail to initialize libvpx decoder.");
+    delete context->decoder;
+    delete context;
+    return 0;
+  }
+  if (skipLoopFilter) {
+    setSkipLoopFilter(context->decoder, true);
+  }
+  if (config.row_mt) {
+#ifdef VPX_CTRL_VP9D_SET_ROW_MT
+    if (vpx_codec_control(context->decoder, VP9D_SET_ROW_MT, 1)) {
+      LOGE("ERROR: Fail to enable row multithreading: %s",
+           vpx_codec_error_detail(context->decoder));
+    }
+#else
+    LOGE("ERROR: Row multithreading is not supported by this libvpx.");
+#endif
+  }
+  context->buffer_manager = new JniBufferManager();
+  context->buffer_manager->set_budget(std::max<jlong>(memoryBudget, 0));
+  if (vpx_codec_set_frame_buffer_functions(
+          context->decoder, vpx_get_frame_buffer, vpx_release_frame_buffer,
+          context->buffer_manager)) {
+    LOGE("ERROR: Fail to set libvpx frame buffer functions.");
+    destroyDecoder(env, context->decoder, context->buffer_manager);
+    delete context;
+    return 0;
+  }
+  if (enablePipelinedMode) {
+    startPipeline(context, skipLoopFilter);
+  }
 
   return reinterpret_cast<intptr_t>(context);
 }
 
-FUNC(jlong, vpxDecode, jlong jContext, jobject encoded, jint len) {
-  vpx_codec_ctx_t* const context = reinterpret_cast<vpx_codec_ctx_t*>(jContext);
+// Sets the number of closed decoders that are kept for reuse, destroying any
+// pooled decoders beyond the new capacity.
+FUNC(void, vpxSetDecoderPoolCapacity, jint capacity) {
+  PooledDecoder excess[kMaxDecoderPoolCapacity];
+  int excessCount = 0;
+  pthread_mutex_lock(&decoder_pool_mutex);
+  decoder_pool_capacity =
+      std::max(0, std::min(static_cast<int>(capacity),
+                           kMaxDecoderPoolCapacity));
+  while (decoder_pool_size > decoder_pool_capacity) {
+    excess[excessCount++] = decoder_pool[--decoder_pool_size];
+  }
+  pthread_mutex_unlock(&decoder_pool_mutex);
+  for (int i = 0; i < excessCount; i++) {
+    destroyDecoder(env, excess[i].decoder, excess[i].buffer_manager);
+  }
+}
+
+// Returns the size of the decoder's frame buffers, which hold most of its
+// memory. libvpx's own allocations, such as its per-frame mode info, are not
+// included because libvpx allocates them internally.
+FUNC(jlong, vpxGetMemoryUsage, jlong jContext) {
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  return context->buffer_manager->get_allocated_size();
+}
+
+FUNC(void, vpxSetSkipLoopFilter, jlong jContext, jboolean skipLoopFilter) {
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  if (context->pipeline != NULL) {
+    // Applied by the worker thread before it decodes the next frame.
+    context->pipeline->set_skip_loop_filter(skipLoopFilter);
+  } else {
+    setSkipLoopFilter(context->decoder, skipLoopFilter);
+  }
+}
+
+// Decodes a frame, tagging it with frameIndex so that it can be identified
+// when it is output, which in frame parallel mode may be after later frames
+// have been decoded. In pipelined mode the frame is queued for the worker
+// thread instead, and is output by a later call to vpxGetFrame.
+FUNC(jlong, vpxDecode, jlong jContext, jobject encoded, jint len,
+     jint frameIndex) {
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
   const uint8_t* const buffer =
       reinterpret_cast<const uint8_t*>(env->GetDirectBufferAddress(encoded));
-  const vpx_codec_err_t status =
-      vpx_codec_decode(context, buffer, len, NULL, 0);
+  if (context->pipeline != NULL) {
+    return context->pipeline->queue_input(buffer, len, frameIndex) ? 0 : -1;
+  }
+  ScopedTrace trace("vpxDecode");
+  context->next_frame = NULL;
+  const int64_t startNs = nowNs();
+  const vpx_codec_err_t status = vpx_codec_decode(
+      context->decoder, buffer, len,
+      reinterpret_cast<void*>(static_cast<intptr_t>(frameIndex)), 0);
   if (status != VPX_CODEC_OK) {
+    context->stats.add(kStatErrorCount, 1);
     LOGE("ERROR: vpx_codec_decode() failed, status= %d", status);
     return -1;
   }
+  context->iter = NULL;
+  context->next_frame = vpx_codec_get_frame(context->decoder, &context->iter);
+  context->stats.addCall(kStatDecodeCount, kStatDecodeTimeNs, startNs);
+  return 0;
+}
+
+// Signals the end of the input to the decoder, so that it outputs all of the
+// frames it holds. If discard is true the frames are dropped, which resets the
+// decoder in frame parallel mode. In pipelined mode the frames still queued
+// are either output after the flush, or dropped along with it.
+FUNC(jlong, vpxFlush, jlong jContext, jboolean discard) {
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  if (context->pipeline != NULL) {
+    if (!discard) {
+      return context->pipeline->queue_end_of_stream() ? 0 : -1;
+    }
+    context->pipeline->discard();
+  }
+  context->next_frame = NULL;
+  const vpx_codec_err_t status =
+      vpx_codec_decode(context->decoder, NULL, 0, NULL, 0);
+  if (status != VPX_CODEC_OK) {
+    context->stats.add(kStatErrorCount, 1);
+    LOGE("ERROR: vpx_codec_decode() flush failed, status= %d", status);
+    return -1;
+  }
+  context->iter = NULL;
+  if (discard) {
+    while (vpx_codec_get_frame(context->decoder, &context->iter) != NULL) {}
+  } else {
+    context->next_frame =
+        vpx_codec_get_frame(context->decoder, &context->iter);
+  }
   return 0;
 }
 
 FUNC(jlong, vpxClose, jlong jContext) {
-  vpx_codec_ctx_t* const context = reinterpret_cast<vpx_codec_ctx_t*>(jContext);
-  vpx_codec_destroy(context);
-  delete context;
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  // Stop the worker thread before the decoder is reset or destroyed.
+  delete context->pipeline;
+  context->pipeline = NULL;
+  context->next_frame = NULL;
+  releaseNativeWindow(env, &context->window);
+  free(context->convert_buffer);
+  context->convert_buffer = NULL;
+  context->convert_buffer_size = 0;
+  if (recycleDecoder(context)) {
+    // The decoder and its frame buffers now belong to the pool.
+    delete context;
+    return 0;
+  }
+  // Destroying the decoder releases all of the buffers that libvpx holds.
+  vpx_codec_destroy(context->decoder);
+  delete context->decoder;
+  context->decoder = NULL;
+  if (context->buffer_manager->close()) {
+    context->buffer_manager->destroy(env);
+    delete context;
+  }
+  // Otherwise the context is deleted when the last frame is released.
   return 0;
 }
 
-FUNC(jint, vpxGetFrame, jlong jContext, jobject jOutputBuffer) {
-  vpx_codec_ctx_t* const context = reinterpret_cast<vpx_codec_ctx_t*>(jContext);
-  vpx_codec_iter_t iter = NULL;
-  const vpx_image_t* const img = vpx_codec_get_frame(context, &iter);
+FUNC(void, vpxReleaseFrame, jlong jContext, jint frameBufferId) {
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  if (context->buffer_manager->release_java_ref(frameBufferId)) {
+    context->buffer_manager->destroy(env);
+    delete context;
+  }
+}
 
-  if (img == NULL) {
-    return 1;
+static const int kOutputModeYuv = 0;
+static const int kOutputModeRgb = 1;
+static const int kOutputModeArgb = 2;
+static const int kOutputModeAbgr = 3;
+static const int kOutputModeNv12 = 4;
+static const int kOutputModeP010 = 5;
+
+static const int kColorspaceUnknown = 0;
+static const int kColorspaceBT601 = 1;
+static const int kColorspaceBT709 = 2;
+static const int kColorspaceBT2020 = 3;
+
+typedef int (*ConvertFunction)(const uint8_t*, int, const uint8_t*, int,
+                               const uint8_t*, int, uint8_t*, int, int, int);
+typedef int (*Convert16Function)(const uint16_t*, int, const uint16_t*, int,
+                                 const uint16_t*, int, uint8_t*, int, int,
+                                 int);
+
+// Returns the libyuv function converting 8-bit I420 to ARGB or ABGR with the
+// coefficients of colorspace. The H420 variants use BT.709, the U420 variants
+// BT.2020 and the I420 variants BT.601.
+static ConvertFunction getConvertFunction(bool abgr, int colorspace) {
+  switch (colorspace) {
+    case kColorspaceBT709:
+      return abgr ? libyuv::H420ToABGR : libyuv::H420ToARGB;
+    case kColorspaceBT2020:
+      return abgr ? libyuv::U420ToABGR : libyuv::U420ToARGB;
+    default:
+      return abgr ? libyuv::I420ToABGR : libyuv::I420ToARGB;
+  }
+}
+
+// As getConvertFunction, but for 10-bit I420.
+static Convert16Function getConvert16Function(bool abgr, int colorspace) {
+  switch (colorspace) {
+    case kColorspaceBT709:
+      return abgr ? libyuv::H010ToABGR : libyuv::H010ToARGB;
+    case kColorspaceBT2020:
+      return abgr ? libyuv::U010ToABGR : libyuv::U010ToARGB;
+    default:
+      return abgr ? libyuv::I010ToABGR : libyuv::I010ToARGB;
+  }
+}
+
+// Returns a scratch buffer of at least size bytes for converting frames
+// between bit depths, or NULL if it cannot be allocated. Only used on the
+// decode thread.
+static uint8_t* getConvertBuffer(JniCtx* const context, size_t size) {
+  if (context->convert_buffer_size < size) {
+    free(context->convert_buffer);
+    context->convert_buffer = reinterpret_cast<uint8_t*>(malloc(size));
+    context->convert_buffer_size = context->convert_buffer ? size : 0;
+  }
+  return context->convert_buffer;
+}
+
+// Gets the planes of img as 8-bit I420, converting high bit depth images into
+// the scratch buffer. Returns false on allocation failure.
+static bool get8BitPlanes(JniCtx* const context, const vpx_image_t* const img,
+                          const uint8_t* planes[3], int strides[3]) {
+  if (!(img->fmt & VPX_IMG_FMT_HIGHBITDEPTH)) {
+    for (int i = 0; i < 3; i++) {
+      planes[i] = img->planes[i];
+      strides[i] = img->stride[i];
+    }
+    return true;
+  }
+  const int uvWidth = (img->d_w + 1) / 2;
+  const int uvHeight = (img->d_h + 1) / 2;
+  const size_t yLength = img->d_w * img->d_h;
+  const size_t uvLength = uvWidth * uvHeight;
+  uint8_t* const buffer = getConvertBuffer(context, yLength + uvLength * 2);
+  if (buffer == NULL) {
+    return false;
+  }
+  // Scale samples down to 8 bits.
+  const int scale = 1 << (24 - img->bit_depth);
+  uint8_t* dst = buffer;
+  for (int i = 0; i < 3; i++) {
+    const int width = (i == VPX_PLANE_Y) ? img->d_w : uvWidth;
+    const int height = (i == VPX_PLANE_Y) ? img->d_h : uvHeight;
+    libyuv::Convert16To8Plane(
+        reinterpret_cast<const uint16_t*>(img->planes[i]), img->stride[i] / 2,
+        dst, width, scale, width, height);
+    planes[i] = dst;
+    strides[i] = width;
+    dst += width * height;
+  }
+  return true;
+}
+
+// Gets the planes of img as 16-bit I420, with strides in samples, converting
+// 8-bit images to 10-bit in the scratch buffer. Returns the bit depth of the
+// planes, or 0 on allocation failure.
+static int get16BitPlanes(JniCtx* const context, const vpx_image_t* const img,
+                          const uint16_t* planes[3], int strides[3]) {
+  if (img->fmt & VPX_IMG_FMT_HIGHBITDEPTH) {
+    for (int i = 0; i < 3; i++) {
+      planes[i] = reinterpret_cast<const uint16_t*>(img->planes[i]);
+      strides[i] = img->stride[i] / 2;
+    }
+    return img->bit_depth;
+  }
+  const int uvWidth = (img->d_w + 1) / 2;
+  const int uvHeight = (img->d_h + 1) / 2;
+  const size_t yLength = img->d_w * img->d_h;
+  const size_t uvLength = uvWidth * uvHeight;
+  uint16_t* const buffer = reinterpret_cast<uint16_t*>(
+      getConvertBuffer(context, (yLength + uvLength * 2) * sizeof(uint16_t)));
+  if (buffer == NULL) {
+    return 0;
+  }
+  // A scale of 1024 converts 8-bit samples to 10-bit.
+  uint16_t* dst = buffer;
+  for (int i = 0; i < 3; i++) {
+    const int width = (i == VPX_PLANE_Y) ? img->d_w : uvWidth;
+    const int height = (i == VPX_PLANE_Y) ? img->d_h : uvHeight;
+    libyuv::Convert8To16Plane(img->planes[i], img->stride[i], dst, width, 1024,
+                              width, height);
+    planes[i] = dst;
+    strides[i] = width;
+    dst += width * height;
   }
+  return 10;
+}
+
+// Calls one of the init methods of jOutputBuffer, returning its result.
+static jboolean initOutputBuffer(JNIEnv* env, JniCtx* const context,
+                                 jobject jOutputBuffer, jmethodID method,
+                                 ...) {
+  const int64_t startNs = nowNs();
+  va_list args;
+  va_start(args, method);
+  const jboolean result = env->CallBooleanMethodV(jOutputBuffer, method, args);
+  va_end(args);
+  context->stats.addCall(kStatUpcallCount, kStatUpcallTimeNs, startNs);
+  return result;
+}
+
+// Writes img to jOutputBuffer in the buffer's output mode. Returns false if
+// the frame cannot be output.
+static bool outputFrame(JNIEnv* env, JniCtx* const context,
+                        const vpx_image_t* const img, jobject jOutputBuffer) {
+  if ((img->fmt & ~VPX_IMG_FMT_HIGHBITDEPTH) != VPX_IMG_FMT_I420) {
+    LOGE("ERROR: Unsupported image format %d.", img->fmt);
+    return false;
+  }
+  const bool highBitDepth = (img->fmt & VPX_IMG_FMT_HIGHBITDEPTH) != 0;
 
-  const int kOutputModeYuv = 0;
-  const int kOutputModeRgb = 1;
+  int colorspace = kColorspaceUnknown;
+  switch (img->cs) {
+    case VPX_CS_BT_601:
+      colorspace = kColorspaceBT601;
+      break;
+    case VPX_CS_BT_709:
+      colorspace = kColorspaceBT709;
+      break;
+    case VPX_CS_BT_2020:
+      colorspace = kColorspaceBT2020;
+      break;
+    default:
+      break;
+  }
 
+  const uint8_t* planes[3];
+  int strides[3];
   int outputMode = env->GetIntField(jOutputBuffer, outputModeField);
   if (outputMode == kOutputModeRgb) {
     // resize buffer if required.
-    env->CallVoidMethod(jOutputBuffer, initForRgbFrame, img->d_w, img->d_h);
-
-    // get pointer to the data buffer.
-    const jobject dataObject = env->GetObjectField(jOutputBuffer, dataField);
-    uint8_t* const dst =
-        reinterpret_cast<uint8_t*>(env->GetDirectBufferAddress(dataObject));
+    const jboolean reallocated = initOutputBuffer(
+        env, context, jOutputBuffer, initForRgbFrame, img->d_w, img->d_h, 2);
+    uint8_t* const dst = getOutputData(env, jOutputBuffer, reallocated);
 
-    libyuv::I420ToRGB565(img->planes[VPX_PLANE_Y], img->stride[VPX_PLANE_Y],
-                         img->planes[VPX_PLANE_U], img->stride[VPX_PLANE_U],
-                         img->planes[VPX_PLANE_V], img->stride[VPX_PLANE_V],
+    if (!get8BitPlanes(context, img, planes, strides)) {
+      LOGE("ERROR: Failed to allocate conversion buffer.");
+      return false;
+    }
+    libyuv::I420ToRGB565(planes[VPX_PLANE_Y], strides[VPX_PLANE_Y],
+                         planes[VPX_PLANE_U], strides[VPX_PLANE_U],
+                         planes[VPX_PLANE_V], strides[VPX_PLANE_V],
                          dst, img->d_w * 2, img->d_w, img->d_h);
+  } else if (outputMode == kOutputModeArgb || outputMode == kOutputModeAbgr) {
+    // resize buffer if required.
+    const jboolean reallocated = initOutputBuffer(
+        env, context, jOutputBuffer, initForRgbFrame, img->d_w, img->d_h, 4);
+    uint8_t* const dst = getOutputData(env, jOutputBuffer, reallocated);
+
+    const bool abgr = outputMode == kOutputModeAbgr;
+    if (highBitDepth && img->bit_depth == 10) {
+      // Convert 10-bit frames directly.
+      getConvert16Function(abgr, colorspace)(
+          reinterpret_cast<const uint16_t*>(img->planes[VPX_PLANE_Y]),
+          img->stride[VPX_PLANE_Y] / 2,
+          reinterpret_cast<const uint16_t*>(img->planes[VPX_PLANE_U]),
+          img->stride[VPX_PLANE_U] / 2,
+          reinterpret_cast<const uint16_t*>(img->planes[VPX_PLANE_V]),
+          img->stride[VPX_PLANE_V] / 2, dst, img->d_w * 4, img->d_w,
+          img->d_h);
+    } else {
+      if (!get8BitPlanes(context, img, planes, strides)) {
+        LOGE("ERROR: Failed to allocate conversion buffer.");
+        return false;
+      }
+      getConvertFunction(abgr, colorspace)(
+          planes[VPX_PLANE_Y], strides[VPX_PLANE_Y], planes[VPX_PLANE_U],
+          strides[VPX_PLANE_U], planes[VPX_PLANE_V], strides[VPX_PLANE_V], dst,
+          img->d_w * 4, img->d_w, img->d_h);
+    }
+  } else if (outputMode == kOutputModeNv12) {
+    // resize buffer if required.
+    const jboolean reallocated = initOutputBuffer(
+        env, context, jOutputBuffer, initForSemiPlanarFrame, img->d_w,
+        img->d_h, 1, colorspace);
+    uint8_t* const dst = getOutputData(env, jOutputBuffer, reallocated);
+
+    if (!get8BitPlanes(context, img, planes, strides)) {
+      LOGE("ERROR: Failed to allocate conversion buffer.");
+      return false;
+    }
+    // The Y plane is tightly packed, followed by the interleaved UV plane.
+    const int uvStride = ((img->d_w + 1) / 2) * 2;
+    libyuv::I420ToNV12(planes[VPX_PLANE_Y], strides[VPX_PLANE_Y],
+                       planes[VPX_PLANE_U], strides[VPX_PLANE_U],
+                       planes[VPX_PLANE_V], strides[VPX_PLANE_V],
+                       dst, img->d_w, dst + img->d_w * img->d_h, uvStride,
+                       img->d_w, img->d_h);
+  } else if (outputMode == kOutputModeP010) {
+    // resize buffer if required.
+    const jboolean reallocated = initOutputBuffer(
+        env, context, jOutputBuffer, initForSemiPlanarFrame, img->d_w,
+        img->d_h, 2, colorspace);
+    uint16_t* const dst = reinterpret_cast<uint16_t*>(
+        getOutputData(env, jOutputBuffer, reallocated));
+
+    const uint16_t* planes16[3];
+    const int bitDepth = get16BitPlanes(context, img, planes16, strides);
+    if (bitDepth == 0) {
+      LOGE("ERROR: Failed to allocate conversion buffer.");
+      return false;
+    }
+    // P010 holds samples in the most significant bits of each 16-bit word.
+    // Strides are in samples.
+    const int uvWidth = (img->d_w + 1) / 2;
+    uint16_t* const dstUv = dst + img->d_w * img->d_h;
+    libyuv::ConvertToMSBPlane_16(planes16[VPX_PLANE_Y], strides[VPX_PLANE_Y],
+                                 dst, img->d_w, bitDepth, img->d_w, img->d_h);
+    libyuv::MergeUVPlane_16(planes16[VPX_PLANE_U], strides[VPX_PLANE_U],
+                            planes16[VPX_PLANE_V], strides[VPX_PLANE_V], dstUv,
+                            uvWidth * 2, uvWidth, (img->d_h + 1) / 2,
+                            bitDepth);
   } else if (outputMode == kOutputModeYuv) {
-    const int kColorspaceUnknown = 0;
-    const int kColorspaceBT601 = 1;
-    const int kColorspaceBT709 = 2;
-
-    int colorspace = kColorspaceUnknown;
-    switch (img->cs) {
-      case VPX_CS_BT_601:
-        colorspace = kColorspaceBT601;
-        break;
-      case VPX_CS_BT_709:
-        colorspace = kColorspaceBT709;
-        break;
-      default:
-        break;
+    // High bit depth planes are output as is, with 16 bits per sample.
+    env->SetIntField(jOutputBuffer, bitDepthField,
+                     highBitDepth ? img->bit_depth : 8);
+    JniFrameBuffer* const frameBuffer =
+        context->buffer_manager->add_java_ref(img);
+    if (frameBuffer != NULL) {
+      // Hand the planes to Java in place. The output buffer keeps a reference
+      // to the frame buffer until it is released or reused.
+      const jobject frameData =
+          context->buffer_manager->get_byte_buffer(env, frameBuffer);
+      const uint8_t* const base = frameBuffer->vpx_fb.data;
+      const int64_t upcallStartNs = nowNs();
+      env->CallVoidMethod(jOutputBuffer, initForExternalYuvFrame, frameData,
+                          static_cast<jint>(img->planes[VPX_PLANE_Y] - base),
+                          static_cast<jint>(img->planes[VPX_PLANE_U] - base),
+                          static_cast<jint>(img->planes[VPX_PLANE_V] - base),
+                          img->d_w, img->d_h, img->stride[VPX_PLANE_Y],
+                          img->stride[VPX_PLANE_U], colorspace,
+                          frameBuffer->id);
+      context->stats.addCall(kStatUpcallCount, kStatUpcallTimeNs,
+                             upcallStartNs);
+      return true;
     }
 
+    // The frame is not backed by one of our buffers, so fall back to copying.
     // resize buffer if required.
-    env->CallVoidMethod(jOutputBuffer, initForYuvFrame, img->d_w, img->d_h,
-                        img->stride[VPX_PLANE_Y], img->stride[VPX_PLANE_U],
-                        colorspace);
-
-    // get pointer to the data buffer.
-    const jobject dataObject = env->GetObjectField(jOutputBuffer, dataField);
-    jbyte* const data =
-        reinterpret_cast<jbyte*>(env->GetDirectBufferAddress(dataObject));
-
-    // TODO: This copy can be eliminated by using external frame buffers. NOLINT
-    // This is insignificant for smaller videos but takes ~1.5ms for 1080p
-    // clips. So this should eventually be gotten rid of.
+    const jboolean reallocated = initOutputBuffer(
+        env, context, jOutputBuffer, initForYuvFrame, img->d_w, img->d_h,
+        img->stride[VPX_PLANE_Y], img->stride[VPX_PLANE_U], colorspace);
+    uint8_t* const data = getOutputData(env, jOutputBuffer, reallocated);
+
     const uint64_t y_length = img->stride[VPX_PLANE_Y] * img->d_h;
     const uint64_t uv_length = img->stride[VPX_PLANE_U] * ((img->d_h + 1) / 2);
     memcpy(data, img->planes[VPX_PLANE_Y], y_length);
     memcpy(data + y_length, img->planes[VPX_PLANE_U], uv_length);
     memcpy(data + y_length + uv_length, img->planes[VPX_PLANE_V], uv_length);
   }
+  return true;
+}
+
+// Returns the frame index that was passed to vpxDecode for a decoded frame.
+static jint getFrameIndex(const vpx_image_t* const img) {
+  return static_cast<jint>(reinterpret_cast<intptr_t>(img->user_priv));
+}
+
+// Returns the next frame that is ready to be output, or NULL if there is none.
+static const vpx_image_t* nextFrame(JniCtx* const context) {
+  if (context->pipeline != NULL && context->next_frame == NULL) {
+    context->next_frame = context->pipeline->peek_output();
+  }
+  return context->next_frame;
+}
+
+// Moves on from the frame returned by nextFrame, once it has been output or
+// dropped.
+static void advanceFrame(JniCtx* const context) {
+  if (context->pipeline != NULL) {
+    context->pipeline->pop_output();
+    context->next_frame = NULL;
+  } else {
+    // Frames remain valid until the next call to vpx_codec_decode.
+    context->next_frame =
+        vpx_codec_get_frame(context->decoder, &context->iter);
+  }
+}
+
+// Outputs the next frame that is ready after the last call to vpxDecode or
+// vpxFlush. Returns the frame index that was passed when decoding the frame,
+// -1 if no frame is ready, or -2 if the frame could not be output.
+FUNC(jint, vpxGetFrame, jlong jContext, jobject jOutputBuffer) {
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  const vpx_image_t* const img = nextFrame(context);
+  if (img == NULL) {
+    return -1;
+  }
+  ScopedTrace trace("vpxGetFrame");
+  // Upcalls made while outputting the frame are counted separately.
+  const int64_t startNs = nowNs();
+  const int64_t startUpcallTimeNs = context->stats.get(kStatUpcallTimeNs);
+  const bool output = outputFrame(env, context, img, jOutputBuffer);
+  if (output) {
+    context->stats.add(kStatConvertCount, 1);
+    const int64_t upcallTimeNs =
+        context->stats.get(kStatUpcallTimeNs) - startUpcallTimeNs;
+    context->stats.add(kStatConvertTimeNs, nowNs() - startNs - upcallTimeNs);
+  } else {
+    context->stats.add(kStatErrorCount, 1);
+  }
+  // The output buffer holds its own reference to the frame, if it needs one.
+  const jint frameIndex = getFrameIndex(img);
+  advanceFrame(context);
+  return output ? frameIndex : -2;
+}
+
+FUNC(jboolean, vpxHasFrame, jlong jContext) {
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  if (context->pipeline != NULL) {
+    return context->next_frame != NULL || context->pipeline->has_output();
+  }
+  return context->next_frame != NULL;
+}
+
+// Returns the frame index of the frame that the next call to vpxGetFrame or
+// vpxSkipFrame will return, or -1 if no frame is ready.
+FUNC(jint, vpxPeekFrame, jlong jContext) {
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  const vpx_image_t* const img = nextFrame(context);
+  return img == NULL ? -1 : getFrameIndex(img);
+}
+
+// Drops the next frame that is ready without outputting it, for a frame that
+// will not be presented. The frame has already updated the decoder's reference
+// state, so only the output buffer upcall and the copy or conversion are
+// skipped. Returns the frame index of the dropped frame, or -1 if no frame is
+// ready.
+FUNC(jint, vpxSkipFrame, jlong jContext) {
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  const vpx_image_t* const img = nextFrame(context);
+  if (img == NULL) {
+    return -1;
+  }
+  const jint frameIndex = getFrameIndex(img);
+  advanceFrame(context);
+  return frameIndex;
+}
+
+// Draws a frame output in YUV or ABGR mode to a Surface. The frame is
+// converted straight into the window buffer. If scale is true the window
+// buffer is sized to match the frame, so that the compositor scales it, and
+// libyuv only scales the frame if the buffer has a different size anyway.
+// Otherwise the frame is drawn unscaled in the top left corner of the window.
+// Returns 0 on success, or -1 on failure.
+static jint renderFrame(JNIEnv* env, JniCtx* const context, jobject jSurface,
+                        jint outputMode, jobject jPlane0, jobject jPlane1,
+                        jobject jPlane2, jint stride0, jint stride1,
+                        jint width, jint height, jint colorspace,
+                        jint bitDepth, jboolean scale) {
+  NativeWindowCtx* const window = &context->window;
+  if (window->surface == NULL ||
+      !env->IsSameObject(window->surface, jSurface)) {
+    releaseNativeWindow(env, window);
+    window->native_window = ANativeWindow_fromSurface(env, jSurface);
+    if (window->native_window == NULL) {
+      LOGE("ERROR: Failed to acquire native window.");
+      return -1;
+    }
+    window->surface = env->NewGlobalRef(jSurface);
+    window->width = -1;
+    window->height = -1;
+  }
+  const int geometryWidth = scale ? width : 0;
+  const int geometryHeight = scale ? height : 0;
+  if (geometryWidth != window->width || geometryHeight != window->height) {
+    if (ANativeWindow_setBuffersGeometry(window->native_window, geometryWidth,
+                                         geometryHeight,
+                                         WINDOW_FORMAT_RGBA_8888)) {
+      LOGE("ERROR: Failed to set native window buffer geometry.");
+      return -1;
+    }
+    window->width = geometryWidth;
+    window->height = geometryHeight;
+  }
+
+  ANativeWindow_Buffer buffer;
+  if (ANativeWindow_lock(window->native_window, &buffer, NULL)) {
+    LOGE("ERROR: Failed to lock native window.");
+    return -1;
+  }
+  uint8_t* const dst = reinterpret_cast<uint8_t*>(buffer.bits);
+  const int dstStride = buffer.stride * 4;
+  const bool resize = scale && (buffer.width != width ||
+                                buffer.height != height);
+  const int drawWidth = resize ? buffer.width : std::min(width, buffer.width);
+  const int drawHeight =
+      resize ? buffer.height : std::min(height, buffer.height);
+
+  if (outputMode == kOutputModeAbgr) {
+    const uint8_t* const src = reinterpret_cast<const uint8_t*>(
+        env->GetDirectBufferAddress(jPlane0));
+    if (resize) {
+      libyuv::ARGBScale(src, width * 4, width, height, dst, dstStride,
+                        drawWidth, drawHeight, libyuv::kFilterBilinear);
+    } else {
+      libyuv::CopyPlane(src, width * 4, dst, dstStride, drawWidth * 4,
+                        drawHeight);
+    }
+  } else if (outputMode == kOutputModeYuv) {
+    const bool highBitDepth = bitDepth > 8;
+    const int bytesPerSample = highBitDepth ? 2 : 1;
+    const uint8_t* y = reinterpret_cast<const uint8_t*>(
+        env->GetDirectBufferAddress(jPlane0));
+    const uint8_t* u = reinterpret_cast<const uint8_t*>(
+        env->GetDirectBufferAddress(jPlane1));
+    const uint8_t* v = reinterpret_cast<const uint8_t*>(
+        env->GetDirectBufferAddress(jPlane2));
+    // Strides in samples.
+    int yStride = stride0 / bytesPerSample;
+    int uvStride = stride1 / bytesPerSample;
+    if (resize) {
+      const int scaledUvWidth = (drawWidth + 1) / 2;
+      const size_t yLength = drawWidth * drawHeight;
+      const size_t uvLength = scaledUvWidth * ((drawHeight + 1) / 2);
+      const size_t scaledFrameSize = (yLength + uvLength * 2) * bytesPerSample;
+      if (window->scaled_frame_size < scaledFrameSize) {
+        free(window->scaled_frame);
+        window->scaled_frame =
+            reinterpret_cast<uint8_t*>(malloc(scaledFrameSize));
+        window->scaled_frame_size =
+            window->scaled_frame != NULL ? scaledFrameSize : 0;
+      }
+      if (window->scaled_frame == NULL) {
+        ANativeWindow_unlockAndPost(window->native_window);
+        LOGE("ERROR: Failed to allocate scaled frame.");
+        return -1;
+      }
+      uint8_t* const scaledY = window->scaled_frame;
+      uint8_t* const scaledU = scaledY + yLength * bytesPerSample;
+      uint8_t* const scaledV = scaledU + uvLength * bytesPerSample;
+      if (highBitDepth) {
+        libyuv::I420Scale_16(
+            reinterpret_cast<const uint16_t*>(y), yStride,
+            reinterpret_cast<const uint16_t*>(u), uvStride,
+            reinterpret_cast<const uint16_t*>(v), uvStride, width, height,
+            reinterpret_cast<uint16_t*>(scaledY), drawWidth,
+            reinterpret_cast<uint16_t*>(scaledU), scaledUvWidth,
+            reinterpret_cast<uint16_t*>(scaledV), scaledUvWidth, drawWidth,
+            drawHeight, libyuv::kFilterBilinear);
+      } else {
+        libyuv::I420Scale(y, yStride, u, uvStride, v, uvStride, width, height,
+                          scaledY, drawWidth, scaledU, scaledUvWidth, scaledV,
+                          scaledUvWidth, drawWidth, drawHeight,
+                          libyuv::kFilterBilinear);
+      }
+      y = scaledY;
+      u = scaledU;
+      v = scaledV;
+      yStride = drawWidth;
+      uvStride = scaledUvWidth;
+    }
+    if (!highBitDepth) {
+      getConvertFunction(true, colorspace)(y, yStride, u, uvStride, v,
+                                           uvStride, dst, dstStride,
+                                           drawWidth, drawHeight);
+    } else if (bitDepth == 10) {
+      getConvert16Function(true, colorspace)(
+          reinterpret_cast<const uint16_t*>(y), yStride,
+          reinterpret_cast<const uint16_t*>(u), uvStride,
+          reinterpret_cast<const uint16_t*>(v), uvStride, dst, dstStride,
+          drawWidth, drawHeight);
+    } else {
+      ANativeWindow_unlockAndPost(window->native_window);
+      LOGE("ERROR: Unsupported bit depth %d.", bitDepth);
+      return -1;
+    }
+  }
+
+  if (ANativeWindow_unlockAndPost(window->native_window)) {
+    LOGE("ERROR: Failed to post native window buffer.");
+    return -1;
+  }
   return 0;
 }
 
+FUNC(jint, vpxRenderFrame, jlong jContext, jobject jSurface, jint outputMode,
+     jobject jPlane0, jobject jPlane1, jobject jPlane2, jint stride0,
+     jint stride1, jint width, jint height, jint colorspace, jint bitDepth,
+     jboolean scale) {
+  ScopedTrace trace("vpxRenderFrame");
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  const int64_t startNs = nowNs();
+  const jint result = renderFrame(env, context, jSurface, outputMode, jPlane0,
+                                  jPlane1, jPlane2, stride0, stride1, width,
+                                  height, colorspace, bitDepth, scale);
+  if (result == 0) {
+    context->stats.addCall(kStatConvertCount, kStatConvertTimeNs, startNs);
+  } else {
+    context->stats.add(kStatErrorCount, 1);
+  }
+  return result;
+}
+
+// Writes the running totals of the decoder into jStats, in the order of the
+// indices in NativeDecoderCounters.
+FUNC(void, vpxGetStats, jlong jContext, jlongArray jStats) {
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  jlong stats[kStatCount];
+  for (int i = 0; i < kStatCount; i++) {
+    stats[i] = context->stats.get(i);
+  }
+  env->SetLongArrayRegion(jStats, 0, kStatCount, stats);
+}
+
 FUNC(jstring, getLibvpxVersion) {
   return env->NewStringUTF(vpx_codec_version_str());
 }
 
 FUNC(jstring, vpxGetErrorMessage, jlong jContext) {
-  vpx_codec_ctx_t* const context = reinterpret_cast<vpx_codec_ctx_t*>(jContext);
-  return env->NewStringUTF(vpx_codec_error(context));
+  JniCtx* const context = reinterpret_cast<JniCtx*>(jContext);
+  return env->NewStringUTF(vpx_codec_error(context->decoder));
 }
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.google.android.exoplayer.util.extensions;
+
+import junit.framework.TestCase;
+
+import java.util.ArrayList;
+import java.util.List;
+
+/**
+ * Unit tests for {@link SimpleDecoder}.
+ */
+public class SimpleDecoderTest extends TestCase {
+
+  private static final long TIMEOUT_MS = 5000;
+  private static final long END_OF_STREAM = -1;
+
+  private FakeDecoder decoder;
+
+  @Override
+  public void tearDown() {
+    if (decoder != null) {
+      decoder.release();
+      decoder = null;
+    }
+  }
+
+  public void testDecodesEachInputBuffer() throws Exception {
+    decoder = new FakeDecoder(0, 0);
+    decoder.start();
+    queueInputBuffer(0, 0);
+    queueInputBuffer(1000, 0);
+    queueInputBuffer(0, Buffer.FLAG_END_OF_STREAM);
+    assertEquals(0, dequeueOutputBuffer());
+    assertEquals(1000, dequeueOutputBuffer());
+    assertEquals(END_OF_STREAM, dequeueOutputBuffer());
+  }
+
+  public void testPendingOutputBeforeFurtherInput() throws Exception {
+    decoder = new FakeDecoder(2, 0);
+    // Queue all of the input before starting, so that it is waiting while pending output exists.
+    queueInputBuffer(0, 0);
+    queueInputBuffer(1000, 0);
+    decoder.start();
+    assertEquals(0, dequeueOutputBuffer());
+    assertEquals(1, dequeueOutputBuffer());
+    assertEquals(2, dequeueOutputBuffer());
+    assertEquals(1000, dequeueOutputBuffer());
+    assertEquals(1001, dequeueOutputBuffer());
+    assertEquals(1002, dequeueOutputBuffer());
+  }
+
+  public void testEndOfStreamAfterPendingOutput() throws Exception {
+    decoder = new FakeDecoder(1, 2);
+    queueInputBuffer(0, 0);
+    queueInputBuffer(0, Buffer.FLAG_END_OF_STREAM);
+    decoder.start();
+    assertEquals(0, dequeueOutputBuffer());
+    assertEquals(1, dequeueOutputBuffer());
+    // The output held back until the end of the stream comes before the end of stream buffer.
+    assertEquals(FakeDecoder.TAIL_OFFSET_US + 1, dequeueOutputBuffer());
+    assertEquals(FakeDecoder.TAIL_OFFSET_US + 2, dequeueOutputBuffer());
+    assertEquals(END_OF_STREAM, dequeueOutputBuffer());
+    assertEquals(1, decoder.endOfStreamCount);
+  }
+
+  public void testFlushDiscardsPendingOutput() throws Exception {
+    decoder = new FakeDecoder(3, 0);
+    queueInputBuffer(0, 0);
+    decoder.start();
+    assertEquals(0, dequeueOutputBuffer());
+    decoder.flush();
+    decoder.pendingOutputsPerInput = 0;
+    queueInputBuffer(1000, 0);
+    queueInputBuffer(0, Buffer.FLAG_END_OF_STREAM);
+    // The remaining pending output of the first input buffer is discarded.
+    assertEquals(1000, dequeueOutputBuffer());
+    assertEquals(END_OF_STREAM, dequeueOutputBuffer());
+  }
+
+  public void testBatchesQueuedInputBuffers() throws Exception {
+    decoder = new FakeDecoder(0, 0);
+    decoder.maxInputBuffersPerDecode = 3;
+    queueInputBuffer(0, 0);
+    queueInputBuffer(1000, 0);
+    queueInputBuffer(2000, 0);
+    queueInputBuffer(3000, 0);
+    queueInputBuffer(0, Buffer.FLAG_END_OF_STREAM);
+    decoder.start();
+    assertEquals(0, dequeueOutputBuffer());
+    assertEquals(3000, dequeueOutputBuffer());
+    assertEquals(END_OF_STREAM, dequeueOutputBuffer());
+    assertEquals(3, (int) decoder.batchSizes.get(0));
+    assertEquals(1, (int) decoder.batchSizes.get(1));
+  }
+
+  public void testDoesNotBatchAcrossDecodeOnlyBuffers() throws Exception {
+    decoder = new FakeDecoder(0, 0);
+    decoder.maxInputBuffersPerDecode = 3;
+    queueInputBuffer(0, Buffer.FLAG_DECODE_ONLY);
+    queueInputBuffer(1000, Buffer.FLAG_DECODE_ONLY);
+    queueInputBuffer(2000, 0);
+    queueInputBuffer(3000, 0);
+    queueInputBuffer(0, Buffer.FLAG_END_OF_STREAM);
+    decoder.start();
+    assertEquals(2000, dequeueOutputBuffer());
+    assertEquals(END_OF_STREAM, dequeueOutputBuffer());
+    assertEquals(2, decoder.batchSizes.size());
+    assertEquals(2, (int) decoder.batchSizes.get(0));
+    assertEquals(2, (int) decoder.batchSizes.get(1));
+  }
+
+  private void queueInputBuffer(long timeUs, int flags) throws Exception {
+    long deadlineMs = System.currentTimeMillis() + TIMEOUT_MS;
+    InputBuffer inputBuffer = decoder.dequeueInputBuffer();
+    while (inputBuffer == null) {
+      assertTrue("Timed out waiting for an input buffer", System.currentTimeMillis() < deadlineMs);
+      Thread.sleep(1);
+      inputBuffer = decoder.dequeueInputBuffer();
+    }
+    inputBuffer.sampleHolder.timeUs = timeUs;
+    if (flags != 0) {
+      inputBuffer.setFlag(flags);
+    }
+    decoder.queueInputBuffer(inputBuffer);
+  }
+
+  /**
+   * Dequeues and releases the next output buffer, returning its timestamp or
+   * {@link #END_OF_STREAM}.
+   */
+  private long dequeueOutputBuffer() throws Exception {
+    long deadlineMs = System.currentTimeMillis() + TIMEOUT_MS;
+    FakeOutputBuffer outputBuffer = decoder.dequeueOutputBuffer();
+    while (outputBuffer == null) {
+      assertTrue("Timed out waiting for an output buffer", System.currentTimeMillis() < deadlineMs);
+      Thread.sleep(1);
+      outputBuffer = decoder.dequeueOutputBuffer();
+    }
+    long timestampUs = outputBuffer.getFlag(Buffer.FLAG_END_OF_STREAM) ? END_OF_STREAM
+        : outputBuffer.timestampUs;
+    outputBuffer.release();
+    return timestampUs;
+  }
+
+  /**
+   * Decoder that outputs the timestamp of each input buffer, followed by a configurable number of
+   * pending outputs at consecutive microseconds after it.
+   */
+  private static final class FakeDecoder
+      extends SimpleDecoder<InputBuffer, FakeOutputBuffer, Exception> {
+
+    public static final long TAIL_OFFSET_US = 100000;
+
+    public final List<Integer> batchSizes;
+
+    public volatile int pendingOutputsPerInput;
+    public volatile int maxInputBuffersPerDecode;
+    public int endOfStreamCount;
+
+    private final int tailOutputs;
+
+    private long lastTimeUs;
+    private int pendingOutputCount;
+    private int pendingOutputIndex;
+
+    public FakeDecoder(int pendingOutputsPerInput, int tailOutputs) {
+      super(new InputBuffer[8], new FakeOutputBuffer[2]);
+      this.pendingOutputsPerInput = pendingOutputsPerInput;
+      this.tailOutputs = tailOutputs;
+      maxInputBuffersPerDecode = 1;
+      batchSizes = new ArrayList<>();
+    }
+
+    @Override
+    protected InputBuffer createInputBuffer() {
+      return new InputBuffer();
+    }
+
+    @Override
+    protected FakeOutputBuffer createOutputBuffer() {
+      return new FakeOutputBuffer(this);
+    }
+
+    @Override
+    protected Exception decode(InputBuffer inputBuffer, FakeOutputBuffer outputBuffer,
+        boolean reset) {
+      batchSizes.add(1);
+      return decode(inputBuffer.sampleHolder.timeUs, outputBuffer, reset);
+    }
+
+    @Override
+    protected int getMaxInputBuffersPerDecode() {
+      return maxInputBuffersPerDecode;
+    }
+
+    @Override
+    protected Exception decode(List<InputBuffer> inputBuffers, FakeOutputBuffer outputBuffer,
+        boolean reset) {
+      batchSizes.add(inputBuffers.size());
+      return decode(inputBuffers.get(0).sampleHolder.timeUs, outputBuffer, reset);
+    }
+
+    @Override
+    protected boolean hasPendingOutput() {
+      return pendingOutputIndex < pendingOutputCount;
+    }
+
+    @Override
+    protected Exception decodePendingOutput(FakeOutputBuffer outputBuffer) {
+      outputBuffer.timestampUs = lastTimeUs + ++pendingOutputIndex;
+      return null;
+    }
+
+    @Override
+    protected void onEndOfStream() {
+      endOfStreamCount++;
+      lastTimeUs = TAIL_OFFSET_US;
+      pendingOutputCount = tailOutputs;
+      pendingOutputIndex = 0;
+    }
+
+    private Exception decode(long timeUs, FakeOutputBuffer outputBuffer, boolean reset) {
+      if (reset) {
+        pendingOutputCount = 0;
+        pendingOutputIndex = 0;
+      }
+      if (hasPendingOutput()) {
+        return new IllegalStateException("Input decoded before pending output");
+      }
+      lastTimeUs = timeUs;
+      pendingOutputCount = pendingOutputsPerInput;
+      pendingOutputIndex = 0;
+      outputBuffer.timestampUs = timeUs;
+      return null;
+    }
+
+  }
+
+  private static final class FakeOutputBuffer extends OutputBuffer {
+
+    private final FakeDecoder owner;
+
+    public FakeOutputBuffer(FakeDecoder owner) {
+      this.owner = owner;
+    }
+
+    @Override
+    public void release() {
+      owner.releaseOutputBuffer(this);
+    }
+
+  }
+
+}
@@ -83,6 +83,12 @@ public final class C {
    */
   public static final int ENCODING_PCM_32BIT = 0x40000000;
 
+  /**
+   * @see AudioFormat#ENCODING_PCM_FLOAT
+   */
+  @SuppressWarnings("InlinedApi")
+  public static final int ENCODING_PCM_FLOAT = AudioFormat.ENCODING_PCM_FLOAT;
+
   /**
    * @see AudioFormat#ENCODING_AC3
    */
@@ -39,6 +39,10 @@ public abstract class Buffer {
     flags |= flag;
   }
 
+  public final void clearFlag(int flag) {
+    flags &= ~flag;
+  }
+
   public final boolean getFlag(int flag) {
     return (flags & flag) == flag;
   }
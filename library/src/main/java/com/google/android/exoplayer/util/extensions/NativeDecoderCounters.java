@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.google.android.exoplayer.util.extensions;
+
+/**
+ * Maintains the time spent in, and the number of calls to, each stage of a native decoder.
+ * <p>
+ * Native decoders keep running totals, which are written into a snapshot array of
+ * {@link #SNAPSHOT_SIZE} values in the order of the {@code INDEX_*} constants. The changes between
+ * consecutive snapshots are added to the counters by {@link #accumulate(long[], long[])}, so the
+ * counters cover all of the decoders used by a renderer. {@link #memoryUsageBytes} is instead the
+ * current value for the decoder in use.
+ * <p>
+ * Counters should be written from the playback thread only. Counters may be read from any thread.
+ * To ensure that the counter values are correctly reflected between threads, users of this class
+ * should invoke {@link #ensureUpdated()} prior to reading and after writing.
+ */
+public final class NativeDecoderCounters {
+
+  public static final int INDEX_DECODE_COUNT = 0;
+  public static final int INDEX_DECODE_TIME_NS = 1;
+  public static final int INDEX_CONVERT_COUNT = 2;
+  public static final int INDEX_CONVERT_TIME_NS = 3;
+  public static final int INDEX_READ_COUNT = 4;
+  public static final int INDEX_READ_TIME_NS = 5;
+  public static final int INDEX_READ_BYTES = 6;
+  public static final int INDEX_UPCALL_COUNT = 7;
+  public static final int INDEX_UPCALL_TIME_NS = 8;
+  public static final int INDEX_ERROR_COUNT = 9;
+
+  /**
+   * The number of values in a snapshot written by a native decoder.
+   */
+  public static final int SNAPSHOT_SIZE = 10;
+
+  /**
+   * The number of calls to the underlying decoder, and the time spent in it (excluding reads and
+   * upcalls made while decoding).
+   */
+  public long decodeCount;
+  public long decodeTimeNs;
+  /**
+   * The number of decoded frames or samples that were copied or converted into output buffers, and
+   * the time spent doing so.
+   */
+  public long convertCount;
+  public long convertTimeNs;
+  /**
+   * The number of reads from the data source made by the native decoder, the time spent in them
+   * and the number of bytes read.
+   */
+  public long readCount;
+  public long readTimeNs;
+  public long readBytes;
+  /**
+   * The number of other calls from native code into Java (for example to resize output buffers),
+   * and the time spent in them.
+   */
+  public long upcallCount;
+  public long upcallTimeNs;
+  public long errorCount;
+  /**
+   * The native memory held by the decoder in use, in bytes, or 0 if there is none.
+   */
+  public long memoryUsageBytes;
+
+  /**
+   * Adds the changes between two snapshots written by the same native decoder, and then copies
+   * {@code snapshot} into {@code previousSnapshot}.
+   *
+   * @param snapshot The latest snapshot.
+   * @param previousSnapshot The snapshot passed to the previous call, or an array of zeros if this
+   *     is the first snapshot of the decoder.
+   */
+  public void accumulate(long[] snapshot, long[] previousSnapshot) {
+    decodeCount += delta(snapshot, previousSnapshot, INDEX_DECODE_COUNT);
+    decodeTimeNs += delta(snapshot, previousSnapshot, INDEX_DECODE_TIME_NS);
+    convertCount += delta(snapshot, previousSnapshot, INDEX_CONVERT_COUNT);
+    convertTimeNs += delta(snapshot, previousSnapshot, INDEX_CONVERT_TIME_NS);
+    readCount += delta(snapshot, previousSnapshot, INDEX_READ_COUNT);
+    readTimeNs += delta(snapshot, previousSnapshot, INDEX_READ_TIME_NS);
+    readBytes += delta(snapshot, previousSnapshot, INDEX_READ_BYTES);
+    upcallCount += delta(snapshot, previousSnapshot, INDEX_UPCALL_COUNT);
+    upcallTimeNs += delta(snapshot, previousSnapshot, INDEX_UPCALL_TIME_NS);
+    errorCount += delta(snapshot, previousSnapshot, INDEX_ERROR_COUNT);
+    System.arraycopy(snapshot, 0, previousSnapshot, 0, SNAPSHOT_SIZE);
+  }
+
+  /**
+   * Should be invoked from the playback thread after the counters have been updated. Should also
+   * be invoked from any other thread that wishes to read the counters, before reading. These calls
+   * ensure that counter updates are made visible to the reading threads.
+   */
+  public synchronized void ensureUpdated() {
+    // Do nothing. The use of synchronized ensures a memory barrier should another thread also
+    // call this method.
+  }
+
+  public String getDebugString() {
+    ensureUpdated();
+    StringBuilder builder = new StringBuilder();
+    builder.append("dec:").append(decodeCount).append('/').append(decodeTimeNs / 1000);
+    builder.append(" cnv:").append(convertCount).append('/').append(convertTimeNs / 1000);
+    builder.append(" rd:").append(readCount).append('/').append(readTimeNs / 1000);
+    builder.append(" rdb:").append(readBytes);
+    builder.append(" up:").append(upcallCount).append('/').append(upcallTimeNs / 1000);
+    builder.append(" err:").append(errorCount);
+    builder.append(" mem:").append(memoryUsageBytes / 1024);
+    return builder.toString();
+  }
+
+  private static long delta(long[] snapshot, long[] previousSnapshot, int index) {
+    return snapshot[index] - previousSnapshot[index];
+  }
+
+}
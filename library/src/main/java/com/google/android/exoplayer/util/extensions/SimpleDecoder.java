@@ -17,7 +17,9 @@ package com.google.android.exoplayer.util.extensions;
 
 import com.google.android.exoplayer.util.Assertions;
 
+import java.util.ArrayList;
 import java.util.LinkedList;
+import java.util.List;
 
 /**
  * Base class for {@link Decoder}s that use their own decode thread.
@@ -44,6 +46,7 @@ public abstract class SimpleDecoder<I extends InputBuffer, O extends OutputBuffe
   private final LinkedList<O> queuedOutputBuffers;
   private final I[] availableInputBuffers;
   private final O[] availableOutputBuffers;
+  private final ArrayList<I> batchedInputBuffers;
 
   private int availableInputBufferCount;
   private int availableOutputBufferCount;
@@ -52,6 +55,8 @@ public abstract class SimpleDecoder<I extends InputBuffer, O extends OutputBuffe
   private E exception;
   private boolean flushed;
   private boolean released;
+  private boolean pendingOutput;
+  private boolean endOfStreamSignaled;
 
   /**
    * @param inputBuffers An array of nulls that will be used to store references to input buffers.
@@ -61,6 +66,7 @@ public abstract class SimpleDecoder<I extends InputBuffer, O extends OutputBuffe
     lock = new Object();
     queuedInputBuffers = new LinkedList<>();
     queuedOutputBuffers = new LinkedList<>();
+    batchedInputBuffers = new ArrayList<>();
     availableInputBuffers = inputBuffers;
     availableInputBufferCount = inputBuffers.length;
     for (int i = 0; i < availableInputBufferCount; i++) {
@@ -141,6 +147,8 @@ public abstract class SimpleDecoder<I extends InputBuffer, O extends OutputBuffe
   public final void flush() {
     synchronized (lock) {
       flushed = true;
+      pendingOutput = false;
+      endOfStreamSignaled = false;
       if (dequeuedInputBuffer != null) {
         availableInputBuffers[availableInputBufferCount++] = dequeuedInputBuffer;
         dequeuedInputBuffer = null;
@@ -165,6 +173,16 @@ public abstract class SimpleDecoder<I extends InputBuffer, O extends OutputBuffe
     } catch (InterruptedException e) {
       Thread.currentThread().interrupt();
     }
+    synchronized (lock) {
+      // Reset output buffers still owned by the decoder, so that subclasses can free any resources
+      // that they reference. Dequeued output buffers are the responsibility of the caller.
+      while (!queuedOutputBuffers.isEmpty()) {
+        availableOutputBuffers[availableOutputBufferCount++] = queuedOutputBuffers.removeFirst();
+      }
+      for (int i = 0; i < availableOutputBufferCount; i++) {
+        availableOutputBuffers[i].reset();
+      }
+    }
   }
 
   /**
@@ -206,8 +224,10 @@ public abstract class SimpleDecoder<I extends InputBuffer, O extends OutputBuffe
     I inputBuffer;
     O outputBuffer;
     boolean resetDecoder;
+    boolean signalEndOfStream;
 
-    // Wait until we have an input buffer to decode, and an output buffer to decode into.
+    // Wait until we have an input buffer to decode or pending output, and an output buffer to
+    // decode into.
     synchronized (lock) {
       while (!released && !canDecodeBuffer()) {
         lock.wait();
@@ -215,28 +235,65 @@ public abstract class SimpleDecoder<I extends InputBuffer, O extends OutputBuffe
       if (released) {
         return false;
       }
-      inputBuffer = queuedInputBuffers.removeFirst();
+      // Pending output is drained before any further input is decoded.
+      inputBuffer = pendingOutput ? null : queuedInputBuffers.removeFirst();
+      batchedInputBuffers.clear();
+      if (inputBuffer != null && !inputBuffer.getFlag(Buffer.FLAG_END_OF_STREAM)) {
+        // Take any further input that is already queued, up to the batch size of the subclass.
+        batchedInputBuffers.add(inputBuffer);
+        int maxBatchSize = getMaxInputBuffersPerDecode();
+        boolean decodeOnly = inputBuffer.getFlag(Buffer.FLAG_DECODE_ONLY);
+        while (batchedInputBuffers.size() < maxBatchSize && !queuedInputBuffers.isEmpty()) {
+          I nextInputBuffer = queuedInputBuffers.getFirst();
+          if (nextInputBuffer.getFlag(Buffer.FLAG_END_OF_STREAM)
+              || nextInputBuffer.getFlag(Buffer.FLAG_DECODE_ONLY) != decodeOnly) {
+            break;
+          }
+          batchedInputBuffers.add(queuedInputBuffers.removeFirst());
+        }
+      }
       outputBuffer = availableOutputBuffers[--availableOutputBufferCount];
       resetDecoder = flushed;
       flushed = false;
+      signalEndOfStream = !endOfStreamSignaled;
     }
 
     outputBuffer.reset();
-    if (inputBuffer.getFlag(Buffer.FLAG_END_OF_STREAM)) {
-      outputBuffer.setFlag(Buffer.FLAG_END_OF_STREAM);
+    boolean requeueInputBuffer = false;
+    if (inputBuffer == null) {
+      exception = decodePendingOutput(outputBuffer);
+    } else if (inputBuffer.getFlag(Buffer.FLAG_END_OF_STREAM)) {
+      if (signalEndOfStream) {
+        onEndOfStream();
+      }
+      if (hasPendingOutput()) {
+        // Output the pending output first, and return to the end of stream buffer afterwards.
+        exception = decodePendingOutput(outputBuffer);
+        requeueInputBuffer = true;
+      } else {
+        outputBuffer.setFlag(Buffer.FLAG_END_OF_STREAM);
+      }
     } else {
       if (inputBuffer.getFlag(Buffer.FLAG_DECODE_ONLY)) {
         outputBuffer.setFlag(Buffer.FLAG_DECODE_ONLY);
       }
-      exception = decode(inputBuffer, outputBuffer, resetDecoder);
-      if (exception != null) {
-        // Memory barrier to ensure that the decoder exception is visible from the playback thread.
-        synchronized (lock) {}
-        return false;
-      }
+      exception = batchedInputBuffers.size() > 1
+          ? decode(batchedInputBuffers, outputBuffer, resetDecoder)
+          : decode(inputBuffer, outputBuffer, resetDecoder);
+    }
+    if (exception != null) {
+      // Memory barrier to ensure that the decoder exception is visible from the playback thread.
+      synchronized (lock) {}
+      return false;
     }
 
     synchronized (lock) {
+      pendingOutput = !flushed && hasPendingOutput();
+      if (requeueInputBuffer) {
+        endOfStreamSignaled = !flushed;
+      } else if (inputBuffer != null) {
+        endOfStreamSignaled = false;
+      }
       if (flushed || outputBuffer.getFlag(Buffer.FLAG_DECODE_ONLY)) {
         // If a flush occurred while decoding or the buffer was only for decoding (not presentation)
         // then make the output buffer available again rather than queueing it to be consumed.
@@ -245,15 +302,25 @@ public abstract class SimpleDecoder<I extends InputBuffer, O extends OutputBuffe
         // Queue the decoded output buffer to be consumed.
         queuedOutputBuffers.addLast(outputBuffer);
       }
-      // Make the input buffer available again.
-      availableInputBuffers[availableInputBufferCount++] = inputBuffer;
+      if (requeueInputBuffer && !flushed) {
+        // Return the end of stream buffer to the head of the queue, to be consumed once all of the
+        // pending output has been drained.
+        queuedInputBuffers.addFirst(inputBuffer);
+      } else if (inputBuffer != null) {
+        // Make the input buffer available again.
+        availableInputBuffers[availableInputBufferCount++] = inputBuffer;
+        for (int i = 1; i < batchedInputBuffers.size(); i++) {
+          availableInputBuffers[availableInputBufferCount++] = batchedInputBuffers.get(i);
+        }
+      }
+      batchedInputBuffers.clear();
     }
 
     return true;
   }
 
   private boolean canDecodeBuffer() {
-    return !queuedInputBuffers.isEmpty() && availableOutputBufferCount > 0;
+    return (pendingOutput || !queuedInputBuffers.isEmpty()) && availableOutputBufferCount > 0;
   }
 
   /**
@@ -279,4 +346,66 @@ public abstract class SimpleDecoder<I extends InputBuffer, O extends OutputBuffe
    */
   protected abstract E decode(I inputBuffer, O outputBuffer, boolean reset);
 
+  /**
+   * Returns the maximum number of queued input buffers that may be decoded into a single output
+   * buffer by {@link #decode(List, OutputBuffer, boolean)}. Called on the decode thread before each
+   * decode. Only input buffers that are already queued are batched, so batching never waits for
+   * input. The default implementation returns 1, so that each input buffer is decoded by
+   * {@link #decode(InputBuffer, OutputBuffer, boolean)}.
+   */
+  protected int getMaxInputBuffersPerDecode() {
+    return 1;
+  }
+
+  /**
+   * Decodes consecutive input buffers into {@code outputBuffer}. Only called with more than one
+   * input buffer, if {@link #getMaxInputBuffersPerDecode()} returns more than 1. Batched input
+   * buffers all have the same {@link Buffer#FLAG_DECODE_ONLY} flag, and none is the end of stream.
+   * The default implementation throws {@link UnsupportedOperationException}.
+   *
+   * @param inputBuffers The buffers to decode, in the order in which they were queued. The list
+   *     must not be retained after this method returns.
+   * @param outputBuffer The output buffer to store decoded data. See
+   *     {@link #decode(InputBuffer, OutputBuffer, boolean)}.
+   * @param reset True if the decoder must be reset before decoding.
+   * @return A decoder exception if an error occurred, or null if decoding was successful.
+   */
+  protected E decode(List<I> inputBuffers, O outputBuffer, boolean reset) {
+    throw new UnsupportedOperationException();
+  }
+
+  /**
+   * Returns whether the decoder has further output ready, other than the output of the last call
+   * to {@link #decode(InputBuffer, OutputBuffer, boolean)} or
+   * {@link #decodePendingOutput(OutputBuffer)}. Called on the decode thread after each decode.
+   * <p>
+   * Pending output is drained by calls to {@link #decodePendingOutput(OutputBuffer)} before any
+   * further input is decoded. The default implementation returns false.
+   */
+  protected boolean hasPendingOutput() {
+    return false;
+  }
+
+  /**
+   * Outputs the next pending output into {@code outputBuffer}. Only called if
+   * {@link #hasPendingOutput()} returned true. The default implementation does nothing.
+   *
+   * @param outputBuffer The output buffer to store the pending output. If the flag
+   *     {@link Buffer#FLAG_DECODE_ONLY} is set after this method returns, the output should not be
+   *     presented.
+   * @return A decoder exception if an error occurred, or null if decoding was successful.
+   */
+  protected E decodePendingOutput(O outputBuffer) {
+    return null;
+  }
+
+  /**
+   * Called on the decode thread when the end of the input stream is reached, so that the decoder
+   * can make any output it is holding back available through {@link #hasPendingOutput()}. The
+   * default implementation does nothing.
+   */
+  protected void onEndOfStream() {
+    // Do nothing.
+  }
+
 }